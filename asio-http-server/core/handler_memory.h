@@ -0,0 +1,126 @@
+#pragma once
+
+#include <memory>
+#include <utility>
+#include <cstddef>
+#include <type_traits>
+
+// A small block of memory for the completion handlers of one connection.
+// asio stores every pending operation together with its handler, asking the
+// handler's associated allocator for the space; a connection has one such
+// operation in flight at a time, so its handlers take turns on the block.
+// Bigger or overlapping requests go to the heap.
+class handler_memory
+{
+public:
+    handler_memory() :
+        in_use_(false)
+    {
+    }
+
+    handler_memory(const handler_memory&) = delete;
+    handler_memory& operator=(const handler_memory&) = delete;
+
+    void* allocate(std::size_t size)
+    {
+        if(!in_use_ && size <= sizeof(storage_)) {
+            in_use_ = true;
+            return &storage_;
+        }
+        return ::operator new(size);
+    }
+
+    void deallocate(void* pointer)
+    {
+        if(pointer == &storage_) {
+            in_use_ = false;
+        }
+        else {
+            ::operator delete(pointer);
+        }
+    }
+
+private:
+    typename std::aligned_storage<1024>::type storage_;
+    bool in_use_;
+};
+
+// The allocator asio finds through custom_alloc_handler::get_allocator().
+template<class T>
+class handler_allocator
+{
+public:
+    typedef T value_type;
+
+    explicit handler_allocator(handler_memory& memory) :
+        memory_(memory)
+    {
+    }
+
+    template<class U>
+    handler_allocator(const handler_allocator<U>& other) :
+        memory_(other.memory_)
+    {
+    }
+
+    T* allocate(std::size_t n) const
+    {
+        return static_cast<T*>(memory_.allocate(sizeof(T) * n));
+    }
+
+    void deallocate(T* pointer, std::size_t /*n*/) const
+    {
+        memory_.deallocate(pointer);
+    }
+
+    bool operator==(const handler_allocator& other) const
+    {
+        return &memory_ == &other.memory_;
+    }
+
+    bool operator!=(const handler_allocator& other) const
+    {
+        return &memory_ != &other.memory_;
+    }
+
+private:
+    template<class> friend class handler_allocator;
+
+    handler_memory& memory_;
+};
+
+// Wraps a completion handler so that asio allocates its operation from the
+// given handler_memory.
+template<class Handler>
+class custom_alloc_handler
+{
+public:
+    typedef handler_allocator<Handler> allocator_type;
+
+    custom_alloc_handler(handler_memory& memory, Handler handler) :
+        memory_(memory),
+        handler_(std::move(handler))
+    {
+    }
+
+    allocator_type get_allocator() const
+    {
+        return allocator_type(memory_);
+    }
+
+    template<class... Args>
+    void operator()(Args&&... args)
+    {
+        handler_(std::forward<Args>(args)...);
+    }
+
+private:
+    handler_memory& memory_;
+    Handler handler_;
+};
+
+template<class Handler>
+custom_alloc_handler<Handler> make_custom_alloc_handler(handler_memory& memory, Handler handler)
+{
+    return custom_alloc_handler<Handler>(memory, std::move(handler));
+}
@@ -0,0 +1,79 @@
+#include "http_router.h"
+#include "http_session.h"
+
+#include <algorithm>
+
+void http_router::add(const std::string& method, const std::string& path, http_handler handler)
+{
+    exact_[path].push_back(route{method, std::move(handler)});
+}
+
+void http_router::add_prefix(const std::string& method, const std::string& prefix, http_handler handler)
+{
+    auto it = std::find_if(prefixes_.begin(), prefixes_.end(), [&prefix](const prefix_route& r) {
+        return r.prefix == prefix;
+    });
+    if(it == prefixes_.end()) {
+        // longest first, so the most specific prefix wins
+        it = std::find_if(prefixes_.begin(), prefixes_.end(), [&prefix](const prefix_route& r) {
+            return r.prefix.size() < prefix.size();
+        });
+        it = prefixes_.insert(it, prefix_route{prefix, {}});
+    }
+    it->routes.push_back(route{method, std::move(handler)});
+}
+
+void http_router::set_fallback(http_handler handler)
+{
+    fallback_ = std::move(handler);
+}
+
+void http_router::dispatch(const http_session_ptr& session) const
+{
+    const std::string& path = session->path();
+
+    auto exact = exact_.find(path);
+    if(exact != exact_.end()) {
+        dispatch(exact->second, session);
+        return;
+    }
+
+    for(const prefix_route& prefix : prefixes_) {
+        if(path.compare(0, prefix.prefix.size(), prefix.prefix) == 0) {
+            dispatch(prefix.routes, session);
+            return;
+        }
+    }
+
+    if(fallback_) {
+        fallback_(session);
+        return;
+    }
+    session->reply_status("404 Not Found");
+}
+
+const http_handler* http_router::find(const std::vector<route>& routes, const std::string& method)
+{
+    for(const route& r : routes) {
+        if(r.method == method) {
+            return &r.handler;
+        }
+    }
+    return nullptr;
+}
+
+void http_router::dispatch(const std::vector<route>& routes, const http_session_ptr& session)
+{
+    const std::string& method = session->request().get_method();
+
+    const http_handler* handler = find(routes, method);
+    if(!handler && method == "HEAD") {
+        handler = find(routes, "GET");
+    }
+    if(handler) {
+        (*handler)(session);
+        return;
+    }
+
+    session->reply_status("405 Method Not Allowed");
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+
+class http_session;
+
+typedef std::shared_ptr<http_session> http_session_ptr;
+
+// A handler owns the exchange until it calls one of the session's reply
+// functions or complete(); holding the pointer keeps the connection alive.
+typedef std::function<void(const http_session_ptr&)> http_handler;
+
+// Routes by method and path, the query string is not part of the match.
+// Exact paths are looked up first, then prefixes longest first. HEAD falls
+// back to the GET handler. A known path with no handler for the method is
+// answered with 405, anything else goes to the fallback or gets a 404.
+class http_router
+{
+public:
+    void add(const std::string& method, const std::string& path, http_handler handler);
+    void add_prefix(const std::string& method, const std::string& prefix, http_handler handler);
+
+    // e.g. a compile-time route_table, see dispatch_route()
+    void set_fallback(http_handler handler);
+
+    void dispatch(const http_session_ptr& session) const;
+
+private:
+    struct route
+    {
+        std::string method;
+        http_handler handler;
+    };
+
+    struct prefix_route
+    {
+        std::string prefix;
+        std::vector<route> routes;
+    };
+
+    static const http_handler* find(const std::vector<route>& routes, const std::string& method);
+    static void dispatch(const std::vector<route>& routes, const http_session_ptr& session);
+
+    std::unordered_map<std::string, std::vector<route>> exact_;
+    std::vector<prefix_route> prefixes_;
+    http_handler fallback_;
+};
@@ -0,0 +1,179 @@
+#include "http_server.h"
+#include "http_session.h"
+
+#include <cerrno>
+#include <iostream>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+namespace {
+
+void set_tcp_option(stream_acceptor& acceptor, int name, int value, const char* what)
+{
+    if (::setsockopt(acceptor.native_handle(), IPPROTO_TCP, name, &value, sizeof(value)) != 0) {
+        throw boost::system::system_error(errno, boost::system::system_category(), what);
+    }
+}
+
+}
+
+void open_acceptor(stream_acceptor& acceptor, const server_config& config)
+{
+    const stream_endpoint& endpoint = config.endpoint;
+    remove_stale_socket(endpoint);
+    acceptor.open(endpoint.protocol());
+    if (!is_unix(endpoint)) {
+        acceptor.set_option(stream_acceptor::reuse_address(true));
+    }
+    acceptor.bind(endpoint);
+
+    if (config.fastopen > 0) {
+#ifdef TCP_FASTOPEN
+        set_tcp_option(acceptor, TCP_FASTOPEN, config.fastopen, "TCP_FASTOPEN");
+#else
+        throw std::runtime_error("TCP_FASTOPEN is not supported");
+#endif
+    }
+
+    acceptor.listen(config.backlog);
+
+    if (config.defer_accept > 0) {
+#ifdef TCP_DEFER_ACCEPT
+        set_tcp_option(acceptor, TCP_DEFER_ACCEPT, config.defer_accept, "TCP_DEFER_ACCEPT");
+#else
+        throw std::runtime_error("TCP_DEFER_ACCEPT is not supported");
+#endif
+    }
+
+    if (config.accept_batch) {
+        acceptor.native_non_blocking(true);
+    }
+}
+
+bool accept_exhausted(const boost::system::error_code& ec)
+{
+    return ec == boost::asio::error::no_descriptors ||
+           ec == boost::system::error_code(ENFILE, boost::system::system_category()) ||
+           ec == boost::asio::error::no_buffer_space ||
+           ec == boost::asio::error::no_memory;
+}
+
+int accept_native(stream_acceptor& acceptor, boost::system::error_code& ec)
+{
+    for (;;) {
+#ifdef __linux__
+        const int fd = ::accept4(acceptor.native_handle(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        const int fd = ::accept(acceptor.native_handle(), nullptr, nullptr);
+#endif
+        if (fd >= 0) {
+            ec = boost::system::error_code();
+            return fd;
+        }
+        if (errno != EINTR) {
+            ec = boost::system::error_code(errno, boost::system::system_category());
+            return -1;
+        }
+    }
+}
+
+http_server::http_server(io_service_pool& pool, const server_config& config, const http_router& router) :
+    pool_(pool),
+    config_(config),
+    sessions_(std::make_shared<session_pool>(router, config)),
+    accept_service_(pool.next()),
+    acceptor_(accept_service_),
+    backoff_(accept_service_)
+{
+    open_acceptor(acceptor_, config_);
+    do_accept();
+
+    if (config_.stats > 0) {
+        stats_.reset(new stats_reporter(std::chrono::seconds(config_.stats), []() {
+            return http_session::counters().requests.value();
+        }, std::clog));
+    }
+}
+
+http_server::~http_server()
+{
+    boost::system::error_code ec;
+    backoff_.cancel(ec);
+    acceptor_.close(ec);
+    remove_stale_socket(config_.endpoint);
+    sessions_->close();
+}
+
+void http_server::do_accept()
+{
+    if (config_.accept_batch) {
+        acceptor_.async_wait(stream_acceptor::wait_read, [this](boost::system::error_code ec) {
+            if (ec == boost::asio::error::operation_aborted) {
+                return;
+            }
+            if (ec || !accept_batch()) {
+                back_off();
+                return;
+            }
+
+            do_accept();
+        });
+        return;
+    }
+
+    session_ = sessions_->acquire(pool_.next());
+    acceptor_.async_accept(session_->socket(), [this](boost::system::error_code ec) {
+        if (ec == boost::asio::error::operation_aborted) {
+            return;
+        }
+        if (!ec) {
+            session_->start();
+        }
+        else if (accept_exhausted(ec)) {
+            back_off();
+            return;
+        }
+
+        do_accept();
+    });
+}
+
+void http_server::back_off()
+{
+    backoff_.expires_from_now(accept_backoff);
+    backoff_.async_wait([this](boost::system::error_code ec) {
+        if (ec == boost::asio::error::operation_aborted) {
+            return;
+        }
+        do_accept();
+    });
+}
+
+bool http_server::accept_batch()
+{
+    for (std::size_t i = 0; i < config_.accept_batch; i++) {
+        boost::system::error_code ec;
+        const int fd = accept_native(acceptor_, ec);
+        if (fd < 0) {
+            if (ec == boost::asio::error::connection_aborted) {
+                continue;
+            }
+            // drained: wait for the next wakeup; out of descriptors: the
+            // backlog stays readable, so waiting at once would spin
+            return !accept_exhausted(ec);
+        }
+
+        const http_session_ptr session = sessions_->acquire(pool_.next());
+        session->socket().assign(config_.endpoint.protocol(), fd, ec);
+        if (ec) {
+            ::close(fd);
+            continue;
+        }
+        session->start();
+    }
+    return true;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <resource_stats.h>
+
+#include "http_router.h"
+#include "session_pool.h"
+#include "server_config.h"
+#include "io_service_pool.h"
+
+// Opens, binds and listens on the configured endpoint, TCP or a UNIX socket
+// whose stale file is removed first: backlog, TCP_FASTOPEN and
+// TCP_DEFER_ACCEPT where the system has them. With an accept batch the
+// acceptor is left non-blocking, for accept_native().
+void open_acceptor(stream_acceptor& acceptor, const server_config& config);
+
+// Takes one connection off the backlog of a non-blocking acceptor, with
+// accept4() where available. Returns the descriptor, non-blocking and
+// close-on-exec, or -1 with `ec` set; would_block once the backlog is empty.
+int accept_native(stream_acceptor& acceptor, boost::system::error_code& ec);
+
+// Whether an accept failed for want of descriptors or memory (EMFILE,
+// ENFILE, ENOBUFS, ENOMEM), which accepting again at once does not fix: the
+// listening socket stays readable, so the servers wait accept_backoff first.
+bool accept_exhausted(const boost::system::error_code& ec);
+
+const std::chrono::milliseconds accept_backoff(100);
+
+// Accepts connections and starts an http_session on each, placing it on
+// the pool's next io_service. Sessions come from a session_pool. With an
+// accept batch the server waits for the listening socket to be readable
+// and drains up to that many connections per wakeup; without one it
+// accepts a connection per completion. Out of descriptors, it pauses for
+// accept_backoff instead of spinning on the readable backlog. With
+// config.stats it prints the requests served and the resources they took
+// every that many seconds.
+class http_server
+{
+public:
+    http_server(io_service_pool& pool, const server_config& config, const http_router& router);
+    ~http_server();
+
+    http_server(const http_server&) = delete;
+    http_server& operator=(const http_server&) = delete;
+
+    stream_endpoint local_endpoint() const
+    {
+        return acceptor_.local_endpoint();
+    }
+
+    const session_pool& sessions() const
+    {
+        return *sessions_;
+    }
+
+private:
+    void do_accept();
+    void back_off();
+
+    // false when it ran out of descriptors
+    bool accept_batch();
+
+    io_service_pool& pool_;
+    const server_config& config_;
+
+    std::shared_ptr<session_pool> sessions_;
+    boost::asio::io_service& accept_service_;
+    stream_acceptor acceptor_;
+    boost::asio::steady_timer backoff_;
+    http_session_ptr session_;
+    std::unique_ptr<stats_reporter> stats_;
+};
@@ -0,0 +1,352 @@
+#include "http_session.h"
+
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+
+#include <strings.h>
+
+#include <http_date.h>
+
+namespace {
+
+http_counters counters_;
+
+const std::string CONTINUE = "HTTP/1.1 100 Continue\r\n\r\n";
+
+// a recycled session gives back buffers grown past this
+const std::size_t RETAINED_CAPACITY = 64 * 1024;
+
+void trim(std::string& buffer)
+{
+    buffer.clear();
+    if (buffer.capacity() > RETAINED_CAPACITY) {
+        std::string().swap(buffer);
+    }
+}
+
+// How a request body is delimited (RFC 7230 3.3.3). Framing that another
+// hop could read differently - both Transfer-Encoding and Content-Length,
+// lengths that disagree or do not parse, chunked not being the final
+// coding, whitespace in a header name - is refused rather than guessed, so
+// a body is never taken for the next request.
+enum class body_framing
+{
+    none,
+    length,
+    chunked,
+    invalid
+};
+
+bool parse_length(const std::string& text, std::size_t& value)
+{
+    if (text.empty()) {
+        return false;
+    }
+    value = 0;
+    for (const char c : text) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        const std::size_t digit = static_cast<std::size_t>(c - '0');
+        if (value > (SIZE_MAX - digit) / 10) {
+            return false;
+        }
+        value = value * 10 + digit;
+    }
+    return true;
+}
+
+// Transfer-Encoding is a list of codings, applied in order; chunked may only
+// be the last one, and only once.
+bool chunked_last(const std::string& codings)
+{
+    bool chunked = false;
+    bool any = false;
+    std::size_t first = 0;
+    while (first <= codings.size()) {
+        std::size_t last = codings.find(',', first);
+        if (last == std::string::npos) {
+            last = codings.size();
+        }
+        std::size_t end = std::min(codings.find(';', first), last);
+        std::size_t begin = first;
+        while (begin < end && (codings[begin] == ' ' || codings[begin] == '\t')) {
+            begin++;
+        }
+        while (end > begin && (codings[end - 1] == ' ' || codings[end - 1] == '\t')) {
+            end--;
+        }
+        if (end > begin) {
+            if (chunked) {
+                return false;
+            }
+            chunked = end - begin == 7 && strncasecmp(codings.c_str() + begin, "chunked", 7) == 0;
+            any = true;
+        }
+        first = last + 1;
+    }
+    return any && chunked;
+}
+
+body_framing request_framing(const http_request& request, std::size_t& length)
+{
+    std::string codings;
+    bool has_length = false;
+    length = 0;
+    for (const http_request::header& h : request) {
+        if (h.first.find_first_of(" \t") != std::string::npos) {
+            return body_framing::invalid;
+        }
+        if (strcasecmp(h.first.c_str(), "Transfer-Encoding") == 0) {
+            codings += codings.empty() ? h.second : "," + h.second;
+        }
+        else if (strcasecmp(h.first.c_str(), "Content-Length") == 0) {
+            std::size_t value = 0;
+            if (!parse_length(h.second, value) || (has_length && value != length)) {
+                return body_framing::invalid;
+            }
+            has_length = true;
+            length = value;
+        }
+    }
+    if (!codings.empty()) {
+        if (has_length || !chunked_last(codings)) {
+            return body_framing::invalid;
+        }
+        return body_framing::chunked;
+    }
+    return length ? body_framing::length : body_framing::none;
+}
+
+}
+
+http_session::http_session(boost::asio::io_service& io_service, const http_router& router, const server_config& config) :
+    io_service_(io_service),
+    socket_(io_service),
+    router_(router),
+    config_(config),
+    chunked_(config.max_body),
+    head_(false),
+    keep_alive_(false),
+    started_(false)
+{
+}
+
+http_session::~http_session()
+{
+    if (started_) {
+        counters_.sessions.sub();
+    }
+}
+
+const http_counters& http_session::counters()
+{
+    return counters_;
+}
+
+void http_session::start()
+{
+    started_ = true;
+    counters_.connections.add();
+    counters_.sessions.add();
+    do_read();
+}
+
+void http_session::recycle()
+{
+    boost::system::error_code ec;
+    socket_.close(ec);
+
+    buffer_.consume(buffer_.size());
+    chunked_.reset();
+    head_ = false;
+    keep_alive_ = false;
+
+    trim(body_);
+    trim(header_);
+    trim(response_);
+
+    if (started_) {
+        started_ = false;
+        counters_.sessions.sub();
+    }
+}
+
+void http_session::do_read()
+{
+    auto self(shared_from_this());
+    boost::asio::async_read_until(socket_, buffer_, "\r\n\r\n", make_handler(
+        [this, self](boost::system::error_code ec, std::size_t /*length*/) {
+            if (!ec) {
+                handle_request();
+            }
+    }));
+}
+
+void http_session::handle_request()
+{
+    request_.parse(buffer_);
+
+    const std::string& url = request_.get_url();
+    path_.assign(url, 0, url.find_first_of("?#"));
+
+    const std::string& version = request_.get_version();
+    const std::string connection = request_.get_header("Connection", "");
+    keep_alive_ = (version == "HTTP/1.1") ? (strcasecmp(connection.c_str(), "close") != 0)
+                                          : (strcasecmp(connection.c_str(), "keep-alive") == 0);
+    head_ = (request_.get_method() == "HEAD");
+
+    body_.clear();
+
+    std::size_t length = 0;
+    const body_framing framing = request_framing(request_, length);
+    if (framing == body_framing::invalid) {
+        keep_alive_ = false;
+        reply_status("400 Bad Request");
+        return;
+    }
+    const bool chunked = (framing == body_framing::chunked);
+    if (!chunked) {
+        if (length > config_.max_body) {
+            keep_alive_ = false;
+            reply_status("413 Payload Too Large");
+            return;
+        }
+        if (length == 0) {
+            dispatch();
+            return;
+        }
+    }
+
+    chunked_.reset();
+    auto read_body = [this, chunked, length]() {
+        if (chunked) {
+            do_read_chunked();
+        }
+        else {
+            do_read_body(length);
+        }
+    };
+
+    if (strcasecmp(request_.get_header("Expect", "").c_str(), "100-continue") == 0) {
+        auto self(shared_from_this());
+        boost::asio::async_write(socket_, boost::asio::buffer(CONTINUE), make_handler(
+            [this, self, read_body](boost::system::error_code ec, std::size_t /*length*/) {
+                if (!ec) {
+                    read_body();
+                }
+        }));
+        return;
+    }
+    read_body();
+}
+
+void http_session::do_read_body(std::size_t length)
+{
+    // part of the body may have arrived together with the head
+    const std::size_t buffered = std::min(length, buffer_.size());
+    body_.resize(length);
+    boost::asio::buffer_copy(boost::asio::buffer(&body_[0], buffered), buffer_.data());
+    buffer_.consume(buffered);
+
+    if (buffered == length) {
+        dispatch();
+        return;
+    }
+
+    auto self(shared_from_this());
+    boost::asio::async_read(socket_, boost::asio::buffer(&body_[buffered], length - buffered), make_handler(
+        [this, self](boost::system::error_code ec, std::size_t /*length*/) {
+            if (!ec) {
+                dispatch();
+            }
+    }));
+}
+
+void http_session::do_read_chunked()
+{
+    std::size_t consumed = 0;
+    const auto result = chunked_.decode(boost::asio::buffer_cast<const char*>(buffer_.data()),
+                                        buffer_.size(), consumed, body_);
+    buffer_.consume(consumed);
+
+    if (result == http_chunked_decoder::result::done) {
+        dispatch();
+        return;
+    }
+    if (result != http_chunked_decoder::result::more) {
+        keep_alive_ = false;
+        reply_status(result == http_chunked_decoder::result::too_large ? "413 Payload Too Large" : "400 Bad Request");
+        return;
+    }
+
+    auto self(shared_from_this());
+    boost::asio::async_read(socket_, buffer_, boost::asio::transfer_at_least(1), make_handler(
+        [this, self](boost::system::error_code ec, std::size_t /*length*/) {
+            if (!ec) {
+                do_read_chunked();
+            }
+    }));
+}
+
+void http_session::dispatch()
+{
+    counters_.requests.add();
+    router_.dispatch(shared_from_this());
+}
+
+void http_session::reply(const std::string& header, boost::asio::const_buffer body,
+                         std::shared_ptr<const void> hold)
+{
+    general_.clear();
+    append_general_headers(general_);
+
+    const std::array<boost::asio::const_buffer, 3> buffers = {{
+        boost::asio::buffer(header),
+        boost::asio::buffer(general_),
+        head_ ? boost::asio::const_buffer() : body
+    }};
+
+    auto self(shared_from_this());
+    boost::asio::async_write(socket_, buffers, make_handler(
+        [this, self, hold](boost::system::error_code ec, std::size_t /*length*/) {
+            if (!ec) {
+                complete();
+            }
+    }));
+}
+
+void http_session::reply_status(const char* status)
+{
+    header_.clear();
+    header_ += "HTTP/1.1 ";
+    header_ += status;
+    header_ += "\r\nServer: ashttp\r\nContent-Type: text/plain\r\nContent-Length: ";
+    header_ += std::to_string(std::char_traits<char>::length(status) + 1);
+    header_ += "\r\n";
+
+    response_.assign(status);
+    response_ += '\n';
+
+    reply(header_, boost::asio::buffer(response_));
+}
+
+void http_session::append_general_headers(std::string& header) const
+{
+    header += "Date: ";
+    append_http_date(std::time(nullptr), header);
+    header += keep_alive_ ? "\r\nConnection: keep-alive\r\n\r\n" : "\r\nConnection: close\r\n\r\n";
+}
+
+void http_session::complete()
+{
+    if (keep_alive_) {
+        do_read();
+    }
+    else {
+        boost::system::error_code ec;
+        socket_.shutdown(boost::asio::socket_base::shutdown_send, ec);
+    }
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <cstdint>
+
+#include <boost/asio.hpp>
+
+#include <http_request.h>
+#include <http_chunked.h>
+#include <sharded_counter.h>
+
+#include "route_table.h"
+#include "http_router.h"
+#include "handler_memory.h"
+#include "server_config.h"
+
+// Engine-wide counters, reported by the servers. Every worker updates its
+// own shard; the totals are summed when read.
+struct http_counters
+{
+    sharded_counter connections;    // accepted
+    sharded_counter sessions;       // alive
+    sharded_counter requests;       // dispatched
+};
+
+// One client connection: reads a request head and its body, if any, hands
+// the exchange to the router and, once the handler replied, either waits
+// for the next request or shuts the connection down. Sessions are made by a
+// session_pool and may serve several connections one after another.
+class http_session : public std::enable_shared_from_this<http_session>
+{
+public:
+    http_session(boost::asio::io_service& io_service, const http_router& router, const server_config& config);
+    ~http_session();
+
+    http_session(const http_session&) = delete;
+    http_session& operator=(const http_session&) = delete;
+
+    // once a connection has been accepted on socket()
+    void start();
+
+    // Closes the connection and resets the session for the next one; the
+    // buffers keep their capacity unless it grew past a sane size.
+    void recycle();
+
+    static const http_counters& counters();
+
+    boost::asio::io_service& io_service()
+    {
+        return io_service_;
+    }
+
+    // TCP or a UNIX domain socket, whichever the server listens on
+    stream_socket& socket()
+    {
+        return socket_;
+    }
+
+    // Binds a completion handler to the session's handler memory, so that
+    // asio does not allocate for the operation. For operations on socket().
+    template<class Handler>
+    custom_alloc_handler<Handler> make_handler(Handler handler)
+    {
+        return make_custom_alloc_handler(memory_, std::move(handler));
+    }
+
+    const http_request& request() const
+    {
+        return request_;
+    }
+
+    // target without the query string
+    const std::string& path() const
+    {
+        return path_;
+    }
+
+    // complete request body; writable, handlers may parse it in place
+    std::string& body()
+    {
+        return body_;
+    }
+
+    bool head() const
+    {
+        return head_;
+    }
+
+    bool keep_alive() const
+    {
+        return keep_alive_;
+    }
+
+    void close_after_reply()
+    {
+        keep_alive_ = false;
+    }
+
+    // Per connection scratch buffers for handlers; they keep their capacity
+    // between requests.
+    std::string& header_buffer()
+    {
+        return header_;
+    }
+
+    std::string& response_buffer()
+    {
+        return response_;
+    }
+
+    // Sends `header` (status line and entity headers, each ending with CRLF),
+    // Date, Connection, the blank line and `body` in one gather write; for
+    // HEAD the body is left out. `hold` keeps the owner of header and body
+    // alive until the write is done.
+    void reply(const std::string& header, boost::asio::const_buffer body,
+               std::shared_ptr<const void> hold = nullptr);
+
+    // A short text/plain reply, e.g. "404 Not Found".
+    void reply_status(const char* status);
+
+    // For handlers writing on their own: appends Date, Connection and the
+    // blank line closing the header block. They call complete() when done.
+    void append_general_headers(std::string& header) const;
+    void complete();
+
+private:
+    void do_read();
+    void handle_request();
+    void do_read_body(std::size_t length);
+    void do_read_chunked();
+    void dispatch();
+
+    boost::asio::io_service& io_service_;
+    stream_socket socket_;
+    const http_router& router_;
+    const server_config& config_;
+
+    boost::asio::streambuf buffer_;
+    http_request request_;
+    std::string path_;
+    std::string body_;
+    http_chunked_decoder chunked_;
+    bool head_;
+    bool keep_alive_;
+    bool started_;
+
+    std::string header_;
+    std::string general_;
+    std::string response_;
+
+    handler_memory memory_;
+};
+
+// Hands the exchange to a compile-time route_table whose handlers take
+// (session, params, args...); 404 and 405 are answered here.
+template<class Table, class... Args>
+void dispatch_route(const Table& table, const http_session_ptr& session, Args&&... args)
+{
+    typename Table::handler_type handler;
+    route_params params;
+    const http_method method = parse_http_method(session->request().get_method());
+
+    switch(table.match(method, session->path(), handler, params)) {
+    case route_status::found:
+        handler(session, params, std::forward<Args>(args)...);
+        break;
+    case route_status::method_not_allowed:
+        session->reply_status("405 Method Not Allowed");
+        break;
+    case route_status::not_found:
+        session->reply_status("404 Not Found");
+        break;
+    }
+}
@@ -0,0 +1,72 @@
+#include "io_service_pool.h"
+
+#include <utility>
+#include <iostream>
+
+#include <cpu_topology.h>
+
+io_service_pool::io_service_pool(std::size_t threads, io_model model, std::vector<int> cpus) :
+    threads_(threads ? threads : 1),
+    cpus_(std::move(cpus)),
+    next_(0)
+{
+    const std::size_t services = (model == io_model::per_thread) ? threads_ : 1;
+    for(std::size_t i = 0; i < services; i++) {
+        services_.emplace_back(new boost::asio::io_service(static_cast<int>(model == io_model::per_thread ? 1 : threads_)));
+        work_.emplace_back(new boost::asio::io_service::work(*services_.back()));
+    }
+}
+
+boost::asio::io_service& io_service_pool::next()
+{
+    if(services_.size() == 1) {
+        return *services_[0];
+    }
+    return *services_[next_++ % services_.size()];
+}
+
+void io_service_pool::start()
+{
+    report_worker_cpus(std::cerr, assign_worker_cpus(threads_, cpus_));
+
+    for(std::size_t i = 0; i < threads_; i++) {
+        boost::asio::io_service& service = *services_[i % services_.size()];
+        const int cpu = cpus_.empty() ? -1 : cpus_[i % cpus_.size()];
+        workers_.push_back(std::thread([&service, cpu](){
+            if(cpu >= 0 && !pin_current_thread(cpu)) {
+                std::cerr << "#> can not pin a worker to cpu " << cpu << std::endl;
+            }
+            try {
+                service.run();
+            }
+            catch(const std::exception& e) {
+                std::cerr << "#> worker exception: " << e.what() << std::endl;
+            }
+            catch(...) {
+                std::cerr << "#> worker unknown error" << std::endl;
+            }
+        }));
+    }
+}
+
+void io_service_pool::join()
+{
+    for(std::size_t i = 0; i < workers_.size(); i++) {
+        workers_[i].join();
+    }
+    workers_.clear();
+}
+
+void io_service_pool::run()
+{
+    start();
+    join();
+}
+
+void io_service_pool::stop()
+{
+    work_.clear();
+    for(std::size_t i = 0; i < services_.size(); i++) {
+        services_[i]->stop();
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <memory>
+#include <thread>
+#include <vector>
+#include <atomic>
+
+#include <boost/asio/io_service.hpp>
+
+#include "server_config.h"
+
+// Worker threads and the io_services they run, per the configured model.
+// With io_model::shared next() always returns the same io_service; with
+// io_model::per_thread it hands out the workers' io_services round robin,
+// so a connection stays on one thread for its whole life.
+//
+// Given CPUs, worker i is pinned to cpus[i] before it runs. Memory a worker
+// touches first - its thread_local state, the buffers its sessions grow -
+// then comes from its own NUMA node under the default first-touch policy.
+// start() reports the placement and the NIC queue and interrupt affinity.
+class io_service_pool
+{
+public:
+    io_service_pool(std::size_t threads, io_model model, std::vector<int> cpus = std::vector<int>());
+
+    io_service_pool(const io_service_pool&) = delete;
+    io_service_pool& operator=(const io_service_pool&) = delete;
+
+    boost::asio::io_service& next();
+
+    std::size_t threads() const
+    {
+        return threads_;
+    }
+
+    // start() launches the workers, join() waits for them; run() does both.
+    void start();
+    void join();
+    void run();
+    void stop();
+
+private:
+    typedef std::unique_ptr<boost::asio::io_service> io_service_ptr;
+    typedef std::unique_ptr<boost::asio::io_service::work> work_ptr;
+
+    const std::size_t threads_;
+    const std::vector<int> cpus_;
+    std::vector<io_service_ptr> services_;
+    std::vector<work_ptr> work_;
+    std::vector<std::thread> workers_;
+    std::atomic<std::size_t> next_;
+};
@@ -0,0 +1,59 @@
+#include "route_table.h"
+
+#include <limits>
+
+http_method parse_http_method(const std::string& method)
+{
+    switch(method.size()) {
+    case 3:
+        if(method == "GET") return http_method::get;
+        if(method == "PUT") return http_method::put;
+        break;
+    case 4:
+        if(method == "HEAD") return http_method::head;
+        if(method == "POST") return http_method::post;
+        break;
+    case 5:
+        if(method == "PATCH") return http_method::patch;
+        break;
+    case 6:
+        if(method == "DELETE") return http_method::del;
+        break;
+    case 7:
+        if(method == "OPTIONS") return http_method::options;
+        break;
+    }
+    return http_method::unknown;
+}
+
+namespace route_detail {
+
+bool parse_integer(const char* data, std::size_t size, std::int64_t& value)
+{
+    std::size_t i = 0;
+    const bool negative = (size > 0 && data[0] == '-');
+    if(negative) {
+        i++;
+    }
+    if(i == size) {
+        return false;
+    }
+
+    std::uint64_t result = 0;
+    const std::uint64_t limit = static_cast<std::uint64_t>(std::numeric_limits<std::int64_t>::max()) + (negative ? 1 : 0);
+    for(; i < size; i++) {
+        if(data[i] < '0' || data[i] > '9') {
+            return false;
+        }
+        const unsigned digit = static_cast<unsigned>(data[i] - '0');
+        if(result > (limit - digit) / 10) {
+            return false;
+        }
+        result = result * 10 + digit;
+    }
+
+    value = negative ? static_cast<std::int64_t>(0 - result) : static_cast<std::int64_t>(result);
+    return true;
+}
+
+}
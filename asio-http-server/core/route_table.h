@@ -0,0 +1,357 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+
+enum class http_method : unsigned char
+{
+    get,
+    head,
+    post,
+    put,
+    del,
+    patch,
+    options,
+    unknown
+};
+
+http_method parse_http_method(const std::string& method);
+
+// A path segment captured by "{int}" or "{str}"; `data` points into the
+// request path, so it is only valid while the request is.
+struct route_param
+{
+    std::int64_t integer;
+    const char* data;
+    std::size_t size;
+
+    std::string str() const
+    {
+        return std::string(data, size);
+    }
+};
+
+struct route_params
+{
+    enum { capacity = 4 };
+
+    std::size_t count = 0;
+    route_param values[capacity];
+
+    const route_param& operator[](std::size_t i) const
+    {
+        return values[i];
+    }
+};
+
+// A route as declared: method, pattern and handler, e.g.
+//     { "GET", "/users/{int}/posts/{str}", &get_post }
+// Pattern segments are literals, "{int}" (a decimal integer) or "{str}" (any
+// non-empty segment). Handler is a function pointer type.
+template<class Handler>
+struct route
+{
+    const char* method;
+    const char* pattern;
+    Handler handler;
+};
+
+enum class route_status
+{
+    found,
+    not_found,
+    method_not_allowed
+};
+
+namespace route_detail {
+
+constexpr std::size_t METHODS = static_cast<std::size_t>(http_method::unknown);
+
+constexpr std::uint32_t fnv1a(const char* data, std::size_t size)
+{
+    std::uint32_t hash = 2166136261u;
+    for(std::size_t i = 0; i < size; i++) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+constexpr bool equal(const char* a, std::size_t a_size, const char* b, std::size_t b_size)
+{
+    if(a_size != b_size) {
+        return false;
+    }
+    for(std::size_t i = 0; i < a_size; i++) {
+        if(a[i] != b[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+constexpr std::size_t length(const char* str)
+{
+    std::size_t size = 0;
+    while(str[size]) {
+        size++;
+    }
+    return size;
+}
+
+constexpr std::size_t method_index(const char* method)
+{
+    const char* names[METHODS] = { "GET", "HEAD", "POST", "PUT", "DELETE", "PATCH", "OPTIONS" };
+    for(std::size_t i = 0; i < METHODS; i++) {
+        if(equal(method, length(method), names[i], length(names[i]))) {
+            return i;
+        }
+    }
+    throw std::logic_error("route: unknown method");
+}
+
+// twice the nodes, rounded up to a power of two
+constexpr std::size_t buckets_for(std::size_t nodes)
+{
+    std::size_t buckets = 1;
+    while(buckets < nodes * 2) {
+        buckets <<= 1;
+    }
+    return buckets;
+}
+
+constexpr std::size_t bucket_of(std::uint32_t parent, std::uint32_t hash, std::size_t buckets)
+{
+    return (hash ^ (parent * 0x9e3779b1u)) & (buckets - 1);
+}
+
+bool parse_integer(const char* data, std::size_t size, std::int64_t& value);
+
+}
+
+// Routes compiled into a trie when the table is constructed in a constant
+// expression: literal edges live in one open-addressed hash table keyed by
+// (parent node, segment hash), parameter edges are direct links. A lookup
+// hashes each path segment once and probes a single bucket chain, so its
+// cost depends on the depth of the path and not on how many routes there
+// are. At every level a literal segment wins over "{int}", which wins over
+// "{str}"; there is no backtracking. HEAD falls back to GET.
+//
+//     constexpr route<handler> ROUTES[] = { ... };
+//     constexpr route_table<handler, 16> TABLE(ROUTES);
+//
+// MaxNodes bounds the trie: one node per distinct path prefix plus the root.
+// Too small a bound, a malformed pattern or a duplicate route fail the build.
+template<class Handler, std::size_t MaxNodes>
+class route_table
+{
+public:
+    typedef Handler handler_type;
+
+    template<std::size_t N>
+    constexpr explicit route_table(const route<Handler> (&routes)[N]) :
+        nodes_{},
+        buckets_{},
+        size_(1)
+    {
+        for(std::size_t i = 0; i < N; i++) {
+            add(routes[i]);
+        }
+    }
+
+    template<std::size_t N>
+    constexpr explicit route_table(const std::array<route<Handler>, N>& routes) :
+        nodes_{},
+        buckets_{},
+        size_(1)
+    {
+        for(std::size_t i = 0; i < N; i++) {
+            add(routes[i]);
+        }
+    }
+
+    // `path` without the query string.
+    route_status match(http_method method, const char* path, std::size_t length,
+                       Handler& handler, route_params& params) const
+    {
+        params.count = 0;
+        if(length == 0 || path[0] != '/') {
+            return route_status::not_found;
+        }
+
+        std::uint32_t current = 0;
+        for(std::size_t i = 1; i < length; ) {
+            std::size_t end = i;
+            while(end < length && path[end] != '/') {
+                end++;
+            }
+            const char* segment = path + i;
+            const std::size_t size = end - i;
+            i = end + 1;
+
+            std::uint32_t next = find(current, segment, size);
+            if(next) {
+                current = next;
+                continue;
+            }
+            if(params.count == route_params::capacity) {
+                return route_status::not_found;
+            }
+
+            route_param& param = params.values[params.count];
+            param.data = segment;
+            param.size = size;
+            param.integer = 0;
+            if(nodes_[current].integer && route_detail::parse_integer(segment, size, param.integer)) {
+                current = nodes_[current].integer;
+            }
+            else if(nodes_[current].string && size) {
+                current = nodes_[current].string;
+            }
+            else {
+                return route_status::not_found;
+            }
+            params.count++;
+        }
+
+        const node& target = nodes_[current];
+        handler = Handler();
+        if(method != http_method::unknown) {
+            handler = target.handlers[static_cast<std::size_t>(method)];
+        }
+        if(!handler && method == http_method::head) {
+            handler = target.handlers[static_cast<std::size_t>(http_method::get)];
+        }
+        if(handler) {
+            return route_status::found;
+        }
+        for(std::size_t i = 0; i < route_detail::METHODS; i++) {
+            if(target.handlers[i]) {
+                return route_status::method_not_allowed;
+            }
+        }
+        return route_status::not_found;
+    }
+
+    route_status match(http_method method, const std::string& path, Handler& handler, route_params& params) const
+    {
+        return match(method, path.data(), path.size(), handler, params);
+    }
+
+    // trie nodes in use, the root included
+    constexpr std::size_t size() const
+    {
+        return size_;
+    }
+
+private:
+    static constexpr std::size_t BUCKETS = route_detail::buckets_for(MaxNodes);
+
+    // Node 0 is the root; it is never anybody's child, so 0 also means "none".
+    struct node
+    {
+        std::uint32_t parent = 0;
+        std::uint32_t hash = 0;
+        const char* text = nullptr;
+        std::size_t size = 0;
+        std::uint32_t integer = 0;
+        std::uint32_t string = 0;
+        Handler handlers[route_detail::METHODS] = {};
+    };
+
+    constexpr void add(const route<Handler>& r)
+    {
+        const std::size_t method = route_detail::method_index(r.method);
+        const char* p = r.pattern;
+        if(*p != '/') {
+            throw std::logic_error("route: pattern must start with '/'");
+        }
+        p++;
+
+        std::uint32_t current = 0;
+        std::size_t params = 0;
+        while(*p) {
+            const char* end = p;
+            while(*end && *end != '/') {
+                end++;
+            }
+            const std::size_t size = static_cast<std::size_t>(end - p);
+
+            if(route_detail::equal(p, size, "{int}", 5)) {
+                if(!nodes_[current].integer) {
+                    nodes_[current].integer = make_node(current, 0, p, size);
+                }
+                current = nodes_[current].integer;
+                params++;
+            }
+            else if(route_detail::equal(p, size, "{str}", 5)) {
+                if(!nodes_[current].string) {
+                    nodes_[current].string = make_node(current, 0, p, size);
+                }
+                current = nodes_[current].string;
+                params++;
+            }
+            else {
+                current = insert(current, p, size);
+            }
+            p = *end ? end + 1 : end;
+        }
+
+        if(params > route_params::capacity) {
+            throw std::logic_error("route: too many parameters");
+        }
+        if(nodes_[current].handlers[method]) {
+            throw std::logic_error("route: duplicate");
+        }
+        nodes_[current].handlers[method] = r.handler;
+    }
+
+    constexpr std::uint32_t make_node(std::uint32_t parent, std::uint32_t hash, const char* text, std::size_t size)
+    {
+        if(size_ == MaxNodes) {
+            throw std::logic_error("route: MaxNodes is too small");
+        }
+        node& n = nodes_[size_];
+        n.parent = parent;
+        n.hash = hash;
+        n.text = text;
+        n.size = size;
+        return static_cast<std::uint32_t>(size_++);
+    }
+
+    constexpr std::uint32_t insert(std::uint32_t parent, const char* text, std::size_t size)
+    {
+        const std::uint32_t hash = route_detail::fnv1a(text, size);
+        std::size_t bucket = route_detail::bucket_of(parent, hash, BUCKETS);
+        while(buckets_[bucket]) {
+            const node& n = nodes_[buckets_[bucket]];
+            if(n.parent == parent && n.hash == hash && route_detail::equal(n.text, n.size, text, size)) {
+                return buckets_[bucket];
+            }
+            bucket = (bucket + 1) & (BUCKETS - 1);
+        }
+        buckets_[bucket] = make_node(parent, hash, text, size);
+        return buckets_[bucket];
+    }
+
+    std::uint32_t find(std::uint32_t parent, const char* text, std::size_t size) const
+    {
+        const std::uint32_t hash = route_detail::fnv1a(text, size);
+        std::size_t bucket = route_detail::bucket_of(parent, hash, BUCKETS);
+        while(buckets_[bucket]) {
+            const node& n = nodes_[buckets_[bucket]];
+            if(n.parent == parent && n.hash == hash && route_detail::equal(n.text, n.size, text, size)) {
+                return buckets_[bucket];
+            }
+            bucket = (bucket + 1) & (BUCKETS - 1);
+        }
+        return 0;
+    }
+
+    node nodes_[MaxNodes];
+    std::uint32_t buckets_[BUCKETS];
+    std::size_t size_;
+};
@@ -0,0 +1,74 @@
+#include "server_config.h"
+
+#include <stdexcept>
+
+#include <cpu_topology.h>
+
+namespace po = boost::program_options;
+
+std::size_t server_config::worker_threads() const
+{
+    return worker_count(threads, placement_cpus(pinning, cpu_list));
+}
+
+std::vector<int> server_config::worker_cpus() const
+{
+    return assign_worker_cpus(worker_threads(), placement_cpus(pinning, cpu_list));
+}
+
+void add_server_options(po::options_description& description, po::positional_options_description& positional)
+{
+    description.add_options()
+        ("port,p", po::value<std::string>(), "listen port, host:port, unix:/path or unix:@abstract-name")
+        ("threads", po::value<std::size_t>()->default_value(0), "worker threads, 0 for one per hardware thread")
+        ("io-model", po::value<std::string>()->default_value("shared"), "shared: one io_service for all workers, per-thread: one each")
+        ("backlog", po::value<int>()->default_value(1024), "listen backlog")
+        ("max-body", po::value<std::size_t>()->default_value(1024), "largest request body accepted, KB")
+        ("session-pool", po::value<std::size_t>()->default_value(1024), "idle sessions kept for new connections, 0 disables reuse")
+        ("accept-batch", po::value<std::size_t>()->default_value(64), "connections accepted per wakeup, 0 for one per completion")
+        ("defer-accept", po::value<int>()->default_value(0), "TCP_DEFER_ACCEPT: wake up for a connection once it has data, seconds to wait")
+        ("fastopen", po::value<int>()->default_value(0), "TCP_FASTOPEN queue length, 0 disables")
+        ("affinity", po::value<std::string>()->default_value("none"), "worker placement: none, list (pinned to --cpu-list) or cores (one per physical core)")
+        ("cpu-list", po::value<std::string>()->default_value(""), "CPUs for --affinity list, e.g. 0-3,8; every online CPU if empty")
+        ("stats", po::value<int>()->default_value(0), "print requests and resources used per request every N seconds, 0 disables");
+
+    positional.add("port", 1);
+}
+
+server_config make_server_config(const po::variables_map& options)
+{
+    server_config config;
+    if(!options.count("port")) {
+        throw std::runtime_error("listen port is not set");
+    }
+    config.endpoint = parse_stream_endpoint(options["port"].as<std::string>());
+    config.threads = options["threads"].as<std::size_t>();
+    config.backlog = options["backlog"].as<int>();
+    config.max_body = options["max-body"].as<std::size_t>() * 1024;
+    config.session_pool = options["session-pool"].as<std::size_t>();
+    config.accept_batch = options["accept-batch"].as<std::size_t>();
+    config.defer_accept = options["defer-accept"].as<int>();
+    config.fastopen = options["fastopen"].as<int>();
+    config.stats = options["stats"].as<int>();
+    if(is_unix(config.endpoint) && (config.defer_accept > 0 || config.fastopen > 0)) {
+        throw std::runtime_error("--defer-accept and --fastopen need a TCP endpoint");
+    }
+
+    config.pinning = parse_affinity(options["affinity"].as<std::string>());
+    config.cpu_list = parse_cpu_list(options["cpu-list"].as<std::string>());
+    if(!config.cpu_list.empty() && config.pinning == affinity::none) {
+        config.pinning = affinity::list;
+    }
+
+    const std::string& model = options["io-model"].as<std::string>();
+    if(model == "shared") {
+        config.model = io_model::shared;
+    }
+    else if(model == "per-thread") {
+        config.model = io_model::per_thread;
+    }
+    else {
+        throw std::runtime_error("unknown io model: " + model);
+    }
+    return config;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+#include <boost/program_options.hpp>
+
+#include <cpu_topology.h>
+#include <stream_endpoint.h>
+
+// How worker threads share the network.
+enum class io_model
+{
+    shared,         // one io_service run by every worker thread
+    per_thread      // an io_service per worker, connections spread round robin
+};
+
+struct server_config
+{
+    stream_endpoint endpoint;               // TCP or a UNIX socket
+    std::size_t threads = 0;                // 0: one per hardware thread
+    io_model model = io_model::shared;
+    int backlog = 1024;
+    std::size_t max_body = 1024 * 1024;     // request bodies, bytes
+    std::size_t session_pool = 1024;        // idle sessions kept for reuse
+    std::size_t accept_batch = 64;          // connections accepted per wakeup, 0: one per completion
+    int defer_accept = 0;                   // TCP_DEFER_ACCEPT, seconds; 0 disables
+    int fastopen = 0;                       // TCP_FASTOPEN queue length; 0 disables
+    affinity pinning = affinity::none;
+    std::vector<int> cpu_list;              // affinity::list; empty: every online CPU
+    int stats = 0;                          // seconds between stats lines; 0 disables
+
+    // `threads`, or else one per planned CPU, or per hardware thread
+    std::size_t worker_threads() const;
+
+    // The CPU for each worker, wrapping around when there are more workers
+    // than CPUs; empty without pinning.
+    std::vector<int> worker_cpus() const;
+};
+
+// The listen endpoint (also accepted as the first positional argument): a
+// port, host:port, unix:/path or unix:@abstract-name; and the engine options
+// common to every asio server: --threads, --io-model, --backlog, --max-body,
+// --session-pool, --accept-batch, --defer-accept, --fastopen, --affinity,
+// --cpu-list and --stats.
+void add_server_options(boost::program_options::options_description& description,
+                        boost::program_options::positional_options_description& positional);
+
+server_config make_server_config(const boost::program_options::variables_map& options);
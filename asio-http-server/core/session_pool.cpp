@@ -0,0 +1,177 @@
+#include "session_pool.h"
+
+#include <algorithm>
+
+namespace {
+
+// Allocates shared_ptr control blocks for the pool's sessions: they all
+// have the same type, and a freed one goes on a process-wide free list.
+template<class T>
+class block_allocator
+{
+public:
+    typedef T value_type;
+
+    block_allocator()
+    {
+    }
+
+    template<class U>
+    block_allocator(const block_allocator<U>&)
+    {
+    }
+
+    T* allocate(std::size_t n)
+    {
+        if (n == 1) {
+            std::lock_guard<std::mutex> lock(mutex());
+            std::vector<void*>& blocks = free_blocks();
+            if (!blocks.empty()) {
+                void* block = blocks.back();
+                blocks.pop_back();
+                return static_cast<T*>(block);
+            }
+        }
+        return static_cast<T*>(::operator new(sizeof(T) * n));
+    }
+
+    void deallocate(T* pointer, std::size_t n)
+    {
+        if (n == 1) {
+            std::lock_guard<std::mutex> lock(mutex());
+            free_blocks().push_back(pointer);
+            return;
+        }
+        ::operator delete(pointer);
+    }
+
+    bool operator==(const block_allocator&) const
+    {
+        return true;
+    }
+
+    bool operator!=(const block_allocator&) const
+    {
+        return false;
+    }
+
+private:
+    // never destroyed: blocks may come back while statics are torn down
+    static std::mutex& mutex()
+    {
+        static std::mutex* mutex = new std::mutex;
+        return *mutex;
+    }
+
+    static std::vector<void*>& free_blocks()
+    {
+        static std::vector<void*>* blocks = new std::vector<void*>;
+        return *blocks;
+    }
+};
+
+}
+
+// Keeps the pool alive while any of its sessions is.
+struct session_pool::releaser
+{
+    std::shared_ptr<session_pool> pool;
+
+    void operator()(http_session* session) const
+    {
+        pool->release(session);
+    }
+};
+
+session_pool::session_pool(const http_router& router, const server_config& config) :
+    router_(router),
+    config_(config),
+    idle_(0),
+    created_(0),
+    reused_(0),
+    closed_(false)
+{
+}
+
+session_pool::~session_pool()
+{
+    for (shelf& s : shelves_) {
+        for (http_session* session : s.sessions) {
+            delete session;
+        }
+    }
+}
+
+http_session_ptr session_pool::acquire(boost::asio::io_service& io_service)
+{
+    http_session* session = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (shelf& s : shelves_) {
+            if (s.io_service == &io_service && !s.sessions.empty()) {
+                session = s.sessions.back();
+                s.sessions.pop_back();
+                idle_--;
+                reused_++;
+                break;
+            }
+        }
+        if (!session) {
+            created_++;
+        }
+    }
+    if (!session) {
+        session = new http_session(io_service, router_, config_);
+    }
+
+    return http_session_ptr(session, releaser{shared_from_this()}, block_allocator<http_session>());
+}
+
+void session_pool::close()
+{
+    std::vector<shelf> shelves;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        idle_ = 0;
+        shelves.swap(shelves_);
+    }
+    for (shelf& s : shelves) {
+        for (http_session* session : s.sessions) {
+            delete session;
+        }
+    }
+}
+
+std::size_t session_pool::created() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return created_;
+}
+
+std::size_t session_pool::reused() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return reused_;
+}
+
+void session_pool::release(http_session* session)
+{
+    session->recycle();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!closed_ && idle_ < config_.session_pool) {
+            boost::asio::io_service* io_service = &session->io_service();
+            auto it = std::find_if(shelves_.begin(), shelves_.end(), [io_service](const shelf& s) {
+                return s.io_service == io_service;
+            });
+            if (it == shelves_.end()) {
+                it = shelves_.insert(shelves_.end(), shelf{io_service, {}});
+            }
+            it->sessions.push_back(session);
+            idle_++;
+            return;
+        }
+    }
+    delete session;
+}
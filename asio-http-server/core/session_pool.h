@@ -0,0 +1,60 @@
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <cstddef>
+
+#include <boost/asio/io_service.hpp>
+
+#include "http_router.h"
+#include "http_session.h"
+#include "server_config.h"
+
+// Idle sessions kept with their socket, buffers and handler memory for the
+// next connection on the same io_service, so with either io model a session
+// is reused by the thread that served it. acquire() hands one out as an
+// http_session_ptr whose deleter brings it back when the last handler lets
+// go; the shared_ptr control blocks are recycled too. Once warm, accepting
+// a connection does not touch the heap.
+//
+// At most config.session_pool sessions are kept; after close() none are.
+class session_pool : public std::enable_shared_from_this<session_pool>
+{
+public:
+    session_pool(const http_router& router, const server_config& config);
+    ~session_pool();
+
+    session_pool(const session_pool&) = delete;
+    session_pool& operator=(const session_pool&) = delete;
+
+    // a session whose socket belongs to `io_service`, ready for async_accept
+    http_session_ptr acquire(boost::asio::io_service& io_service);
+
+    void close();
+
+    // sessions made, and handed out again
+    std::size_t created() const;
+    std::size_t reused() const;
+
+private:
+    struct releaser;
+
+    struct shelf
+    {
+        boost::asio::io_service* io_service;
+        std::vector<http_session*> sessions;
+    };
+
+    void release(http_session* session);
+
+    const http_router& router_;
+    const server_config& config_;
+
+    mutable std::mutex mutex_;
+    std::vector<shelf> shelves_;
+    std::size_t idle_;
+    std::size_t created_;
+    std::size_t reused_;
+    bool closed_;
+};
@@ -0,0 +1,108 @@
+#include "http_chunked.h"
+
+#include <algorithm>
+
+#include <url.h>
+
+http_chunked_decoder::http_chunked_decoder(std::size_t limit) :
+    limit_(limit)
+{
+    reset();
+}
+
+void http_chunked_decoder::reset()
+{
+    state_ = state::size;
+    chunk_ = 0;
+    digits_ = 0;
+}
+
+http_chunked_decoder::result http_chunked_decoder::decode(const char* data, std::size_t length,
+                                                          std::size_t& consumed, std::string& out)
+{
+    std::size_t i = 0;
+    while(i < length) {
+        const char c = data[i];
+        switch(state_) {
+        case state::size: {
+            const int digit = hex_digit(c);
+            if(digit >= 0) {
+                // 15 hex digits can not overflow size_t, the limit takes care of the rest
+                if(++digits_ > 15) {
+                    return result::error;
+                }
+                chunk_ = chunk_ * 16 + digit;
+                i++;
+                break;
+            }
+            if(digits_ == 0 || (c != ';' && c != '\r')) {
+                return result::error;
+            }
+            if(out.size() + chunk_ > limit_) {
+                return result::too_large;
+            }
+            state_ = (c == ';') ? state::extension : state::size_lf;
+            i++;
+            break;
+        }
+        case state::extension:
+            if(c == '\r') {
+                state_ = state::size_lf;
+            }
+            i++;
+            break;
+        case state::size_lf:
+            if(c != '\n') {
+                return result::error;
+            }
+            state_ = chunk_ ? state::data : state::trailer;
+            i++;
+            break;
+        case state::data: {
+            const std::size_t count = std::min(chunk_, length - i);
+            out.append(data + i, count);
+            chunk_ -= count;
+            i += count;
+            if(chunk_ == 0) {
+                state_ = state::data_cr;
+            }
+            break;
+        }
+        case state::data_cr:
+            if(c != '\r') {
+                return result::error;
+            }
+            state_ = state::data_lf;
+            i++;
+            break;
+        case state::data_lf:
+            if(c != '\n') {
+                return result::error;
+            }
+            state_ = state::size;
+            digits_ = 0;
+            i++;
+            break;
+        case state::trailer:
+            state_ = (c == '\r') ? state::final_lf : state::trailer_line;
+            i++;
+            break;
+        case state::trailer_line:
+            if(c == '\n') {
+                state_ = state::trailer;
+            }
+            i++;
+            break;
+        case state::final_lf:
+            if(c != '\n') {
+                return result::error;
+            }
+            consumed = i + 1;
+            reset();
+            return result::done;
+        }
+    }
+
+    consumed = length;
+    return result::more;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+// Incremental decoder for "Transfer-Encoding: chunked" bodies. Bytes are fed
+// as they arrive from the socket; chunk data is appended to the output and
+// extensions and trailers are skipped. Whatever follows the final CRLF is left
+// unconsumed, it belongs to the next pipelined request.
+class http_chunked_decoder
+{
+public:
+    enum class result
+    {
+        more,
+        done,
+        error,
+        too_large       // more than `limit` bytes of chunk data
+    };
+
+    explicit http_chunked_decoder(std::size_t limit);
+
+    void reset();
+
+    result decode(const char* data, std::size_t length, std::size_t& consumed, std::string& out);
+
+private:
+    enum class state
+    {
+        size,
+        extension,
+        size_lf,
+        data,
+        data_cr,
+        data_lf,
+        trailer,
+        trailer_line,
+        final_lf
+    };
+
+    const std::size_t limit_;
+    state state_;
+    std::size_t chunk_;
+    std::size_t digits_;
+};
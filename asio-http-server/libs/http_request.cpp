@@ -1,29 +1,76 @@
 #include "http_request.h"
 
-#include <boost/asio/streambuf.hpp>
+#include <algorithm>
+
+#include <boost/asio/buffer.hpp>
+
+namespace {
+
+const char* skip_spaces(const char* first, const char* last)
+{
+    while(first != last && (*first == ' ' || *first == '\t')) {
+        first++;
+    }
+    return first;
+}
+
+const char* next_token(const char* first, const char* last, std::string& token)
+{
+    first = skip_spaces(first, last);
+    const char* end = first;
+    while(end != last && *end != ' ' && *end != '\t') {
+        end++;
+    }
+    token.assign(first, end);
+    return end;
+}
+
+}
 
 size_t http_request::parse(boost::asio::streambuf& buffer)
 {
-    std::istream response_stream(&buffer);
-
-    response_stream >> method_;
-    response_stream >> url_;
-    response_stream >> version_;
-
-    std::string key;
-    std::string value;
-    std::string header;
-
-    std::getline(response_stream, header);
-    while (std::getline(response_stream, header) && header != "\r") {
-        header.resize(header.size() - 1);
-        std::size_t found = header.find(':');
-        if (found != std::string::npos) {
-            key = header.substr(0, found);
-            value = header.substr(found + 2);
-            headers_[key] = value;
+    const char* const data = boost::asio::buffer_cast<const char*>(buffer.data());
+    const char* const last = data + buffer.size();
+
+    // one line at a time, each ending with LF and usually CRLF
+    const char* line = data;
+    auto next_line = [&line, last](const char*& end) {
+        const char* lf = std::find(line, last, '\n');
+        end = (lf != line && lf[-1] == '\r') ? lf - 1 : lf;
+        const char* first = line;
+        line = (lf == last) ? last : lf + 1;
+        return first;
+    };
+
+    const char* end = nullptr;
+    const char* first = next_line(end);
+    first = next_token(first, end, method_);
+    first = next_token(first, end, url_);
+    next_token(first, end, version_);
+
+    headers_count_ = 0;
+    while(line != last) {
+        first = next_line(end);
+        if(first == end) {
+            break;
+        }
+        const char* colon = std::find(first, end, ':');
+        if(colon == end) {
+            continue;
+        }
+        if(headers_count_ == headers_.size()) {
+            headers_.emplace_back();
+        }
+        header& h = headers_[headers_count_++];
+        const char* value = skip_spaces(colon + 1, end);
+        const char* value_end = end;
+        while(value_end != value && (value_end[-1] == ' ' || value_end[-1] == '\t')) {
+            value_end--;
         }
+        h.first.assign(first, colon);
+        h.second.assign(value, value_end);
     }
 
+    buffer.consume(line - data);
     return buffer.size();
 }
@@ -1,58 +1,81 @@
 #pragma once
 
-#include <map>
+#include <vector>
 #include <string>
-#include <istream>
+#include <utility>
+#include <strings.h>
 #include <boost/asio/streambuf.hpp>
 
 class http_request
 {
 public:
-    typedef std::map<std::string, std::string>::const_iterator header_iterator;
+    typedef std::pair<std::string, std::string> header;
+    typedef std::vector<header>::const_iterator header_iterator;
 
-    http_request()
+    http_request() :
+        headers_count_(0)
     {
     }
 
+    // Parses the request head at the front of the buffer and consumes it;
+    // returns the bytes left, the start of the body. A request object may be
+    // parsed into again: its strings keep their capacity, so a reused one
+    // does not allocate for heads no bigger than the ones it has seen.
     size_t parse(boost::asio::streambuf& buffer);
 
-    const std::string& get_method()
+    const std::string& get_method() const
     {
         return method_;
     }
 
-    const std::string& get_url()
+    const std::string& get_url() const
     {
         return url_;
     }
 
-    const std::string& get_version()
+    const std::string& get_version() const
     {
         return version_;
     }
 
-    const std::string get_header(const std::string& name, const std::string def = "")
+    // the last header of that name in any case (RFC 7230 3.2), its value as
+    // sent without the surrounding whitespace
+    const std::string get_header(const std::string& name, const std::string def = "") const
     {
-        auto it = headers_.find(name);
-        if(it != headers_.end()) {
-            return it->second;
-        }
-        return def;
+        const header* found = find(name.c_str());
+        return found ? found->second : def;
+    }
+
+    const std::string get_header(const char* name, const char* def) const
+    {
+        const header* found = find(name);
+        return found ? found->second : std::string(def);
     }
 
-    header_iterator begin()
+    header_iterator begin() const
     {
         return headers_.cbegin();
     }
 
-    header_iterator end()
+    header_iterator end() const
     {
-        return headers_.end();
+        return headers_.cbegin() + headers_count_;
     }
 
 private:
+    const header* find(const char* name) const
+    {
+        for(size_t i = headers_count_; i > 0; i--) {
+            if(strcasecmp(headers_[i - 1].first.c_str(), name) == 0) {
+                return &headers_[i - 1];
+            }
+        }
+        return nullptr;
+    }
+
     std::string method_;
     std::string url_;
     std::string version_;
-    std::map<std::string, std::string> headers_;
+    std::vector<header> headers_;
+    size_t headers_count_;
 };
@@ -3,12 +3,22 @@
 #include <map>
 #include <string>
 #include <istream>
+#include <strings.h>
 #include <boost/asio/streambuf.hpp>
 
 class http_response
 {
+    // header names are case-insensitive
+    struct name_less
+    {
+        bool operator()(const std::string& a, const std::string& b) const
+        {
+            return strcasecmp(a.c_str(), b.c_str()) < 0;
+        }
+    };
+
 public:
-    typedef std::map<std::string, std::string>::const_iterator header_iterator;
+    typedef std::map<std::string, std::string, name_less>::const_iterator header_iterator;
 
     http_response()
     {
@@ -59,5 +69,5 @@ private:
     std::string version_;
     size_t      status_code_;
     std::string status_message_;
-    std::map<std::string, std::string> headers_;
+    std::map<std::string, std::string, name_less> headers_;
 };
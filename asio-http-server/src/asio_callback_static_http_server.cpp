@@ -9,22 +9,28 @@
 //
 
 #include <memory>
-#include <thread>
+#include <vector>
 #include <utility>
 #include <cstdlib>
 #include <iostream>
 #include <boost/asio.hpp>
+#include <boost/program_options.hpp>
 
-using boost::asio::ip::tcp;
+#include <sys/sendfile.h>
 
-const std::string RESPONSE =
-R"(HTTP/1.1 200 OK
-Date: Thu, 08 Dec 2016 00:53:42 GMT
-Connection: Close
-Content-Type: text/html
+#include <http_server.h>
+#include <http_session.h>
 
+#include <gzip.h>
+#include <http_range.h>
+#include <file_cache.h>
+#include <memory_cache.h>
+#include <http_conditional.h>
 
-<!DOCTYPE html>
+namespace po = boost::program_options;
+
+const std::string PAGE =
+R"(<!DOCTYPE html>
 <html>
 <head>
 <title>Welcome to ASIO!</title>
@@ -49,96 +55,354 @@ working.</p>
 </html>
 )";
 
-class session : public std::enable_shared_from_this<session>
+// The built-in page and its gzip variant, compressed once at startup.
+struct page_responses
+{
+    std::string header;
+    std::string gzip_header;
+    std::string gzip;
+};
+
+page_responses make_page_responses(const gzip_options& options)
+{
+    page_responses result;
+
+    const std::string compressed = options.worth(PAGE.size()) ? gzip_compress(PAGE, options.level) : "";
+    const std::string vary = compressed.empty() ? "" : "Vary: Accept-Encoding\r\n";
+    const std::string head = "HTTP/1.1 200 OK\r\nServer: ashttp\r\nContent-Type: text/html\r\n" + vary;
+
+    result.header = head + "Content-Length: " + std::to_string(PAGE.size()) + "\r\n";
+    if (!compressed.empty()) {
+        result.gzip = compressed;
+        result.gzip_header = head + "Content-Encoding: gzip\r\nContent-Length: " +
+                             std::to_string(compressed.size()) + "\r\n";
+    }
+    return result;
+}
+
+void handle_page(const http_session_ptr& session, const page_responses& page)
+{
+    if (!page.gzip.empty() && accepts_gzip(session->request().get_header("Accept-Encoding", ""))) {
+        session->reply(page.gzip_header, boost::asio::buffer(page.gzip));
+    }
+    else {
+        session->reply(page.header, boost::asio::buffer(PAGE));
+    }
+}
+
+// One response served with sendfile(2): the header, then the file or its
+// ranges straight from the page cache. Lives until the last byte is out.
+class file_transfer : public std::enable_shared_from_this<file_transfer>
 {
 public:
-    session(tcp::socket socket) : socket_(std::move(socket))
+    // `file` is what goes out, `typed` the file asked for: they differ for a
+    // precompressed sibling, which is sent with the original's content type
+    file_transfer(const http_session_ptr& session, const file_cache::entry_ptr& file, const file_cache::entry_ptr& typed) :
+        session_(session),
+        socket_(session->socket()),
+        file_(file),
+        typed_(typed),
+        offset_(0),
+        end_(0),
+        part_index_(0)
     {
     }
 
-    ~session()
+    void start(bool encoded)
     {
-        //std::cout << "~session" << std::endl;
+        const http_request& request = session_->request();
+
+        std::vector<byte_range> ranges;
+        range_result result = range_result::none;
+        const std::string range = request.get_header("Range", "");
+        if (!range.empty() && if_range_matches(request.get_header("If-Range", ""), file_->etag, file_->last_modified)) {
+            result = parse_range(range, file_->size, ranges);
+        }
+
+        std::string& header = session_->header_buffer();
+        header.clear();
+
+        if (result == range_result::unsatisfiable) {
+            header += "HTTP/1.1 416 Range Not Satisfiable\r\nServer: ashttp\r\nContent-Range: ";
+            header += content_range(file_->size);
+            header += "\r\nContent-Length: 0\r\n";
+            session_->reply(header, boost::asio::const_buffer());
+            return;
+        }
+
+        offset_ = 0;
+        end_ = file_->size;
+
+        if (result == range_result::none) {
+            header += "HTTP/1.1 200 OK\r\nServer: ashttp\r\nContent-Type: ";
+            header += typed_->content_type;
+            header += "\r\nContent-Length: ";
+            header += std::to_string(file_->size);
+            if (encoded) {
+                header += "\r\nContent-Encoding: gzip\r\nVary: Accept-Encoding";
+            }
+        }
+        else if (ranges.size() == 1) {
+            offset_ = ranges[0].first;
+            end_ = ranges[0].last + 1;
+
+            header += "HTTP/1.1 206 Partial Content\r\nServer: ashttp\r\nContent-Type: ";
+            header += typed_->content_type;
+            header += "\r\nContent-Range: ";
+            header += content_range(ranges[0], file_->size);
+            header += "\r\nContent-Length: ";
+            header += std::to_string(ranges[0].length());
+        }
+        else {
+            multipart_ = make_multipart_ranges(ranges, file_->size, typed_->content_type);
+            parts_ = ranges;
+            end_ = 0;
+
+            header += "HTTP/1.1 206 Partial Content\r\nServer: ashttp\r\nContent-Type: ";
+            header += multipart_.content_type;
+            header += "\r\nContent-Length: ";
+            header += std::to_string(multipart_.content_length);
+        }
+        header += "\r\nAccept-Ranges: bytes\r\nLast-Modified: ";
+        header += file_->last_modified;
+        header += "\r\nETag: ";
+        header += file_->etag;
+        header += "\r\n";
+        session_->append_general_headers(header);
+
+        if (session_->head()) {
+            parts_.clear();
+            end_ = offset_;
+        }
+
+        socket_.native_non_blocking(true);
+
+        auto self(shared_from_this());
+        boost::asio::async_write(socket_, boost::asio::buffer(header), session_->make_handler(
+            [this, self](boost::system::error_code ec, std::size_t /*length*/) {
+                if (!ec) {
+                    do_sendfile();
+                }
+        }));
     }
 
-    void start()
+private:
+    // The socket is non-blocking, so sendfile() pushes as much as the send
+    // buffer takes and we wait for writability to continue.
+    void do_sendfile()
     {
-        do_read();
+        while (offset_ < end_) {
+            const ssize_t n = ::sendfile(socket_.native_handle(), file_->fd, &offset_, end_ - offset_);
+            if (n > 0) {
+                continue;
+            }
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                auto self(shared_from_this());
+                socket_.async_write_some(boost::asio::null_buffers(), session_->make_handler(
+                    [this, self](boost::system::error_code ec, std::size_t /*length*/) {
+                        if (!ec) {
+                            do_sendfile();
+                        }
+                }));
+                return;
+            }
+            // the file was truncated under us or the peer is gone
+            return;
+        }
+
+        if (!parts_.empty()) {
+            do_write_part();
+            return;
+        }
+
+        session_->complete();
     }
 
-private:
-    void do_read()
+    // multipart/byteranges: part header, sendfile of the range, ..., closing delimiter
+    void do_write_part()
     {
         auto self(shared_from_this());
-        socket_.async_read_some(boost::asio::buffer(data_, max_length),
-            [this, self](boost::system::error_code ec, std::size_t length) {
+
+        if (part_index_ == parts_.size()) {
+            parts_.clear();
+            boost::asio::async_write(socket_, boost::asio::buffer(multipart_.trailer), session_->make_handler(
+                [this, self](boost::system::error_code ec, std::size_t /*length*/) {
+                    if (!ec) {
+                        session_->complete();
+                    }
+            }));
+            return;
+        }
+
+        const byte_range& range = parts_[part_index_];
+        boost::asio::async_write(socket_, boost::asio::buffer(multipart_.part_headers[part_index_]), session_->make_handler(
+            [this, self, range](boost::system::error_code ec, std::size_t /*length*/) {
                 if (!ec) {
-                    do_write(length);
+                    part_index_++;
+                    offset_ = range.first;
+                    end_ = range.last + 1;
+                    do_sendfile();
                 }
-        });
+        }));
     }
 
-    void do_write(std::size_t length)
-    {
-        auto self(shared_from_this());
-        boost::asio::async_write(socket_, boost::asio::buffer(RESPONSE),
-            [this, self](boost::system::error_code ec, std::size_t /*length*/) {
-                return;
-        });
-  }
+    http_session_ptr session_;
+    stream_socket& socket_;
+
+    file_cache::entry_ptr file_;
+    file_cache::entry_ptr typed_;
+    off_t offset_;
+    off_t end_;
 
-    tcp::socket socket_;
-    enum { max_length = 1024 };
-    char data_[max_length];
+    std::vector<byte_range> parts_;
+    std::size_t part_index_;
+    multipart_ranges multipart_;
 };
 
-class server
+void reply_not_modified(const http_session_ptr& session, const std::string& etag,
+                        const std::string& last_modified, bool vary)
 {
-public:
-    server(boost::asio::io_service& io_service, short port) :
-        acceptor_(io_service, tcp::endpoint(tcp::v4(), port)),
-        socket_(io_service)
-    {
-        do_accept();
+    std::string& header = session->header_buffer();
+    header.clear();
+    header += "HTTP/1.1 304 Not Modified\r\nServer: ashttp\r\nLast-Modified: ";
+    header += last_modified;
+    header += "\r\nETag: ";
+    header += etag;
+    header += "\r\n";
+    if (vary) {
+        header += "Vary: Accept-Encoding\r\n";
     }
+    session->reply(header, boost::asio::const_buffer());
+}
 
-private:
-    void do_accept()
-    {
-        acceptor_.async_accept(socket_, [this](boost::system::error_code ec) {
-            if (!ec) {
-                std::make_shared<session>(std::move(socket_))->start();
+void handle_file(const http_session_ptr& session, file_cache& cache, memory_cache* memory)
+{
+    const http_request& request = session->request();
+    const std::string& url = request.get_url();
+    const std::string if_none_match = request.get_header("If-None-Match", "");
+    const std::string if_modified_since = request.get_header("If-Modified-Since", "");
+    const bool range = !request.get_header("Range", "").empty();
+    const bool gzip = accepts_gzip(request.get_header("Accept-Encoding", ""));
+
+    // pre-rendered headers and the mapped body go out in one gather write;
+    // range requests always take the sendfile path
+    if (memory && !range) {
+        auto entry = memory->lookup(url);
+        if (entry) {
+            const memory_variant& variant = (gzip && entry->has_gzip()) ? entry->gzip : entry->identity;
+
+            if (not_modified(if_none_match, if_modified_since, variant.etag, variant.mtime)) {
+                reply_not_modified(session, variant.etag, variant.last_modified, entry->has_gzip());
+                return;
             }
+            session->reply(variant.header, boost::asio::buffer(variant.body, variant.size), entry);
+            return;
+        }
+    }
 
-            do_accept();
-        });
+    std::string path;
+    file_cache::entry_ptr file;
+    if (cache.resolve(url, path)) {
+        file = cache.open_path(path);
+    }
+    if (!file) {
+        session->reply_status("404 Not Found");
+        return;
     }
 
-    tcp::acceptor acceptor_;
-    tcp::socket socket_;
-};
+    // too large for the memory cache: only a precompressed sibling is
+    // worth it, compressing on the fly would give up sendfile
+    const file_cache::entry_ptr typed = file;
+    bool encoded = false;
+    if (gzip && !range && compressible(file->content_type)) {
+        auto sibling = cache.open_path(path + ".gz");
+        if (sibling) {
+            file = sibling;
+            encoded = true;
+        }
+    }
+
+    if (not_modified(if_none_match, if_modified_since, file->etag, file->mtime)) {
+        reply_not_modified(session, file->etag, file->last_modified, encoded);
+        return;
+    }
+
+    std::make_shared<file_transfer>(session, file, typed)->start(encoded);
+}
 
 int main(int argc, char* argv[])
 {
     try {
-        if (argc != 2) {
-            std::cerr << "Usage: " << argv[0] << " <port>\n";
+        po::options_description description("Usage: asio_callback_static_http_server <port> [document_root] [options]");
+        po::positional_options_description positional;
+        description.add_options()
+            ("help,h", "print this message")
+            ("root,r", po::value<std::string>(), "serve files from the document root with sendfile")
+            ("cache-size", po::value<std::size_t>()->default_value(64), "memory cache budget for hot files, MB (0 disables)")
+            ("cache-max-file", po::value<std::size_t>()->default_value(256), "largest file kept in the memory cache, KB")
+            ("open-files", po::value<std::size_t>()->default_value(1024), "descriptors the file cache keeps open")
+            ("gzip-level", po::value<int>()->default_value(6), "gzip compression level, 0 disables")
+            ("gzip-min-size", po::value<std::size_t>()->default_value(256), "smallest body worth compressing, bytes");
+        add_server_options(description, positional);
+        positional.add("root", 1);
+
+        po::variables_map options;
+        po::store(po::command_line_parser(argc, argv).options(description).positional(positional).run(), options);
+        po::notify(options);
+
+        if (options.count("help") || !options.count("port")) {
+            std::cerr << description << "\n";
             return 1;
         }
 
-        boost::asio::io_service io_service;
-        server s(io_service, std::atoi(argv[1]));
+        const server_config config = make_server_config(options);
 
-        std::vector<std::thread> threads;
-        const size_t hardware_concurrency = std::thread::hardware_concurrency();
-        for(size_t i = 0; i < hardware_concurrency; i++) {
-            threads.push_back(std::thread([&io_service](){
-                io_service.run();
-            }));
+        gzip_options gzip;
+        gzip.level = options["gzip-level"].as<int>();
+        gzip.min_size = options["gzip-min-size"].as<std::size_t>();
+
+        const page_responses page = make_page_responses(gzip);
+
+        std::unique_ptr<file_cache> cache;
+        std::unique_ptr<memory_cache> memory;
+        if (options.count("root")) {
+            cache.reset(new file_cache(options["root"].as<std::string>(), options["open-files"].as<std::size_t>()));
+
+            const std::size_t budget = options["cache-size"].as<std::size_t>() * 1024 * 1024;
+            const std::size_t max_file = options["cache-max-file"].as<std::size_t>() * 1024;
+            if (budget) {
+                memory.reset(new memory_cache(*cache, budget, max_file, gzip));
+            }
         }
-        for(size_t i = 0; i < hardware_concurrency; i++) {
-            threads[i].join();
+
+        http_router router;
+        if (cache) {
+            file_cache& files = *cache;
+            memory_cache* hot = memory.get();
+            router.add_prefix("GET", "/", [&files, hot](const http_session_ptr& session) {
+                handle_file(session, files, hot);
+            });
         }
+        else {
+            router.add_prefix("GET", "/", [&page](const http_session_ptr& session) {
+                handle_page(session, page);
+            });
+        }
+
+        io_service_pool pool(config.worker_threads(), config.model, config.worker_cpus());
+        http_server server(pool, config, router);
+
+        // stopping the pool lets the server go out of scope and report
+        boost::asio::signal_set signals(pool.next(), SIGINT, SIGTERM);
+        signals.async_wait([&](const boost::system::error_code&, const int&){
+            std::cerr << "#> catch signal" << std::endl;
+            pool.stop();
+        });
+
+        pool.run();
     }
     catch (std::exception& e) {
         std::cerr << "Exception: " << e.what() << "\n";
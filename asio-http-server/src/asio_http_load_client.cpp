@@ -0,0 +1,1130 @@
+// An HTTP load generator: N connections over M threads, each thread with
+// its own io_service. With --rps-schedule it runs open loop: requests are
+// due at the times the schedule gives, whether or not the server keeps up,
+// and a request that cannot be sent yet waits in a backlog. Its latency is
+// counted from when it was due, not from when it went out, so a stalled
+// server shows in the percentiles instead of just slowing the client down
+// (coordinated omission). Without a schedule every connection sends as fast
+// as the server answers, for --duration.
+//
+// The schedule takes the yandex-tank forms, one or more of:
+//
+//     const(RPS,DURATION) line(FROM,TO,DURATION) step(FROM,TO,STEP,DURATION)
+//
+// with durations like 500ms, 30s, 2m or 1h.
+//
+
+#include <cmath>
+#include <cctype>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <condition_variable>
+
+#include <strings.h>
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/program_options.hpp>
+
+#include <stream_endpoint.h>
+#include <latency_histogram.h>
+
+using boost::asio::ip::tcp;
+namespace po = boost::program_options;
+
+std::uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::chrono::steady_clock::time_point to_time_point(std::uint64_t ns)
+{
+    return std::chrono::steady_clock::time_point(std::chrono::nanoseconds(ns));
+}
+
+// The value of a header in a response head [first, last), or nullptr.
+const char* find_header(const char* first, const char* last, const char* name)
+{
+    const std::size_t size = std::strlen(name);
+    const char crlf[] = "\r\n";
+    for (const char* line = first; line < last; ) {
+        const char* end = std::search(line, last, crlf, crlf + 2);
+        if (static_cast<std::size_t>(end - line) > size && line[size] == ':' && strncasecmp(line, name, size) == 0) {
+            const char* value = line + size + 1;
+            while (value < end && *value == ' ') {
+                value++;
+            }
+            return value;
+        }
+        line = end + 2;
+    }
+    return nullptr;
+}
+
+// Whether a Transfer-Encoding value found in [first, last) ends with
+// chunked, the coding that frames the body.
+bool is_chunked(const char* value, const char* last)
+{
+    const char crlf[] = "\r\n";
+    const char* end = std::search(value, last, crlf, crlf + 2);
+    while (end > value && (end[-1] == ' ' || end[-1] == '\t')) {
+        end--;
+    }
+    return end - value >= 7 && strncasecmp(end - 7, "chunked", 7) == 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//----------------------------- rps_schedule ----------------------------------
+///////////////////////////////////////////////////////////////////////////////
+
+class rps_schedule
+{
+public:
+    static rps_schedule parse(const std::string& text)
+    {
+        rps_schedule schedule;
+        std::size_t position = 0;
+        while ((position = text.find_first_not_of(" \t,", position)) != std::string::npos) {
+            const std::size_t open = text.find('(', position);
+            const std::size_t close = text.find(')', position);
+            if (open == std::string::npos || close == std::string::npos || close < open) {
+                throw std::runtime_error("bad rps schedule: " + text);
+            }
+            const std::string kind = text.substr(position, open - position);
+            const std::vector<std::string> args = split(text.substr(open + 1, close - open - 1));
+            position = close + 1;
+
+            if (kind == "const" && args.size() == 2) {
+                schedule.add(std::stod(args[0]), std::stod(args[0]), parse_duration(args[1]));
+            }
+            else if (kind == "line" && args.size() == 3) {
+                schedule.add(std::stod(args[0]), std::stod(args[1]), parse_duration(args[2]));
+            }
+            else if (kind == "step" && args.size() == 4) {
+                const double from = std::stod(args[0]);
+                const double to = std::stod(args[1]);
+                const double step = std::stod(args[2]);
+                const double seconds = parse_duration(args[3]);
+                if (step <= 0) {
+                    throw std::runtime_error("bad rps schedule step: " + args[2]);
+                }
+                for (double rps = from; from <= to ? rps <= to : rps >= to; rps += from <= to ? step : -step) {
+                    schedule.add(rps, rps, seconds);
+                }
+            }
+            else {
+                throw std::runtime_error("bad rps schedule: " + kind + "(...)");
+            }
+        }
+        return schedule;
+    }
+
+    // "1500ms", "30s", "2m", "1h"; a plain number is seconds
+    static double parse_duration(const std::string& text)
+    {
+        std::size_t used = 0;
+        const double value = std::stod(text, &used);
+        const std::string unit = text.substr(used);
+        if (unit.empty() || unit == "s") return value;
+        if (unit == "ms") return value / 1000;
+        if (unit == "m") return value * 60;
+        if (unit == "h") return value * 3600;
+        throw std::runtime_error("bad duration: " + text);
+    }
+
+    bool empty() const
+    {
+        return segments_.empty();
+    }
+
+    double duration() const
+    {
+        return segments_.empty() ? 0 : segments_.back().offset + segments_.back().seconds;
+    }
+
+    // When request k, counting from 0, is due, in seconds from the start;
+    // false once the schedule is over.
+    bool due(std::uint64_t k, double& at) const
+    {
+        const double n = static_cast<double>(k);
+        for (const segment& s : segments_) {
+            if (n >= s.first + s.requests) {
+                continue;
+            }
+            const double m = n - s.first;
+            const double slope = (s.to - s.from) / s.seconds;
+            if (std::fabs(slope) < 1e-9) {
+                at = s.offset + m / s.from;
+            }
+            else {
+                // requests by t: from * t + slope * t^2 / 2
+                at = s.offset + (std::sqrt(s.from * s.from + 2 * slope * m) - s.from) / slope;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    std::string text() const
+    {
+        std::string result;
+        for (const segment& s : segments_) {
+            result += (result.empty() ? "" : " ");
+            result += s.from == s.to ?
+                "const(" + format(s.from) + "," + format(s.seconds) + "s)" :
+                "line(" + format(s.from) + "," + format(s.to) + "," + format(s.seconds) + "s)";
+        }
+        return result;
+    }
+
+private:
+    struct segment
+    {
+        double from;
+        double to;
+        double seconds;
+        double offset;      // seconds before it
+        double first;       // requests before it
+        double requests;
+    };
+
+    void add(double from, double to, double seconds)
+    {
+        if (from < 0 || to < 0 || seconds <= 0 || (from == 0 && to == 0)) {
+            throw std::runtime_error("bad rps schedule segment");
+        }
+        segment s;
+        s.from = from;
+        s.to = to;
+        s.seconds = seconds;
+        s.offset = duration();
+        s.first = segments_.empty() ? 0 : segments_.back().first + segments_.back().requests;
+        s.requests = (from + to) / 2 * seconds;
+        segments_.push_back(s);
+    }
+
+    static std::vector<std::string> split(const std::string& text)
+    {
+        std::vector<std::string> parts;
+        std::size_t first = 0;
+        for (;;) {
+            const std::size_t comma = text.find(',', first);
+            std::string part = text.substr(first, comma == std::string::npos ? std::string::npos : comma - first);
+            part.erase(0, part.find_first_not_of(' '));
+            part.erase(part.find_last_not_of(' ') + 1);
+            parts.push_back(part);
+            if (comma == std::string::npos) {
+                return parts;
+            }
+            first = comma + 1;
+        }
+    }
+
+    static std::string format(double value)
+    {
+        std::string text = std::to_string(value);
+        text.erase(text.find_last_not_of('0') + 1);
+        if (text.back() == '.') {
+            text.pop_back();
+        }
+        return text;
+    }
+
+    std::vector<segment> segments_;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//------------------------------- settings ------------------------------------
+///////////////////////////////////////////////////////////////////////////////
+
+struct load_settings
+{
+    stream_endpoint endpoint;       // TCP or a UNIX socket
+    std::string request;            // one request, sent as is
+    bool head = false;              // HEAD: responses carry no body
+    bool keep_alive = true;
+    std::size_t pipeline = 1;       // requests in flight per connection
+    std::size_t connections = 64;
+    std::size_t threads = 1;
+    rps_schedule schedule;          // empty: closed loop
+    double duration = 10;           // closed loop only
+    double timeout = 5;             // wait for answers once sending stopped
+};
+
+struct load_result
+{
+    latency_histogram corrected;    // from when the request was due
+    latency_histogram uncorrected;  // from when it was written
+    std::uint64_t completed = 0;
+    std::uint64_t non_2xx = 0;
+    std::uint64_t errors = 0;       // requests lost to failed connects, reads and writes
+    std::uint64_t timeouts = 0;     // still in flight at the end
+    std::uint64_t unsent = 0;       // never left the backlog
+    std::uint64_t connects = 0;
+    std::uint64_t connect_errors = 0;
+    std::uint64_t bytes = 0;        // response bytes
+
+    void merge(const load_result& other)
+    {
+        corrected.merge(other.corrected);
+        uncorrected.merge(other.uncorrected);
+        completed += other.completed;
+        non_2xx += other.non_2xx;
+        errors += other.errors;
+        timeouts += other.timeouts;
+        unsent += other.unsent;
+        connects += other.connects;
+        connect_errors += other.connect_errors;
+        bytes += other.bytes;
+    }
+};
+
+class load_worker;
+
+///////////////////////////////////////////////////////////////////////////////
+//---------------------------- load_connection --------------------------------
+///////////////////////////////////////////////////////////////////////////////
+
+class load_connection : public std::enable_shared_from_this<load_connection>
+{
+public:
+    load_connection(boost::asio::io_service& io_service, load_worker& worker, const load_settings& settings) :
+        socket_(io_service),
+        worker_(worker),
+        settings_(settings),
+        state_(state::closed),
+        writing_(false),
+        served_(0)
+    {
+    }
+
+    // Whether send() may be called now.
+    bool can_take() const
+    {
+        if (state_ == state::connecting || state_ == state::stopped) {
+            return false;
+        }
+        if (!settings_.keep_alive) {
+            return in_flight_.empty() && served_ == 0;
+        }
+        return in_flight_.size() < settings_.pipeline;
+    }
+
+    // Connects ahead of the first request, in keep-alive mode.
+    void connect();
+
+    void send(std::uint64_t due);
+
+    // Counts what is still in flight as timed out and closes.
+    void stop();
+
+    bool idle() const
+    {
+        return in_flight_.empty();
+    }
+
+    bool queued_ = false;       // on the worker's ready list
+
+private:
+    enum class state { closed, connecting, open, stopped };
+
+    struct request
+    {
+        std::uint64_t due;
+        std::uint64_t sent;
+    };
+
+    // where a chunked body is up to
+    enum class chunk_state { size, data, data_end, trailer };
+
+    void do_connect();
+    void do_write();
+    void do_read();
+    bool parse_response();
+    bool parse_chunked();
+    void complete(int status);
+    void fail();
+    void close();
+
+    stream_socket socket_;
+    load_worker& worker_;
+    const load_settings& settings_;
+
+    // bumped on close, so handlers of a closed socket know they are stale
+    std::size_t generation_ = 0;
+    state state_;
+    std::deque<request> in_flight_;
+    std::string out_;               // requests not yet handed to the socket
+    std::string writing_buffer_;
+    bool writing_;
+    std::size_t served_;            // responses on this connection
+
+    std::vector<char> chunk_ = std::vector<char>(64 * 1024);
+    std::string in_;
+    std::size_t parsed_ = 0;        // offset of the next response in in_
+    std::size_t body_left_ = 0;     // of the body, or of the current chunk
+    bool in_body_ = false;
+    bool chunked_ = false;
+    chunk_state chunk_state_ = chunk_state::size;
+    bool until_eof_ = false;
+    bool close_after_ = false;
+    int status_ = 0;
+    std::size_t response_bytes_ = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//------------------------------ load_worker ----------------------------------
+///////////////////////////////////////////////////////////////////////////////
+
+class load_worker
+{
+public:
+    load_worker(const load_settings& settings, std::size_t index, std::size_t connections) :
+        settings_(settings),
+        timer_(io_service_),
+        next_(index),
+        stride_(settings.threads),
+        start_(0),
+        sending_(false),
+        stopped_(false),
+        pending_connects_(0)
+    {
+        for (std::size_t i = 0; i < connections; i++) {
+            connections_.push_back(std::make_shared<load_connection>(io_service_, *this, settings_));
+        }
+    }
+
+    // Opens the keep-alive connections; returns once all of them connected
+    // or failed.
+    void prepare()
+    {
+        if (settings_.keep_alive) {
+            pending_connects_ = connections_.size();
+            for (auto& c : connections_) {
+                c->connect();
+            }
+            while (pending_connects_ && io_service_.run_one()) {
+            }
+        }
+    }
+
+    void run(std::uint64_t start)
+    {
+        start_ = start;
+        sending_ = true;
+        for (auto& c : connections_) {
+            ready(*c);
+        }
+        if (settings_.schedule.empty()) {
+            end_ = start_ + static_cast<std::uint64_t>(settings_.duration * 1e9);
+        }
+        else {
+            end_ = start_ + static_cast<std::uint64_t>(settings_.schedule.duration() * 1e9);
+        }
+
+        timer_.expires_at(to_time_point(start_));
+        timer_.async_wait([this](const boost::system::error_code& ec) {
+            if (!ec) {
+                release();
+            }
+        });
+
+        io_service_.reset();
+        io_service_.run();
+    }
+
+    // Sent requests so far, for the progress line.
+    std::uint64_t completed() const
+    {
+        return completed_.load(std::memory_order_relaxed);
+    }
+
+    const load_result& result() const
+    {
+        return result_;
+    }
+
+    // called by the connections
+
+    void connected()
+    {
+        result_.connects++;
+        if (pending_connects_) {
+            pending_connects_--;
+        }
+    }
+
+    void connect_failed()
+    {
+        result_.connect_errors++;
+        if (pending_connects_) {
+            pending_connects_--;
+        }
+    }
+
+    void done(std::uint64_t due, std::uint64_t sent, int status, std::size_t bytes)
+    {
+        const std::uint64_t now = now_ns();
+        result_.corrected.add(now - due);
+        result_.uncorrected.add(now - sent);
+        result_.completed++;
+        result_.bytes += bytes;
+        if (status < 200 || status > 299) {
+            result_.non_2xx++;
+        }
+        completed_.store(result_.completed, std::memory_order_relaxed);
+    }
+
+    void failed(std::size_t requests)
+    {
+        result_.errors += requests;
+    }
+
+    void timed_out(std::size_t requests)
+    {
+        result_.timeouts += requests;
+    }
+
+    // A connection can take (another) request.
+    void ready(load_connection& connection)
+    {
+        if (!connection.queued_ && connection.can_take()) {
+            connection.queued_ = true;
+            ready_.push_back(&connection);
+        }
+        dispatch();
+    }
+
+    // A connection went idle; once sending stopped, the last one to do so
+    // ends the run.
+    void idle()
+    {
+        if (draining_ && !stopped_) {
+            finish_if_idle();
+        }
+    }
+
+private:
+    // Moves the requests that became due to the backlog and arms the timer
+    // for the next one; closed loop, keeps the backlog as long as the
+    // connections can take.
+    void release()
+    {
+        const std::uint64_t now = now_ns();
+        if (settings_.schedule.empty()) {
+            if (now >= end_) {
+                stop_sending();
+                return;
+            }
+            closed_loop_ = true;
+            dispatch();
+            arm(end_);
+            return;
+        }
+
+        double at = 0;
+        while (settings_.schedule.due(next_, at)) {
+            const std::uint64_t due = start_ + static_cast<std::uint64_t>(at * 1e9);
+            if (due > now) {
+                dispatch();
+                arm(due);
+                return;
+            }
+            backlog_.push_back(due);
+            next_ += stride_;
+        }
+        dispatch();
+        stop_sending();
+    }
+
+    void arm(std::uint64_t at)
+    {
+        timer_.expires_at(to_time_point(at));
+        timer_.async_wait([this](const boost::system::error_code& ec) {
+            if (!ec) {
+                release();
+            }
+        });
+    }
+
+    void dispatch()
+    {
+        while (!ready_.empty() && sending_ && (closed_loop_ || !backlog_.empty())) {
+            load_connection* c = ready_.front();
+            if (c->can_take()) {
+                std::uint64_t due = 0;
+                if (closed_loop_) {
+                    due = now_ns();
+                }
+                else {
+                    due = backlog_.front();
+                    backlog_.pop_front();
+                }
+                c->send(due);
+            }
+            if (!c->can_take()) {
+                c->queued_ = false;
+                ready_.pop_front();
+            }
+        }
+    }
+
+    // Waits up to the timeout for the answers still in flight.
+    void stop_sending()
+    {
+        sending_ = false;
+        draining_ = true;
+        closed_loop_ = false;
+        result_.unsent += backlog_.size();
+        backlog_.clear();
+
+        timer_.expires_at(to_time_point(now_ns() + static_cast<std::uint64_t>(settings_.timeout * 1e9)));
+        timer_.async_wait([this](const boost::system::error_code& ec) {
+            if (!ec) {
+                stop();
+            }
+        });
+        finish_if_idle();
+    }
+
+    void finish_if_idle()
+    {
+        for (auto& c : connections_) {
+            if (!c->idle()) {
+                return;
+            }
+        }
+        stop();
+    }
+
+    void stop()
+    {
+        if (stopped_) {
+            return;
+        }
+        stopped_ = true;
+        timer_.cancel();
+        for (auto& c : connections_) {
+            c->stop();
+        }
+    }
+
+    const load_settings& settings_;
+    boost::asio::io_service io_service_;
+    boost::asio::steady_timer timer_;
+    std::vector<std::shared_ptr<load_connection>> connections_;
+
+    std::deque<load_connection*> ready_;
+    std::deque<std::uint64_t> backlog_;     // due times, ns
+    std::uint64_t next_;                    // next request of the schedule
+    std::uint64_t stride_;
+    std::uint64_t start_;
+    std::uint64_t end_ = 0;
+    bool sending_;
+    bool closed_loop_ = false;
+    bool draining_ = false;
+    bool stopped_;
+    std::size_t pending_connects_;
+
+    load_result result_;
+    std::atomic<std::uint64_t> completed_{0};
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+void load_connection::connect()
+{
+    state_ = state::connecting;
+    do_connect();
+}
+
+void load_connection::send(std::uint64_t due)
+{
+    in_flight_.push_back(request{ due, now_ns() });
+    out_ += settings_.request;
+    if (state_ == state::closed) {
+        state_ = state::connecting;
+        do_connect();
+    }
+    else if (state_ == state::open) {
+        do_write();
+    }
+}
+
+void load_connection::stop()
+{
+    worker_.timed_out(in_flight_.size());
+    in_flight_.clear();
+    state_ = state::stopped;
+    boost::system::error_code ec;
+    socket_.close(ec);
+}
+
+void load_connection::do_connect()
+{
+    auto self(shared_from_this());
+    const std::size_t generation = generation_;
+    socket_.async_connect(settings_.endpoint, [this, self, generation](const boost::system::error_code& ec) {
+        if (state_ == state::stopped || generation != generation_) {
+            return;
+        }
+        if (ec) {
+            worker_.connect_failed();
+            fail();
+            return;
+        }
+        if (!is_unix(settings_.endpoint)) {
+            socket_.set_option(tcp::no_delay(true));
+        }
+        worker_.connected();
+        state_ = state::open;
+        do_read();
+        if (!out_.empty()) {
+            do_write();
+        }
+        worker_.ready(*this);
+    });
+}
+
+void load_connection::do_write()
+{
+    if (writing_ || out_.empty()) {
+        return;
+    }
+    // everything queued so far goes out in one write
+    writing_ = true;
+    writing_buffer_.swap(out_);
+    out_.clear();
+
+    auto self(shared_from_this());
+    const std::size_t generation = generation_;
+    boost::asio::async_write(socket_, boost::asio::buffer(writing_buffer_),
+        [this, self, generation](const boost::system::error_code& ec, std::size_t /*length*/) {
+            if (state_ == state::stopped || generation != generation_) {
+                return;
+            }
+            writing_ = false;
+            writing_buffer_.clear();
+            if (ec) {
+                fail();
+                return;
+            }
+            do_write();
+    });
+}
+
+void load_connection::do_read()
+{
+    auto self(shared_from_this());
+    const std::size_t generation = generation_;
+    socket_.async_read_some(boost::asio::buffer(chunk_),
+        [this, self, generation](const boost::system::error_code& ec, std::size_t length) {
+            if (state_ == state::stopped || generation != generation_) {
+                return;
+            }
+            if (ec) {
+                if (ec == boost::asio::error::eof && in_body_ && until_eof_) {
+                    complete(status_);
+                    if (state_ != state::open) {
+                        return;
+                    }
+                }
+                if (in_flight_.empty() && state_ == state::open) {
+                    // the server closed an idle connection
+                    close();
+                    worker_.ready(*this);
+                    return;
+                }
+                fail();
+                return;
+            }
+            in_.append(chunk_.data(), length);
+            while (parse_response()) {
+            }
+            if (parsed_ > 0 && parsed_ * 2 >= in_.size()) {
+                in_.erase(0, parsed_);
+                parsed_ = 0;
+            }
+            if (state_ == state::open) {
+                do_read();
+            }
+    });
+}
+
+// Takes one response off the input; false if it is not all there yet.
+bool load_connection::parse_response()
+{
+    if (!in_body_) {
+        const std::size_t end = in_.find("\r\n\r\n", parsed_);
+        if (end == std::string::npos) {
+            return false;
+        }
+        const char* first = in_.data() + parsed_;
+        const char* last = in_.data() + end;
+        status_ = end > parsed_ + 12 ? std::atoi(first + 9) : 0;
+        const char* encoding = find_header(first, last, "Transfer-Encoding");
+        const char* length = find_header(first, last, "Content-Length");
+        const char* connection = find_header(first, last, "Connection");
+        // chunked framing wins over a Content-Length sent along with it
+        const bool bodiless = settings_.head || status_ / 100 == 1 || status_ == 204 || status_ == 304;
+        chunked_ = !bodiless && encoding && is_chunked(encoding, last);
+        chunk_state_ = chunk_state::size;
+        until_eof_ = !bodiless && !chunked_ && length == nullptr;
+        body_left_ = bodiless || chunked_ || until_eof_ ? 0 : std::strtoull(length, nullptr, 10);
+        close_after_ = connection && strncasecmp(connection, "close", 5) == 0;
+
+        response_bytes_ = end + 4 - parsed_;
+        parsed_ = end + 4;
+        in_body_ = true;
+    }
+
+    if (until_eof_) {
+        response_bytes_ += in_.size() - parsed_;
+        parsed_ = in_.size();
+        return false;
+    }
+    if (chunked_) {
+        if (!parse_chunked()) {
+            return false;
+        }
+    }
+    else {
+        const std::size_t available = std::min(body_left_, in_.size() - parsed_);
+        parsed_ += available;
+        body_left_ -= available;
+        response_bytes_ += available;
+        if (body_left_) {
+            return false;
+        }
+    }
+    complete(status_);
+    return state_ == state::open && parsed_ < in_.size();
+}
+
+// Steps over the chunks received so far, keeping its place between reads;
+// true once the last chunk and the trailers are in. A malformed chunk fails
+// the connection.
+bool load_connection::parse_chunked()
+{
+    for (;;) {
+        if (chunk_state_ == chunk_state::data) {
+            const std::size_t available = std::min(body_left_, in_.size() - parsed_);
+            parsed_ += available;
+            body_left_ -= available;
+            response_bytes_ += available;
+            if (body_left_) {
+                return false;
+            }
+            chunk_state_ = chunk_state::data_end;
+        }
+
+        const std::size_t eol = in_.find("\r\n", parsed_);
+        if (eol == std::string::npos) {
+            return false;
+        }
+        const char* line = in_.data() + parsed_;
+        const std::size_t size = eol - parsed_;
+        response_bytes_ += size + 2;
+        parsed_ = eol + 2;
+
+        switch (chunk_state_) {
+        case chunk_state::size:
+            // chunk extensions after the size are ignored
+            if (size == 0 || !std::isxdigit(static_cast<unsigned char>(line[0]))) {
+                fail();
+                return false;
+            }
+            body_left_ = std::strtoull(line, nullptr, 16);
+            chunk_state_ = body_left_ ? chunk_state::data : chunk_state::trailer;
+            break;
+        case chunk_state::data_end:
+            if (size != 0) {
+                fail();
+                return false;
+            }
+            chunk_state_ = chunk_state::size;
+            break;
+        case chunk_state::trailer:
+            if (size == 0) {
+                chunk_state_ = chunk_state::size;
+                return true;
+            }
+            break;
+        case chunk_state::data:
+            break;
+        }
+    }
+}
+
+void load_connection::complete(int status)
+{
+    in_body_ = false;
+    if (in_flight_.empty()) {
+        fail();
+        return;
+    }
+    const request r = in_flight_.front();
+    in_flight_.pop_front();
+    served_++;
+    worker_.done(r.due, r.sent, status, response_bytes_);
+
+    if (!settings_.keep_alive || close_after_) {
+        if (!in_flight_.empty()) {
+            // pipelined behind a closing response
+            worker_.failed(in_flight_.size());
+            in_flight_.clear();
+        }
+        close();
+    }
+    worker_.ready(*this);
+    if (in_flight_.empty()) {
+        worker_.idle();
+    }
+}
+
+void load_connection::fail()
+{
+    worker_.failed(in_flight_.size());
+    in_flight_.clear();
+    close();
+    worker_.ready(*this);
+    worker_.idle();
+}
+
+void load_connection::close()
+{
+    boost::system::error_code ec;
+    socket_.close(ec);
+    generation_++;
+    state_ = state::closed;
+    writing_ = false;
+    out_.clear();
+    in_.clear();
+    parsed_ = 0;
+    in_body_ = false;
+    served_ = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+std::string make_request(const std::string& method, const std::string& host, const std::string& path,
+                         bool keep_alive, const std::vector<std::string>& headers)
+{
+    std::string request = method + " " + path + " HTTP/1.1\r\n";
+    request += "Host: " + host + "\r\n";
+    request += "User-Agent: asio/1.60.0\r\n";
+    request += "Accept: */*\r\n";
+    for (const std::string& header : headers) {
+        request += header + "\r\n";
+    }
+    request += keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    request += "\r\n";
+    return request;
+}
+
+void write_latency(std::ostream& out, const latency_histogram& histogram)
+{
+    out << "{\"mean\":" << histogram.mean() / 1000
+        << ",\"p50\":" << histogram.percentile(0.5) / 1000.0
+        << ",\"p90\":" << histogram.percentile(0.9) / 1000.0
+        << ",\"p99\":" << histogram.percentile(0.99) / 1000.0
+        << ",\"p999\":" << histogram.percentile(0.999) / 1000.0
+        << ",\"max\":" << histogram.max() / 1000.0
+        << "}";
+}
+
+void write_json(std::ostream& out, const load_settings& settings, const std::string& target,
+                const load_result& result, double seconds)
+{
+    out << "{\"target\":\"" << target << "\""
+        << ",\"mode\":\"" << (settings.keep_alive ? "keep-alive" : "close") << "\""
+        << ",\"connections\":" << settings.connections
+        << ",\"threads\":" << settings.threads
+        << ",\"pipeline\":" << settings.pipeline
+        << ",\"schedule\":\"" << (settings.schedule.empty() ? "closed-loop" : settings.schedule.text()) << "\""
+        << ",\"seconds\":" << seconds
+        << ",\"requests\":" << result.completed
+        << ",\"rps\":" << (seconds > 0 ? result.completed / seconds : 0)
+        << ",\"non_2xx\":" << result.non_2xx
+        << ",\"errors\":" << result.errors
+        << ",\"timeouts\":" << result.timeouts
+        << ",\"unsent\":" << result.unsent
+        << ",\"connects\":" << result.connects
+        << ",\"connect_errors\":" << result.connect_errors
+        << ",\"bytes\":" << result.bytes
+        << ",\"latency_us\":";
+    write_latency(out, result.corrected);
+    out << ",\"uncorrected_latency_us\":";
+    write_latency(out, result.uncorrected);
+    out << "}\n";
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        po::options_description description("Usage: asio_http_load_client <server> <port> | unix:<path> [options]");
+        po::positional_options_description positional;
+        positional.add("server", 1);
+        positional.add("port", 1);
+        description.add_options()
+            ("help,h", "print this message")
+            ("server", po::value<std::string>(), "server address, or unix:/path or unix:@abstract-name without a port")
+            ("port", po::value<unsigned short>(), "server port")
+            ("path", po::value<std::string>()->default_value("/"), "request path")
+            ("method", po::value<std::string>()->default_value("GET"), "request method")
+            ("header", po::value<std::vector<std::string>>()->composing(), "extra request header, repeatable")
+            ("connections,c", po::value<std::size_t>()->default_value(64), "connections")
+            ("threads,t", po::value<std::size_t>()->default_value(std::max(1u, std::thread::hardware_concurrency())), "threads")
+            ("mode", po::value<std::string>()->default_value("keep-alive"), "keep-alive or close (a connection per request)")
+            ("pipeline", po::value<std::size_t>()->default_value(1), "requests in flight per keep-alive connection")
+            ("rps-schedule", po::value<std::string>(), "open loop: const(RPS,DUR) line(FROM,TO,DUR) step(FROM,TO,STEP,DUR)")
+            ("duration", po::value<std::string>()->default_value("10s"), "closed loop run time")
+            ("timeout", po::value<std::string>()->default_value("5s"), "wait for the answers in flight at the end")
+            ("json", po::value<std::string>(), "write the result as JSON to this file, - for stdout");
+
+        po::variables_map options;
+        po::store(po::command_line_parser(argc, argv).options(description).positional(positional).run(), options);
+        po::notify(options);
+
+        const bool local = options.count("server") && options["server"].as<std::string>().compare(0, 5, "unix:") == 0;
+        if (options.count("help") || !options.count("server") || (!options.count("port") && !local)) {
+            std::cerr << description << "\n";
+            return 1;
+        }
+
+        const std::string server = options["server"].as<std::string>();
+        const std::string authority = local ? server : server + ":" + std::to_string(options["port"].as<unsigned short>());
+        const std::string mode = options["mode"].as<std::string>();
+        if (mode != "keep-alive" && mode != "close") {
+            throw std::runtime_error("bad mode: " + mode);
+        }
+
+        load_settings settings;
+        settings.endpoint = parse_stream_endpoint(authority);
+        settings.keep_alive = mode == "keep-alive";
+        settings.pipeline = settings.keep_alive ? std::max<std::size_t>(1, options["pipeline"].as<std::size_t>()) : 1;
+        settings.threads = std::max<std::size_t>(1, options["threads"].as<std::size_t>());
+        settings.connections = std::max(settings.threads, options["connections"].as<std::size_t>());
+        settings.duration = rps_schedule::parse_duration(options["duration"].as<std::string>());
+        settings.timeout = rps_schedule::parse_duration(options["timeout"].as<std::string>());
+        if (options.count("rps-schedule")) {
+            settings.schedule = rps_schedule::parse(options["rps-schedule"].as<std::string>());
+        }
+        settings.head = options["method"].as<std::string>() == "HEAD";
+        settings.request = make_request(options["method"].as<std::string>(),
+                                        local ? "localhost" : authority,
+                                        options["path"].as<std::string>(),
+                                        settings.keep_alive,
+                                        options.count("header") ? options["header"].as<std::vector<std::string>>() : std::vector<std::string>());
+
+        std::vector<std::unique_ptr<load_worker>> workers;
+        for (std::size_t i = 0; i < settings.threads; i++) {
+            const std::size_t connections = settings.connections / settings.threads + (i < settings.connections % settings.threads);
+            workers.emplace_back(new load_worker(settings, i, connections));
+        }
+
+        // every thread connects, then all start on the same clock
+        std::mutex mutex;
+        std::condition_variable started;
+        std::size_t prepared = 0;
+        std::uint64_t start = 0;
+
+        std::vector<std::thread> threads;
+        for (auto& worker : workers) {
+            load_worker* w = worker.get();
+            threads.push_back(std::thread([&, w]() {
+                w->prepare();
+                std::unique_lock<std::mutex> lock(mutex);
+                if (++prepared == workers.size()) {
+                    start = now_ns() + 10000000;
+                    started.notify_all();
+                }
+                started.wait(lock, [&start]() { return start != 0; });
+                lock.unlock();
+                w->run(start);
+            }));
+        }
+
+        std::atomic<bool> finished(false);
+        std::thread progress([&]() {
+            std::uint64_t last = 0;
+            for (std::size_t second = 1; !finished; second++) {
+                for (int i = 0; i < 10 && !finished; i++) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                }
+                std::uint64_t completed = 0;
+                for (auto& worker : workers) {
+                    completed += worker->completed();
+                }
+                if (!finished) {
+                    std::cerr << "<- " << second << "s rps: " << completed - last << std::endl;
+                }
+                last = completed;
+            }
+        });
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        const std::uint64_t end = now_ns();
+        finished = true;
+        progress.join();
+
+        load_result result;
+        for (auto& worker : workers) {
+            result.merge(worker->result());
+        }
+
+        const double seconds = static_cast<double>(end - start) / 1e9;
+        const std::string target = authority + options["path"].as<std::string>();
+
+        std::cout << "<- requests: " << result.completed
+                  << " rps: " << (seconds > 0 ? result.completed / seconds : 0)
+                  << " non-2xx: " << result.non_2xx
+                  << " errors: " << result.errors
+                  << " timeouts: " << result.timeouts
+                  << " unsent: " << result.unsent
+                  << " connect errors: " << result.connect_errors
+                  << "\n<- latency us p50: " << result.corrected.percentile(0.5) / 1000.0
+                  << " p90: " << result.corrected.percentile(0.9) / 1000.0
+                  << " p99: " << result.corrected.percentile(0.99) / 1000.0
+                  << " p99.9: " << result.corrected.percentile(0.999) / 1000.0
+                  << " max: " << result.corrected.max() / 1000.0
+                  << "\n<- uncorrected us p50: " << result.uncorrected.percentile(0.5) / 1000.0
+                  << " p99: " << result.uncorrected.percentile(0.99) / 1000.0
+                  << " p99.9: " << result.uncorrected.percentile(0.999) / 1000.0
+                  << std::endl;
+
+        if (options.count("json")) {
+            const std::string path = options["json"].as<std::string>();
+            if (path == "-") {
+                write_json(std::cout, settings, target, result, seconds);
+            }
+            else {
+                std::ofstream file(path);
+                write_json(file, settings, target, result, seconds);
+            }
+        }
+
+        return result.errors == 0 && result.timeouts == 0 ? 0 : 1;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "<- main exception: " << e.what() << "\n";
+    }
+
+    return 1;
+}
@@ -0,0 +1,187 @@
+// Times the parsers of libs/http on canned input: request heads the size of
+// a curl and of a browser request, a response head, and a chunked body.
+// Each head is copied into a streambuf and parsed, the way the servers get
+// them from the socket. With --json the results are written as metrics
+// bench_store records.
+//
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/streambuf.hpp>
+
+#include <http_chunked.h>
+#include <http_request.h>
+#include <http_response.h>
+
+const char CURL_REQUEST[] =
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8080\r\n"
+    "User-Agent: curl/7.58.0\r\n"
+    "Accept: */*\r\n"
+    "\r\n";
+
+const char BROWSER_REQUEST[] =
+    "GET /static/js/app.3f2a9c.js?v=20170412 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/57.0.2987.133 Safari/537.36\r\n"
+    "Accept: */*\r\n"
+    "Referer: https://www.example.com/articles/2017/04/http-parsing\r\n"
+    "Accept-Encoding: gzip, deflate, sdch, br\r\n"
+    "Accept-Language: en-US,en;q=0.8,ru;q=0.6\r\n"
+    "Cookie: session=5b1f0c9e2d7a4e3f8c6b; theme=dark; _ga=GA1.2.1234567890.1491990000; _gid=GA1.2.987654321.1491990000\r\n"
+    "If-None-Match: \"5a1b-54d2c6f0a3e80\"\r\n"
+    "If-Modified-Since: Wed, 12 Apr 2017 10:00:00 GMT\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "\r\n";
+
+const char RESPONSE[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Server: nginx/1.12.0\r\n"
+    "Date: Wed, 12 Apr 2017 10:00:00 GMT\r\n"
+    "Content-Type: text/html; charset=utf-8\r\n"
+    "Content-Length: 12345\r\n"
+    "Connection: keep-alive\r\n"
+    "Vary: Accept-Encoding\r\n"
+    "\r\n";
+
+struct result
+{
+    std::string name;
+    std::size_t bytes;          // per iteration
+    double ns;                  // per iteration
+};
+
+volatile std::size_t sink;
+
+template<class Step>
+result measure(const std::string& name, std::size_t bytes, std::size_t iterations, Step step)
+{
+    std::size_t sum = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < iterations; i++) {
+        sum += step();
+    }
+    const auto end = std::chrono::steady_clock::now();
+
+    sink = sum;
+    return result{ name, bytes, std::chrono::duration<double, std::nano>(end - start).count() / iterations };
+}
+
+void fill(boost::asio::streambuf& buffer, const char* data, std::size_t size)
+{
+    const std::size_t copied = boost::asio::buffer_copy(buffer.prepare(size), boost::asio::buffer(data, size));
+    buffer.commit(copied);
+}
+
+result bench_request(const std::string& name, const char* head, std::size_t size, std::size_t iterations)
+{
+    boost::asio::streambuf buffer;
+    http_request request;
+    return measure(name, size, iterations, [&]() {
+        fill(buffer, head, size);
+        request.parse(buffer);
+        return request.get_url().size();
+    });
+}
+
+result bench_response(std::size_t iterations)
+{
+    const std::size_t size = sizeof(RESPONSE) - 1;
+    boost::asio::streambuf buffer;
+    return measure("response", size, iterations, [&]() {
+        fill(buffer, RESPONSE, size);
+        http_response response;
+        response.parse(buffer);
+        buffer.consume(buffer.size());
+        return response.get_code();
+    });
+}
+
+// 64 KB in 4 KB chunks, fed the way it arrives: 1460 bytes at a time
+result bench_chunked(std::size_t iterations)
+{
+    std::string body;
+    for (int i = 0; i < 16; i++) {
+        body += "1000\r\n";
+        body.append(4096, static_cast<char>('a' + i));
+        body += "\r\n";
+    }
+    body += "0\r\n\r\n";
+
+    http_chunked_decoder decoder(1 << 20);
+    std::string out;
+    return measure("chunked", body.size(), std::max<std::size_t>(iterations / 100, 1), [&]() {
+        decoder.reset();
+        out.clear();
+        for (std::size_t first = 0; first < body.size();) {
+            const std::size_t length = std::min<std::size_t>(1460, body.size() - first);
+            std::size_t consumed = 0;
+            if (decoder.decode(body.data() + first, length, consumed, out) == http_chunked_decoder::result::error) {
+                std::abort();
+            }
+            first += consumed;
+        }
+        return out.size();
+    });
+}
+
+void write_json(std::ostream& out, const std::vector<result>& results)
+{
+    out << "{\"benchmark\":\"http_parser\",\"metrics\":{";
+    for (std::size_t i = 0; i < results.size(); i++) {
+        const result& r = results[i];
+        out << (i ? "," : "")
+            << "\"" << r.name << ".ns\":{\"value\":" << r.ns << ",\"unit\":\"ns\",\"better\":\"lower\"},"
+            << "\"" << r.name << ".mbps\":{\"value\":" << r.bytes * 1000.0 / r.ns << ",\"unit\":\"MB/s\",\"better\":\"higher\"}";
+    }
+    out << "}}\n";
+}
+
+int main(int argc, char* argv[])
+{
+    std::size_t iterations = 1000000;
+    std::string json;
+    for (int i = 1; i < argc; i++) {
+        const std::string option = argv[i];
+        if (option == "--json" && i + 1 < argc) {
+            json = argv[++i];
+        }
+        else if (option.find_first_not_of("0123456789") == std::string::npos) {
+            iterations = std::stoul(option);
+        }
+        else {
+            std::cerr << "Usage: asio_http_parser_benchmark [iterations] [--json FILE]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<result> results;
+    results.push_back(bench_request("curl_request", CURL_REQUEST, sizeof(CURL_REQUEST) - 1, iterations));
+    results.push_back(bench_request("browser_request", BROWSER_REQUEST, sizeof(BROWSER_REQUEST) - 1, iterations));
+    results.push_back(bench_response(iterations));
+    results.push_back(bench_chunked(iterations));
+
+    for (const result& r : results) {
+        std::cout << "<- " << r.name
+                  << " bytes: " << r.bytes
+                  << " time: " << r.ns << " ns"
+                  << " throughput: " << r.bytes * 1000.0 / r.ns << " MB/s"
+                  << std::endl;
+    }
+
+    if (!json.empty()) {
+        std::ofstream file(json);
+        write_json(file, results);
+    }
+
+    return 0;
+}
@@ -0,0 +1,231 @@
+// Posts a JSON document of the given size to /echo over N keep-alive
+// connections, checks that it comes back unchanged and reports the rate.
+//
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <istream>
+#include <ostream>
+#include <iostream>
+
+#include <boost/asio.hpp>
+
+#include <http_response.h>
+
+using boost::asio::ip::tcp;
+
+// Compact JSON, so the server's serialization of it is byte for byte equal.
+std::string make_body(size_t size)
+{
+    std::string body = "{\"items\":[";
+    for(size_t i = 0; body.size() + 2 < size; i++) {
+        if(i) {
+            body += ',';
+        }
+        body += "{\"id\":" + std::to_string(i) +
+                ",\"name\":\"item-" + std::to_string(i) +
+                "\",\"tags\":[\"a\",\"b\"],\"ok\":true}";
+    }
+    body += "]}";
+    return body;
+}
+
+std::string make_request(const std::string& body, bool chunked)
+{
+    std::string request = "POST /echo HTTP/1.1\r\n";
+    request += "Host: localhost\r\n";
+    request += "User-Agent: asio/1.60.0\r\n";
+    request += "Content-Type: application/json\r\n";
+    if(chunked) {
+        // the body split in 4 KB chunks, to exercise the decoder
+        request += "Transfer-Encoding: chunked\r\n\r\n";
+        const size_t step = 4096;
+        for(size_t first = 0; first < body.size(); first += step) {
+            const std::string chunk = body.substr(first, step);
+            char size[32];
+            std::snprintf(size, sizeof(size), "%zx\r\n", chunk.size());
+            request += size + chunk + "\r\n";
+        }
+        request += "0\r\n\r\n";
+    }
+    else {
+        request += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+        request += body;
+    }
+    return request;
+}
+
+class post_client : public std::enable_shared_from_this<post_client>
+{
+public:
+    post_client(boost::asio::io_service& io_service, const tcp::endpoint& endpoint,
+                const std::string& request, const std::string& body, size_t requests,
+                std::atomic<size_t>& completed, std::atomic<size_t>& errors) :
+        socket_(io_service),
+        endpoint_(endpoint),
+        request_(request),
+        body_(body),
+        remaining_(requests),
+        completed_(completed),
+        errors_(errors)
+    {
+    }
+
+    void go()
+    {
+        auto self(shared_from_this());
+        socket_.async_connect(endpoint_, [this, self](boost::system::error_code ec) {
+            if (!ec) {
+                do_write();
+            }
+            else {
+                errors_ += remaining_;
+            }
+        });
+    }
+
+private:
+    void do_write()
+    {
+        if(remaining_ == 0) {
+            return;
+        }
+
+        auto self(shared_from_this());
+        boost::asio::async_write(socket_, boost::asio::buffer(request_),
+            [this, self](boost::system::error_code ec, std::size_t /*length*/) {
+                if (!ec) {
+                    do_read_header();
+                }
+                else {
+                    errors_ += remaining_;
+                }
+        });
+    }
+
+    void do_read_header()
+    {
+        auto self(shared_from_this());
+        boost::asio::async_read_until(socket_, response_, "\r\n\r\n",
+            [this, self](boost::system::error_code ec, std::size_t /*length*/) {
+                if (ec) {
+                    errors_ += remaining_;
+                    return;
+                }
+
+                http_response response;
+                const size_t buffered = response.parse(response_);
+                if(response.get_code() != 200) {
+                    std::cerr << "<- unexpected status: " << response.get_code() << std::endl;
+                    errors_ += remaining_;
+                    return;
+                }
+
+                const size_t length = std::stoul(response.get_header("Content-Length", "0"));
+                if(buffered >= length) {
+                    handle_body(length);
+                    return;
+                }
+                boost::asio::async_read(socket_, response_, boost::asio::transfer_exactly(length - buffered),
+                    [this, self, length](boost::system::error_code ec, std::size_t /*length*/) {
+                        if (!ec) {
+                            handle_body(length);
+                        }
+                        else {
+                            errors_ += remaining_;
+                        }
+                });
+        });
+    }
+
+    void handle_body(size_t length)
+    {
+        const char* data = boost::asio::buffer_cast<const char*>(response_.data());
+        if(body_.compare(0, std::string::npos, data, length) == 0) {
+            completed_++;
+        }
+        else {
+            errors_++;
+        }
+        response_.consume(length);
+
+        remaining_--;
+        do_write();
+    }
+
+private:
+    tcp::socket socket_;
+    tcp::endpoint endpoint_;
+    const std::string& request_;
+    const std::string& body_;
+
+    boost::asio::streambuf response_;
+    size_t remaining_;
+    std::atomic<size_t>& completed_;
+    std::atomic<size_t>& errors_;
+};
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        if (argc != 6 && argc != 7) {
+            std::cout << "Usage: asio_json_post_client <server> <port> <connections> <requests> <body-kb> [chunked]\n";
+            return 1;
+        }
+
+        const tcp::endpoint endpoint(boost::asio::ip::address::from_string(argv[1]), std::stoi(argv[2]));
+        const size_t connections = std::stoul(argv[3]);
+        const size_t requests = std::stoul(argv[4]);
+        const size_t size = std::stoul(argv[5]) * 1024;
+        const bool chunked = (argc == 7 && std::string(argv[6]) == "chunked");
+
+        const std::string body = make_body(size);
+        const std::string request = make_request(body, chunked);
+
+        boost::asio::io_service io_service;
+        std::atomic<size_t> completed(0);
+        std::atomic<size_t> errors(0);
+
+        for(size_t i = 0; i < connections; i++) {
+            std::make_shared<post_client>(io_service, endpoint, request, body, requests, completed, errors)->go();
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> threads;
+        const size_t hardware_concurrency = std::thread::hardware_concurrency();
+        for(size_t i = 0; i < hardware_concurrency; i++) {
+            threads.push_back(std::thread([&io_service](){
+                io_service.run();
+            }));
+        }
+        for(size_t i = 0; i < hardware_concurrency; i++) {
+            threads[i].join();
+        }
+
+        const auto end = std::chrono::steady_clock::now();
+        const double seconds = std::chrono::duration<double>(end - start).count();
+
+        std::cout << "<- body: " << body.size()
+                  << " requests: " << completed
+                  << " errors: " << errors
+                  << " time: " << seconds * 1000 << " ms"
+                  << " rps: " << (seconds > 0 ? completed / seconds : 0)
+                  << " throughput: " << (seconds > 0 ? completed * body.size() / seconds / (1024 * 1024) : 0) << " MB/s"
+                  << std::endl;
+
+        return errors == 0 ? 0 : 1;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "<- main exception: " << e.what() << "\n";
+    }
+
+    return 1;
+}
@@ -0,0 +1,343 @@
+// A stand-in for the proxies' upstream: answers every GET after a latency
+// drawn from a distribution, with a body whose size is drawn from another,
+// and fails a chosen share of requests with 500 or with a connection reset.
+// Bodies go out with Content-Length or chunked, at once or dripped a few
+// bytes at a time. Distributions are written as
+//
+//     fixed:V  uniform:MIN:MAX  lognormal:MEDIAN:SIGMA  bimodal:FAST:SLOW:P
+//
+// where P is the share of SLOW samples; sizes take k and m suffixes,
+// latencies us, ms and s.
+//
+
+#include <array>
+#include <cmath>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/program_options.hpp>
+
+#include <http_server.h>
+#include <http_session.h>
+
+namespace po = boost::program_options;
+
+const std::size_t MAX_BODY = 64 * 1024 * 1024;
+
+class distribution
+{
+public:
+    enum class kind { fixed, uniform, lognormal, bimodal };
+
+    // `unit` turns one written value, suffix included, into a number
+    template<class Unit>
+    static distribution parse(const std::string& text, Unit unit)
+    {
+        std::vector<std::string> parts;
+        std::size_t first = 0;
+        for (;;) {
+            const std::size_t colon = text.find(':', first);
+            parts.push_back(text.substr(first, colon == std::string::npos ? std::string::npos : colon - first));
+            if (colon == std::string::npos) {
+                break;
+            }
+            first = colon + 1;
+        }
+
+        distribution d;
+        if (parts.size() == 1) {
+            d.kind_ = kind::fixed;
+            d.a_ = unit(parts[0]);
+        }
+        else if (parts[0] == "fixed" && parts.size() == 2) {
+            d.kind_ = kind::fixed;
+            d.a_ = unit(parts[1]);
+        }
+        else if (parts[0] == "uniform" && parts.size() == 3) {
+            d.kind_ = kind::uniform;
+            d.a_ = unit(parts[1]);
+            d.b_ = unit(parts[2]);
+        }
+        else if (parts[0] == "lognormal" && parts.size() == 3) {
+            d.kind_ = kind::lognormal;
+            d.a_ = unit(parts[1]);
+            d.b_ = std::stod(parts[2]);
+        }
+        else if (parts[0] == "bimodal" && parts.size() == 4) {
+            d.kind_ = kind::bimodal;
+            d.a_ = unit(parts[1]);
+            d.b_ = unit(parts[2]);
+            d.p_ = std::stod(parts[3]);
+        }
+        else {
+            throw std::runtime_error("bad distribution: " + text);
+        }
+        if (d.a_ < 0 || d.b_ < 0 || (d.kind_ == kind::uniform && d.b_ < d.a_) || d.p_ < 0 || d.p_ > 1) {
+            throw std::runtime_error("bad distribution: " + text);
+        }
+        return d;
+    }
+
+    template<class Random>
+    double sample(Random& random) const
+    {
+        switch (kind_) {
+        case kind::fixed:
+            return a_;
+        case kind::uniform:
+            return std::uniform_real_distribution<double>(a_, b_)(random);
+        case kind::lognormal:
+            // a_ is the median: exp(mu)
+            return a_ * std::exp(b_ * std::normal_distribution<double>()(random));
+        case kind::bimodal:
+            return std::bernoulli_distribution(p_)(random) ? b_ : a_;
+        }
+        return a_;
+    }
+
+private:
+    kind kind_ = kind::fixed;
+    double a_ = 0;
+    double b_ = 0;
+    double p_ = 0;
+};
+
+// "512", "4k", "1m"
+double parse_size(const std::string& text)
+{
+    std::size_t used = 0;
+    const double value = std::stod(text, &used);
+    const std::string unit = text.substr(used);
+    if (unit.empty()) return value;
+    if (unit == "k" || unit == "K") return value * 1024;
+    if (unit == "m" || unit == "M") return value * 1024 * 1024;
+    throw std::runtime_error("bad size: " + text);
+}
+
+// "250us", "5ms", "1s", microseconds; a plain number is milliseconds
+double parse_latency(const std::string& text)
+{
+    std::size_t used = 0;
+    const double value = std::stod(text, &used);
+    const std::string unit = text.substr(used);
+    if (unit == "us") return value;
+    if (unit.empty() || unit == "ms") return value * 1000;
+    if (unit == "s") return value * 1000 * 1000;
+    throw std::runtime_error("bad latency: " + text);
+}
+
+struct mock_config
+{
+    distribution size;
+    distribution latency;           // microseconds
+    double error_rate = 0;
+    double reset_rate = 0;
+    bool chunked = false;
+    std::size_t drip_bytes = 0;     // 0: the body in one write
+    std::chrono::microseconds drip_interval{0};
+    std::string body;               // MAX_BODY of filler, responses send a prefix
+};
+
+thread_local std::mt19937_64 random_engine(std::random_device{}());
+
+// One response: waits out its latency, then fails the request or sends
+// the body, in drips if asked to. Holds the session until it is done.
+class mock_exchange : public std::enable_shared_from_this<mock_exchange>
+{
+public:
+    mock_exchange(const http_session_ptr& session, const mock_config& config) :
+        session_(session),
+        config_(config),
+        timer_(session->io_service()),
+        size_(0),
+        sent_(0)
+    {
+    }
+
+    void start()
+    {
+        const double latency = std::max(0.0, config_.latency.sample(random_engine));
+        const double size = std::max(0.0, config_.size.sample(random_engine));
+        size_ = std::min(MAX_BODY, static_cast<std::size_t>(size));
+
+        auto self(shared_from_this());
+        timer_.expires_from_now(std::chrono::microseconds(static_cast<std::int64_t>(latency)));
+        timer_.async_wait([this, self](const boost::system::error_code& ec) {
+            if (!ec) {
+                respond();
+            }
+        });
+    }
+
+private:
+    void respond()
+    {
+        std::bernoulli_distribution reset(config_.reset_rate);
+        std::bernoulli_distribution error(config_.error_rate);
+
+        if (reset(random_engine)) {
+            // RST instead of FIN
+            boost::system::error_code ec;
+            session_->socket().set_option(boost::asio::socket_base::linger(true, 0), ec);
+            session_->socket().close(ec);
+            return;
+        }
+        if (error(random_engine)) {
+            session_->reply_status("500 Internal Server Error");
+            return;
+        }
+
+        std::string& header = session_->header_buffer();
+        header.clear();
+        header += "HTTP/1.1 200 OK\r\nServer: ashttp\r\nContent-Type: application/octet-stream\r\n";
+        if (config_.chunked) {
+            header += "Transfer-Encoding: chunked\r\n";
+        }
+        else {
+            header += "Content-Length: ";
+            header += std::to_string(size_);
+            header += "\r\n";
+        }
+        session_->append_general_headers(header);
+
+        if (session_->head()) {
+            size_ = 0;
+        }
+        write_piece(true);
+    }
+
+    // The header with the first piece, then one piece per drip interval.
+    void write_piece(bool first)
+    {
+        const std::size_t step = config_.drip_bytes ? config_.drip_bytes : size_;
+        const std::size_t piece = std::min(step, size_ - sent_);
+        const bool last = sent_ + piece == size_;
+
+        framing_.clear();
+        trailer_.clear();
+        if (config_.chunked && !session_->head()) {
+            if (piece) {
+                char line[32];
+                const int length = std::snprintf(line, sizeof(line), "%zx\r\n", piece);
+                framing_.assign(line, length);
+                trailer_ = "\r\n";
+            }
+            if (last) {
+                trailer_ += "0\r\n\r\n";
+            }
+        }
+
+        const std::array<boost::asio::const_buffer, 4> buffers = {{
+            first ? boost::asio::buffer(session_->header_buffer()) : boost::asio::const_buffer(),
+            boost::asio::buffer(framing_),
+            boost::asio::buffer(config_.body.data() + sent_, piece),
+            boost::asio::buffer(trailer_)
+        }};
+        sent_ += piece;
+
+        auto self(shared_from_this());
+        boost::asio::async_write(session_->socket(), buffers, session_->make_handler(
+            [this, self, last](boost::system::error_code ec, std::size_t /*length*/) {
+                if (ec) {
+                    return;
+                }
+                if (last) {
+                    session_->complete();
+                    return;
+                }
+                timer_.expires_from_now(config_.drip_interval);
+                timer_.async_wait([this, self](const boost::system::error_code& ec) {
+                    if (!ec) {
+                        write_piece(false);
+                    }
+                });
+        }));
+    }
+
+    http_session_ptr session_;
+    const mock_config& config_;
+    boost::asio::steady_timer timer_;
+    std::size_t size_;
+    std::size_t sent_;
+    std::string framing_;
+    std::string trailer_;
+};
+
+int main(int argc, char* argv[])
+{
+    try {
+        po::options_description description("Usage: asio_mock_upstream_server <port> [options]");
+        po::positional_options_description positional;
+        description.add_options()
+            ("help,h", "print this message")
+            ("size", po::value<std::string>()->default_value("1k"), "body size distribution, bytes")
+            ("latency", po::value<std::string>()->default_value("0"), "response latency distribution")
+            ("error-rate", po::value<double>()->default_value(0), "share of requests answered with 500")
+            ("reset-rate", po::value<double>()->default_value(0), "share of requests answered with a connection reset")
+            ("chunked", "send bodies chunked instead of with Content-Length")
+            ("drip-bytes", po::value<std::size_t>()->default_value(0), "send bodies this many bytes at a time, 0 at once")
+            ("drip-interval", po::value<std::string>()->default_value("1ms"), "pause between drips");
+        add_server_options(description, positional);
+
+        po::variables_map options;
+        po::store(po::command_line_parser(argc, argv).options(description).positional(positional).run(), options);
+        po::notify(options);
+
+        if (options.count("help") || !options.count("port")) {
+            std::cerr << description << "\n";
+            return 1;
+        }
+
+        const server_config config = make_server_config(options);
+
+        mock_config mock;
+        mock.size = distribution::parse(options["size"].as<std::string>(), parse_size);
+        mock.latency = distribution::parse(options["latency"].as<std::string>(), parse_latency);
+        mock.error_rate = options["error-rate"].as<double>();
+        mock.reset_rate = options["reset-rate"].as<double>();
+        mock.chunked = options.count("chunked") != 0;
+        mock.drip_bytes = options["drip-bytes"].as<std::size_t>();
+        mock.drip_interval = std::chrono::microseconds(
+            static_cast<std::int64_t>(parse_latency(options["drip-interval"].as<std::string>())));
+        if (mock.error_rate < 0 || mock.error_rate > 1 || mock.reset_rate < 0 || mock.reset_rate > 1) {
+            throw std::runtime_error("rates are between 0 and 1");
+        }
+
+        mock.body.resize(MAX_BODY);
+        for (std::size_t i = 0; i < mock.body.size(); i++) {
+            mock.body[i] = static_cast<char>('a' + i % 26);
+        }
+
+        http_router router;
+        router.add_prefix("GET", "/", [&mock](const http_session_ptr& session) {
+            std::make_shared<mock_exchange>(session, mock)->start();
+        });
+
+        io_service_pool pool(config.worker_threads(), config.model, config.worker_cpus());
+        http_server server(pool, config, router);
+
+        // stopping the pool lets the server go out of scope and report
+        boost::asio::signal_set signals(pool.next(), SIGINT, SIGTERM);
+        signals.async_wait([&](const boost::system::error_code&, const int&){
+            std::cerr << "#> catch signal" << std::endl;
+            pool.stop();
+        });
+
+        pool.run();
+    }
+    catch (std::exception& e) {
+        std::cerr << "Exception: " << e.what() << "\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,234 @@
+// Downloads one file over N connections, each fetching its own byte range,
+// and reports the aggregate throughput.
+//
+
+#include <array>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdexcept>
+#include <istream>
+#include <ostream>
+#include <iostream>
+
+#include <boost/asio.hpp>
+
+#include <http_response.h>
+
+using boost::asio::ip::tcp;
+
+std::string build_request(const std::string& method, const std::string& hostname,
+                          const std::string& path, const std::string& range)
+{
+    std::string request = method + " " + path + " HTTP/1.1\r\n";
+    request += "Host: " + hostname + "\r\n";
+    request += "Accept: */*\r\n";
+    request += "User-Agent: asio/1.60.0\r\n";
+    if(!range.empty()) {
+        request += "Range: bytes=" + range + "\r\n";
+    }
+    request += "Connection: close\r\n";
+    request += "\r\n";
+    return request;
+}
+
+size_t fetch_size(const tcp::endpoint& endpoint, const std::string& hostname, const std::string& path)
+{
+    boost::asio::io_service io_service;
+    tcp::socket socket(io_service);
+    socket.connect(endpoint);
+
+    boost::asio::write(socket, boost::asio::buffer(build_request("HEAD", hostname, path, "")));
+
+    boost::asio::streambuf buffer;
+    boost::asio::read_until(socket, buffer, "\r\n\r\n");
+
+    http_response response;
+    response.parse(buffer);
+    if(response.get_code() != 200) {
+        throw std::runtime_error("HEAD " + path + ": " + std::to_string(response.get_code()));
+    }
+    if(response.get_header("Accept-Ranges", "") != "bytes") {
+        std::cerr << "<- warning: server does not advertise byte ranges" << std::endl;
+    }
+    return std::stoull(response.get_header("Content-Length", "0"));
+}
+
+class chunk_client : public std::enable_shared_from_this<chunk_client>
+{
+public:
+    chunk_client(boost::asio::io_service& io_service, const tcp::endpoint& endpoint,
+                 const std::string& request, size_t expected, std::atomic<size_t>& received) :
+        socket_(io_service),
+        endpoint_(endpoint),
+        request_(request),
+        expected_(expected),
+        body_(0),
+        received_(received),
+        failed_(false)
+    {
+    }
+
+    ~chunk_client()
+    {
+        if(failed_ || body_ != expected_) {
+            std::cerr << "<- chunk failed: " << request_.substr(0, request_.find("\r\nConnection"))
+                      << " received: " << body_ << " expected: " << expected_ << std::endl;
+        }
+    }
+
+    void go()
+    {
+        auto self(shared_from_this());
+        socket_.async_connect(endpoint_, [this, self](boost::system::error_code ec) {
+            if (!ec) {
+                do_write();
+            }
+            else {
+                failed_ = true;
+            }
+        });
+    }
+
+private:
+    void do_write()
+    {
+        auto self(shared_from_this());
+        boost::asio::async_write(socket_, boost::asio::buffer(request_),
+            [this, self](boost::system::error_code ec, std::size_t /*length*/) {
+                if (!ec) {
+                    do_read_header();
+                }
+                else {
+                    failed_ = true;
+                }
+        });
+    }
+
+    void do_read_header()
+    {
+        auto self(shared_from_this());
+        boost::asio::async_read_until(socket_, header_, "\r\n\r\n",
+            [this, self](boost::system::error_code ec, std::size_t /*length*/) {
+                if (ec) {
+                    failed_ = true;
+                    return;
+                }
+
+                http_response response;
+                const size_t body = response.parse(header_);
+                if(response.get_code() != 206) {
+                    std::cerr << "<- unexpected status: " << response.get_code() << std::endl;
+                    failed_ = true;
+                    return;
+                }
+                account(body);
+                do_read_body();
+        });
+    }
+
+    void do_read_body()
+    {
+        if(body_ >= expected_) {
+            return;
+        }
+
+        auto self(shared_from_this());
+        socket_.async_read_some(boost::asio::buffer(buffer_),
+            [this, self](boost::system::error_code ec, std::size_t length) {
+                account(length);
+                if (!ec) {
+                    do_read_body();
+                }
+        });
+    }
+
+    void account(size_t length)
+    {
+        body_ += length;
+        received_ += length;
+    }
+
+private:
+    tcp::socket socket_;
+    tcp::endpoint endpoint_;
+    std::string request_;
+
+    boost::asio::streambuf header_;
+    std::array<char, 64 * 1024> buffer_;
+
+    size_t expected_;
+    size_t body_;
+    std::atomic<size_t>& received_;
+    bool failed_;
+};
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        if (argc != 6) {
+            std::cout << "Usage: asio_range_http_client <hostname> <path> <server> <port> <connections>\n";
+            return 1;
+        }
+
+        const std::string hostname = argv[1];
+        const std::string path = argv[2];
+        const tcp::endpoint endpoint(boost::asio::ip::address::from_string(argv[3]), std::stoi(argv[4]));
+        const size_t connections = std::stoul(argv[5]);
+
+        const size_t size = fetch_size(endpoint, hostname, path);
+        if(size == 0 || connections == 0) {
+            std::cerr << "<- nothing to download" << std::endl;
+            return 1;
+        }
+
+        boost::asio::io_service io_service;
+        std::atomic<size_t> received(0);
+
+        const size_t chunk = (size + connections - 1) / connections;
+        size_t chunks = 0;
+        for(size_t first = 0; first < size; first += chunk) {
+            const size_t last = std::min(size, first + chunk) - 1;
+            const std::string range = std::to_string(first) + "-" + std::to_string(last);
+            std::make_shared<chunk_client>(io_service, endpoint,
+                build_request("GET", hostname, path, range), last - first + 1, received)->go();
+            chunks++;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> threads;
+        const size_t hardware_concurrency = std::thread::hardware_concurrency();
+        for(size_t i = 0; i < hardware_concurrency; i++) {
+            threads.push_back(std::thread([&io_service](){
+                io_service.run();
+            }));
+        }
+        for(size_t i = 0; i < hardware_concurrency; i++) {
+            threads[i].join();
+        }
+
+        const auto end = std::chrono::steady_clock::now();
+        const double seconds = std::chrono::duration<double>(end - start).count();
+
+        std::cout << "<- size: " << size
+                  << " chunks: " << chunks
+                  << " received: " << received
+                  << " time: " << seconds * 1000 << " ms"
+                  << " throughput: " << (seconds > 0 ? received / seconds / (1024 * 1024) : 0) << " MB/s"
+                  << std::endl;
+
+        return received == size ? 0 : 1;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "<- main exception: " << e.what() << "\n";
+    }
+
+    return 1;
+}
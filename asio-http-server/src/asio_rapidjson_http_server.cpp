@@ -1,112 +1,350 @@
+#include <chrono>
 #include <memory>
-#include <thread>
-#include <utility>
-#include <cstdlib>
+#include <string>
+#include <cstdint>
 #include <iostream>
+#include <algorithm>
 
 #include <boost/asio.hpp>
+#include <boost/program_options.hpp>
 
-using boost::asio::ip::tcp;
+#include <rapidjson/writer.h>
+#include <rapidjson/document.h>
+#include <rapidjson/error/en.h>
 
-const std::string RESPONSE =
-R"(HTTP/1.1 200 OK
-Content-Type: application/json
-Server: ashttp
-Date: Wed, 07 Jun 2017 16:19:01 GMT
-Content-Length: 95)" + std::string("\r\n\r\n") +
+#include <http_server.h>
+#include <http_session.h>
 
-R"({"Hello":"world","T":true,"F":false,"N":null,"I":123,"PI":3.1416,"Array":[0,1,2,3,4,5,6,7,8,9]})";
+#include <url.h>
+#include <gzip.h>
 
-class session : public std::enable_shared_from_this<session>
+namespace po = boost::program_options;
+
+const std::int64_t MAX_ARRAY = 1 << 20;
+
+// how far behind the counters in the document may be
+const std::chrono::milliseconds COUNTERS_INTERVAL(100);
+
+// rapidjson output stream appending to the session's write buffer: the
+// document is serialized in place and handed to async_write as is.
+class write_buffer_stream
 {
 public:
-    session(tcp::socket socket) : socket_(std::move(socket))
+    typedef char Ch;
+
+    explicit write_buffer_stream(std::string& buffer) :
+        buffer_(buffer)
     {
     }
 
-    ~session()
+    void Put(Ch c)
     {
-        //std::cout << "~session" << std::endl;
+        buffer_.push_back(c);
     }
 
-    void start()
+    void Flush()
     {
-        do_read();
     }
 
 private:
-    void do_read()
+    std::string& buffer_;
+};
+
+typedef rapidjson::MemoryPoolAllocator<> pool_allocator;
+typedef rapidjson::Writer<write_buffer_stream, rapidjson::UTF8<>, rapidjson::UTF8<>, pool_allocator> json_writer;
+typedef rapidjson::GenericDocument<rapidjson::UTF8<>, pool_allocator, pool_allocator> json_document;
+
+// Per worker thread scratch space. Writer and parser stacks and the values of
+// a parsed body live in pools backed by chunks allocated once per thread, and
+// the decoded query strings keep their capacity, so a request does not touch
+// the heap once the thread has warmed up. Both pools are cleared per request.
+struct json_context
+{
+    enum
+    {
+        stack_size = 4096,
+        values_size = 256 * 1024
+    };
+
+    json_context() :
+        values_chunk(new char[values_size]),
+        stack(stack_chunk, sizeof(stack_chunk)),
+        values(values_chunk.get(), values_size)
     {
-        auto self(shared_from_this());
-        socket_.async_read_some(boost::asio::buffer(data_, max_length),
-            [this, self](boost::system::error_code ec, std::size_t length) {
-                if (!ec) {
-                    do_write(length);
-                }
-        });
     }
 
-    void do_write(std::size_t length)
+    void clear()
     {
-        auto self(shared_from_this());
-        boost::asio::async_write(socket_, boost::asio::buffer(RESPONSE),
-            [this, self](boost::system::error_code ec, std::size_t /*length*/) {
-                return;
-        });
-  }
+        stack.Clear();
+        values.Clear();
+    }
 
-    tcp::socket socket_;
-    enum { max_length = 1024 };
-    char data_[max_length];
+    char stack_chunk[stack_size];
+    std::unique_ptr<char[]> values_chunk;
+    pool_allocator stack;
+    pool_allocator values;
+    std::string name;
+    std::string value;
+    std::string compressed;
 };
 
-class server
+thread_local json_context context;
+
+void write_document(const std::string& url, std::string& out)
 {
-public:
-    server(boost::asio::io_service& io_service, short port) :
-        acceptor_(io_service, tcp::endpoint(tcp::v4(), port)),
-        socket_(io_service)
-    {
-        do_accept();
+    write_buffer_stream stream(out);
+    json_writer writer(stream, &context.stack);
+
+    writer.StartObject();
+    writer.Key("Hello");
+    writer.String("world");
+    writer.Key("T");
+    writer.Bool(true);
+    writer.Key("F");
+    writer.Bool(false);
+    writer.Key("N");
+    writer.Null();
+    writer.Key("I");
+    writer.Uint(123);
+    writer.Key("PI");
+    writer.Double(3.1416);
+    writer.Key("Array");
+    writer.StartArray();
+    for (unsigned i = 0; i < 10; i++) {
+        writer.Uint(i);
     }
+    writer.EndArray();
 
-private:
-    void do_accept()
-    {
-        acceptor_.async_accept(socket_, [this](boost::system::error_code ec) {
-            if (!ec) {
-                std::make_shared<session>(std::move(socket_))->start();
-            }
+    writer.Key("query");
+    writer.StartObject();
+    query_string query(url);
+    while (query.next(context.name, context.value)) {
+        writer.Key(context.name.data(), static_cast<rapidjson::SizeType>(context.name.size()));
+        writer.String(context.value.data(), static_cast<rapidjson::SizeType>(context.value.size()));
+    }
+    writer.EndObject();
 
-            do_accept();
-        });
+    writer.Key("server");
+    writer.StartObject();
+    const http_counters& counters = http_session::counters();
+    writer.Key("requests");
+    writer.Int64(counters.requests.published());
+    writer.Key("connections");
+    writer.Int64(counters.connections.published());
+    writer.Key("sessions");
+    writer.Int64(counters.sessions.published());
+    writer.EndObject();
+
+    writer.EndObject();
+}
+
+// Request bodies are parsed in situ: strings of the document point into
+// `body`, which therefore has to outlive the echo.
+bool echo_document(std::string& body, std::string& out, std::string& error)
+{
+    json_document document(&context.values, 1024, &context.stack);
+    document.ParseInsitu(&body[0]);
+
+    write_buffer_stream stream(out);
+    json_writer writer(stream, &context.stack);
+
+    if (document.HasParseError()) {
+        error = rapidjson::GetParseError_En(document.GetParseError());
+        error += " at offset ";
+        error += std::to_string(document.GetErrorOffset());
+        return false;
     }
+    if (!document.IsObject() && !document.IsArray()) {
+        error = "an object or an array expected";
+        return false;
+    }
+
+    document.Accept(writer);
+    return true;
+}
+
+void write_error(const std::string& message, std::string& out)
+{
+    write_buffer_stream stream(out);
+    json_writer writer(stream, &context.stack);
+
+    writer.StartObject();
+    writer.Key("error");
+    writer.String(message.data(), static_cast<rapidjson::SizeType>(message.size()));
+    writer.EndObject();
+}
+
+// Sends the document in the session's response buffer. A compressed body is
+// swapped into that buffer, so both keep their capacity for later requests.
+void reply_json(const http_session_ptr& session, const gzip_options& gzip, const char* status)
+{
+    std::string& response = session->response_buffer();
+
+    bool encoded = false;
+    if (gzip.worth(response.size()) &&
+        accepts_gzip(session->request().get_header("Accept-Encoding", "")) &&
+        gzip_compress(response.data(), response.size(), gzip.level, context.compressed) &&
+        context.compressed.size() < response.size()) {
+        response.swap(context.compressed);
+        encoded = true;
+    }
+
+    std::string& header = session->header_buffer();
+    header.clear();
+    header += "HTTP/1.1 ";
+    header += status;
+    header += "\r\nServer: ashttp\r\nContent-Type: application/json\r\nContent-Length: ";
+    header += std::to_string(response.size());
+    header += "\r\n";
+    if (gzip.enabled()) {
+        header += encoded ? "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n" : "Vary: Accept-Encoding\r\n";
+    }
+
+    session->reply(header, boost::asio::buffer(response));
+}
 
-    tcp::acceptor acceptor_;
-    tcp::socket socket_;
+void handle_document(const http_session_ptr& session, const route_params& /*params*/, const gzip_options& gzip)
+{
+    std::string& response = session->response_buffer();
+    response.clear();
+    write_document(session->request().get_url(), response);
+    context.clear();
+
+    reply_json(session, gzip, "200 OK");
+}
+
+void handle_echo(const http_session_ptr& session, const route_params& /*params*/, const gzip_options& gzip)
+{
+    std::string& response = session->response_buffer();
+    response.clear();
+
+    std::string error;
+    const bool valid = echo_document(session->body(), response, error);
+    if (!valid) {
+        response.clear();
+        write_error(error, response);
+    }
+    context.clear();
+
+    reply_json(session, gzip, valid ? "200 OK" : "400 Bad Request");
+}
+
+// GET /array/<n>: n consecutive integers, a response of chosen size
+void handle_array(const http_session_ptr& session, const route_params& params, const gzip_options& gzip)
+{
+    const std::int64_t count = params[0].integer;
+
+    std::string& response = session->response_buffer();
+    response.clear();
+    if (count < 0 || count > MAX_ARRAY) {
+        write_error("array size out of range 0.." + std::to_string(MAX_ARRAY), response);
+        context.clear();
+        reply_json(session, gzip, "400 Bad Request");
+        return;
+    }
+
+    write_buffer_stream stream(response);
+    json_writer writer(stream, &context.stack);
+    writer.StartArray();
+    for (std::int64_t i = 0; i < count; i++) {
+        writer.Int64(i);
+    }
+    writer.EndArray();
+    context.clear();
+
+    reply_json(session, gzip, "200 OK");
+}
+
+// GET /counters/<name>: a single engine counter
+void handle_counter(const http_session_ptr& session, const route_params& params, const gzip_options& gzip)
+{
+    const http_counters& counters = http_session::counters();
+    const route_param& name = params[0];
+
+    std::string& response = session->response_buffer();
+    response.clear();
+    write_buffer_stream stream(response);
+    json_writer writer(stream, &context.stack);
+
+    writer.StartObject();
+    writer.Key(name.data, static_cast<rapidjson::SizeType>(name.size));
+    if (name.size == 8 && std::equal(name.data, name.data + name.size, "requests")) {
+        writer.Int64(counters.requests.value());
+    }
+    else if (name.size == 11 && std::equal(name.data, name.data + name.size, "connections")) {
+        writer.Int64(counters.connections.value());
+    }
+    else if (name.size == 8 && std::equal(name.data, name.data + name.size, "sessions")) {
+        writer.Int64(counters.sessions.value());
+    }
+    else {
+        session->reply_status("404 Not Found");
+        context.clear();
+        return;
+    }
+    writer.EndObject();
+    context.clear();
+
+    reply_json(session, gzip, "200 OK");
+}
+
+typedef void (*json_handler)(const http_session_ptr&, const route_params&, const gzip_options&);
+
+constexpr route<json_handler> ROUTES[] = {
+    { "GET",  "/",                  &handle_document },
+    { "POST", "/echo",              &handle_echo },
+    { "PUT",  "/echo",              &handle_echo },
+    { "GET",  "/array/{int}",       &handle_array },
+    { "GET",  "/counters/{str}",    &handle_counter },
 };
 
+constexpr route_table<json_handler, 8> ROUTE_TABLE(ROUTES);
+
 int main(int argc, char* argv[])
 {
     try {
-        if (argc != 2) {
-            std::cerr << "Usage: " << argv[0] << " <port>\n";
+        po::options_description description("Usage: asio-rapidjson-http-server <port> [options]");
+        po::positional_options_description positional;
+        description.add_options()
+            ("help,h", "print this message")
+            ("gzip-level", po::value<int>()->default_value(6), "gzip compression level, 0 disables")
+            ("gzip-min-size", po::value<std::size_t>()->default_value(256), "smallest body worth compressing, bytes");
+        add_server_options(description, positional);
+
+        po::variables_map options;
+        po::store(po::command_line_parser(argc, argv).options(description).positional(positional).run(), options);
+        po::notify(options);
+
+        if (options.count("help") || !options.count("port")) {
+            std::cerr << description << "\n";
             return 1;
         }
 
-        boost::asio::io_service io_service;
-        server s(io_service, std::atoi(argv[1]));
+        const server_config config = make_server_config(options);
 
-        std::vector<std::thread> threads;
-        const size_t hardware_concurrency = std::thread::hardware_concurrency();
-        for(size_t i = 0; i < hardware_concurrency; i++) {
-            threads.push_back(std::thread([&io_service](){
-                io_service.run();
-            }));
-        }
-        for(size_t i = 0; i < hardware_concurrency; i++) {
-            threads[i].join();
-        }
+        gzip_options gzip;
+        gzip.level = options["gzip-level"].as<int>();
+        gzip.min_size = options["gzip-min-size"].as<std::size_t>();
+
+        http_router router;
+        router.set_fallback([&gzip](const http_session_ptr& session) {
+            dispatch_route(ROUTE_TABLE, session, gzip);
+        });
+
+        const http_counters& counters = http_session::counters();
+        counter_publisher publisher(COUNTERS_INTERVAL, { &counters.requests, &counters.connections, &counters.sessions });
+
+        io_service_pool pool(config.worker_threads(), config.model, config.worker_cpus());
+        http_server server(pool, config, router);
+
+        // stopping the pool lets the server go out of scope and report
+        boost::asio::signal_set signals(pool.next(), SIGINT, SIGTERM);
+        signals.async_wait([&](const boost::system::error_code&, const int&){
+            std::cerr << "#> catch signal" << std::endl;
+            pool.stop();
+        });
+
+        pool.run();
     }
     catch (std::exception& e) {
         std::cerr << "Exception: " << e.what() << "\n";
@@ -0,0 +1,181 @@
+// Resolves "GET /api/rNNNN/<id>" against 8, 64 and 512 routes, with the
+// compile-time route table and with a list of prefixes compared one after
+// another, and reports the cost of a lookup.
+//
+
+#include <array>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+#include <iostream>
+
+#include <route_table.h>
+
+typedef std::int64_t (*bench_handler)(const route_params&);
+
+std::int64_t handle(const route_params& params)
+{
+    return params[0].integer;
+}
+
+// "/api/rNNNN/{int}" patterns, written at compile time
+template<std::size_t N>
+struct bench_routes
+{
+    enum { pattern_size = 20 };
+
+    constexpr bench_routes() :
+        patterns{}
+    {
+        for(std::size_t i = 0; i < N; i++) {
+            const char prefix[] = "/api/r";
+            const char suffix[] = "/{int}";
+            char* p = patterns[i];
+            for(std::size_t j = 0; prefix[j]; j++) {
+                *p++ = prefix[j];
+            }
+            *p++ = static_cast<char>('0' + i / 1000 % 10);
+            *p++ = static_cast<char>('0' + i / 100 % 10);
+            *p++ = static_cast<char>('0' + i / 10 % 10);
+            *p++ = static_cast<char>('0' + i % 10);
+            for(std::size_t j = 0; suffix[j]; j++) {
+                *p++ = suffix[j];
+            }
+        }
+    }
+
+    char patterns[N][pattern_size];
+};
+
+template<std::size_t N>
+struct bench_table
+{
+    static constexpr bench_routes<N> DATA{};
+    static constexpr route<bench_handler> make(std::size_t i)
+    {
+        return route<bench_handler>{ "GET", DATA.patterns[i], &handle };
+    }
+};
+
+template<std::size_t N>
+constexpr bench_routes<N> bench_table<N>::DATA;
+
+template<std::size_t N, std::size_t... I>
+constexpr std::array<route<bench_handler>, N> make_routes(std::index_sequence<I...>)
+{
+    return {{ bench_table<N>::make(I)... }};
+}
+
+// the way a hand written router does it: compare until something matches
+class linear_router
+{
+public:
+    void add(const std::string& method, const std::string& prefix, bench_handler handler)
+    {
+        entries_.push_back(entry{ method, prefix, handler });
+    }
+
+    bool match(const std::string& method, const std::string& path, bench_handler& handler, route_params& params) const
+    {
+        for(const entry& e : entries_) {
+            if(e.method == method && path.compare(0, e.prefix.size(), e.prefix) == 0) {
+                char* end = nullptr;
+                const char* first = path.c_str() + e.prefix.size();
+                params.values[0].integer = std::strtoll(first, &end, 10);
+                if(end != first && *end == '\0') {
+                    params.count = 1;
+                    handler = e.handler;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+private:
+    struct entry
+    {
+        std::string method;
+        std::string prefix;
+        bench_handler handler;
+    };
+
+    std::vector<entry> entries_;
+};
+
+volatile std::int64_t sink;
+
+template<class Lookup>
+double measure(const std::vector<std::string>& paths, std::size_t lookups, Lookup lookup)
+{
+    std::int64_t sum = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for(std::size_t i = 0; i < lookups; i++) {
+        sum += lookup(paths[i % paths.size()]);
+    }
+    const auto end = std::chrono::steady_clock::now();
+
+    sink = sum;
+    return std::chrono::duration<double, std::nano>(end - start).count() / lookups;
+}
+
+template<std::size_t N>
+void run(std::size_t lookups)
+{
+    static constexpr std::array<route<bench_handler>, N> ROUTES = make_routes<N>(std::make_index_sequence<N>());
+    // root, "api", N literals and N parameters
+    static constexpr route_table<bench_handler, 2 * N + 2> TABLE(ROUTES);
+
+    linear_router linear;
+    for(std::size_t i = 0; i < N; i++) {
+        std::string prefix(bench_table<N>::DATA.patterns[i]);
+        linear.add("GET", prefix.substr(0, prefix.size() - 5), &handle);
+    }
+
+    std::mt19937 random(N);
+    std::vector<std::string> paths;
+    for(std::size_t i = 0; i < 4096; i++) {
+        const std::string pattern(bench_table<N>::DATA.patterns[random() % N]);
+        paths.push_back(pattern.substr(0, pattern.size() - 5) + std::to_string(random() % 100000));
+    }
+
+    const double table = measure(paths, lookups, [](const std::string& path) -> std::int64_t {
+        bench_handler handler;
+        route_params params;
+        if(TABLE.match(http_method::get, path, handler, params) != route_status::found) {
+            std::abort();
+        }
+        return handler(params);
+    });
+
+    const std::string method("GET");
+    const double baseline = measure(paths, lookups, [&linear, &method](const std::string& path) -> std::int64_t {
+        bench_handler handler;
+        route_params params;
+        if(!linear.match(method, path, handler, params)) {
+            std::abort();
+        }
+        return handler(params);
+    });
+
+    std::cout << "<- routes: " << N
+              << " nodes: " << TABLE.size()
+              << " route_table: " << table << " ns"
+              << " linear: " << baseline << " ns"
+              << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    const std::size_t lookups = argc > 1 ? std::stoul(argv[1]) : 2000000;
+
+    run<8>(lookups);
+    run<64>(lookups);
+    run<512>(lookups);
+
+    return 0;
+}
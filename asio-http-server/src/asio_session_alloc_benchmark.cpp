@@ -0,0 +1,186 @@
+// Runs the engine in process with one worker thread and counts the heap
+// allocations made on that thread per keep-alive request and per
+// connection, once warmed up, with and without session reuse.
+//
+
+#include <atomic>
+#include <future>
+#include <string>
+#include <cstdlib>
+#include <iostream>
+
+#include <boost/asio.hpp>
+
+#include <http_server.h>
+#include <http_session.h>
+#include <resource_stats.h>
+
+using boost::asio::ip::tcp;
+
+#if !RESOURCE_STATS
+
+namespace {
+
+thread_local bool counted = false;
+std::atomic<std::size_t> allocations(0);
+
+}
+
+void* operator new(std::size_t size)
+{
+    if (counted) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    void* pointer = std::malloc(size ? size : 1);
+    if (!pointer) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t /*size*/) noexcept
+{
+    std::free(pointer);
+}
+
+// the allocations of the thread that posted `counted`
+std::size_t worker_allocations(boost::asio::io_service& /*io_service*/)
+{
+    return allocations.load();
+}
+
+void count_worker(boost::asio::io_service& io_service)
+{
+    io_service.post([]() {
+        counted = true;
+    });
+}
+
+#else
+
+// A RESOURCE_STATS build replaces operator new in every binary already and
+// counts per thread: the worker reports its own count.
+std::size_t worker_allocations(boost::asio::io_service& io_service)
+{
+    std::promise<std::int64_t> count;
+    io_service.post([&count]() {
+        count.set_value(resource_thread_allocations());
+    });
+    return static_cast<std::size_t>(count.get_future().get());
+}
+
+void count_worker(boost::asio::io_service& /*io_service*/)
+{
+}
+
+#endif
+
+const std::string HEADER = "HTTP/1.1 200 OK\r\nServer: ashttp\r\nContent-Type: text/plain\r\nContent-Length: 3\r\n";
+const std::string BODY = "ok\n";
+
+const std::string KEEP_ALIVE = "GET / HTTP/1.1\r\nHost: localhost\r\nUser-Agent: asio/1.60.0\r\nAccept: */*\r\n\r\n";
+const std::string CLOSE = "GET / HTTP/1.1\r\nHost: localhost\r\nUser-Agent: asio/1.60.0\r\nConnection: close\r\n\r\n";
+
+void exchange(tcp::socket& socket, const std::string& request, boost::asio::streambuf& response)
+{
+    boost::asio::write(socket, boost::asio::buffer(request));
+    const std::size_t head = boost::asio::read_until(socket, response, "\r\n\r\n");
+    if (response.size() < head + BODY.size()) {
+        boost::asio::read(socket, response, boost::asio::transfer_exactly(head + BODY.size() - response.size()));
+    }
+    response.consume(head + BODY.size());
+}
+
+void keep_alive_requests(const tcp::endpoint& endpoint, std::size_t count)
+{
+    boost::asio::io_service io_service;
+    tcp::socket socket(io_service);
+    socket.connect(endpoint);
+    boost::asio::streambuf response;
+    for (std::size_t i = 0; i < count; i++) {
+        exchange(socket, KEEP_ALIVE, response);
+    }
+}
+
+void connections(const tcp::endpoint& endpoint, std::size_t count)
+{
+    boost::asio::io_service io_service;
+    boost::asio::streambuf response;
+    for (std::size_t i = 0; i < count; i++) {
+        tcp::socket socket(io_service);
+        socket.connect(endpoint);
+        exchange(socket, CLOSE, response);
+
+        // wait for the server to shut its side down
+        boost::system::error_code ec;
+        char byte;
+        socket.read_some(boost::asio::buffer(&byte, 1), ec);
+    }
+}
+
+template<class Run>
+double per_operation(boost::asio::io_service& worker, const tcp::endpoint& endpoint,
+                     std::size_t warmup, std::size_t count, Run run)
+{
+    run(endpoint, warmup);
+    const std::size_t before = worker_allocations(worker);
+    run(endpoint, count);
+    const std::size_t after = worker_allocations(worker);
+    return static_cast<double>(after - before) / count;
+}
+
+void measure(std::size_t session_pool, std::size_t requests)
+{
+    server_config config;
+    config.endpoint = stream_endpoint(tcp::endpoint(tcp::v4(), 0));
+    config.threads = 1;
+    config.session_pool = session_pool;
+
+    http_router router;
+    router.add("GET", "/", [](const http_session_ptr& session) {
+        session->reply(HEADER, boost::asio::buffer(BODY));
+    });
+
+    io_service_pool pool(config.threads, io_model::shared);
+    http_server server(pool, config, router);
+    const tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), to_tcp(server.local_endpoint()).port());
+
+    boost::asio::io_service& worker = pool.next();
+    count_worker(worker);
+    pool.start();
+
+    const double per_request = per_operation(worker, endpoint, requests / 10, requests, keep_alive_requests);
+    const double per_connection = per_operation(worker, endpoint, requests / 100, requests / 10, connections);
+
+    std::cout << "<- session-pool: " << session_pool
+              << " allocations per request: " << per_request
+              << " per connection: " << per_connection
+              << " sessions created: " << server.sessions().created()
+              << " reused: " << server.sessions().reused()
+              << std::endl;
+
+    pool.stop();
+    pool.join();
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        const std::size_t requests = argc > 1 ? std::stoul(argv[1]) : 20000;
+
+        measure(0, requests);
+        measure(1024, requests);
+
+        return 0;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "<- main exception: " << e.what() << "\n";
+    }
+
+    return 1;
+}
@@ -15,9 +15,12 @@
 #include <atomic>
 #include <thread>
 #include <memory>
+#include <fstream>
 #include <sstream>
 #include <iostream>
 
+#include <unistd.h>
+
 #include <boost/asio.hpp>
 #include <boost/asio/spawn.hpp>
 #include <boost/asio/write.hpp>
@@ -26,20 +29,37 @@
 #include <boost/asio/signal_set.hpp>
 #include <boost/asio/steady_timer.hpp>
 
+#include <boost/program_options.hpp>
+
+#include <http_chunked.h>
 #include <http_request.h>
 #include <http_response.h>
 
-using boost::asio::ip::tcp;
+#include <http_server.h>
+#include <io_service_pool.h>
+
+#include <log.h>
+#include <request_trace.h>
+#include <resource_stats.h>
+#include <sharded_counter.h>
+#include <stream_endpoint.h>
+
+namespace po = boost::program_options;
 
 namespace {
     const std::size_t TIMEOUT = 1000;
-
-    const std::string SERVER_HOST = "nginx.org";
-    const std::string SERVER_PATH = "/";
-    const std::string SERVER_ADDR = "95.211.80.227";
-    const std::size_t SERVER_PORT = 80;
+    const std::size_t MAX_CHUNK = 64 << 20;
 }
 
+// where the proxied requests go; --upstream and friends
+struct upstream_config
+{
+    std::string host = "nginx.org";
+    std::string path = "/";
+    stream_endpoint endpoint = parse_stream_endpoint("95.211.80.227:80");  // TCP or a UNIX socket
+    int port = 80;                                                          // of the Host header
+};
+
 class timeout_exception : public std::exception
 {
 public:
@@ -77,8 +97,8 @@ void check_error_and_timeout(T1 error, T2& timeout)
 ///////////////////////////////////////////////////////////////////////////////
 
 namespace {
-    std::atomic<size_t> client_counter(0);
-    std::atomic<size_t> client_sequence(0);
+    sharded_counter client_counter;
+    sharded_counter client_sequence;
 }
 
 class client : public std::enable_shared_from_this<client>
@@ -90,93 +110,104 @@ public:
         timer_counter_(0),
         timeout_(false)
     {
-        client_counter++;
-        sequence_ = client_sequence++;
-        std::clog << "<- " << sequence_ << " client" << std::endl;
+        client_counter.add();
+        sequence_ = client_sequence.next_id();
+        LOG_DEBUG("<- {} client", sequence_);
     }
 
     ~client()
     {
-        client_counter--;
-        std::clog << "<- " << sequence_ << " ~client" << std::endl;
+        client_counter.sub();
+        LOG_DEBUG("<- {} ~client", sequence_);
     }
 
     bool go(const std::string& hostname, const std::string& path,
-            const std::string& server, int port,
+            const stream_endpoint& server, int port,
             boost::asio::io_service::strand& strand,
-            boost::asio::yield_context& yield)
+            boost::asio::yield_context& yield,
+            request_trace& trace)
     {
-        std::clog << "<- " << sequence_ << " go client" << std::endl;
+        LOG_DEBUG("<- {} go client", sequence_);
 
         bool error = false;
         http_response response;
+        // left over from a request that failed half way
+        response_.consume(response_.size());
 
         try {
             boost::system::error_code err;
 
-            std::clog << "<- " << sequence_ << " schedule timer" << std::endl;
+            LOG_DEBUG("<- {} schedule timer", sequence_);
             timer_.expires_from_now(std::chrono::milliseconds(TIMEOUT));
             schedule_timer(strand);
 
             if(!socket_.is_open()) {
-                std::clog << "<- " << sequence_ << " schedule async_connect" << std::endl;
-                boost::asio::ip::tcp::endpoint endpoint( boost::asio::ip::address::from_string(server), port );
-                socket_.async_connect(endpoint, yield[err]);
+                LOG_DEBUG("<- {} schedule async_connect", sequence_);
+                socket_.async_connect(server, yield[err]);
                 check_error_and_timeout(err, timeout_);
 
-                tcp::socket::reuse_address ra(true);
-                tcp::socket::keep_alive ka(true);
+                stream_socket::reuse_address ra(true);
+                stream_socket::keep_alive ka(true);
 
                 socket_.set_option(ra);
                 socket_.set_option(ka);
+                trace.mark(trace_phase::upstream_connect);
             }
 
             build_request(hostname, path, port);
 
-            std::clog << "<- " << sequence_ << " schedule async_write" << std::endl;
+            LOG_DEBUG("<- {} schedule async_write", sequence_);
             boost::asio::async_write(socket_, request_, yield[err]);
             check_error_and_timeout(err, timeout_);
 
-            std::clog << "<- " << sequence_ << " schedule async_read_until head" << std::endl;
+            LOG_DEBUG("<- {} schedule async_read_until head", sequence_);
             boost::asio::async_read_until(socket_, response_, "\r\n\r\n", yield[err]);
             check_error_and_timeout(err, timeout_);
+            trace.mark(trace_phase::upstream_first_byte);
 
             std::string str_buff = buffer_to_string(response_);
             const size_t body_size = response.parse(str_buff);
             dump_response(response);
 
             const std::string str_content_length = response.get_header("Content-Length", "");
-            const size_t content_length = std::stoi(str_content_length);
-            if(!str_content_length.empty() && content_length - body_size) {
-                std::clog << "<- " << sequence_ << " schedule async_read body" << std::endl;
-                boost::asio::async_read(socket_, response_,
-                    boost::asio::transfer_at_least(content_length - body_size),
-                    yield[err]);
-                check_error_and_timeout(err, timeout_);
+            if(response.get_header("Transfer-Encoding", "").find("chunked") != std::string::npos) {
+                read_chunked(str_buff.size() - body_size, yield);
+                trace.mark(trace_phase::body_transfer);
+            }
+            else if(!str_content_length.empty()) {
+                const size_t content_length = std::stoul(str_content_length);
+                if(content_length > body_size) {
+                    LOG_DEBUG("<- {} schedule async_read body", sequence_);
+                    boost::asio::async_read(socket_, response_,
+                        boost::asio::transfer_at_least(content_length - body_size),
+                        yield[err]);
+                    check_error_and_timeout(err, timeout_);
+                    trace.mark(trace_phase::body_transfer);
+                }
             }
         }
         catch (const timeout_exception& e) {
             error = true;
-            std::clog << "<- " << sequence_ << " timeout error: " << e.what() << std::endl;
+            LOG_WARNING("<- {} timeout error: {}", sequence_, e.what());
         }
         catch (const std::exception& e) {
             error = true;
             socket_.close();
-            std::clog << "<- " << sequence_ << " catch error: " << e.what() << std::endl;
+            LOG_WARNING("<- {} catch error: {}", sequence_, e.what());
         }
         catch (...) {
             error = true;
             socket_.close();
-            std::clog << "<- " << sequence_ << " unknown error" << std::endl;
+            LOG_WARNING("<- {} unknown error", sequence_);
         }
-        std::clog << "<- " << sequence_ << " cancle timer" << std::endl;
+        LOG_DEBUG("<- {} cancle timer", sequence_);
 
         timer_.cancel();
         if(error || (response.get_header("Connection", "") != "keep-alive")) {
-            std::clog << "<- !!!!! " << sequence_ << " close keep-alive" << std::endl;
+            LOG_DEBUG("<- !!!!! {} close keep-alive", sequence_);
             socket_.close();
         }
-        std::clog << "<- " << sequence_ << " done" << std::endl;
+        LOG_DEBUG("<- {} done", sequence_);
 
         return error;
     }
@@ -202,6 +233,32 @@ private:
         request_stream << "\r\n";
     }
 
+    // Reads until the last chunk, starting `offset` bytes into the response.
+    // The chunks are forwarded as they came, decoding only finds the end.
+    void read_chunked(std::size_t offset, boost::asio::yield_context& yield)
+    {
+        http_chunked_decoder decoder(MAX_CHUNK);
+        std::string chunk;
+        for(;;) {
+            const char* data = boost::asio::buffer_cast<const char*>(response_.data());
+            std::size_t consumed = 0;
+            const auto result = decoder.decode(data + offset, response_.size() - offset, consumed, chunk);
+            offset += consumed;
+            if(result == http_chunked_decoder::result::done) {
+                return;
+            }
+            if(result != http_chunked_decoder::result::more) {
+                throw std::runtime_error("bad chunked body");
+            }
+            chunk.clear();
+
+            LOG_DEBUG("<- {} schedule async_read chunk", sequence_);
+            boost::system::error_code err;
+            boost::asio::async_read(socket_, response_, boost::asio::transfer_at_least(1), yield[err]);
+            check_error_and_timeout(err, timeout_);
+        }
+    }
+
     void schedule_timer(boost::asio::io_service::strand& strand)
     {
         timeout_ = false;
@@ -214,7 +271,7 @@ private:
             while (!done) {
                 boost::system::error_code ec;
                 timer_.async_wait(yield[ec]);
-                std::clog << "<- " << sequence_ << " timer gotcha: " << value << " err: " << ec << std::endl;
+                LOG_DEBUG("<- {} timer gotcha: {} err: {}", sequence_, value, ec.value());
                 if(boost::asio::error::operation_aborted == ec) {
                     done = true;
                 }
@@ -222,7 +279,7 @@ private:
                     if (timer_.expires_from_now() <= std::chrono::seconds(0)) {
                         self->timeout_ = true;
                         done = true;
-                        std::clog << "<- " << sequence_ << " timer timeout: " << value << std::endl;
+                        LOG_DEBUG("<- {} timer timeout: {}", sequence_, value);
                     }
                 }
             }
@@ -231,16 +288,10 @@ private:
 
     void dump_response(http_response& response)
     {
-        std::clog << ">"
-                  << " " << response.get_version()
-                  << " " << response.get_code()
-                  << " " << response.get_message()
-                  << "\n";
-
+        LOG_TRACE("> {} {} {}", response.get_version(), response.get_code(), response.get_message());
         for(auto it = response.begin(); it != response.end(); ++it) {
-            std::clog << "> " << it->first << ": " << it->second << "\n";
+            LOG_TRACE("> {}: {}", it->first, it->second);
         }
-        std::clog << ">" << std::endl;
     }
 
     std::string buffer_to_string(const boost::asio::streambuf& buffer)
@@ -254,7 +305,7 @@ private:
 private:
     size_t sequence_;
 
-    tcp::socket socket_;
+    stream_socket socket_;
     boost::asio::steady_timer timer_;
 
     boost::asio::streambuf request_;
@@ -271,11 +322,17 @@ private:
 class client_pool
 {
 public:
-    client_pool(boost::asio::io_service& io_service) :
-        io_service_(io_service)
+    client_pool(boost::asio::io_service& io_service, const upstream_config& upstream) :
+        io_service_(io_service),
+        upstream_(upstream)
     {
     }
 
+    const upstream_config& upstream() const
+    {
+        return upstream_;
+    }
+
     std::shared_ptr<client> get_client()
     {
         {
@@ -298,6 +355,7 @@ public:
 
 private:
     boost::asio::io_service& io_service_;
+    const upstream_config& upstream_;
 
     std::mutex mutex_;
     std::list<std::shared_ptr<client>> clients_;
@@ -308,108 +366,139 @@ private:
 ///////////////////////////////////////////////////////////////////////////////
 
 namespace {
-    std::atomic<size_t> session_counter(0);
-    std::atomic<size_t> session_sequence(0);
+    sharded_counter session_counter;
+    sharded_counter session_sequence;
+    sharded_counter request_counter;
 
     const size_t MAX_SESSIONS = 10000;
+    // how far behind the session count the MAX_SESSIONS check may be
+    const std::chrono::milliseconds SESSIONS_INTERVAL(10);
 }
 
 class session : public std::enable_shared_from_this<session>
 {
 public:
-    explicit session(tcp::socket socket, client_pool& pool) :
+    explicit session(stream_socket socket, client_pool& pool) :
         socket_(std::move(socket)),
         strand_(socket_.get_io_service()),
         pool_(pool)
     {
-        boost::asio::ip::tcp::socket::reuse_address ra(true);
-        boost::asio::ip::tcp::socket::keep_alive ka(true);
+        stream_socket::reuse_address ra(true);
+        stream_socket::keep_alive ka(true);
         socket_.set_option(ra);
         socket_.set_option(ka);
 
-        counter_ = session_counter++;
-        sequence_ = session_sequence++;
-        std::clog << "-> " << sequence_ << " session " << std::endl;
+        // a single load; summing the workers' cells is left to the publisher
+        counter_ = static_cast<size_t>(session_counter.published());
+        session_counter.add();
+        sequence_ = session_sequence.next_id();
+        accepted_ = trace_now();
+        LOG_DEBUG("-> {} session", sequence_);
     }
 
     ~session()
     {
         socket_.close();
-        std::clog << "-> " << sequence_ << " ~session" << sequence_ << std::endl;
-        session_counter--;
+        LOG_DEBUG("-> {} ~session", sequence_);
+        session_counter.sub();
     }
 
     void go()
     {
-        std::clog << "-> " << sequence_ << " go session" << std::endl;
+        LOG_DEBUG("-> {} go session", sequence_);
 
         if(counter_ > MAX_SESSIONS) {
-            std::cerr << "-> " << sequence_ << " FORCE CLOSE" << std::endl;
+            LOG_WARNING("-> {} FORCE CLOSE", sequence_);
             socket_.close();
             return;
         }
 
         auto self(shared_from_this());
         boost::asio::spawn(strand_, [this, self](boost::asio::yield_context yield) {
+            request_trace trace;
+            bool head_read = false;
             try {
                 bool close = false;
                 for(size_t i = 1; !close; i++) {
                     boost::system::error_code err;
+                    head_read = false;
 
-                    std::clog << "-> " << sequence_ << " schedule read: " << i << std::endl;
+                    if(i == 1) {
+                        // the first request also carries the wait for the coroutine;
+                        // a new connection sends its head right after the accept
+                        trace.begin(sequence_, accepted_);
+                        trace.mark(trace_phase::accept);
+                    }
+                    else {
+                        // a keep-alive connection idles until the next head arrives
+                        socket_.async_wait(stream_socket::wait_read, yield[err]);
+                        check_error(err);
+                        trace.begin(sequence_);
+                    }
+
+                    LOG_DEBUG("-> {} schedule read: {}", sequence_, i);
 
                     boost::asio::async_read_until(socket_, request_, "\r\n\r\n", yield[err]);
                     check_error(err);
+                    trace.mark(trace_phase::head_read);
+                    head_read = true;
 
                     http_request request;
                     request.parse(request_);
-/*
-                    std::clog << "@request method:  '" << request.get_method() << "'" << std::endl;
-                    std::clog << "@request url:     '" << request.get_url() << "'" << std::endl;
-                    std::clog << "@request version: '" << request.get_version() << "'" << std::endl;
-                    std::clog << "@request headers:  " << std::endl;
+                    LOG_TRACE("@request method:  '{}'", request.get_method());
+                    LOG_TRACE("@request url:     '{}'", request.get_url());
+                    LOG_TRACE("@request version: '{}'", request.get_version());
                     for(auto it = request.begin(); it != request.end(); ++it) {
-                        std::clog << "'" << it->first << "': '" << it->second << "'" << std::endl;
+                        LOG_TRACE("@request header:  '{}': '{}'", it->first, it->second);
                     }
-*/
-                    std::clog << "-> " << sequence_ << " read: " << request_.size() << " in: " << std::this_thread::get_id() << std::endl;
+                    LOG_DEBUG("-> {} read: {} in: {}", sequence_, request_.size(), std::this_thread::get_id());
                     request_.consume(request_.size());
 
                     auto c = pool_.get_client();
-                    bool error = c->go(SERVER_HOST, SERVER_PATH, SERVER_ADDR, SERVER_PORT, strand_, yield);
+                    trace.mark(trace_phase::pool_acquire);
+                    const upstream_config& upstream = pool_.upstream();
+                    bool error = c->go(upstream.host, upstream.path, upstream.endpoint, upstream.port, strand_, yield, trace);
                     pool_.return_client(c);
 
                     if(error) {
                         build_response();
-                        std::clog << "-> " << sequence_ << " schedule write" << std::endl;
+                        LOG_DEBUG("-> {} schedule write", sequence_);
                         auto& buff = response_;
                         const size_t size = buff.size();
                         boost::asio::async_write(socket_, buff, yield[err]);
                         check_error(err);
-                        std::clog << "-> " << sequence_ << " write: " << size << " in: " << std::this_thread::get_id() << std::endl;
+                        LOG_DEBUG("-> {} write: {} in: {}", sequence_, size, std::this_thread::get_id());
                     }
                     else {
-                        std::clog << "-> " << sequence_ << " schedule write" << std::endl;
+                        LOG_DEBUG("-> {} schedule write", sequence_);
                         auto& buff = c->get_response();
                         const size_t size = buff.size();
                         boost::asio::async_write(socket_, buff, yield[err]);
                         check_error(err);
-                        std::clog << "-> " << sequence_ << " write: " << size << " in: " << std::this_thread::get_id() << std::endl;
+                        LOG_DEBUG("-> {} write: {} in: {}", sequence_, size, std::this_thread::get_id());
                     }
+                    trace.mark(trace_phase::downstream_write);
+                    trace.finish();
+                    request_counter.add();
+
                     if(request.get_header("Connection", "") != "keep-alive") {
-                        std::clog << "-> " << sequence_ << " close keep-alive" << std::endl;
+                        LOG_DEBUG("-> {} close keep-alive", sequence_);
                         close = true;
                     }
                 }
             }
             catch (const std::exception& e) {
-                std::clog << "-> " << sequence_ << " catch error: " << e.what() << std::endl;
+                LOG_WARNING("-> {} catch error: {}", sequence_, e.what());
             }
             catch (...) {
-                std::clog << "-> " << sequence_ << " unknown error" << std::endl;
+                LOG_WARNING("-> {} unknown error", sequence_);
+            }
+            // a connection closed between requests leaves nothing to report
+            if(head_read) {
+                trace.finish();
             }
 
-            std::clog << "-> " << sequence_ << " done" << std::endl;
+            LOG_DEBUG("-> {} done", sequence_);
         });
     }
 
@@ -418,14 +507,16 @@ private:
     {
         std::ostream stream(&response_);
         stream << "HTTP/1.1 500 Internal Server Error\r\n";
+        stream << "Content-Length: 0\r\n";
         stream << "\r\n";
     }
 
 private:
     size_t counter_;
     size_t sequence_;
+    std::uint64_t accepted_;
 
-    tcp::socket socket_;
+    stream_socket socket_;
     boost::asio::io_service::strand strand_;
     client_pool& pool_;
 
@@ -437,14 +528,52 @@ int main(int argc, char* argv[])
 {
     try
     {
-        if (argc != 2) {
-            std::cerr << "Usage: " << argv[0] << " <port>\n";
+        po::options_description description("Usage: asio_spawn_proxy_http_server <port> [options]");
+        po::positional_options_description positional;
+        description.add_options()
+            ("help,h", "print this message")
+            ("log-level", po::value<std::string>()->default_value("warning"), "trace, debug, info, warning, error or off; "
+                                                                              "levels under LOG_MIN_LEVEL are not compiled in")
+            ("log-async", "format and write log records on a background thread")
+            ("trace-rate", po::value<double>()->default_value(0), "fraction of requests to trace phase by phase, 0 disables")
+            ("trace-chrome", po::value<std::string>(), "write the sampled requests to this file as Chrome trace-event JSON")
+            ("upstream", po::value<std::string>()->default_value("95.211.80.227:80"), "upstream address:port, unix:/path or unix:@abstract-name")
+            ("upstream-host", po::value<std::string>()->default_value("nginx.org"), "Host header of the upstream requests")
+            ("upstream-path", po::value<std::string>()->default_value("/"), "path of the upstream requests");
+        add_server_options(description, positional);
+
+        po::variables_map options;
+        po::store(po::command_line_parser(argc, argv).options(description).positional(positional).run(), options);
+        po::notify(options);
+
+        if (options.count("help") || !options.count("port")) {
+            std::cerr << description << "\n";
             return 1;
         }
-        std::cerr << "#> starting: " << argv[0] << ":" << argv[1] << std::endl;
-        std::clog.setstate(std::ios_base::failbit);
 
-        boost::asio::io_service io_service;
+        const server_config config = make_server_config(options);
+
+        upstream_config upstream;
+        std::string address = options["upstream"].as<std::string>();
+        if (address.compare(0, 5, "unix:") != 0 && address.find(':') == std::string::npos) {
+            address += ":80";
+        }
+        upstream.endpoint = parse_stream_endpoint(address);
+        upstream.port = is_unix(upstream.endpoint) ? 80 : to_tcp(upstream.endpoint).port();
+        upstream.host = options["upstream-host"].as<std::string>();
+        upstream.path = options["upstream-path"].as<std::string>();
+
+        log_start(options.count("log-async") ? log_mode::async : log_mode::sync,
+                  parse_log_level(options["log-level"].as<std::string>()));
+        const double trace_rate = options["trace-rate"].as<double>();
+        trace_start(trace_rate);
+
+        std::cerr << "#> starting: " << argv[0] << " " << to_string(config.endpoint) << std::endl;
+
+        // upstream clients and their strands are shared between sessions,
+        // so the proxy always runs a single io_service
+        io_service_pool workers(config.worker_threads(), io_model::shared, config.worker_cpus());
+        boost::asio::io_service& io_service = workers.next();
         boost::asio::io_service::strand io_strand(io_service);
 
         bool done = false;
@@ -452,52 +581,79 @@ int main(int argc, char* argv[])
         signals.async_wait([&](const boost::system::error_code&, const int&){
             std::cerr << "#> catch signal" << std::endl;
             done = true;
-            io_service.stop();
+            workers.stop();
         });
 
-        client_pool pool(io_service);
+        client_pool pool(io_service, upstream);
+        counter_publisher publisher(SESSIONS_INTERVAL, { &session_counter });
 
         boost::asio::spawn(io_strand, [&](boost::asio::yield_context yield) {
-            tcp::acceptor acceptor(io_service, tcp::endpoint(tcp::v4(), std::atoi(argv[1])));
+            stream_acceptor acceptor(io_service);
+            open_acceptor(acceptor, config);
 
+            boost::asio::steady_timer backoff(io_service);
             for (;;) {
                 boost::system::error_code ec;
-                tcp::socket socket(io_service);
-                acceptor.async_accept(socket, yield[ec]);
-                if (!ec) std::make_shared<session>(std::move(socket), pool)->go();
+                if (config.accept_batch) {
+                    // drain the backlog once the listening socket is readable
+                    acceptor.async_wait(stream_acceptor::wait_read, yield[ec]);
+                    if (ec == boost::asio::error::operation_aborted) break;
+                    // a failed wait fails again at once, as does accept out of descriptors
+                    bool exhausted = static_cast<bool>(ec);
+                    for (std::size_t i = 0; !ec && i < config.accept_batch; i++) {
+                        const int fd = accept_native(acceptor, ec);
+                        if (fd < 0) { exhausted = accept_exhausted(ec); break; }
+                        stream_socket socket(io_service);
+                        socket.assign(config.endpoint.protocol(), fd, ec);
+                        if (ec) { ::close(fd); break; }
+                        std::make_shared<session>(std::move(socket), pool)->go();
+                    }
+                    if (!exhausted) continue;
+                }
+                else {
+                    stream_socket socket(io_service);
+                    acceptor.async_accept(socket, yield[ec]);
+                    if (ec == boost::asio::error::operation_aborted) break;
+                    if (!ec) std::make_shared<session>(std::move(socket), pool)->go();
+                    if (!accept_exhausted(ec)) continue;
+                }
+                // the backlog stays readable until descriptors are freed
+                backoff.expires_from_now(accept_backoff);
+                backoff.async_wait(yield[ec]);
             }
         });
 
-        std::vector<std::thread> threads;
-        size_t hardware_concurrency = std::thread::hardware_concurrency();
-        for(size_t i = 0; i < hardware_concurrency; i++) {
-            threads.push_back(std::thread([&io_service](){
-                try {
-                    io_service.run();
-                }
-                catch(const std::exception& e) {
-                    std::cerr << "#> worker exception: " << e.what() << std::endl;
-                }
-                catch(...) {
-                    std::cerr << "#> worker unknown error" << std::endl;
-                }
-            }));
+        workers.start();
+
+        std::unique_ptr<stats_reporter> stats;
+        if (config.stats > 0) {
+            stats.reset(new stats_reporter(std::chrono::seconds(config.stats), []() {
+                return request_counter.value();
+            }, std::clog));
         }
 
         while(!done) {
             std::this_thread::sleep_for(std::chrono::seconds(1));
 
             std::cout << "#>"
-                      << " session_counter: " << session_counter
-                      << " session_sequence: " << session_sequence
-                      << " client_counter: " << client_counter
-                      << " client_sequence: " << client_sequence
+                      << " session_counter: " << session_counter.value()
+                      << " session_sequence: " << session_sequence.value()
+                      << " client_counter: " << client_counter.value()
+                      << " client_sequence: " << client_sequence.value()
                       << std::endl;
 
         }
 
-        for(size_t i = 0; i < threads.size(); i++) {
-            threads[i].join();
+        workers.join();
+        stats.reset();
+        log_stop();
+
+        if (trace_rate > 0) {
+            trace_write_histograms(std::cout);
+            if (options.count("trace-chrome")) {
+                std::ofstream chrome(options["trace-chrome"].as<std::string>());
+                trace_write_chrome(chrome);
+            }
         }
     }
     catch (const std::exception& e)
@@ -0,0 +1,74 @@
+#include "speed_cycles.h"
+
+#include <string>
+#include <cstring>
+#include <fstream>
+
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/perf_event.h>
+
+namespace {
+
+double cpuinfo_hz()
+{
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        if (line.compare(0, 7, "cpu MHz") == 0) {
+            const std::size_t colon = line.find(':');
+            if (colon != std::string::npos) {
+                return std::stod(line.substr(colon + 1)) * 1e6;
+            }
+        }
+    }
+    return 1e9;
+}
+
+double cpu_seconds()
+{
+    rusage usage;
+    if (::getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+} // namespace
+
+cycle_counter::cycle_counter() :
+    fd_(-1),
+    hz_(0)
+{
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    fd_ = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    if (fd_ < 0) {
+        hz_ = cpuinfo_hz();
+    }
+}
+
+cycle_counter::~cycle_counter()
+{
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+std::uint64_t cycle_counter::read() const
+{
+    if (fd_ < 0) {
+        return static_cast<std::uint64_t>(cpu_seconds() * hz_);
+    }
+    std::uint64_t cycles = 0;
+    if (::read(fd_, &cycles, sizeof(cycles)) != sizeof(cycles)) {
+        return 0;
+    }
+    return cycles;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+
+// CPU cycles of the calling thread, user and kernel, for throughput per
+// cycle. Counted by perf_event_open(2) when the kernel lets us; otherwise
+// estimated from the process CPU time (getrusage) at the clock rate of
+// /proc/cpuinfo, which turbo and frequency scaling make approximate.
+class cycle_counter
+{
+public:
+    cycle_counter();
+    ~cycle_counter();
+
+    cycle_counter(const cycle_counter&) = delete;
+    cycle_counter& operator=(const cycle_counter&) = delete;
+
+    std::uint64_t read() const;
+
+    bool estimated() const { return fd_ < 0; }
+
+private:
+    int fd_;
+    double hz_;
+};
@@ -0,0 +1,383 @@
+#include "speed_protocol.h"
+
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include <zlib.h>
+
+namespace {
+
+void put16(unsigned char* out, std::uint16_t value)
+{
+    out[0] = static_cast<unsigned char>(value);
+    out[1] = static_cast<unsigned char>(value >> 8);
+}
+
+void put32(unsigned char* out, std::uint32_t value)
+{
+    for (int i = 0; i < 4; i++) {
+        out[i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+}
+
+void put64(unsigned char* out, std::uint64_t value)
+{
+    for (int i = 0; i < 8; i++) {
+        out[i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+}
+
+std::uint16_t get16(const unsigned char* in)
+{
+    return static_cast<std::uint16_t>(in[0] | in[1] << 8);
+}
+
+std::uint32_t get32(const unsigned char* in)
+{
+    std::uint32_t value = 0;
+    for (int i = 3; i >= 0; i--) {
+        value = value << 8 | in[i];
+    }
+    return value;
+}
+
+std::uint64_t get64(const unsigned char* in)
+{
+    std::uint64_t value = 0;
+    for (int i = 7; i >= 0; i--) {
+        value = value << 8 | in[i];
+    }
+    return value;
+}
+
+// the bytes of a block without checksums, and the middle of one with them
+char pattern_byte(std::size_t i)
+{
+    return static_cast<char>((i * 31 + (i >> 8)) & 0xff);
+}
+
+std::uint32_t block_crc(const char* block, std::size_t length)
+{
+    return static_cast<std::uint32_t>(::crc32(0, reinterpret_cast<const Bytef*>(block), static_cast<uInt>(length - 4)));
+}
+
+} // namespace
+
+void speed_encode(const speed_hello& hello, unsigned char* out)
+{
+    std::memset(out, 0, speed_hello_size);
+    put32(out, speed_magic);
+    put16(out + 4, speed_version);
+    out[6] = static_cast<unsigned char>(hello.direction);
+    out[7] = hello.flags;
+    put32(out + 8, hello.block_size);
+    put32(out + 12, hello.streams);
+    put32(out + 16, hello.stream);
+    put64(out + 20, hello.test_id);
+    put64(out + 28, hello.total_bytes);
+    put32(out + 36, hello.duration_ms);
+    out[40] = static_cast<unsigned char>(hello.engine);
+    put16(out + 42, hello.gather);
+}
+
+void speed_encode(const speed_reply& reply, unsigned char* out)
+{
+    std::memset(out, 0, speed_reply_size);
+    put32(out, speed_magic);
+    put16(out + 4, speed_version);
+    put16(out + 6, static_cast<std::uint16_t>(reply.status));
+    put32(out + 12, reply.block_size);
+}
+
+void speed_encode(const speed_summary& summary, unsigned char* out)
+{
+    std::memset(out, 0, speed_summary_size);
+    put32(out, speed_magic);
+    put16(out + 4, speed_version);
+    put64(out + 8, summary.datagrams);
+    put64(out + 16, summary.bytes);
+}
+
+speed_status speed_decode(const unsigned char* in, speed_hello& hello)
+{
+    if (get32(in) != speed_magic) {
+        return speed_status::bad_magic;
+    }
+    if (get16(in + 4) != speed_version) {
+        return speed_status::bad_version;
+    }
+    if (in[6] > static_cast<unsigned char>(speed_direction::pingpong)) {
+        return speed_status::bad_direction;
+    }
+    hello.direction = static_cast<speed_direction>(in[6]);
+    hello.flags = in[7];
+    hello.block_size = get32(in + 8);
+    hello.streams = get32(in + 12);
+    hello.stream = get32(in + 16);
+    hello.test_id = get64(in + 20);
+    hello.total_bytes = get64(in + 28);
+    hello.duration_ms = get32(in + 36);
+    hello.gather = std::max<std::uint16_t>(get16(in + 42), 1);
+
+    if (in[40] > static_cast<unsigned char>(speed_engine::zerocopy)) {
+        return speed_status::bad_engine;
+    }
+    hello.engine = static_cast<speed_engine>(in[40]);
+    const bool stamps = hello.engine == speed_engine::write || hello.engine == speed_engine::gather;
+    if ((hello.flags & speed_flag_checksum) && !stamps) {
+        return speed_status::bad_engine;
+    }
+
+    const std::uint32_t min_block = (hello.flags & speed_flag_checksum) ? speed_min_checksum_block : speed_min_block;
+    if (hello.block_size < min_block || hello.block_size > speed_max_block) {
+        return speed_status::bad_block_size;
+    }
+    if (!hello.total_bytes && !hello.duration_ms) {
+        return speed_status::bad_limit;
+    }
+    if ((hello.flags & speed_flag_udp) &&
+        (hello.direction != speed_direction::upload || (hello.flags & speed_flag_checksum) ||
+         hello.block_size < speed_datagram_header)) {
+        return speed_status::bad_transport;
+    }
+    return speed_status::ok;
+}
+
+speed_status speed_decode(const unsigned char* in, speed_reply& reply)
+{
+    if (get32(in) != speed_magic) {
+        return speed_status::bad_magic;
+    }
+    if (get16(in + 4) != speed_version) {
+        return speed_status::bad_version;
+    }
+    reply.status = static_cast<speed_status>(get16(in + 6));
+    reply.block_size = get32(in + 12);
+    return reply.status;
+}
+
+speed_status speed_decode(const unsigned char* in, speed_summary& summary)
+{
+    if (get32(in) != speed_magic) {
+        return speed_status::bad_magic;
+    }
+    if (get16(in + 4) != speed_version) {
+        return speed_status::bad_version;
+    }
+    summary.datagrams = get64(in + 8);
+    summary.bytes = get64(in + 16);
+    return speed_status::ok;
+}
+
+void speed_encode_datagram(std::uint64_t test_id, std::uint32_t stream, unsigned char* out)
+{
+    std::memset(out, 0, speed_datagram_header);
+    put64(out, test_id);
+    put32(out + 8, stream);
+}
+
+void speed_decode_datagram(const unsigned char* in, std::uint64_t& test_id, std::uint32_t& stream)
+{
+    test_id = get64(in);
+    stream = get32(in + 8);
+}
+
+const char* to_string(speed_direction direction)
+{
+    switch (direction) {
+    case speed_direction::download:
+        return "download";
+    case speed_direction::upload:
+        return "upload";
+    case speed_direction::both:
+        return "both";
+    case speed_direction::pingpong:
+        return "pingpong";
+    }
+    return "unknown";
+}
+
+const char* to_string(speed_status status)
+{
+    switch (status) {
+    case speed_status::ok:
+        return "ok";
+    case speed_status::bad_magic:
+        return "bad magic";
+    case speed_status::bad_version:
+        return "unsupported version";
+    case speed_status::bad_direction:
+        return "bad direction";
+    case speed_status::bad_block_size:
+        return "bad block size";
+    case speed_status::bad_limit:
+        return "no total bytes or duration";
+    case speed_status::bad_engine:
+        return "send engine not supported";
+    case speed_status::bad_transport:
+        return "UDP takes uploads without checksums, on a TCP port";
+    }
+    return "unknown status";
+}
+
+const char* to_string(speed_engine engine)
+{
+    switch (engine) {
+    case speed_engine::write:
+        return "write";
+    case speed_engine::gather:
+        return "gather";
+    case speed_engine::sendfile:
+        return "sendfile";
+    case speed_engine::zerocopy:
+        return "zerocopy";
+    }
+    return "unknown";
+}
+
+speed_direction parse_speed_direction(const std::string& text)
+{
+    if (text == "download") {
+        return speed_direction::download;
+    }
+    if (text == "upload") {
+        return speed_direction::upload;
+    }
+    if (text == "both") {
+        return speed_direction::both;
+    }
+    if (text == "pingpong") {
+        return speed_direction::pingpong;
+    }
+    throw std::runtime_error("unknown direction: " + text);
+}
+
+speed_engine parse_speed_engine(const std::string& text)
+{
+    for (auto engine : { speed_engine::write, speed_engine::gather, speed_engine::sendfile, speed_engine::zerocopy }) {
+        if (text == to_string(engine)) {
+            return engine;
+        }
+    }
+    throw std::runtime_error("unknown engine: " + text);
+}
+
+bool sends(speed_direction direction, bool server)
+{
+    if (direction == speed_direction::pingpong) {
+        return !server;
+    }
+    return direction == speed_direction::both ||
+           direction == (server ? speed_direction::download : speed_direction::upload);
+}
+
+bool receives(speed_direction direction, bool server)
+{
+    if (direction == speed_direction::pingpong) {
+        return true;
+    }
+    return sends(direction, !server);
+}
+
+//==============================================================================
+
+speed_payload::speed_payload(std::uint32_t block_size, bool checksum, std::size_t slots) :
+    block_size_(block_size),
+    slots_(std::max<std::size_t>(slots, 1)),
+    ring_(block_size_ * slots_),
+    checksum_(checksum),
+    sequence_(0)
+{
+    speed_pattern(block_size, ring_.data(), ring_.size());
+}
+
+const char* speed_payload::next()
+{
+    char* block = ring_.data() + (sequence_ % slots_) * block_size_;
+    if (checksum_) {
+        unsigned char* bytes = reinterpret_cast<unsigned char*>(block);
+        put64(bytes, sequence_);
+        put32(bytes + block_size_ - 4, block_crc(block, block_size_));
+    }
+    sequence_++;
+    return block;
+}
+
+void speed_pattern(std::uint32_t block_size, char* out, std::size_t length)
+{
+    for (std::size_t i = 0; i < length; i++) {
+        out[i] = pattern_byte(i % block_size);
+    }
+}
+
+//==============================================================================
+
+speed_verifier::speed_verifier(std::uint32_t block_size, bool checksum) :
+    pattern_(block_size),
+    checksum_(checksum),
+    offset_(0),
+    blocks_(0),
+    bad_blocks_(0)
+{
+    speed_pattern(block_size, pattern_.data(), pattern_.size());
+    if (checksum_) {
+        partial_.reserve(block_size);
+    }
+}
+
+void speed_verifier::feed(const char* data, std::size_t length)
+{
+    const std::size_t block_size = pattern_.size();
+    while (length) {
+        const std::size_t piece = std::min(length, block_size - offset_);
+        if (!checksum_) {
+            // compared in place, a block is bad when any piece of it is
+            if (std::memcmp(data, pattern_.data() + offset_, piece) != 0 && partial_.empty()) {
+                partial_.push_back(1);
+            }
+        }
+        else if (offset_ == 0 && piece == block_size) {
+            check(data, piece);
+        }
+        else {
+            partial_.insert(partial_.end(), data, data + piece);
+        }
+
+        offset_ += piece;
+        data += piece;
+        length -= piece;
+        if (offset_ == block_size) {
+            if (checksum_ && !partial_.empty()) {
+                check(partial_.data(), partial_.size());
+            }
+            else if (!checksum_) {
+                blocks_++;
+                bad_blocks_ += partial_.empty() ? 0 : 1;
+            }
+            partial_.clear();
+            offset_ = 0;
+        }
+    }
+}
+
+void speed_verifier::finish()
+{
+    if (offset_ == 0) {
+        return;
+    }
+    blocks_++;
+    if (checksum_ || !partial_.empty()) {
+        bad_blocks_++;
+    }
+    partial_.clear();
+    offset_ = 0;
+}
+
+void speed_verifier::check(const char* block, std::size_t length)
+{
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(block);
+    const bool good = get64(bytes) == blocks_ && get32(bytes + length - 4) == block_crc(block, length);
+    blocks_++;
+    bad_blocks_ += good ? 0 : 1;
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// The handshake of asio_speed_client and asio_speed_server. Every connection
+// starts with the client's hello, a fixed 48 byte little-endian record with
+// the test it wants; the server answers with a 16 byte reply, status ok or
+// the reason it refuses, and the data flows. Each sender stops after its
+// total bytes or its duration and shuts its side down; the receiver reads to
+// the end of the stream.
+//
+//   hello:  magic "SPD1", version, direction, flags, block size, streams,
+//           stream index, test id, total bytes, duration ms, send engine,
+//           reserved, blocks per gather write, reserved
+//   reply:  magic, version, status, reserved, block size
+//
+// The payload goes in blocks of the negotiated size. With speed_flag_checksum
+// a block starts with its 8 byte sequence number and ends with the CRC32 of
+// everything before it, which the receiver checks; without it a block is the
+// bare pattern and the receiver compares the bytes with the pattern.
+//
+// In pingpong the client keeps up to its depth of messages, one block each,
+// in flight and the server echoes them, for the round trip latency.
+//
+// With speed_flag_udp the connection only negotiates: the client uploads
+// datagrams of the block size to the server's UDP socket on the same port,
+// each starting with the test id and the stream, then shuts the connection
+// down; the server waits for the stragglers and answers with a 24 byte
+// summary of what arrived. A server listening on a UNIX socket has no UDP
+// port and refuses it.
+//
+//   summary: magic, version, reserved, datagrams, bytes
+
+enum { speed_hello_size = 48, speed_reply_size = 16, speed_summary_size = 24 };
+
+const std::uint32_t speed_magic = 0x31445053;    // "SPD1"
+const std::uint16_t speed_version = 1;
+
+const std::uint32_t speed_min_block = 1;
+const std::uint32_t speed_min_checksum_block = 16;     // sequence number and CRC32
+const std::uint32_t speed_max_block = 16 * 1024 * 1024;
+
+enum class speed_direction : std::uint8_t
+{
+    download = 0,       // server to client
+    upload = 1,         // client to server
+    both = 2,
+    pingpong = 3        // client to server and echoed back
+};
+
+// How the server sends. Its checksums are stamped into the blocks as they
+// go, which only write and gather do.
+enum class speed_engine : std::uint8_t
+{
+    write = 0,          // one block per async_write
+    gather = 1,         // a writev of several blocks
+    sendfile = 2,       // from a payload file on tmpfs
+    zerocopy = 3        // MSG_ZEROCOPY gather sends, completions reaped from the error queue
+};
+
+enum speed_flags : std::uint8_t
+{
+    speed_flag_checksum = 1 << 0,
+    speed_flag_busy_poll = 1 << 1,      // SO_BUSY_POLL on the server's socket
+    speed_flag_udp = 1 << 2
+};
+
+// how long a socket read may spin on the device queue with SO_BUSY_POLL
+const int speed_busy_poll_usec = 50;
+
+// the head of every datagram: test id and stream
+enum { speed_datagram_header = 16 };
+
+enum class speed_status : std::uint16_t
+{
+    ok = 0,
+    bad_magic = 1,
+    bad_version = 2,
+    bad_direction = 3,
+    bad_block_size = 4,
+    bad_limit = 5,      // neither total bytes nor duration
+    bad_engine = 6,     // unknown, not with checksums, or not in this kernel
+    bad_transport = 7   // UDP takes uploads without checksums, on a TCP port
+};
+
+struct speed_hello
+{
+    speed_direction direction = speed_direction::download;
+    std::uint8_t flags = 0;
+    std::uint32_t block_size = 8 * 1024;
+    std::uint32_t streams = 1;
+    std::uint32_t stream = 0;
+    std::uint64_t test_id = 0;
+    std::uint64_t total_bytes = 0;      // per stream and direction, 0: by duration
+    std::uint32_t duration_ms = 0;      // 0: by total bytes
+    speed_engine engine = speed_engine::write;
+    std::uint16_t gather = 16;          // blocks per gather or zerocopy send
+};
+
+struct speed_reply
+{
+    speed_status status = speed_status::ok;
+    std::uint32_t block_size = 0;
+};
+
+struct speed_summary
+{
+    std::uint64_t datagrams = 0;
+    std::uint64_t bytes = 0;
+};
+
+void speed_encode(const speed_hello& hello, unsigned char* out);
+void speed_encode(const speed_reply& reply, unsigned char* out);
+void speed_encode(const speed_summary& summary, unsigned char* out);
+
+// Fails with the status the server should answer; a reply with a bad magic
+// or version comes back as bad_magic or bad_version.
+speed_status speed_decode(const unsigned char* in, speed_hello& hello);
+speed_status speed_decode(const unsigned char* in, speed_reply& reply);
+speed_status speed_decode(const unsigned char* in, speed_summary& summary);
+
+// A datagram's header, and the stream it names.
+void speed_encode_datagram(std::uint64_t test_id, std::uint32_t stream, unsigned char* out);
+void speed_decode_datagram(const unsigned char* in, std::uint64_t& test_id, std::uint32_t& stream);
+
+const char* to_string(speed_direction direction);
+const char* to_string(speed_status status);
+const char* to_string(speed_engine engine);
+
+// "download", "upload", "both" or "pingpong"
+speed_direction parse_speed_direction(const std::string& text);
+
+// "write", "gather", "sendfile" or "zerocopy"
+speed_engine parse_speed_engine(const std::string& text);
+
+// whether that end streams blocks, which the echoing pingpong server does not,
+// and whether it checks what arrives
+bool sends(speed_direction direction, bool server);
+bool receives(speed_direction direction, bool server);
+
+// Blocks to send, from a ring of `slots` pattern blocks built once. With
+// checksums each call stamps the sequence number and the CRC32 into the next
+// slot, so a slot must be sent before the ring comes round to it again.
+class speed_payload
+{
+public:
+    speed_payload(std::uint32_t block_size, bool checksum, std::size_t slots = 1);
+
+    const char* next();
+
+    std::size_t block_size() const { return block_size_; }
+    std::uint64_t blocks() const { return sequence_; }
+
+private:
+    std::size_t block_size_;
+    std::size_t slots_;
+    std::vector<char> ring_;
+    bool checksum_;
+    std::uint64_t sequence_;
+};
+
+// Fills `out` with `length` bytes of the pattern the receivers expect, from
+// the start of a block; payload files are made of it.
+void speed_pattern(std::uint32_t block_size, char* out, std::size_t length);
+
+// Checks what arrives, in pieces of any size, against what speed_payload
+// sends. A trailing partial block is only counted by finish().
+class speed_verifier
+{
+public:
+    speed_verifier(std::uint32_t block_size, bool checksum);
+
+    void feed(const char* data, std::size_t length);
+
+    // the partial block at the end of the stream: fine without checksums,
+    // where the sender may stop mid block, bad with them
+    void finish();
+
+    std::uint64_t blocks() const { return blocks_; }
+    std::uint64_t bad_blocks() const { return bad_blocks_; }
+
+private:
+    void check(const char* block, std::size_t length);
+
+    std::vector<char> pattern_;
+    std::vector<char> partial_;
+    bool checksum_;
+    std::size_t offset_;            // into the current block
+    std::uint64_t blocks_;
+    std::uint64_t bad_blocks_;
+};
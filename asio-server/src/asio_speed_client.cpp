@@ -1,149 +1,1120 @@
+#include <array>
+#include <cstring>
+#include <deque>
+#include <cmath>
 #include <chrono>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <random>
 #include <istream>
 #include <ostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
 #include <iostream>
+#include <algorithm>
+
+#include <sys/time.h>
+#include <sys/resource.h>
+
 #include <boost/asio.hpp>
+#include <boost/program_options.hpp>
+
+#include <netinet/udp.h>
+
+#include <speed_protocol.h>
+#include <stream_endpoint.h>
+#include <latency_histogram.h>
 
 using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
+namespace po = boost::program_options;
+
+// What one connection moved; written by its worker, read by the reporting
+// thread. The latencies are only read once the workers are joined.
+struct connection_stats
+{
+    std::atomic<std::uint64_t> received{0};
+    std::atomic<std::uint64_t> sent{0};
+    std::atomic<std::uint64_t> messages{0};  // pingpong round trips
+    std::atomic<std::uint64_t> bad_blocks{0};
+    std::atomic<bool> connected{false};     // and negotiated
+    std::atomic<std::int64_t> started{0};   // steady clock ns at negotiation
+    std::atomic<bool> failed{false};
+    std::atomic<bool> done{false};
+
+    latency_histogram latency;
+
+    std::uint64_t bytes() const
+    {
+        return received.load(std::memory_order_relaxed) + sent.load(std::memory_order_relaxed);
+    }
+};
+
+// How the client reads what the server sends.
+enum class receive_mode
+{
+    read,       // async_read_some into the --buffer
+    large,      // a buffer of 1 MB or more, woken with a quarter of it there (SO_RCVLOWAT)
+    trunc       // recv(2) with MSG_TRUNC: TCP drops the bytes in the kernel, nothing is copied or checked
+};
 
-template<class T>
-void check_error(T error)
+const char* to_string(receive_mode mode)
 {
-    if(error) {
-        std::stringstream sstream;
-        sstream << error;
-        throw std::runtime_error(sstream.str());
+    switch (mode) {
+    case receive_mode::read:
+        return "read";
+    case receive_mode::large:
+        return "large";
+    case receive_mode::trunc:
+        return "trunc";
     }
+    return "unknown";
+}
+
+receive_mode parse_receive_mode(const std::string& text)
+{
+    for (auto mode : { receive_mode::read, receive_mode::large, receive_mode::trunc }) {
+        if (text == to_string(mode)) {
+            return mode;
+        }
+    }
+    throw std::runtime_error("unknown receive mode: " + text);
 }
 
 class client : public std::enable_shared_from_this<client>
 {
 public:
-    client(boost::asio::io_service& io_service) :
-        socket_(io_service)
+    client(boost::asio::io_service& io_service, connection_stats& stats, const speed_hello& hello,
+           receive_mode mode, std::size_t buffer_size, std::size_t depth) :
+        socket_(io_service),
+        stats_(stats),
+        hello_(hello),
+        mode_(mode),
+        depth_(depth),
+        response_buffer_(buffer_size),
+        sent_(0),
+        pending_(0),
+        pings_(0),
+        echoed_(0),
+        writing_(false),
+        closed_(false)
     {
-        std::clog << "<- client" << std::endl;
     }
 
     ~client()
     {
-        std::chrono::time_point<std::chrono::system_clock> end = std::chrono::system_clock::now();
+        stats_.done = true;
+    }
 
-        size_t elapsed_seconds = std::chrono::duration_cast<std::chrono::seconds>(end - start_time_).count();
+    void go(const stream_endpoint& endpoint)
+    {
+        auto self(shared_from_this());
+        socket_.async_connect(endpoint,
+            [this, self](boost::system::error_code ec) {
+                if (ec) {
+                    std::cerr << "<- connect: " << ec.message() << std::endl;
+                    stats_.failed = true;
+                    return;
+                }
+                do_handshake();
+        });
+    }
 
-        size_t bit_in_sec = accumulator_ / elapsed_seconds * 8;
+private:
+    void do_handshake()
+    {
+        auto self(shared_from_this());
+        speed_encode(hello_, message_.data());
+        boost::asio::async_write(socket_, boost::asio::buffer(message_, speed_hello_size),
+            [this, self](boost::system::error_code ec, std::size_t /*length*/) {
+                if (ec) {
+                    std::cerr << "<- handshake: " << ec.message() << std::endl;
+                    stats_.failed = true;
+                    return;
+                }
+                do_reply();
+        });
+    }
+
+    void do_reply()
+    {
+        auto self(shared_from_this());
+        boost::asio::async_read(socket_, boost::asio::buffer(message_, speed_reply_size),
+            [this, self](boost::system::error_code ec, std::size_t /*length*/) {
+                speed_reply reply;
+                if (ec || speed_decode(message_.data(), reply) != speed_status::ok) {
+                    std::cerr << "<- handshake: " << (ec ? ec.message() : to_string(reply.status)) << std::endl;
+                    stats_.failed = true;
+                    return;
+                }
+
+                const bool checksum = (hello_.flags & speed_flag_checksum) != 0;
+                const auto now = std::chrono::steady_clock::now();
+                deadline_ = now + std::chrono::milliseconds(hello_.duration_ms);
+                stats_.started = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+                stats_.connected = true;
+                if (hello_.flags & speed_flag_busy_poll) {
+                    const int usec = speed_busy_poll_usec;
+                    if (::setsockopt(socket_.native_handle(), SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) != 0 &&
+                        hello_.stream == 0) {
+                        std::cerr << "<- busy poll: SO_BUSY_POLL not permitted" << std::endl;
+                    }
+                }
+                if (hello_.direction == speed_direction::pingpong) {
+                    payload_.reset(new speed_payload(hello_.block_size, checksum, depth_));
+                    pending_ = depth_;
+                    do_ping();
+                }
+                else if (sends(hello_.direction, false)) {
+                    payload_.reset(new speed_payload(hello_.block_size, checksum));
+                    do_write();
+                }
+                if (receives(hello_.direction, false) && mode_ != receive_mode::trunc) {
+                    verifier_.reset(new speed_verifier(hello_.block_size, checksum));
+                }
+                if (mode_ == receive_mode::large) {
+                    const int lowat = static_cast<int>(response_buffer_.size() / 4);
+                    ::setsockopt(socket_.native_handle(), SOL_SOCKET, SO_RCVLOWAT, &lowat, sizeof(lowat));
+                }
+                // uploading too, for the server's close
+                do_read();
+        });
+    }
 
-        double bandwidth = bit_in_sec;
-        std::string units = "Bit/s";
-        if(bit_in_sec > 1000000000) {
-            bandwidth = bit_in_sec / 1000000000.0;
-            units = "GBit/s";
+    // as the server's: whole blocks with checksums, the last one cut short without
+    std::size_t next_block() const
+    {
+        if (hello_.duration_ms && std::chrono::steady_clock::now() >= deadline_) {
+            return 0;
         }
-        else if(bit_in_sec > 1000000) {
-            bandwidth = bit_in_sec / 1000000.0;
-            units = "MBit/s";
+        if (!hello_.total_bytes) {
+            return hello_.block_size;
         }
-        else if(bit_in_sec > 1000) {
-            bandwidth = bit_in_sec / 1000.0;
-            units = "KBit/s";
+        if (sent_ >= hello_.total_bytes) {
+            return 0;
         }
-
-        std::clog << "<- ~client. bytes received: " << accumulator_
-                  << " process time: " << elapsed_seconds << " (seconds)"
-                  << " bandwidth: " << bandwidth << " " << units
-                  << std::endl;
+        if (hello_.flags & speed_flag_checksum) {
+            return hello_.block_size;
+        }
+        return static_cast<std::size_t>(std::min<std::uint64_t>(hello_.block_size, hello_.total_bytes - sent_));
     }
 
-    void go(const std::string& server, int port)
+    void do_write()
     {
-        std::clog << "<- go" << std::endl;
+        const std::size_t size = next_block();
+        if (!size) {
+            boost::system::error_code ignored;
+            socket_.shutdown(tcp::socket::shutdown_send, ignored);
+            return;
+        }
 
         auto self(shared_from_this());
-
-        boost::system::error_code err;
-
-        tcp::endpoint endpoint( boost::asio::ip::address::from_string(server), port );
-
-        std::clog << "<- schedule async_connect" << std::endl;
-        socket_.async_connect(endpoint,
-            [this, self](boost::system::error_code ec) {
+        boost::asio::async_write(socket_, boost::asio::buffer(payload_->next(), size),
+            [this, self](boost::system::error_code ec, std::size_t length) {
+                sent_ += length;
+                stats_.sent.fetch_add(length, std::memory_order_relaxed);
                 if (!ec) {
                     do_write();
                 }
         });
     }
 
-private:
-    void do_write()
+    // pingpong: up to the depth in flight, each timed from its write to the
+    // end of its echo; the next goes as an echo completes
+    std::size_t allowed_pings() const
+    {
+        if (hello_.duration_ms && std::chrono::steady_clock::now() >= deadline_) {
+            return 0;
+        }
+        if (!hello_.total_bytes) {
+            return pending_;
+        }
+        const std::uint64_t total = (hello_.total_bytes + hello_.block_size - 1) / hello_.block_size;
+        return static_cast<std::size_t>(std::min<std::uint64_t>(pending_, total - std::min(total, pings_)));
+    }
+
+    void do_ping()
     {
-        start_time_ = std::chrono::system_clock::now();
+        if (writing_ || closed_) {
+            return;
+        }
+        const std::size_t count = allowed_pings();
+        if (!count) {
+            if (in_flight_.empty()) {
+                closed_ = true;
+                boost::system::error_code ignored;
+                socket_.shutdown(tcp::socket::shutdown_send, ignored);
+            }
+            return;
+        }
+
+        gather_.clear();
+        const auto now = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < count; i++) {
+            gather_.emplace_back(payload_->next(), hello_.block_size);
+            in_flight_.push_back(now);
+        }
+        pending_ -= count;
+        pings_ += count;
+        writing_ = true;
 
         auto self(shared_from_this());
-        build_request();
-        boost::asio::async_write(socket_, request_,
+        boost::asio::async_write(socket_, gather_,
             [this, self](boost::system::error_code ec, std::size_t length) {
+                writing_ = false;
+                stats_.sent.fetch_add(length, std::memory_order_relaxed);
                 if (!ec) {
-                    do_read();
+                    do_ping();
                 }
         });
     }
 
+    void on_echo(std::size_t length)
+    {
+        echoed_ += length;
+        const auto now = std::chrono::steady_clock::now();
+        std::size_t done = 0;
+        for (; echoed_ >= hello_.block_size && !in_flight_.empty(); done++) {
+            echoed_ -= hello_.block_size;
+            stats_.latency.add(std::chrono::duration_cast<std::chrono::nanoseconds>(now - in_flight_.front()).count());
+            in_flight_.pop_front();
+        }
+        if (done) {
+            pending_ += done;
+            stats_.messages.fetch_add(done, std::memory_order_relaxed);
+            do_ping();
+        }
+    }
+
     void do_read()
     {
         auto self(shared_from_this());
-        socket_.async_read_some(boost::asio::buffer(response_buffer_),
+        const boost::asio::socket_base::message_flags flags = mode_ == receive_mode::trunc ? MSG_TRUNC : 0;
+        socket_.async_receive(boost::asio::buffer(response_buffer_), flags,
             [this, self](boost::system::error_code ec, std::size_t length) {
-                accumulator_ += length;
+                stats_.received.fetch_add(length, std::memory_order_relaxed);
+                if (verifier_) {
+                    verifier_->feed(response_buffer_.data(), length);
+                }
+                if (hello_.direction == speed_direction::pingpong) {
+                    on_echo(length);
+                }
                 if (!ec) {
                     do_read();
                 }
+                else if (verifier_) {
+                    verifier_->finish();
+                    stats_.bad_blocks = verifier_->bad_blocks();
+                }
         });
     }
 
-    void build_request()
+private:
+    stream_socket socket_;
+    connection_stats& stats_;
+    const speed_hello hello_;
+    const receive_mode mode_;
+    const std::size_t depth_;
+    std::array<unsigned char, speed_hello_size> message_;
+    std::vector<char> response_buffer_;
+
+    std::unique_ptr<speed_payload> payload_;
+    std::unique_ptr<speed_verifier> verifier_;
+    std::uint64_t sent_;
+    std::chrono::steady_clock::time_point deadline_;
+
+    std::vector<boost::asio::const_buffer> gather_;
+    std::deque<std::chrono::steady_clock::time_point> in_flight_;
+    std::size_t pending_;           // pings the depth allows now
+    std::uint64_t pings_;
+    std::size_t echoed_;            // of the oldest ping in flight
+    bool writing_;
+    bool closed_;
+};
+
+// "9.41 GBit/s"
+std::string format_bandwidth(double bits_per_second)
+{
+    const char* units[] = { "Bit/s", "KBit/s", "MBit/s", "GBit/s" };
+    std::size_t unit = 0;
+    while (unit + 1 < 4 && bits_per_second >= 1000) {
+        bits_per_second /= 1000;
+        unit++;
+    }
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(2) << bits_per_second << " " << units[unit];
+    return text.str();
+}
+
+double cpu_seconds()
+{
+    rusage usage;
+    if (::getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+std::chrono::steady_clock::time_point to_time_point(std::int64_t ns)
+{
+    return std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::nanoseconds(ns)));
+}
+
+std::chrono::steady_clock::duration seconds_to_duration(double seconds)
+{
+    return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+}
+
+std::uint64_t total_bytes(const std::vector<std::unique_ptr<connection_stats>>& stats)
+{
+    std::uint64_t bytes = 0;
+    for (const auto& s : stats) {
+        bytes += s->bytes();
+    }
+    return bytes;
+}
+
+std::uint64_t total_messages(const std::vector<std::unique_ptr<connection_stats>>& stats)
+{
+    std::uint64_t messages = 0;
+    for (const auto& s : stats) {
+        messages += s->messages.load(std::memory_order_relaxed);
+    }
+    return messages;
+}
+
+// "64k", "10M", "1G": powers of 1024
+std::uint64_t parse_size(const std::string& text)
+{
+    std::size_t end = 0;
+    const std::uint64_t value = std::stoull(text, &end);
+    const std::string suffix = text.substr(end);
+    if (suffix.empty()) {
+        return value;
+    }
+    if (suffix.size() == 1) {
+        switch (suffix[0]) {
+        case 'k': case 'K':
+            return value << 10;
+        case 'm': case 'M':
+            return value << 20;
+        case 'g': case 'G':
+            return value << 30;
+        }
+    }
+    throw std::runtime_error("bad size: " + text);
+}
+
+//==============================================================================
+
+// One UDP stream: what it sent, and what the server's summary says arrived.
+// The summary and the times are only read once the workers are joined.
+struct udp_stats
+{
+    std::atomic<std::uint64_t> sent_datagrams{0};
+    std::atomic<std::uint64_t> sent_bytes{0};
+    std::atomic<bool> failed{false};
+    std::atomic<bool> done{false};
+
+    speed_summary received;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point end;
+};
+
+// Negotiates over TCP, then sends the datagrams with sendmmsg(2), `batch`
+// messages a call. With GSO a message is a run of datagrams that the
+// kernel cuts up (UDP_SEGMENT), up to 64 of them and 64 KB.
+class udp_client : public std::enable_shared_from_this<udp_client>
+{
+public:
+    udp_client(boost::asio::io_service& io_service, udp_stats& stats, const speed_hello& hello,
+               std::size_t batch, bool gso) :
+        io_service_(io_service),
+        control_(io_service),
+        socket_(io_service),
+        stats_(stats),
+        hello_(hello),
+        batch_(batch),
+        gso_(gso),
+        segments_(1),
+        datagrams_(0)
     {
-        std::ostream request_stream(&request_);
-        request_stream << "TEST";
+    }
+
+    ~udp_client()
+    {
+        stats_.done = true;
+    }
+
+    void go(const tcp::endpoint& endpoint)
+    {
+        auto self(shared_from_this());
+        control_.async_connect(endpoint,
+            [this, self, endpoint](boost::system::error_code ec) {
+                if (ec) {
+                    std::cerr << "<- connect: " << ec.message() << std::endl;
+                    stats_.failed = true;
+                    return;
+                }
+                do_handshake(udp::endpoint(endpoint.address(), endpoint.port()));
+        });
     }
 
 private:
-    tcp::socket socket_;
-    boost::asio::streambuf request_;
+    void do_handshake(const udp::endpoint& endpoint)
+    {
+        auto self(shared_from_this());
+        speed_encode(hello_, message_.data());
+        boost::asio::async_write(control_, boost::asio::buffer(message_, speed_hello_size),
+            [this, self, endpoint](boost::system::error_code ec, std::size_t /*length*/) {
+                if (ec) {
+                    std::cerr << "<- handshake: " << ec.message() << std::endl;
+                    stats_.failed = true;
+                    return;
+                }
+                do_reply(endpoint);
+        });
+    }
 
-    std::chrono::time_point<std::chrono::system_clock> start_time_;
+    void do_reply(const udp::endpoint& endpoint)
+    {
+        auto self(shared_from_this());
+        boost::asio::async_read(control_, boost::asio::buffer(message_, speed_reply_size),
+            [this, self, endpoint](boost::system::error_code ec, std::size_t /*length*/) {
+                speed_reply reply;
+                if (ec || speed_decode(message_.data(), reply) != speed_status::ok) {
+                    std::cerr << "<- handshake: " << (ec ? ec.message() : to_string(reply.status)) << std::endl;
+                    stats_.failed = true;
+                    return;
+                }
+                try {
+                    open(endpoint);
+                }
+                catch (const std::exception& e) {
+                    std::cerr << "<- udp: " << e.what() << std::endl;
+                    stats_.failed = true;
+                    return;
+                }
+                stats_.start = std::chrono::steady_clock::now();
+                deadline_ = stats_.start + std::chrono::milliseconds(hello_.duration_ms);
+                send_some();
+        });
+    }
+
+    // every message is the same run of datagrams, built once
+    void open(const udp::endpoint& endpoint)
+    {
+        const std::size_t size = hello_.block_size;
+        socket_.connect(endpoint);
+        socket_.native_non_blocking(true);
+        const int buffer = 4 * 1024 * 1024;
+        ::setsockopt(socket_.native_handle(), SOL_SOCKET, SO_SNDBUF, &buffer, sizeof(buffer));
+        if (gso_) {
+            const int segment = static_cast<int>(size);
+            if (::setsockopt(socket_.native_handle(), SOL_UDP, UDP_SEGMENT, &segment, sizeof(segment)) != 0) {
+                throw std::runtime_error("UDP_SEGMENT not supported");
+            }
+            segments_ = std::max<std::size_t>(1, std::min<std::size_t>(64, 65000 / size));
+        }
 
-    enum { max_length = 1024 * 8 };
-    std::array<char, max_length> response_buffer_;
+        run_.resize(segments_ * size);
+        speed_pattern(hello_.block_size, run_.data(), run_.size());
+        for (std::size_t i = 0; i < segments_; i++) {
+            speed_encode_datagram(hello_.test_id, hello_.stream, reinterpret_cast<unsigned char*>(run_.data() + i * size));
+        }
+        iovec_.iov_base = run_.data();
+        iovec_.iov_len = run_.size();
+        messages_.resize(batch_);
+        for (mmsghdr& message : messages_) {
+            message.msg_hdr = msghdr();
+            message.msg_hdr.msg_iov = &iovec_;
+            message.msg_hdr.msg_iovlen = 1;
+        }
+    }
 
-    size_t accumulator_;
+    // messages the total or the duration still allow, whole runs
+    std::size_t allowed_messages() const
+    {
+        if (hello_.duration_ms && std::chrono::steady_clock::now() >= deadline_) {
+            return 0;
+        }
+        if (!hello_.total_bytes) {
+            return batch_;
+        }
+        const std::uint64_t total = (hello_.total_bytes + hello_.block_size - 1) / hello_.block_size;
+        const std::uint64_t left = total - std::min(total, datagrams_);
+        return static_cast<std::size_t>(std::min<std::uint64_t>(batch_, (left + segments_ - 1) / segments_));
+    }
+
+    // until the socket is full, or 16 batches went and the other streams get a turn
+    void send_some()
+    {
+        auto self(shared_from_this());
+        for (int burst = 0; burst < 16; burst++) {
+            const std::size_t count = allowed_messages();
+            if (!count) {
+                finish();
+                return;
+            }
+            const int sent = ::sendmmsg(socket_.native_handle(), messages_.data(), static_cast<unsigned>(count), MSG_DONTWAIT);
+            if (sent > 0) {
+                datagrams_ += sent * segments_;
+                stats_.sent_datagrams.fetch_add(sent * segments_, std::memory_order_relaxed);
+                stats_.sent_bytes.fetch_add(sent * run_.size(), std::memory_order_relaxed);
+            }
+            else if (errno == EAGAIN || errno == ENOBUFS) {
+                socket_.async_wait(udp::socket::wait_write, [this, self](boost::system::error_code ec) {
+                    if (!ec) {
+                        send_some();
+                    }
+                });
+                return;
+            }
+            else if (errno != EINTR) {
+                std::cerr << "<- sendmmsg: " << std::strerror(errno) << std::endl;
+                finish();
+                return;
+            }
+        }
+
+        io_service_.post([this, self]() {
+            send_some();
+        });
+    }
+
+    void finish()
+    {
+        stats_.end = std::chrono::steady_clock::now();
+        boost::system::error_code ignored;
+        control_.shutdown(tcp::socket::shutdown_send, ignored);
+
+        auto self(shared_from_this());
+        boost::asio::async_read(control_, boost::asio::buffer(message_, speed_summary_size),
+            [this, self](boost::system::error_code ec, std::size_t /*length*/) {
+                if (ec || speed_decode(message_.data(), stats_.received) != speed_status::ok) {
+                    std::cerr << "<- summary: " << (ec ? ec.message() : "bad summary") << std::endl;
+                    stats_.failed = true;
+                }
+        });
+    }
+
+private:
+    boost::asio::io_service& io_service_;
+    tcp::socket control_;
+    udp::socket socket_;
+    udp_stats& stats_;
+    const speed_hello hello_;
+    const std::size_t batch_;
+    const bool gso_;
+    std::array<unsigned char, speed_hello_size> message_;
+
+    std::size_t segments_;          // datagrams a message
+    std::vector<char> run_;
+    iovec iovec_;
+    std::vector<mmsghdr> messages_;
+    std::uint64_t datagrams_;
+    std::chrono::steady_clock::time_point deadline_;
+};
+
+struct udp_result
+{
+    std::uint32_t size = 0;
+    std::uint64_t sent_datagrams = 0;
+    std::uint64_t sent_bytes = 0;
+    std::uint64_t received_datagrams = 0;
+    std::uint64_t received_bytes = 0;
+    double seconds = 0;
+    double cpu = 0;
+    std::size_t failed = 0;
+
+    double loss() const
+    {
+        return sent_datagrams ? 1 - static_cast<double>(received_datagrams) / sent_datagrams : 0;
+    }
 };
 
+// One datagram size over every connection: the streams start as they are
+// negotiated, the time runs from the first start to the last end of sending.
+udp_result run_udp(const tcp::endpoint& endpoint, speed_hello hello, std::size_t connections, std::size_t threads,
+                   std::size_t batch, bool gso, bool busy_poll)
+{
+    typedef std::unique_ptr<boost::asio::io_service> io_service_ptr;
+    std::vector<io_service_ptr> services;
+    for (std::size_t i = 0; i < threads; i++) {
+        services.emplace_back(new boost::asio::io_service(1));
+    }
+
+    const double cpu_start = cpu_seconds();
+    std::vector<std::unique_ptr<udp_stats>> stats;
+    for (std::size_t i = 0; i < connections; i++) {
+        stats.emplace_back(new udp_stats);
+        hello.stream = static_cast<std::uint32_t>(i);
+        std::make_shared<udp_client>(*services[i % threads], *stats.back(), hello, batch, gso)->go(endpoint);
+    }
+
+    // each worker ends with its streams, busy polling or not
+    std::vector<std::thread> workers;
+    for (auto& service : services) {
+        boost::asio::io_service* io_service = service.get();
+        workers.emplace_back([io_service, busy_poll]() {
+            if (busy_poll) {
+                while (!io_service->stopped()) {
+                    io_service->poll();
+                }
+            }
+            else {
+                io_service->run();
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    udp_result result;
+    result.size = hello.block_size;
+    result.cpu = cpu_seconds() - cpu_start;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::time_point::max();
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::time_point::min();
+    for (const auto& s : stats) {
+        if (s->failed) {
+            result.failed++;
+            continue;
+        }
+        result.sent_datagrams += s->sent_datagrams;
+        result.sent_bytes += s->sent_bytes;
+        result.received_datagrams += s->received.datagrams;
+        result.received_bytes += s->received.bytes;
+        start = std::min(start, s->start);
+        end = std::max(end, s->end);
+    }
+    result.seconds = start < end ? std::chrono::duration<double>(end - start).count() : 1e-9;
+    return result;
+}
+
+// "1.25 Mpps"
+std::string format_rate(double per_second)
+{
+    const char* units[] = { "pps", "Kpps", "Mpps" };
+    std::size_t unit = 0;
+    while (unit + 1 < 3 && per_second >= 1000) {
+        per_second /= 1000;
+        unit++;
+    }
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(2) << per_second << " " << units[unit];
+    return text.str();
+}
+
 int main(int argc, char* argv[])
 {
     try
     {
-        if (argc != 3) {
-            std::cout << "Usage: async_speed_client <server> <port>\n";
+        po::options_description description("Usage: asio_speed_client <server> <port> | unix:<path> [options]");
+        po::positional_options_description positional;
+        description.add_options()
+            ("help,h", "print this message")
+            ("server", po::value<std::string>(), "server address, or unix:/path or unix:@abstract-name without a port")
+            ("port", po::value<unsigned short>(), "server port")
+            ("connections,c", po::value<std::size_t>()->default_value(1), "parallel connections")
+            ("threads,t", po::value<std::size_t>()->default_value(1), "threads, each with its own io_service")
+            ("direction", po::value<std::string>()->default_value("download"), "download, upload, both or pingpong")
+            ("bytes,n", po::value<std::string>(), "bytes per connection and direction, as 512M or 2G; instead of the duration")
+            ("duration,d", po::value<double>()->default_value(10), "seconds to send for")
+            ("block,l", po::value<std::string>()->default_value("8k"), "block size, the message size in pingpong")
+            ("depth", po::value<std::size_t>()->default_value(1), "pingpong messages in flight per connection")
+            ("busy-poll", "spin in io_service::poll instead of sleeping in epoll, and set SO_BUSY_POLL on both ends")
+            ("udp", "upload UDP datagrams of each --block size in turn, as 64,512,1472")
+            ("batch", po::value<std::size_t>()->default_value(32), "UDP messages per sendmmsg")
+            ("gso", "UDP segmentation offload, up to 64 datagrams a message")
+            ("checksum", "checksum and number every block, checked by the receiver")
+            ("engine,e", po::value<std::string>()->default_value("write"), "how the server sends: write, gather, sendfile or zerocopy")
+            ("gather", po::value<std::uint16_t>()->default_value(16), "blocks per gather or zerocopy send")
+            ("receive,r", po::value<std::string>()->default_value("read"), "how to receive: read, large or trunc")
+            ("interval,i", po::value<double>()->default_value(1), "seconds between interval reports, 0: none")
+            ("buffer", po::value<std::size_t>()->default_value(8), "read buffer per connection, KB")
+            ("json", po::value<std::string>(), "also write the results to this file as JSON");
+        positional.add("server", 1).add("port", 1);
+
+        po::variables_map options;
+        po::store(po::command_line_parser(argc, argv).options(description).positional(positional).run(), options);
+        po::notify(options);
+
+        const bool local = options.count("server") && options["server"].as<std::string>().compare(0, 5, "unix:") == 0;
+        if (options.count("help") || !options.count("server") || (!options.count("port") && !local)) {
+            std::cerr << description << "\n";
             return 1;
         }
 
-        //std::clog.setstate(std::ios_base::failbit);
+        const std::string server = options["server"].as<std::string>();
+        const unsigned short port = local ? 0 : options["port"].as<unsigned short>();
+        const std::string address = local ? server : server + ":" + std::to_string(port);
+        const std::size_t connections = std::max<std::size_t>(1, options["connections"].as<std::size_t>());
+        const std::size_t threads = std::max<std::size_t>(1, std::min(connections, options["threads"].as<std::size_t>()));
+        const double duration = options["duration"].as<double>();
+        const double interval = options["interval"].as<double>();
+        const std::size_t depth = std::max<std::size_t>(1, options["depth"].as<std::size_t>());
+        const bool busy_poll = options.count("busy-poll") != 0;
+        const receive_mode mode = parse_receive_mode(options["receive"].as<std::string>());
+        std::size_t buffer_size = std::max<std::size_t>(1, options["buffer"].as<std::size_t>()) * 1024;
+        if (mode != receive_mode::read) {
+            buffer_size = std::max<std::size_t>(buffer_size, 1024 * 1024);
+        }
+
+        // with --bytes the duration only limits the run when given as well
+        speed_hello hello;
+        hello.direction = parse_speed_direction(options["direction"].as<std::string>());
+        hello.flags = options.count("checksum") ? speed_flag_checksum : 0;
+        hello.engine = parse_speed_engine(options["engine"].as<std::string>());
+        hello.gather = options["gather"].as<std::uint16_t>();
+        hello.flags |= options.count("busy-poll") ? speed_flag_busy_poll : 0;
+        if (mode == receive_mode::trunc && (hello.flags & speed_flag_checksum) && receives(hello.direction, false)) {
+            throw std::runtime_error("trunc receives discard the data, there is nothing to checksum");
+        }
+        std::vector<std::uint32_t> sizes;
+        std::istringstream blocks(options["block"].as<std::string>());
+        for (std::string block; std::getline(blocks, block, ',');) {
+            sizes.push_back(static_cast<std::uint32_t>(std::min<std::uint64_t>(parse_size(block), speed_max_block)));
+        }
+        if (sizes.empty() || (sizes.size() > 1 && !options.count("udp"))) {
+            throw std::runtime_error("one --block size, or a list of them with --udp");
+        }
+        hello.block_size = sizes.front();
+        hello.streams = static_cast<std::uint32_t>(connections);
+        hello.test_id = std::mt19937_64(std::random_device()())();
+        hello.total_bytes = options.count("bytes") ? parse_size(options["bytes"].as<std::string>()) : 0;
+        if (!hello.total_bytes || !options["duration"].defaulted()) {
+            hello.duration_ms = static_cast<std::uint32_t>(std::max(0.0, duration) * 1000);
+        }
+        if (!hello.total_bytes && !hello.duration_ms) {
+            throw std::runtime_error("no --bytes and no --duration");
+        }
+
+        const stream_endpoint endpoint = parse_stream_endpoint(address);
+
+        if (options.count("udp")) {
+            if (local) {
+                throw std::runtime_error("--udp needs a TCP server, the datagrams go to its port");
+            }
+            if (options["direction"].defaulted()) {
+                hello.direction = speed_direction::upload;
+            }
+            hello.flags |= speed_flag_udp;
+            const std::size_t batch = std::max<std::size_t>(1, options["batch"].as<std::size_t>());
+            const bool gso = options.count("gso") != 0;
+
+            std::vector<udp_result> results;
+            std::size_t failed = 0;
+            for (const std::uint32_t size : sizes) {
+                hello.block_size = size;
+                hello.test_id = std::mt19937_64(std::random_device()())();
+                const udp_result r = run_udp(to_tcp(endpoint), hello, connections, threads, batch, gso, busy_poll);
+                std::clog << "<- udp " << std::setw(5) << r.size << " bytes:"
+                          << " sent " << format_rate(r.sent_datagrams / r.seconds)
+                          << " " << format_bandwidth(r.sent_bytes * 8 / r.seconds)
+                          << " received " << format_rate(r.received_datagrams / r.seconds)
+                          << " " << format_bandwidth(r.received_bytes * 8 / r.seconds)
+                          << " loss " << std::fixed << std::setprecision(2) << r.loss() * 100 << "%"
+                          << " cpu " << std::setprecision(3) << r.cpu << " s"
+                          << std::endl;
+                results.push_back(r);
+                failed += r.failed;
+            }
+
+            if (options.count("json")) {
+                std::ofstream json(options["json"].as<std::string>());
+                json << std::setprecision(6)
+                     << "{\"server\":\"" << server << "\",\"port\":" << port
+                     << ",\"transport\":\"udp\""
+                     << ",\"connections\":" << connections
+                     << ",\"threads\":" << threads
+                     << ",\"batch\":" << batch
+                     << ",\"gso\":" << (gso ? "true" : "false")
+                     << ",\"busy_poll\":" << (busy_poll ? "true" : "false")
+                     << ",\"results\":[";
+                for (std::size_t i = 0; i < results.size(); i++) {
+                    const udp_result& r = results[i];
+                    json << (i ? "," : "")
+                         << "{\"size\":" << r.size
+                         << ",\"seconds\":" << r.seconds
+                         << ",\"sent_datagrams\":" << r.sent_datagrams
+                         << ",\"received_datagrams\":" << r.received_datagrams
+                         << ",\"sent_pps\":" << r.sent_datagrams / r.seconds
+                         << ",\"received_pps\":" << r.received_datagrams / r.seconds
+                         << ",\"received_gbps\":" << r.received_bytes * 8 / r.seconds / 1e9
+                         << ",\"loss\":" << r.loss()
+                         << ",\"cpu_seconds\":" << r.cpu
+                         << "}";
+                }
+                json << "]}\n";
+            }
+
+            if (failed) {
+                std::cerr << "<- " << failed << " connections failed" << std::endl;
+                return 1;
+            }
+            return 0;
+        }
+
+        typedef std::unique_ptr<boost::asio::io_service> io_service_ptr;
+        typedef std::unique_ptr<boost::asio::io_service::work> work_ptr;
+        std::vector<io_service_ptr> services;
+        std::vector<work_ptr> work;
+        for (std::size_t i = 0; i < threads; i++) {
+            services.emplace_back(new boost::asio::io_service(1));
+            work.emplace_back(new boost::asio::io_service::work(*services.back()));
+        }
+
+        // streams move data as soon as they are negotiated
+        const double cpu_start = cpu_seconds();
+        std::vector<std::unique_ptr<connection_stats>> stats;
+        for (std::size_t i = 0; i < connections; i++) {
+            stats.emplace_back(new connection_stats);
+            hello.stream = static_cast<std::uint32_t>(i);
+            std::make_shared<client>(*services[i % threads], *stats.back(), hello, mode, buffer_size, depth)->go(endpoint);
+        }
+
+        // busy polling spins on a zero timeout epoll_wait instead of sleeping
+        // in it, a core per thread for the latency of the wakeup
+        std::atomic<bool> polling{true};
+        std::vector<std::thread> workers;
+        for (auto& service : services) {
+            boost::asio::io_service* io_service = service.get();
+            workers.emplace_back([io_service, busy_poll, &polling]() {
+                if (busy_poll) {
+                    while (polling.load(std::memory_order_relaxed)) {
+                        io_service->poll();
+                    }
+                }
+                else {
+                    io_service->run();
+                }
+            });
+        }
+
+        auto finished = [&stats]() {
+            for (const auto& s : stats) {
+                if (!s->done) {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        // the intervals are reported once every connection is up, or has failed
+        for (;;) {
+            bool ready = true;
+            for (const auto& s : stats) {
+                ready = ready && (s->connected || s->done);
+            }
+            if (ready) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        std::size_t failed = 0;
+        for (const auto& s : stats) {
+            failed += s->failed ? 1 : 0;
+        }
+        std::clog << "<- " << connections - failed << " connections on " << threads << " threads to "
+                  << address << " " << to_string(hello.direction)
+                  << " engine: " << to_string(hello.engine)
+                  << " receive: " << to_string(mode)
+                  << " block: " << hello.block_size
+                  << (hello.direction == speed_direction::pingpong ? " depth: " + std::to_string(depth) : "")
+                  << (hello.flags & speed_flag_checksum ? " checksum" : "")
+                  << (busy_poll ? " busy poll" : "") << std::endl;
+
+        const auto start = std::chrono::steady_clock::now();
+        const std::uint64_t first = total_bytes(stats);
+        const std::uint64_t first_messages = total_messages(stats);
+
+        std::vector<double> intervals;     // bits per second
+        auto last = start;
+        std::uint64_t last_bytes = first;
+        std::uint64_t last_messages = first_messages;
+        // the senders keep to the negotiated bytes or duration, the run ends
+        // when every stream has been closed
+        while (!finished()) {
+            const double step = interval > 0 ? interval : 0.1;
+            const auto next = last + seconds_to_duration(step);
+            while (std::chrono::steady_clock::now() < next && !finished()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+
+            const auto at = std::chrono::steady_clock::now();
+            const std::uint64_t bytes = total_bytes(stats);
+            const std::uint64_t messages = total_messages(stats);
+            const double seconds = std::chrono::duration<double>(at - last).count();
+            if (interval > 0 && seconds > 0) {
+                const double rate = (bytes - last_bytes) * 8 / seconds;
+                intervals.push_back(rate);
+                std::clog << "<- " << std::fixed << std::setprecision(2)
+                          << std::chrono::duration<double>(last - start).count() << "-"
+                          << std::chrono::duration<double>(at - start).count() << " s: "
+                          << format_bandwidth(rate);
+                if (hello.direction == speed_direction::pingpong) {
+                    std::clog << " " << std::setprecision(0) << (messages - last_messages) / seconds << " msg/s";
+                }
+                std::clog << std::endl;
+            }
+            last = at;
+            last_bytes = bytes;
+            last_messages = messages;
+        }
+
+        const auto end = std::chrono::steady_clock::now();
+        const double cpu = cpu_seconds() - cpu_start;
+        const std::uint64_t messages = total_messages(stats);
+        std::vector<std::uint64_t> end_received, end_sent;
+        std::uint64_t bad_blocks = 0;
+        for (const auto& s : stats) {
+            end_received.push_back(s->received.load(std::memory_order_relaxed));
+            end_sent.push_back(s->sent.load(std::memory_order_relaxed));
+            bad_blocks += s->bad_blocks;
+        }
+
+        work.clear();
+        polling = false;
+        for (auto& service : services) {
+            service->stop();
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        // the handlers still queued own clients, which refer to their stats
+        services.clear();
 
-        boost::asio::io_service io_service;
-        auto c = std::make_shared<client>(io_service);
-        c->go( argv[1], std::stoi(argv[2]) );
-        c.reset();
+        latency_histogram latency;
+        for (const auto& s : stats) {
+            latency.merge(s->latency);
+        }
 
-        std::clog << "<- io_service run" << std::endl;
+        // every byte counts: the run is timed from the first stream's
+        // negotiation and each stream from its own, so data moved while the
+        // others were still connecting is neither lost nor rated too high
+        auto first_started = end;
+        for (const auto& s : stats) {
+            if (s->started) {
+                first_started = std::min(first_started, to_time_point(s->started));
+            }
+        }
+        const double seconds = std::max(1e-9, std::chrono::duration<double>(end - first_started).count());
+        std::uint64_t received = 0;
+        std::uint64_t sent = 0;
+        std::vector<double> rates;
+        for (std::size_t i = 0; i < connections; i++) {
+            const std::uint64_t r = end_received[i];
+            const std::uint64_t w = end_sent[i];
+            const double own = stats[i]->started ?
+                std::max(1e-9, std::chrono::duration<double>(end - to_time_point(stats[i]->started)).count()) : seconds;
+            received += r;
+            sent += w;
+            rates.push_back((r + w) * 8 / own);
+        }
+        const std::uint64_t bytes = received + sent;
+        const double bandwidth = bytes * 8 / seconds;
+        const double mean = bandwidth / connections;
+        double variance = 0;
+        for (const double rate : rates) {
+            variance += (rate - mean) * (rate - mean);
+        }
+        const double stddev = std::sqrt(variance / connections);
+        const double min_rate = *std::min_element(rates.begin(), rates.end());
+        const double max_rate = *std::max_element(rates.begin(), rates.end());
+        const double cpu_per_gb = bytes ? cpu / (bytes / 1e9) : 0;
 
-        io_service.run();
+        std::clog << "<- per connection: min " << format_bandwidth(min_rate)
+                  << " max " << format_bandwidth(max_rate)
+                  << " stddev " << format_bandwidth(stddev) << std::endl;
+        std::clog << "<- cpu: " << std::fixed << std::setprecision(3) << cpu << " s, "
+                  << cpu_per_gb << " s per GB" << std::endl;
+        if (hello.flags & speed_flag_checksum) {
+            std::clog << "<- bad blocks: " << bad_blocks << std::endl;
+        }
+        if (hello.direction == speed_direction::pingpong) {
+            std::clog << "<- messages: " << messages
+                      << " rate: " << std::setprecision(0) << messages / seconds << " msg/s"
+                      << " cpu per message: " << std::setprecision(2) << (messages ? cpu * 1e6 / messages : 0) << " us"
+                      << "\n<- latency us p50: " << latency.percentile(0.5) / 1000.0
+                      << " p90: " << latency.percentile(0.9) / 1000.0
+                      << " p99: " << latency.percentile(0.99) / 1000.0
+                      << " p99.9: " << latency.percentile(0.999) / 1000.0
+                      << " p99.99: " << latency.percentile(0.9999) / 1000.0
+                      << " max: " << latency.max() / 1000.0
+                      << std::endl;
+        }
+        std::clog << "<- bytes received: " << received
+                  << " sent: " << sent
+                  << " process time: " << std::setprecision(3) << seconds << " (seconds)"
+                  << " bandwidth: " << format_bandwidth(bandwidth)
+                  << std::endl;
+
+        if (options.count("json")) {
+            std::ofstream json(options["json"].as<std::string>());
+            json << std::setprecision(6)
+                 << "{\"server\":\"" << server << "\",\"port\":" << port
+                 << ",\"transport\":\"" << (local ? "unix" : "tcp") << "\""
+                 << ",\"connections\":" << connections
+                 << ",\"threads\":" << threads
+                 << ",\"direction\":\"" << to_string(hello.direction) << "\""
+                 << ",\"engine\":\"" << to_string(hello.engine) << "\""
+                 << ",\"receive\":\"" << to_string(mode) << "\""
+                 << ",\"block_size\":" << hello.block_size
+                 << ",\"checksum\":" << (hello.flags & speed_flag_checksum ? "true" : "false")
+                 << ",\"seconds\":" << seconds
+                 << ",\"bytes\":" << bytes
+                 << ",\"received_bytes\":" << received
+                 << ",\"sent_bytes\":" << sent
+                 << ",\"bad_blocks\":" << bad_blocks
+                 << ",\"bandwidth_gbps\":" << bandwidth / 1e9
+                 << ",\"per_connection_gbps\":{\"min\":" << min_rate / 1e9
+                 << ",\"max\":" << max_rate / 1e9
+                 << ",\"mean\":" << mean / 1e9
+                 << ",\"stddev\":" << stddev / 1e9 << "}"
+                 << ",\"cpu_seconds\":" << cpu
+                 << ",\"cpu_seconds_per_gb\":" << cpu_per_gb
+                 << ",\"busy_poll\":" << (busy_poll ? "true" : "false");
+            if (hello.direction == speed_direction::pingpong) {
+                json << ",\"depth\":" << depth
+                     << ",\"messages\":" << messages
+                     << ",\"messages_per_second\":" << messages / seconds
+                     << ",\"cpu_us_per_message\":" << (messages ? cpu * 1e6 / messages : 0)
+                     << ",\"latency_us\":{\"mean\":" << latency.mean() / 1000
+                     << ",\"p50\":" << latency.percentile(0.5) / 1000.0
+                     << ",\"p90\":" << latency.percentile(0.9) / 1000.0
+                     << ",\"p99\":" << latency.percentile(0.99) / 1000.0
+                     << ",\"p999\":" << latency.percentile(0.999) / 1000.0
+                     << ",\"p9999\":" << latency.percentile(0.9999) / 1000.0
+                     << ",\"max\":" << latency.max() / 1000.0 << "}";
+            }
+            json << ",\"intervals_gbps\":[";
+            for (std::size_t i = 0; i < intervals.size(); i++) {
+                json << (i ? "," : "") << intervals[i] / 1e9;
+            }
+            json << "]}\n";
+        }
 
-        std::clog << "<- io_service done" << std::endl;
+        if (failed) {
+            std::cerr << "<- " << failed << " connections failed" << std::endl;
+            return 1;
+        }
+        if (bad_blocks) {
+            std::cerr << "<- " << bad_blocks << " blocks failed verification" << std::endl;
+            return 1;
+        }
     }
     catch (const std::exception& e)
     {
         std::cerr << "<- main exception: " << e.what() << "\n";
+        return 1;
     }
 
     return 0;
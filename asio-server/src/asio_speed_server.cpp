@@ -1,128 +1,840 @@
+#include <map>
+#include <cstring>
+#include <string>
+#include <array>
+#include <chrono>
 #include <memory>
 #include <thread>
+#include <vector>
 #include <utility>
 #include <cstdlib>
+#include <iomanip>
 #include <iostream>
+#include <algorithm>
+#include <stdexcept>
 #include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/program_options.hpp>
 
-using boost::asio::ip::tcp;
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <linux/errqueue.h>
+
+#include <speed_cycles.h>
+#include <speed_protocol.h>
+#include <stream_endpoint.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+using boost::asio::ip::udp;
+namespace po = boost::program_options;
+
+// The pattern in an unlinked file on tmpfs, for the sendfile engine: whole
+// blocks, about 8 MB of them.
+class payload_file
+{
+public:
+    explicit payload_file(std::uint32_t block_size) :
+        fd_(-1),
+        size_(std::max<std::size_t>(1, (8 << 20) / block_size) * block_size)
+    {
+        char path[] = "/dev/shm/asio_speed_payload.XXXXXX";
+        fd_ = ::mkstemp(path);
+        if (fd_ < 0) {
+            throw std::runtime_error("can't create payload file in /dev/shm");
+        }
+        ::unlink(path);
+
+        std::vector<char> data(size_);
+        speed_pattern(block_size, data.data(), data.size());
+        for (std::size_t written = 0; written < data.size();) {
+            const ssize_t n = ::write(fd_, data.data() + written, data.size() - written);
+            if (n <= 0) {
+                ::close(fd_);
+                throw std::runtime_error("can't write payload file");
+            }
+            written += static_cast<std::size_t>(n);
+        }
+    }
+
+    ~payload_file()
+    {
+        ::close(fd_);
+    }
+
+    payload_file(const payload_file&) = delete;
+    payload_file& operator=(const payload_file&) = delete;
+
+    int fd() const { return fd_; }
+    std::size_t size() const { return size_; }
+
+private:
+    int fd_;
+    std::size_t size_;
+};
+
+// The server's UDP socket, on the TCP port. Counts what arrives for the
+// streams the sessions have registered, read in batches by recvmmsg(2);
+// with UDP GRO the kernel hands over a run of datagrams of one size as one
+// buffer, and a control message with the size.
+class udp_receiver
+{
+public:
+    udp_receiver(boost::asio::io_service& io_service, unsigned short port, bool gro) :
+        io_service_(io_service),
+        socket_(io_service, udp::endpoint(udp::v4(), port)),
+        buffers_(batch * buffer_size),
+        messages_(batch),
+        iovecs_(batch),
+        controls_(batch * control_size),
+        last_(nullptr)
+    {
+        if (gro) {
+            const int on = 1;
+            if (::setsockopt(socket_.native_handle(), SOL_UDP, UDP_GRO, &on, sizeof(on)) != 0) {
+                throw std::runtime_error("UDP_GRO not supported");
+            }
+        }
+        const int size = 16 * 1024 * 1024;
+        ::setsockopt(socket_.native_handle(), SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        socket_.native_non_blocking(true);
+        do_wait();
+    }
+
+    void add(std::uint64_t test_id, std::uint32_t stream)
+    {
+        streams_[key(test_id, stream)];
+    }
+
+    speed_summary remove(std::uint64_t test_id, std::uint32_t stream)
+    {
+        const auto found = streams_.find(key(test_id, stream));
+        if (found == streams_.end()) {
+            return speed_summary();
+        }
+        const speed_summary summary = found->second;
+        streams_.erase(found);
+        last_ = nullptr;
+        return summary;
+    }
+
+private:
+    typedef std::pair<std::uint64_t, std::uint32_t> key;
+
+    enum { batch = 64, buffer_size = 64 * 1024, control_size = 64 };
+
+    void do_wait()
+    {
+        socket_.async_wait(udp::socket::wait_read, [this](boost::system::error_code ec) {
+            if (!ec) {
+                receive_some();
+            }
+        });
+    }
+
+    // until the socket is empty, or 16 batches went and the sessions get a turn
+    void receive_some()
+    {
+        for (int burst = 0; burst < 16; burst++) {
+            for (std::size_t i = 0; i < batch; i++) {
+                iovecs_[i].iov_base = buffers_.data() + i * buffer_size;
+                iovecs_[i].iov_len = buffer_size;
+                msghdr& header = messages_[i].msg_hdr;
+                header = msghdr();
+                header.msg_iov = &iovecs_[i];
+                header.msg_iovlen = 1;
+                header.msg_control = controls_.data() + i * control_size;
+                header.msg_controllen = control_size;
+            }
+
+            const int received = ::recvmmsg(socket_.native_handle(), messages_.data(), batch, MSG_DONTWAIT, nullptr);
+            if (received < 0) {
+                if (errno != EAGAIN && errno != EINTR) {
+                    std::cerr << "-> recvmmsg: " << std::strerror(errno) << std::endl;
+                }
+                do_wait();
+                return;
+            }
+            for (int i = 0; i < received; i++) {
+                receive(messages_[i]);
+            }
+        }
+
+        io_service_.post([this]() {
+            receive_some();
+        });
+    }
+
+    void receive(mmsghdr& message)
+    {
+        const unsigned char* data = static_cast<const unsigned char*>(message.msg_hdr.msg_iov->iov_base);
+        const std::size_t length = message.msg_len;
+        std::size_t segment = length;
+        for (cmsghdr* c = CMSG_FIRSTHDR(&message.msg_hdr); c; c = CMSG_NXTHDR(&message.msg_hdr, c)) {
+            if (c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO) {
+                int size = 0;
+                std::memcpy(&size, CMSG_DATA(c), sizeof(size));
+                segment = size > 0 ? static_cast<std::size_t>(size) : length;
+            }
+        }
+        for (std::size_t offset = 0; offset < length; offset += segment) {
+            count(data + offset, std::min(segment, length - offset));
+        }
+    }
+
+    // datagrams come in runs from one stream, the last one is kept at hand
+    void count(const unsigned char* datagram, std::size_t length)
+    {
+        if (length < speed_datagram_header) {
+            return;
+        }
+        std::uint64_t test_id = 0;
+        std::uint32_t stream = 0;
+        speed_decode_datagram(datagram, test_id, stream);
+        if (!last_ || last_key_ != key(test_id, stream)) {
+            const auto found = streams_.find(key(test_id, stream));
+            if (found == streams_.end()) {
+                return;
+            }
+            last_key_ = found->first;
+            last_ = &found->second;
+        }
+        last_->datagrams++;
+        last_->bytes += length;
+    }
+
+    boost::asio::io_service& io_service_;
+    udp::socket socket_;
+
+    std::vector<char> buffers_;
+    std::vector<mmsghdr> messages_;
+    std::vector<iovec> iovecs_;
+    std::vector<char> controls_;
+
+    std::map<key, speed_summary> streams_;
+    key last_key_;
+    speed_summary* last_;
+};
+
+// The streams of one client test, reported together when the last closes,
+// with the cycles the server thread spent meanwhile; tests that overlap
+// share them.
+class test_registry
+{
+public:
+    void begin(const speed_hello& hello)
+    {
+        test& t = tests_[hello.test_id];
+        if (!t.started++) {
+            t.cycles = cycles_.read();
+        }
+    }
+
+    void add(const speed_hello& hello, std::uint64_t sent, std::uint64_t received, std::uint64_t bad_blocks,
+             std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+    {
+        test& t = tests_[hello.test_id];
+        if (!t.streams++) {
+            t.start = start;
+            t.end = end;
+        }
+        t.start = std::min(t.start, start);
+        t.end = std::max(t.end, end);
+        t.sent += sent;
+        t.received += received;
+        t.bad_blocks += bad_blocks;
+
+        if (t.streams >= hello.streams) {
+            const double seconds = std::max(1e-9, std::chrono::duration<double>(t.end - t.start).count());
+            const std::uint64_t cycles = cycles_.read() - t.cycles;
+            std::clog << "-> test: " << std::hex << hello.test_id << std::dec
+                      << " " << to_string(hello.direction)
+                      << " " << to_string(hello.engine)
+                      << " streams: " << t.streams
+                      << " bytes sent: " << t.sent
+                      << " received: " << t.received
+                      << " bad blocks: " << t.bad_blocks
+                      << " seconds: " << std::fixed << std::setprecision(3) << seconds
+                      << " bandwidth: " << std::setprecision(2) << (t.sent + t.received) * 8 / seconds / 1e9 << " GBit/s"
+                      << " cycles: " << cycles << (cycles_.estimated() ? " (estimated)" : "")
+                      << " bytes per cycle: " << std::setprecision(3) << (cycles ? double(t.sent + t.received) / cycles : 0.0)
+                      << std::endl;
+            tests_.erase(hello.test_id);
+        }
+    }
+
+private:
+    struct test
+    {
+        std::uint32_t started = 0;
+        std::uint32_t streams = 0;
+        std::uint64_t cycles = 0;
+        std::uint64_t sent = 0;
+        std::uint64_t received = 0;
+        std::uint64_t bad_blocks = 0;
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::time_point end;
+    };
+
+    std::map<std::uint64_t, test> tests_;
+    cycle_counter cycles_;
+};
 
 class session : public std::enable_shared_from_this<session>
 {
 public:
-    session(tcp::socket socket) :
+    // `udp` is null on a UNIX socket, which has no UDP port beside it
+    session(boost::asio::io_service& io_service, stream_socket socket, test_registry& tests, udp_receiver* udp) :
+        io_service_(io_service),
         socket_(std::move(socket)),
-        max_iter_{ 1024 * 1024 * 32 },
-        data_{ 0 },
-        iter_{ 0 },
-        accumulator_{ 0 }
+        tests_(tests),
+        udp_(udp),
+        sent_{ 0 },
+        received_{ 0 },
+        negotiated_{ false },
+        zerocopy_sends_{ 0 },
+        zerocopy_completed_{ 0 },
+        zerocopy_copied_{ 0 },
+        datagrams_{ 0 }
     {
         std::clog << "-> session: " << &socket_ << std::endl;
     }
 
     ~session()
     {
+        const std::uint64_t bad_blocks = verifier_ ? verifier_->bad_blocks() : 0;
         std::clog << "-> ~session: " << &socket_
-                  << " bytes sent: " << accumulator_
-                  << std::endl;
+                  << " bytes sent: " << sent_
+                  << " received: " << received_
+                  << " bad blocks: " << bad_blocks;
+        if (hello_.flags & speed_flag_udp) {
+            std::clog << " datagrams: " << datagrams_;
+        }
+        if (zerocopy_sends_) {
+            std::clog << " zerocopy sends: " << zerocopy_sends_
+                      << " completed: " << zerocopy_completed_
+                      << " copied: " << zerocopy_copied_;
+        }
+        std::clog << std::endl;
+        if (negotiated_) {
+            tests_.add(hello_, sent_, received_, bad_blocks, start_, std::chrono::steady_clock::now());
+        }
     }
 
     void start()
     {
-        do_read();
+        do_handshake();
     }
 
 private:
-    void do_read()
+    void do_handshake()
     {
         auto self(shared_from_this());
-        socket_.async_read_some(boost::asio::buffer(data_, max_length),
-            [this, self](boost::system::error_code ec, std::size_t length) {
-                std::clog << "-> read from: " << &socket_
-                          << " data: " << data_.data()
-                          << " length: " << length
-                          << std::endl;
+        boost::asio::async_read(socket_, boost::asio::buffer(message_, speed_hello_size),
+            [this, self](boost::system::error_code ec, std::size_t /*length*/) {
+                if (ec) {
+                    return;
+                }
+
+                speed_reply reply;
+                reply.status = speed_decode(message_.data(), hello_);
+                reply.block_size = hello_.block_size;
+                if (reply.status == speed_status::ok && (hello_.flags & speed_flag_udp) && !udp_) {
+                    reply.status = speed_status::bad_transport;
+                }
+                if (reply.status == speed_status::ok && sends(hello_.direction, true) && !prepare_engine()) {
+                    reply.status = speed_status::bad_engine;
+                }
+                if (reply.status == speed_status::ok && (hello_.flags & speed_flag_busy_poll)) {
+                    const int usec = speed_busy_poll_usec;
+                    if (::setsockopt(socket_.native_handle(), SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) != 0) {
+                        std::cerr << "-> busy poll: SO_BUSY_POLL not permitted" << std::endl;
+                    }
+                }
+                std::clog << "-> hello from: " << &socket_
+                          << " " << to_string(reply.status);
+                if (reply.status == speed_status::ok) {
+                    std::clog << " direction: " << to_string(hello_.direction)
+                              << " engine: " << to_string(hello_.engine)
+                              << " block: " << hello_.block_size
+                              << " bytes: " << hello_.total_bytes
+                              << " duration: " << hello_.duration_ms << " ms"
+                              << " stream: " << hello_.stream + 1 << "/" << hello_.streams
+                              << (hello_.flags & speed_flag_checksum ? " checksum" : "")
+                              << (hello_.flags & speed_flag_udp ? " udp" : "")
+                              << (hello_.flags & speed_flag_busy_poll ? " busy poll" : "");
+                }
+                std::clog << std::endl;
 
-                if(strncmp(data_.data(), "TEST", 4) != 0) {
+                speed_encode(reply, message_.data());
+                do_reply(reply.status == speed_status::ok);
+        });
+    }
+
+    // what the engine needs before the reply, false when it is not to be had
+    bool prepare_engine()
+    {
+        const bool checksum = (hello_.flags & speed_flag_checksum) != 0;
+        switch (hello_.engine) {
+        case speed_engine::write:
+            payload_.reset(new speed_payload(hello_.block_size, checksum));
+            return true;
+        case speed_engine::gather:
+            payload_.reset(new speed_payload(hello_.block_size, checksum, hello_.gather));
+            return true;
+        case speed_engine::sendfile:
+            try {
+                file_.reset(new payload_file(hello_.block_size));
+            }
+            catch (const std::exception& e) {
+                std::cerr << "-> sendfile: " << e.what() << std::endl;
+                return false;
+            }
+            return true;
+        case speed_engine::zerocopy: {
+            // the block is never written again, the kernel may hold on to it
+            const int on = 1;
+            if (::setsockopt(socket_.native_handle(), SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) != 0) {
+                std::cerr << "-> zerocopy: SO_ZEROCOPY not supported" << std::endl;
+                return false;
+            }
+            payload_.reset(new speed_payload(hello_.block_size, false));
+            return true;
+        }
+        }
+        return false;
+    }
+
+    void do_reply(bool accepted)
+    {
+        auto self(shared_from_this());
+        boost::asio::async_write(socket_, boost::asio::buffer(message_, speed_reply_size),
+            [this, self, accepted](boost::system::error_code ec, std::size_t /*length*/) {
+                if (ec || !accepted) {
                     return;
                 }
 
-                if (!ec) {
-                    do_write();
+                negotiated_ = true;
+                start_ = std::chrono::steady_clock::now();
+                deadline_ = start_ + std::chrono::milliseconds(hello_.duration_ms);
+                tests_.begin(hello_);
+
+                if (hello_.flags & speed_flag_udp) {
+                    udp_->add(hello_.test_id, hello_.stream);
+                    do_control();
+                    return;
+                }
+                if (sends(hello_.direction, true)) {
+                    switch (hello_.engine) {
+                    case speed_engine::write:
+                        do_write();
+                        break;
+                    case speed_engine::gather:
+                        do_gather();
+                        break;
+                    case speed_engine::sendfile:
+                        socket_.native_non_blocking(true);
+                        do_sendfile();
+                        break;
+                    case speed_engine::zerocopy:
+                        do_zerocopy();
+                        break;
+                    }
+                }
+                if (receives(hello_.direction, true)) {
+                    const bool checksum = (hello_.flags & speed_flag_checksum) != 0;
+                    verifier_.reset(new speed_verifier(hello_.block_size, checksum));
+                    buffer_.resize(std::max<std::size_t>(hello_.block_size, 64 * 1024));
+                    do_read();
                 }
         });
     }
 
+    // the bytes the next send may take, up to `most`; 0 once the total or
+    // the duration is spent
+    std::size_t allowance(std::size_t most) const
+    {
+        if (hello_.duration_ms && std::chrono::steady_clock::now() >= deadline_) {
+            return 0;
+        }
+        if (!hello_.total_bytes) {
+            return most;
+        }
+        if (sent_ >= hello_.total_bytes) {
+            return 0;
+        }
+        return static_cast<std::size_t>(std::min<std::uint64_t>(most, hello_.total_bytes - sent_));
+    }
+
+    // with checksums the total is rounded up to whole blocks, without the
+    // last block is cut short
+    std::size_t next_blocks(std::size_t blocks) const
+    {
+        const std::size_t size = allowance(blocks * hello_.block_size);
+        if (hello_.flags & speed_flag_checksum) {
+            return (size + hello_.block_size - 1) / hello_.block_size * hello_.block_size;
+        }
+        return size;
+    }
+
+    void finish_sending()
+    {
+        if (zerocopy_sends_) {
+            wait_zerocopy();
+        }
+        boost::system::error_code ignored;
+        socket_.shutdown(boost::asio::socket_base::shutdown_send, ignored);
+    }
+
     void do_write()
     {
-        iter_++;
-        if(iter_ > max_iter_) {
+        const std::size_t size = next_blocks(1);
+        if (!size) {
+            finish_sending();
             return;
         }
 
         auto self(shared_from_this());
-        boost::asio::async_write(socket_, boost::asio::buffer(data_),
+        boost::asio::async_write(socket_, boost::asio::buffer(payload_->next(), size),
             [this, self](boost::system::error_code ec, std::size_t length) {
-                accumulator_ += length;
+                sent_ += length;
                 if (!ec) {
                     do_write();
                 }
         });
     }
 
+    void do_gather()
+    {
+        std::size_t size = next_blocks(hello_.gather);
+        if (!size) {
+            finish_sending();
+            return;
+        }
+
+        gather_.clear();
+        for (; size; ) {
+            const std::size_t length = std::min<std::size_t>(size, hello_.block_size);
+            gather_.emplace_back(payload_->next(), length);
+            size -= length;
+        }
+
+        auto self(shared_from_this());
+        boost::asio::async_write(socket_, gather_,
+            [this, self](boost::system::error_code ec, std::size_t length) {
+                sent_ += length;
+                if (!ec) {
+                    do_gather();
+                }
+        });
+    }
+
+    void do_sendfile()
+    {
+        auto self(shared_from_this());
+        socket_.async_wait(boost::asio::socket_base::wait_write,
+            [this, self](boost::system::error_code ec) {
+                if (!ec) {
+                    sendfile_some();
+                }
+        });
+    }
+
+    // until the socket is full, or 4 MB went and the other sessions get a turn
+    void sendfile_some()
+    {
+        for (std::size_t burst = 0; burst < 4 * 1024 * 1024;) {
+            // the file is whole blocks, its offsets keep the pattern in step
+            off_t offset = static_cast<off_t>(sent_ % file_->size());
+            const std::size_t size = allowance(file_->size() - static_cast<std::size_t>(offset));
+            if (!size) {
+                finish_sending();
+                return;
+            }
+            const ssize_t n = ::sendfile(socket_.native_handle(), file_->fd(), &offset, size);
+            if (n > 0) {
+                sent_ += static_cast<std::size_t>(n);
+                burst += static_cast<std::size_t>(n);
+            }
+            else if (n < 0 && errno == EAGAIN) {
+                do_sendfile();
+                return;
+            }
+            else if (n < 0 && errno != EINTR) {
+                return;
+            }
+        }
+
+        auto self(shared_from_this());
+        io_service_.post([this, self]() {
+            sendfile_some();
+        });
+    }
+
+    void do_zerocopy()
+    {
+        std::size_t size = allowance(hello_.gather * hello_.block_size);
+        if (!size) {
+            finish_sending();
+            return;
+        }
+
+        // one block, as many times as it takes; a short send leaves the
+        // next one starting mid block
+        const char* block = payload_->next();
+        std::size_t offset = sent_ % hello_.block_size;
+        gather_.clear();
+        for (; size; offset = 0) {
+            const std::size_t length = std::min<std::size_t>(size, hello_.block_size - offset);
+            gather_.emplace_back(block + offset, length);
+            size -= length;
+        }
+
+        auto self(shared_from_this());
+        socket_.async_send(gather_, MSG_ZEROCOPY,
+            [this, self](boost::system::error_code ec, std::size_t length) {
+                sent_ += length;
+                zerocopy_sends_ += length ? 1 : 0;
+                reap_zerocopy();
+                if (!ec) {
+                    do_zerocopy();
+                }
+        });
+    }
+
+    // each zerocopy send is acknowledged on the error queue once the kernel
+    // is done with its pages, or copied them after all (loopback does)
+    void reap_zerocopy()
+    {
+        for (;;) {
+            char control[128];
+            msghdr message{};
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            if (::recvmsg(socket_.native_handle(), &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+                return;
+            }
+            for (cmsghdr* c = CMSG_FIRSTHDR(&message); c; c = CMSG_NXTHDR(&message, c)) {
+                const bool recverr = (c->cmsg_level == SOL_IP && c->cmsg_type == IP_RECVERR) ||
+                                     (c->cmsg_level == SOL_IPV6 && c->cmsg_type == IPV6_RECVERR);
+                if (!recverr) {
+                    continue;
+                }
+                const sock_extended_err* error = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(c));
+                if (error->ee_errno != 0 || error->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                    continue;
+                }
+                const std::uint64_t sends = error->ee_data - error->ee_info + 1;
+                zerocopy_completed_ += sends;
+                if (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                    zerocopy_copied_ += sends;
+                }
+            }
+        }
+    }
+
+    // the last acknowledgements, for the count; 100 ms at most
+    void wait_zerocopy()
+    {
+        const auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+        while (zerocopy_completed_ < zerocopy_sends_ && std::chrono::steady_clock::now() < until) {
+            pollfd descriptor{ socket_.native_handle(), 0, 0 };
+            ::poll(&descriptor, 1, 10);
+            reap_zerocopy();
+        }
+    }
+
+    void do_read()
+    {
+        auto self(shared_from_this());
+        socket_.async_read_some(boost::asio::buffer(buffer_),
+            [this, self](boost::system::error_code ec, std::size_t length) {
+                received_ += length;
+                verifier_->feed(buffer_.data(), length);
+                if (ec) {
+                    verifier_->finish();
+                }
+                else if (hello_.direction == speed_direction::pingpong) {
+                    do_echo(length);
+                }
+                else {
+                    do_read();
+                }
+        });
+    }
+
+    // UDP: the connection stays quiet until the client is done, the
+    // datagrams still on their way get a moment before the summary
+    void do_control()
+    {
+        auto self(shared_from_this());
+        socket_.async_read_some(boost::asio::buffer(message_),
+            [this, self](boost::system::error_code ec, std::size_t /*length*/) {
+                if (!ec) {
+                    do_control();
+                    return;
+                }
+                timer_.reset(new boost::asio::steady_timer(io_service_, std::chrono::milliseconds(200)));
+                timer_->async_wait([this, self](boost::system::error_code /*ec*/) {
+                    const speed_summary summary = udp_->remove(hello_.test_id, hello_.stream);
+                    datagrams_ = summary.datagrams;
+                    received_ = summary.bytes;
+                    speed_encode(summary, summary_.data());
+                    boost::asio::async_write(socket_, boost::asio::buffer(summary_),
+                        [this, self](boost::system::error_code /*ec*/, std::size_t /*length*/) {
+                    });
+                });
+        });
+    }
+
+    // pingpong: whatever came in goes back before the next read, the
+    // client's messages in flight queue up in the socket meanwhile
+    void do_echo(std::size_t length)
+    {
+        auto self(shared_from_this());
+        boost::asio::async_write(socket_, boost::asio::buffer(buffer_.data(), length),
+            [this, self](boost::system::error_code ec, std::size_t length) {
+                sent_ += length;
+                if (!ec) {
+                    do_read();
+                }
+        });
+    }
+
 private:
-    tcp::socket socket_;
-    size_t max_iter_;
+    boost::asio::io_service& io_service_;
+    stream_socket socket_;
+    test_registry& tests_;
+    udp_receiver* udp_;
+
+    std::array<unsigned char, speed_hello_size> message_;
+    std::array<unsigned char, speed_summary_size> summary_;
+    std::unique_ptr<boost::asio::steady_timer> timer_;
+    speed_hello hello_;
 
-    enum { max_length = 1024 * 8 };
-    std::array<char, max_length> data_;
+    std::unique_ptr<speed_payload> payload_;
+    std::unique_ptr<payload_file> file_;
+    std::vector<boost::asio::const_buffer> gather_;
+    std::unique_ptr<speed_verifier> verifier_;
+    std::vector<char> buffer_;
 
-    size_t iter_;
-    size_t accumulator_;
+    std::uint64_t sent_;
+    std::uint64_t received_;
+    bool negotiated_;
+    std::chrono::steady_clock::time_point start_;
+    std::chrono::steady_clock::time_point deadline_;
+
+    std::uint64_t zerocopy_sends_;
+    std::uint64_t zerocopy_completed_;
+    std::uint64_t zerocopy_copied_;
+    std::uint64_t datagrams_;
 };
 
+// Listens on one endpoint; on a TCP one the UDP tests come to the same port.
 class server
 {
 public:
-    server(boost::asio::io_service& io_service, short port) :
-        acceptor_(io_service, tcp::endpoint(tcp::v4(), port)),
-        socket_(io_service)
+    server(boost::asio::io_service& io_service, const stream_endpoint& endpoint, test_registry& tests, bool gro) :
+        io_service_(io_service),
+        endpoint_(endpoint),
+        acceptor_(io_service),
+        socket_(io_service),
+        tests_(tests)
     {
+        remove_stale_socket(endpoint_);
+        acceptor_.open(endpoint_.protocol());
+        if (!is_unix(endpoint_)) {
+            acceptor_.set_option(stream_acceptor::reuse_address(true));
+            udp_.reset(new udp_receiver(io_service, to_tcp(endpoint_).port(), gro));
+        }
+        acceptor_.bind(endpoint_);
+        acceptor_.listen();
+        std::clog << "<- listening: " << to_string(endpoint_) << std::endl;
+
         do_accept();
     }
 
+    ~server()
+    {
+        boost::system::error_code ignored;
+        acceptor_.close(ignored);
+        remove_stale_socket(endpoint_);
+    }
+
 private:
     void do_accept()
     {
         acceptor_.async_accept(socket_, [this](boost::system::error_code ec) {
             if (!ec) {
-                std::make_shared<session>(std::move(socket_))->start();
+                std::make_shared<session>(io_service_, std::move(socket_), tests_, udp_.get())->start();
             }
 
             do_accept();
         });
     }
 
-    tcp::acceptor acceptor_;
-    tcp::socket socket_;
+    boost::asio::io_service& io_service_;
+    stream_endpoint endpoint_;
+    stream_acceptor acceptor_;
+    stream_socket socket_;
+    test_registry& tests_;
+    std::unique_ptr<udp_receiver> udp_;
 };
 
 int main(int argc, char* argv[])
 {
     try {
-        if (argc != 2) {
-            std::cerr << "Usage: " << argv[0] << " <port>\n";
+        po::options_description description("Usage: asio_speed_server <endpoint>... [options]");
+        po::positional_options_description positional;
+        description.add_options()
+            ("help,h", "print this message")
+            ("listen", po::value<std::vector<std::string>>(), "TCP and UDP port, host:port, unix:/path or unix:@abstract-name; repeatable")
+            ("busy-poll", "spin in io_service::poll instead of sleeping in epoll")
+            ("udp-gro", "receive UDP with GRO, runs of datagrams in one buffer");
+        positional.add("listen", -1);
+
+        po::variables_map options;
+        po::store(po::command_line_parser(argc, argv).options(description).positional(positional).run(), options);
+        po::notify(options);
+
+        if (options.count("help") || !options.count("listen")) {
+            std::cerr << description << "\n";
             return 1;
         }
+        const bool busy_poll = options.count("busy-poll") != 0;
 
         //std::clog.setstate(std::ios_base::failbit);
 
         boost::asio::io_service io_service;
-        server s(io_service, std::atoi(argv[1]));
+        test_registry tests;
+        std::vector<std::unique_ptr<server>> servers;
+        for (const std::string& listen : options["listen"].as<std::vector<std::string>>()) {
+            servers.emplace_back(new server(io_service, parse_stream_endpoint(listen), tests, options.count("udp-gro") != 0));
+        }
 
-        std::clog << "<- io_service run" << std::endl;
+        std::clog << "<- io_service run" << (busy_poll ? " busy polling" : "") << std::endl;
 
-        io_service.run();
+        // busy polling spins on a zero timeout epoll_wait instead of sleeping
+        // in it, a core for the latency of the wakeup
+        if (busy_poll) {
+            while (!io_service.stopped()) {
+                io_service.poll();
+            }
+        }
+        else {
+            io_service.run();
+        }
 
         std::clog << "<- io_service done" << std::endl;
     }
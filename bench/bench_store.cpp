@@ -0,0 +1,904 @@
+// Keeps benchmark results per commit and per machine and compares them.
+//
+//     bench_store record  --store DIR --name NAME FILE...
+//     bench_store run     --store DIR --name NAME [--runs N] [--keep-failed] -- COMMAND...
+//     bench_store compare --store DIR --baseline COMMIT [--candidate COMMIT]
+//     bench_store list    --store DIR
+//
+// A run is stored as DIR/<machine>/<commit>/<name>.<time>.json holding
+// named metrics, each with the direction that is better. Recorded files may
+// be the JSON of asio_http_load_client, http_bench, the parser benchmark or
+// asio_speed_client, or the speed client's text output. `run` repeats a
+// command and records each run that exits with 0, or every run with
+// --keep-failed; an argument holding {out} is replaced with a file to read
+// the results from, otherwise the output is read.
+//
+// compare takes every metric both commits have on one machine. With two or
+// more runs on each side the means are compared with Welch's t-test, and a
+// change for the worse beyond the threshold counts as a regression only if
+// it is also significant. With a single run the threshold alone decides and
+// the verdict is marked unverified.
+//
+
+#include <cmath>
+#include <ctime>
+#include <cerrno>
+#include <cctype>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/utsname.h>
+
+// The little of JSON the inputs use.
+struct json_value
+{
+    enum class kind { null, boolean, number, string, array, object };
+
+    kind type = kind::null;
+    double number = 0;
+    std::string string;
+    std::vector<json_value> items;
+    std::vector<std::pair<std::string, json_value>> members;
+
+    const json_value* get(const std::string& key) const
+    {
+        for (const auto& member : members) {
+            if (member.first == key) {
+                return &member.second;
+            }
+        }
+        return nullptr;
+    }
+
+    double get_number(const std::string& key, double def = 0) const
+    {
+        const json_value* value = get(key);
+        return value && value->type == kind::number ? value->number : def;
+    }
+
+    std::string get_string(const std::string& key) const
+    {
+        const json_value* value = get(key);
+        return value && value->type == kind::string ? value->string : std::string();
+    }
+};
+
+class json_parser
+{
+public:
+    explicit json_parser(const std::string& text) :
+        text_(text),
+        at_(0)
+    {
+    }
+
+    json_value parse()
+    {
+        json_value value = parse_value();
+        skip_spaces();
+        if (at_ != text_.size()) {
+            fail("trailing characters");
+        }
+        return value;
+    }
+
+private:
+    json_value parse_value()
+    {
+        skip_spaces();
+        json_value value;
+        const char c = peek();
+        if (c == '{') {
+            value.type = json_value::kind::object;
+            at_++;
+            if (!consume('}')) {
+                do {
+                    skip_spaces();
+                    std::string key = parse_string();
+                    skip_spaces();
+                    expect(':');
+                    value.members.emplace_back(std::move(key), parse_value());
+                    skip_spaces();
+                } while (consume(','));
+                expect('}');
+            }
+        }
+        else if (c == '[') {
+            value.type = json_value::kind::array;
+            at_++;
+            if (!consume(']')) {
+                do {
+                    value.items.push_back(parse_value());
+                    skip_spaces();
+                } while (consume(','));
+                expect(']');
+            }
+        }
+        else if (c == '"') {
+            value.type = json_value::kind::string;
+            value.string = parse_string();
+        }
+        else if (text_.compare(at_, 4, "true") == 0 || text_.compare(at_, 5, "false") == 0) {
+            value.type = json_value::kind::boolean;
+            value.number = c == 't';
+            at_ += c == 't' ? 4 : 5;
+        }
+        else if (text_.compare(at_, 4, "null") == 0) {
+            at_ += 4;
+        }
+        else {
+            const char* first = text_.c_str() + at_;
+            char* end = nullptr;
+            value.type = json_value::kind::number;
+            value.number = std::strtod(first, &end);
+            if (end == first) {
+                fail("value expected");
+            }
+            at_ += end - first;
+        }
+        return value;
+    }
+
+    // only \" and \\ are unescaped, names and labels hold nothing else
+    std::string parse_string()
+    {
+        expect('"');
+        std::string value;
+        while (peek() != '"') {
+            char c = text_[at_++];
+            if (c == '\\') {
+                c = peek();
+                at_++;
+            }
+            value.push_back(c);
+        }
+        at_++;
+        return value;
+    }
+
+    void skip_spaces()
+    {
+        while (at_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[at_]))) {
+            at_++;
+        }
+    }
+
+    char peek()
+    {
+        if (at_ >= text_.size()) {
+            fail("unexpected end");
+        }
+        return text_[at_];
+    }
+
+    bool consume(char c)
+    {
+        skip_spaces();
+        if (at_ < text_.size() && text_[at_] == c) {
+            at_++;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char c)
+    {
+        if (!consume(c)) {
+            fail(std::string("'") + c + "' expected");
+        }
+    }
+
+    void fail(const std::string& what)
+    {
+        throw std::runtime_error("bad json at offset " + std::to_string(at_) + ": " + what);
+    }
+
+    const std::string& text_;
+    std::size_t at_;
+};
+
+struct metric
+{
+    double value;
+    std::string unit;
+    bool higher_is_better;
+};
+
+typedef std::map<std::string, metric> metric_set;
+
+struct stored_run
+{
+    std::string benchmark;
+    std::string commit;
+    std::string machine;
+    std::string time;
+    metric_set metrics;
+};
+
+std::string read_file(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("can not read " + path);
+    }
+    std::stringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+std::string run_command(const std::string& command)
+{
+    std::unique_ptr<FILE, int (*)(FILE*)> pipe(::popen(command.c_str(), "r"), ::pclose);
+    std::string out;
+    if (pipe) {
+        char buffer[4096];
+        std::size_t length;
+        while ((length = std::fread(buffer, 1, sizeof(buffer), pipe.get())) > 0) {
+            out.append(buffer, length);
+        }
+    }
+    while (!out.empty() && (out.back() == '\n' || out.back() == '\r')) {
+        out.pop_back();
+    }
+    return out;
+}
+
+// the checked out commit, "-dirty" when tracked files are modified
+std::string current_commit()
+{
+    const std::string commit = run_command("git rev-parse --short=12 HEAD 2>/dev/null");
+    if (commit.empty()) {
+        return "unknown";
+    }
+    const bool dirty = !run_command("git status --porcelain --untracked-files=no 2>/dev/null").empty();
+    return dirty ? commit + "-dirty" : commit;
+}
+
+// letters, digits and '-' only, runs of anything else folded into one '-'
+std::string sanitize(const std::string& text)
+{
+    std::string out;
+    for (const char c : text) {
+        if (std::isalnum(static_cast<unsigned char>(c))) {
+            out.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+        }
+        else if (!out.empty() && out.back() != '-') {
+            out.push_back('-');
+        }
+    }
+    while (!out.empty() && out.back() == '-') {
+        out.pop_back();
+    }
+    return out;
+}
+
+std::string proc_field(const std::string& path, const std::string& name)
+{
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.compare(0, name.size(), name) == 0) {
+            const std::size_t colon = line.find(':');
+            if (colon != std::string::npos) {
+                const std::size_t first = line.find_first_not_of(" \t", colon + 1);
+                return first == std::string::npos ? std::string() : line.substr(first);
+            }
+        }
+    }
+    return std::string();
+}
+
+// "<cpu model>-<cores>c-<hash>": the hash covers the model, the core count,
+// the memory size and the kernel, results of any two machines that differ
+// in one of them are not compared
+std::string machine_fingerprint()
+{
+    const std::string model = proc_field("/proc/cpuinfo", "model name");
+    const long cores = ::sysconf(_SC_NPROCESSORS_ONLN);
+    const std::string memory = proc_field("/proc/meminfo", "MemTotal");
+    utsname name;
+    const std::string kernel = ::uname(&name) == 0 ? std::string(name.release) : std::string();
+
+    // FNV-1a
+    std::uint32_t hash = 2166136261u;
+    for (const char c : model + "|" + std::to_string(cores) + "|" + memory + "|" + kernel) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+    }
+
+    std::string cpu = sanitize(model);
+    if (cpu.empty()) {
+        cpu = "cpu";
+    }
+    if (cpu.size() > 40) {
+        cpu.resize(40);
+    }
+    char suffix[32];
+    std::snprintf(suffix, sizeof(suffix), "-%ldc-%08x", cores, hash);
+    return cpu + suffix;
+}
+
+std::string now_utc()
+{
+    const std::time_t now = std::time(nullptr);
+    std::tm utc;
+    ::gmtime_r(&now, &utc);
+    char text[32];
+    std::strftime(text, sizeof(text), "%Y%m%dT%H%M%SZ", &utc);
+    return text;
+}
+
+void add_metric(metric_set& metrics, const std::string& name, double value, const std::string& unit, bool higher)
+{
+    metrics[name] = metric{ value, unit, higher };
+}
+
+void add_latencies(metric_set& metrics, const std::string& prefix, const json_value& latency)
+{
+    for (const char* key : { "p50", "p99", "p999", "p9999" }) {
+        if (latency.get(key)) {
+            add_metric(metrics, prefix + key + "_us", latency.get_number(key), "us", false);
+        }
+    }
+}
+
+// "bandwidth: 9.41 GBit/s" from asio_speed_client, in MBit/s
+bool read_speed_client(const std::string& text, metric_set& metrics)
+{
+    const std::size_t at = text.rfind("bandwidth: ");
+    if (at == std::string::npos) {
+        return false;
+    }
+    std::istringstream line(text.substr(at + 11));
+    double value = 0;
+    std::string unit;
+    if (!(line >> value >> unit)) {
+        return false;
+    }
+    if (unit == "GBit/s") value *= 1000;
+    else if (unit == "KBit/s") value /= 1000;
+    else if (unit == "Bit/s") value /= 1000000;
+    else if (unit != "MBit/s") return false;
+
+    add_metric(metrics, "bandwidth", value, "MBit/s", true);
+    return true;
+}
+
+// Turns whatever a benchmark wrote into metrics.
+metric_set read_results(const std::string& text)
+{
+    metric_set metrics;
+
+    const std::size_t first = text.find_first_not_of(" \t\r\n");
+    if (first == std::string::npos || (text[first] != '{' && text[first] != '[')) {
+        if (!read_speed_client(text, metrics)) {
+            throw std::runtime_error("no results recognized");
+        }
+        return metrics;
+    }
+
+    const json_value root = json_parser(text).parse();
+    if (root.type == json_value::kind::array) {
+        // http_bench: a row per server, mode and concurrency level
+        for (const json_value& row : root.items) {
+            // a failed run has no numbers to record
+            const json_value* failed = row.get("failed");
+            if (failed && failed->number != 0) {
+                continue;
+            }
+            const std::string prefix = row.get_string("server") + "/" + row.get_string("mode") + "/" +
+                std::to_string(static_cast<long long>(row.get_number("connections"))) + "/";
+            add_metric(metrics, prefix + "rps", row.get_number("rps"), "rps", true);
+            add_metric(metrics, prefix + "p50_us", row.get_number("p50_us"), "us", false);
+            add_metric(metrics, prefix + "p99_us", row.get_number("p99_us"), "us", false);
+            add_metric(metrics, prefix + "p999_us", row.get_number("p999_us"), "us", false);
+            add_metric(metrics, prefix + "non_2xx", row.get_number("non_2xx"), "", false);
+            add_metric(metrics, prefix + "errors", row.get_number("errors"), "", false);
+        }
+    }
+    else if (const json_value* stored = root.get("metrics")) {
+        // already named metrics: the parser benchmark, or a stored run
+        for (const auto& member : stored->members) {
+            add_metric(metrics, member.first, member.second.get_number("value"), member.second.get_string("unit"),
+                       member.second.get_string("better") != "lower");
+        }
+    }
+    else if (root.get_string("transport") == "udp") {
+        // asio_speed_client --udp: a row per datagram size
+        const json_value* rows = root.get("results");
+        for (std::size_t i = 0; rows && i < rows->items.size(); i++) {
+            const json_value& row = rows->items[i];
+            const std::string prefix = "udp/" + std::to_string(static_cast<long long>(row.get_number("size"))) + "/";
+            add_metric(metrics, prefix + "received_pps", row.get_number("received_pps"), "pps", true);
+            add_metric(metrics, prefix + "received_gbps", row.get_number("received_gbps"), "GBit/s", true);
+            add_metric(metrics, prefix + "loss", row.get_number("loss") * 100, "%", false);
+        }
+    }
+    else if (root.get("bandwidth_gbps")) {
+        // asio_speed_client
+        add_metric(metrics, "bandwidth", root.get_number("bandwidth_gbps") * 1000, "MBit/s", true);
+        add_metric(metrics, "cpu_seconds_per_gb", root.get_number("cpu_seconds_per_gb"), "s", false);
+        if (const json_value* fairness = root.get("per_connection_gbps")) {
+            add_metric(metrics, "min_connection", fairness->get_number("min") * 1000, "MBit/s", true);
+        }
+        if (const json_value* latency = root.get("latency_us")) {
+            // pingpong
+            add_metric(metrics, "messages_per_second", root.get_number("messages_per_second"), "msg/s", true);
+            add_metric(metrics, "cpu_us_per_message", root.get_number("cpu_us_per_message"), "us", false);
+            add_latencies(metrics, "", *latency);
+        }
+    }
+    else if (root.get("rps")) {
+        // asio_http_load_client
+        add_metric(metrics, "rps", root.get_number("rps"), "rps", true);
+        if (const json_value* latency = root.get("latency_us")) {
+            add_latencies(metrics, "", *latency);
+        }
+        add_metric(metrics, "non_2xx", root.get_number("non_2xx"), "", false);
+        add_metric(metrics, "errors", root.get_number("errors") + root.get_number("timeouts") +
+                   root.get_number("connect_errors"), "", false);
+    }
+    if (metrics.empty()) {
+        throw std::runtime_error("no results recognized");
+    }
+    return metrics;
+}
+
+void make_directories(const std::string& path)
+{
+    for (std::size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1)) {
+        const std::string prefix = path.substr(0, slash);
+        if (::mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) {
+            throw std::runtime_error("can not create " + prefix);
+        }
+        if (slash == std::string::npos) {
+            break;
+        }
+    }
+}
+
+std::vector<std::string> list_directory(const std::string& path, bool directories)
+{
+    std::vector<std::string> names;
+    std::unique_ptr<DIR, int (*)(DIR*)> dir(::opendir(path.c_str()), ::closedir);
+    if (!dir) {
+        return names;
+    }
+    while (dirent* entry = ::readdir(dir.get())) {
+        const std::string name = entry->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        struct stat info;
+        if (::stat((path + "/" + name).c_str(), &info) == 0 && S_ISDIR(info.st_mode) == directories) {
+            names.push_back(name);
+        }
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+void write_escaped(std::ostream& out, const std::string& text)
+{
+    out << '"';
+    for (const char c : text) {
+        if (c == '"' || c == '\\') {
+            out << '\\';
+        }
+        out << c;
+    }
+    out << '"';
+}
+
+std::string store_run(const std::string& store, const stored_run& run)
+{
+    const std::string directory = store + "/" + run.machine + "/" + run.commit;
+    make_directories(directory);
+
+    // runs recorded within the same second get a counter
+    std::string path = directory + "/" + run.benchmark + "." + run.time + ".json";
+    for (int i = 1; ::access(path.c_str(), F_OK) == 0; i++) {
+        path = directory + "/" + run.benchmark + "." + run.time + "-" + std::to_string(i) + ".json";
+    }
+
+    std::ofstream out(path);
+    out << std::setprecision(10);
+    out << "{\"benchmark\":";
+    write_escaped(out, run.benchmark);
+    out << ",\"commit\":";
+    write_escaped(out, run.commit);
+    out << ",\"machine\":";
+    write_escaped(out, run.machine);
+    out << ",\"time\":";
+    write_escaped(out, run.time);
+    out << ",\"metrics\":{";
+    bool first = true;
+    for (const auto& entry : run.metrics) {
+        out << (first ? "\n" : ",\n");
+        write_escaped(out, entry.first);
+        out << ":{\"value\":" << entry.second.value << ",\"unit\":";
+        write_escaped(out, entry.second.unit);
+        out << ",\"better\":\"" << (entry.second.higher_is_better ? "higher" : "lower") << "\"}";
+        first = false;
+    }
+    out << "\n}}\n";
+    if (!out) {
+        throw std::runtime_error("can not write " + path);
+    }
+    return path;
+}
+
+std::vector<stored_run> load_runs(const std::string& store, const std::string& machine, const std::string& commit)
+{
+    std::vector<stored_run> runs;
+    const std::string directory = store + "/" + machine + "/" + commit;
+    for (const std::string& name : list_directory(directory, false)) {
+        const std::string text = read_file(directory + "/" + name);
+        const json_value root = json_parser(text).parse();
+        stored_run run;
+        run.benchmark = root.get_string("benchmark");
+        run.commit = root.get_string("commit");
+        run.machine = root.get_string("machine");
+        run.time = root.get_string("time");
+        run.metrics = read_results(text);
+        runs.push_back(run);
+    }
+    return runs;
+}
+
+// Regularized incomplete beta I_x(a, b), by its continued fraction.
+double incomplete_beta(double a, double b, double x)
+{
+    if (x <= 0) return 0;
+    if (x >= 1) return 1;
+    if (x > (a + 1) / (a + b + 2)) {
+        return 1 - incomplete_beta(b, a, 1 - x);
+    }
+
+    const double front = std::exp(std::lgamma(a + b) - std::lgamma(a) - std::lgamma(b) +
+                                  a * std::log(x) + b * std::log(1 - x)) / a;
+    const double tiny = 1e-300;
+    double c = 1;
+    double d = 1 - (a + b) * x / (a + 1);
+    d = 1 / (std::fabs(d) < tiny ? tiny : d);
+    double f = d;
+    for (int m = 1; m <= 300; m++) {
+        for (int odd = 0; odd < 2; odd++) {
+            const double numerator = odd
+                ? -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1))
+                : m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m));
+            d = 1 + numerator * d;
+            d = 1 / (std::fabs(d) < tiny ? tiny : d);
+            c = 1 + numerator / c;
+            c = std::fabs(c) < tiny ? tiny : c;
+            f *= c * d;
+        }
+        if (std::fabs(c * d - 1) < 1e-12) {
+            break;
+        }
+    }
+    return front * f;
+}
+
+struct sample
+{
+    std::vector<double> values;
+
+    double mean() const
+    {
+        double sum = 0;
+        for (const double v : values) sum += v;
+        return sum / values.size();
+    }
+
+    double variance() const
+    {
+        const double m = mean();
+        double sum = 0;
+        for (const double v : values) sum += (v - m) * (v - m);
+        return values.size() > 1 ? sum / (values.size() - 1) : 0;
+    }
+};
+
+// Two-sided p-value of Welch's t-test for equal means.
+double welch_p_value(const sample& a, const sample& b)
+{
+    const double va = a.variance() / a.values.size();
+    const double vb = b.variance() / b.values.size();
+    const double difference = std::fabs(a.mean() - b.mean());
+    if (va + vb == 0) {
+        return difference == 0 ? 1 : 0;
+    }
+    const double t = difference / std::sqrt(va + vb);
+    const double df = (va + vb) * (va + vb) /
+        (va * va / (a.values.size() - 1) + vb * vb / (b.values.size() - 1));
+    return incomplete_beta(df / 2, 0.5, df / (df + t * t));
+}
+
+struct compare_settings
+{
+    std::string store;
+    std::string machine;
+    std::string baseline;
+    std::string candidate;
+    std::string benchmark;          // empty: all
+    double threshold = 5;           // percent
+    double alpha = 0.05;
+};
+
+// samples of each "benchmark:metric"
+std::map<std::string, sample> collect(const std::vector<stored_run>& runs, const std::string& benchmark,
+                                      std::map<std::string, metric>& kinds)
+{
+    std::map<std::string, sample> samples;
+    for (const stored_run& run : runs) {
+        if (!benchmark.empty() && run.benchmark != benchmark) {
+            continue;
+        }
+        for (const auto& entry : run.metrics) {
+            const std::string key = run.benchmark + ":" + entry.first;
+            samples[key].values.push_back(entry.second.value);
+            kinds[key] = entry.second;
+        }
+    }
+    return samples;
+}
+
+int compare(const compare_settings& settings)
+{
+    std::map<std::string, metric> kinds;
+    const std::map<std::string, sample> baseline =
+        collect(load_runs(settings.store, settings.machine, settings.baseline), settings.benchmark, kinds);
+    const std::map<std::string, sample> candidate =
+        collect(load_runs(settings.store, settings.machine, settings.candidate), settings.benchmark, kinds);
+    if (baseline.empty() || candidate.empty()) {
+        throw std::runtime_error("no runs of " + (baseline.empty() ? settings.baseline : settings.candidate) +
+                                 " on " + settings.machine);
+    }
+
+    std::cout << "#> machine: " << settings.machine << "\n"
+              << "#> baseline: " << settings.baseline << " candidate: " << settings.candidate
+              << " threshold: " << settings.threshold << "% alpha: " << settings.alpha << "\n";
+    std::cout << std::left << std::setw(48) << "metric" << std::right
+              << std::setw(14) << "baseline" << std::setw(14) << "candidate"
+              << std::setw(9) << "change" << std::setw(7) << "runs" << std::setw(9) << "p"
+              << "  verdict\n";
+
+    int regressions = 0;
+    for (const auto& entry : candidate) {
+        const auto base = baseline.find(entry.first);
+        if (base == baseline.end()) {
+            continue;
+        }
+        const sample& a = base->second;
+        const sample& b = entry.second;
+        const metric& kind = kinds[entry.first];
+
+        const double before = a.mean();
+        const double after = b.mean();
+        const double change = before != 0 ? (after - before) / std::fabs(before) * 100 : (after != 0 ? 100 : 0);
+        const double worse = kind.higher_is_better ? -change : change;
+        const bool repeated = a.values.size() > 1 && b.values.size() > 1;
+        const double p = repeated ? welch_p_value(a, b) : 1;
+        const bool significant = !repeated || p < settings.alpha;
+
+        std::string verdict = "ok";
+        if (std::fabs(worse) > settings.threshold && significant) {
+            verdict = worse > 0 ? "REGRESSION" : "improvement";
+            if (!repeated) {
+                verdict += " (unverified)";
+            }
+            if (worse > 0) {
+                regressions++;
+            }
+        }
+        else if (std::fabs(worse) > settings.threshold) {
+            verdict = "noise";
+        }
+
+        std::ostringstream runs;
+        runs << a.values.size() << "/" << b.values.size();
+        std::ostringstream probability;
+        if (repeated) {
+            probability << std::setprecision(3) << p;
+        }
+        else {
+            probability << "-";
+        }
+
+        std::cout << std::left << std::setw(48) << entry.first << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(14) << before << std::setw(14) << after
+                  << std::setw(8) << std::showpos << change << std::noshowpos << "%"
+                  << std::setw(7) << runs.str() << std::setw(9) << probability.str()
+                  << "  " << verdict << "\n";
+        std::cout.unsetf(std::ios::fixed);
+    }
+
+    std::cout << "#> regressions: " << regressions << std::endl;
+    return regressions ? 1 : 0;
+}
+
+void list(const std::string& store)
+{
+    for (const std::string& machine : list_directory(store, true)) {
+        std::cout << machine << "\n";
+        for (const std::string& commit : list_directory(store + "/" + machine, true)) {
+            std::map<std::string, int> counts;
+            for (const std::string& name : list_directory(store + "/" + machine + "/" + commit, false)) {
+                counts[name.substr(0, name.find('.'))]++;
+            }
+            std::cout << "  " << commit;
+            for (const auto& count : counts) {
+                std::cout << " " << count.first << "x" << count.second;
+            }
+            std::cout << "\n";
+        }
+    }
+}
+
+int run_repeated(const std::string& command, const std::string& out_file, std::string& output)
+{
+    const std::string capture = out_file + ".log";
+    const int status = std::system((command + " > '" + capture + "' 2>&1").c_str());
+    output = read_file(command.find(out_file) != std::string::npos ? out_file : capture);
+    std::remove(capture.c_str());
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+void usage()
+{
+    std::cerr << "Usage: bench_store record  --store DIR --name NAME [--commit ID] FILE...\n"
+              << "       bench_store run     --store DIR --name NAME [--commit ID] [--runs 5] [--keep-failed]\n"
+              << "                           -- COMMAND...\n"
+              << "       bench_store compare --store DIR --baseline ID [--candidate ID] [--benchmark NAME]\n"
+              << "                           [--threshold 5] [--alpha 0.05] [--machine NAME]\n"
+              << "       bench_store list    --store DIR\n"
+              << "  the commit defaults to the checked out one, the machine to this one\n";
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        if (argc < 2) {
+            usage();
+            return 1;
+        }
+        const std::string action = argv[1];
+
+        std::string name;
+        std::string commit;
+        int runs = 5;
+        bool keep_failed = false;
+        std::vector<std::string> rest;
+        compare_settings settings;
+        for (int i = 2; i < argc; i++) {
+            const std::string option = argv[i];
+            if (option == "--") {
+                rest.assign(argv + i + 1, argv + argc);
+                break;
+            }
+            if (option.compare(0, 2, "--") != 0) {
+                rest.push_back(option);
+                continue;
+            }
+            if (option == "--keep-failed") {
+                keep_failed = true;
+                continue;
+            }
+            if (i + 1 == argc) {
+                usage();
+                return 1;
+            }
+            const std::string value = argv[++i];
+            if (option == "--store") settings.store = value;
+            else if (option == "--name") name = sanitize(value);
+            else if (option == "--commit") commit = value;
+            else if (option == "--runs") runs = std::stoi(value);
+            else if (option == "--baseline") settings.baseline = value;
+            else if (option == "--candidate") settings.candidate = value;
+            else if (option == "--benchmark") settings.benchmark = value;
+            else if (option == "--threshold") settings.threshold = std::stod(value);
+            else if (option == "--alpha") settings.alpha = std::stod(value);
+            else if (option == "--machine") settings.machine = value;
+            else {
+                usage();
+                return 1;
+            }
+        }
+        if (settings.store.empty()) {
+            usage();
+            return 1;
+        }
+
+        if (action == "list") {
+            list(settings.store);
+            return 0;
+        }
+
+        if (settings.machine.empty()) {
+            settings.machine = machine_fingerprint();
+        }
+        if (commit.empty()) {
+            commit = current_commit();
+        }
+
+        if (action == "compare") {
+            if (settings.baseline.empty()) {
+                usage();
+                return 1;
+            }
+            if (settings.candidate.empty()) {
+                settings.candidate = commit;
+            }
+            return compare(settings);
+        }
+
+        if ((action != "record" && action != "run") || name.empty() || rest.empty()) {
+            usage();
+            return 1;
+        }
+
+        stored_run run;
+        run.benchmark = name;
+        run.commit = commit;
+        run.machine = settings.machine;
+
+        if (action == "record") {
+            for (const std::string& file : rest) {
+                run.time = now_utc();
+                run.metrics = read_results(read_file(file));
+                std::cout << "#> " << store_run(settings.store, run) << std::endl;
+            }
+            return 0;
+        }
+
+        const std::string out_file = "/tmp/bench_store." + std::to_string(::getpid()) + ".out";
+        std::string command;
+        for (const std::string& word : rest) {
+            std::string argument = word;
+            const std::size_t at = argument.find("{out}");
+            if (at != std::string::npos) {
+                argument.replace(at, 5, out_file);
+            }
+            command += (command.empty() ? "'" : " '") + argument + "'";
+        }
+        int failed = 0;
+        for (int i = 0; i < runs; i++) {
+            std::string output;
+            const int status = run_repeated(command, out_file, output);
+            std::remove(out_file.c_str());
+            if (status != 0) {
+                failed++;
+                if (!keep_failed) {
+                    std::cerr << "#> run " << i + 1 << " exited with " << status << ", skipped" << std::endl;
+                    continue;
+                }
+                std::cerr << "#> run " << i + 1 << " exited with " << status << ", recording anyway" << std::endl;
+            }
+            run.time = now_utc();
+            run.metrics = read_results(output);
+            std::cout << "#> run " << i + 1 << "/" << runs << ": " << store_run(settings.store, run) << std::endl;
+        }
+        return failed ? 1 : 0;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "#> main exception: " << e.what() << std::endl;
+    }
+
+    return 1;
+}
@@ -0,0 +1,457 @@
+// Starts each server in turn on localhost, drives it with
+// asio_http_load_client for every mode and concurrency level, and reports
+// throughput, latency percentiles, the server's CPU use and its peak RSS as
+// a table and as JSON. A server is given as
+//
+//     --server "NAME ENDPOINT COMMAND [ARGS...]"
+//
+// and has to accept connections on ENDPOINT within ten seconds of starting:
+// a port on localhost, or unix:/path or unix:@abstract-name for a UNIX
+// socket, so the same server can be measured over both.
+//
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+struct server_spec
+{
+    std::string name;
+    std::string endpoint;           // a port, or unix:/path or unix:@abstract-name
+    std::vector<std::string> command;
+};
+
+struct bench_settings
+{
+    std::string client;
+    std::vector<server_spec> servers;
+    std::vector<std::string> modes = { "keep-alive", "close" };
+    std::vector<int> connections = { 16, 64, 256 };
+    std::string duration = "10s";
+    std::string warmup = "2s";
+    int client_threads = 0;         // 0: the client's default
+    std::string path = "/";
+    std::string json = "bench.json";
+};
+
+struct bench_row
+{
+    std::string server;
+    std::string mode;
+    int connections;
+    double rps;
+    double p50;
+    double p99;
+    double p999;
+    double cpu;                     // percent of one core
+    double rss;                     // peak, MB
+    long long non_2xx;              // answered, but not with a 2xx
+    long long errors;               // failed, timed out or not connected
+    bool failed;                    // the measured run exited with an error or wrote no results
+};
+
+std::vector<std::string> split(const std::string& text, char separator)
+{
+    std::vector<std::string> parts;
+    std::stringstream stream(text);
+    std::string part;
+    while (std::getline(stream, part, separator)) {
+        if (!part.empty()) {
+            parts.push_back(part);
+        }
+    }
+    return parts;
+}
+
+server_spec parse_server(const std::string& text)
+{
+    const std::vector<std::string> words = split(text, ' ');
+    if (words.size() < 3) {
+        throw std::runtime_error("bad server, NAME ENDPOINT COMMAND expected: " + text);
+    }
+    server_spec spec;
+    spec.name = words[0];
+    spec.endpoint = words[1];
+    spec.command.assign(words.begin() + 2, words.end());
+    return spec;
+}
+
+pid_t spawn(const std::vector<std::string>& command, const std::string& output)
+{
+    const pid_t pid = ::fork();
+    if (pid < 0) {
+        throw std::runtime_error("fork failed");
+    }
+    if (pid == 0) {
+        const int fd = ::open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            ::dup2(fd, STDOUT_FILENO);
+            ::dup2(fd, STDERR_FILENO);
+            ::close(fd);
+        }
+        std::vector<char*> argv;
+        for (const std::string& word : command) {
+            argv.push_back(const_cast<char*>(word.c_str()));
+        }
+        argv.push_back(nullptr);
+        ::execv(argv[0], argv.data());
+        std::_Exit(127);
+    }
+    return pid;
+}
+
+int wait_exit(pid_t pid)
+{
+    int status = 0;
+    ::waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+void stop(pid_t pid)
+{
+    ::kill(pid, SIGTERM);
+    for (int i = 0; i < 50; i++) {
+        int status = 0;
+        if (::waitpid(pid, &status, WNOHANG) == pid) {
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    ::kill(pid, SIGKILL);
+    wait_exit(pid);
+}
+
+bool is_unix(const std::string& endpoint)
+{
+    return endpoint.compare(0, 5, "unix:") == 0;
+}
+
+bool accepting(const std::string& endpoint)
+{
+    if (!is_unix(endpoint)) {
+        const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address;
+        std::memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(static_cast<unsigned short>(std::stoi(endpoint)));
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        const bool connected = ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+        ::close(fd);
+        return connected;
+    }
+
+    // unix:@name is in the abstract namespace, a leading NUL and no terminator
+    const std::string path = endpoint.substr(5);
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("bad unix socket: " + endpoint);
+    }
+    std::memcpy(address.sun_path, path.data(), path.size());
+    socklen_t length = sizeof(address);
+    if (path[0] == '@') {
+        address.sun_path[0] = '\0';
+        length = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + path.size());
+    }
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    const bool connected = ::connect(fd, reinterpret_cast<sockaddr*>(&address), length) == 0;
+    ::close(fd);
+    return connected;
+}
+
+// user + system time of a process, seconds
+double cpu_seconds(pid_t pid)
+{
+    std::ifstream file("/proc/" + std::to_string(pid) + "/stat");
+    std::string text;
+    std::getline(file, text);
+    // the fields after the command name, which may hold spaces
+    const std::size_t paren = text.rfind(')');
+    if (paren == std::string::npos) {
+        return 0;
+    }
+    std::istringstream fields(text.substr(paren + 2));
+    std::string field;
+    unsigned long long utime = 0;
+    unsigned long long stime = 0;
+    for (int i = 3; fields >> field; i++) {
+        if (i == 14) utime = std::stoull(field);
+        if (i == 15) {
+            stime = std::stoull(field);
+            break;
+        }
+    }
+    return static_cast<double>(utime + stime) / ::sysconf(_SC_CLK_TCK);
+}
+
+// peak resident set, MB
+double peak_rss(pid_t pid)
+{
+    std::ifstream file("/proc/" + std::to_string(pid) + "/status");
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return std::stod(line.substr(6)) / 1024;
+        }
+    }
+    return 0;
+}
+
+// A number from the client's JSON: `key` inside the object `object`, or at
+// the top level when `object` is empty.
+double json_number(const std::string& text, const std::string& object, const std::string& key)
+{
+    std::size_t from = 0;
+    if (!object.empty()) {
+        from = text.find("\"" + object + "\":{");
+        if (from == std::string::npos) {
+            return 0;
+        }
+    }
+    const std::size_t at = text.find("\"" + key + "\":", from);
+    return at == std::string::npos ? 0 : std::atof(text.c_str() + at + key.size() + 3);
+}
+
+std::string read_file(const std::string& path)
+{
+    std::ifstream file(path);
+    std::stringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+std::vector<std::string> client_command(const bench_settings& settings, const server_spec& server,
+                                        const std::string& mode, int connections,
+                                        const std::string& duration, const std::string& json)
+{
+    std::vector<std::string> command = { settings.client };
+    if (is_unix(server.endpoint)) {
+        command.push_back(server.endpoint);
+    }
+    else {
+        command.push_back("127.0.0.1");
+        command.push_back(server.endpoint);
+    }
+    command.insert(command.end(), {
+        "--path", settings.path,
+        "--mode", mode,
+        "--connections", std::to_string(connections),
+        "--duration", duration,
+        "--json", json
+    });
+    if (settings.client_threads > 0) {
+        command.push_back("--threads");
+        command.push_back(std::to_string(settings.client_threads));
+    }
+    return command;
+}
+
+std::vector<bench_row> run_server(const bench_settings& settings, const server_spec& server)
+{
+    std::vector<bench_row> rows;
+
+    if (accepting(server.endpoint)) {
+        throw std::runtime_error(server.endpoint + " is already taken, " + server.name + " skipped");
+    }
+
+    const pid_t pid = spawn(server.command, server.name + ".log");
+    bool up = false;
+    for (int i = 0; i < 100 && !up; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        up = accepting(server.endpoint);
+    }
+    if (!up) {
+        stop(pid);
+        throw std::runtime_error(server.name + " did not start, see " + server.name + ".log");
+    }
+
+    for (const std::string& mode : settings.modes) {
+        for (const int connections : settings.connections) {
+            const std::string json = server.name + "-" + mode + "-" + std::to_string(connections) + ".json";
+
+            wait_exit(spawn(client_command(settings, server, mode, connections, settings.warmup, json), "/dev/null"));
+            // the warmup wrote the same file, which a failed measured run would leave behind
+            std::remove(json.c_str());
+
+            const double cpu_before = cpu_seconds(pid);
+            const auto start = std::chrono::steady_clock::now();
+            const int status = wait_exit(spawn(client_command(settings, server, mode, connections, settings.duration, json), "/dev/null"));
+            const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            const double cpu_after = cpu_seconds(pid);
+
+            const std::string text = status == 0 ? read_file(json) : std::string();
+            bench_row row = bench_row();
+            row.server = server.name;
+            row.mode = mode;
+            row.connections = connections;
+            row.failed = text.empty();
+            if (row.failed) {
+                rows.push_back(row);
+                std::cerr << "#> " << server.name << " " << mode << " " << connections
+                          << " failed, exit status: " << status << std::endl;
+                continue;
+            }
+            row.rps = json_number(text, "", "rps");
+            row.p50 = json_number(text, "latency_us", "p50");
+            row.p99 = json_number(text, "latency_us", "p99");
+            row.p999 = json_number(text, "latency_us", "p999");
+            row.cpu = wall > 0 ? (cpu_after - cpu_before) / wall * 100 : 0;
+            row.rss = peak_rss(pid);
+            row.non_2xx = static_cast<long long>(json_number(text, "", "non_2xx"));
+            row.errors = static_cast<long long>(json_number(text, "", "errors") + json_number(text, "", "timeouts") +
+                                                json_number(text, "", "connect_errors"));
+            rows.push_back(row);
+
+            std::cerr << "#> " << server.name << " " << mode << " " << connections
+                      << " rps: " << row.rps << std::endl;
+        }
+    }
+
+    stop(pid);
+    return rows;
+}
+
+void write_table(std::ostream& out, const std::vector<bench_row>& rows)
+{
+    out << std::left
+        << std::setw(28) << "server" << std::setw(12) << "mode" << std::right
+        << std::setw(7) << "conns" << std::setw(11) << "rps"
+        << std::setw(10) << "p50 us" << std::setw(10) << "p99 us" << std::setw(11) << "p99.9 us"
+        << std::setw(8) << "cpu %" << std::setw(9) << "rss MB" << std::setw(9) << "non-2xx"
+        << std::setw(8) << "errors"
+        << "\n";
+    out << std::fixed;
+    for (const bench_row& row : rows) {
+        out << std::left
+            << std::setw(28) << row.server << std::setw(12) << row.mode << std::right
+            << std::setw(7) << row.connections;
+        if (row.failed) {
+            out << std::setw(11) << "failed" << "\n";
+            continue;
+        }
+        out << std::setw(11) << std::setprecision(0) << row.rps
+            << std::setw(10) << std::setprecision(0) << row.p50
+            << std::setw(10) << row.p99
+            << std::setw(11) << row.p999
+            << std::setw(8) << row.cpu
+            << std::setw(9) << std::setprecision(1) << row.rss
+            << std::setw(9) << row.non_2xx
+            << std::setw(8) << row.errors
+            << "\n";
+    }
+}
+
+void write_json(std::ostream& out, const std::vector<bench_row>& rows)
+{
+    out << "[";
+    for (std::size_t i = 0; i < rows.size(); i++) {
+        const bench_row& row = rows[i];
+        out << (i ? ",\n" : "\n")
+            << "{\"server\":\"" << row.server << "\""
+            << ",\"mode\":\"" << row.mode << "\""
+            << ",\"connections\":" << row.connections
+            << ",\"rps\":" << row.rps
+            << ",\"p50_us\":" << row.p50
+            << ",\"p99_us\":" << row.p99
+            << ",\"p999_us\":" << row.p999
+            << ",\"cpu_percent\":" << row.cpu
+            << ",\"rss_mb\":" << row.rss
+            << ",\"non_2xx\":" << row.non_2xx
+            << ",\"errors\":" << row.errors
+            << ",\"failed\":" << (row.failed ? "true" : "false")
+            << "}";
+    }
+    out << "\n]\n";
+}
+
+void usage()
+{
+    std::cerr << "Usage: http_bench --client PATH --server \"NAME ENDPOINT COMMAND [ARGS...]\" ... [options]\n"
+              << "  --modes keep-alive,close   connection modes\n"
+              << "  --connections 16,64,256    concurrency levels\n"
+              << "  --duration 10s             measured run, per mode and level\n"
+              << "  --warmup 2s                unmeasured run before each\n"
+              << "  --client-threads N         load client threads\n"
+              << "  --path /                   request path\n"
+              << "  --json bench.json          where to write the results\n";
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        bench_settings settings;
+        for (int i = 1; i < argc; i++) {
+            const std::string option = argv[i];
+            if (option == "--help" || option == "-h" || i + 1 == argc) {
+                usage();
+                return 1;
+            }
+            const std::string value = argv[++i];
+            if (option == "--client") settings.client = value;
+            else if (option == "--server") settings.servers.push_back(parse_server(value));
+            else if (option == "--modes") settings.modes = split(value, ',');
+            else if (option == "--connections") {
+                settings.connections.clear();
+                for (const std::string& level : split(value, ',')) {
+                    settings.connections.push_back(std::stoi(level));
+                }
+            }
+            else if (option == "--duration") settings.duration = value;
+            else if (option == "--warmup") settings.warmup = value;
+            else if (option == "--client-threads") settings.client_threads = std::stoi(value);
+            else if (option == "--path") settings.path = value;
+            else if (option == "--json") settings.json = value;
+            else {
+                usage();
+                return 1;
+            }
+        }
+        if (settings.client.empty() || settings.servers.empty()) {
+            usage();
+            return 1;
+        }
+
+        std::vector<bench_row> rows;
+        for (const server_spec& server : settings.servers) {
+            try {
+                const std::vector<bench_row> server_rows = run_server(settings, server);
+                rows.insert(rows.end(), server_rows.begin(), server_rows.end());
+            }
+            catch (const std::exception& e) {
+                std::cerr << "#> " << e.what() << std::endl;
+            }
+        }
+
+        write_table(std::cout, rows);
+        std::ofstream json(settings.json);
+        write_json(json, rows);
+        std::cout << "#> results: " << settings.json << std::endl;
+
+        return 0;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "#> main exception: " << e.what() << std::endl;
+    }
+
+    return 1;
+}
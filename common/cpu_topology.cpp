@@ -0,0 +1,281 @@
+#include "cpu_topology.h"
+
+#include <set>
+#include <thread>
+#include <fstream>
+#include <utility>
+#include <iostream>
+#include <stdexcept>
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+
+namespace {
+
+const std::string SYS_CPU = "/sys/devices/system/cpu/";
+const std::string SYS_NET = "/sys/class/net/";
+
+bool read_line(const std::string& path, std::string& line)
+{
+    std::ifstream file(path);
+    return static_cast<bool>(std::getline(file, line));
+}
+
+int read_int(const std::string& path, int def)
+{
+    std::string line;
+    if(!read_line(path, line)) {
+        return def;
+    }
+    try {
+        return std::stoi(line);
+    }
+    catch(const std::exception&) {
+        return def;
+    }
+}
+
+std::vector<std::string> list_directory(const std::string& path)
+{
+    std::vector<std::string> names;
+    DIR* dir = ::opendir(path.c_str());
+    if(!dir) {
+        return names;
+    }
+    while(const dirent* entry = ::readdir(dir)) {
+        if(entry->d_name[0] != '.') {
+            names.push_back(entry->d_name);
+        }
+    }
+    ::closedir(dir);
+    return names;
+}
+
+}
+
+std::vector<cpu_info> online_cpus()
+{
+    std::vector<int> cpus;
+    std::string online;
+    if(read_line(SYS_CPU + "online", online)) {
+        cpus = parse_cpu_list(online);
+    }
+    if(cpus.empty()) {
+        const int count = static_cast<int>(std::thread::hardware_concurrency());
+        for(int i = 0; i < (count ? count : 1); i++) {
+            cpus.push_back(i);
+        }
+    }
+
+    std::vector<cpu_info> result;
+    for(int cpu : cpus) {
+        const std::string topology = SYS_CPU + "cpu" + std::to_string(cpu) + "/topology/";
+        result.push_back(cpu_info{ cpu,
+                                   read_int(topology + "core_id", 0),
+                                   read_int(topology + "physical_package_id", 0),
+                                   cpu_node(cpu) });
+    }
+    return result;
+}
+
+std::vector<int> parse_cpu_list(const std::string& list)
+{
+    std::vector<int> cpus;
+    std::size_t first = 0;
+    while(first < list.size()) {
+        std::size_t last = list.find(',', first);
+        if(last == std::string::npos) {
+            last = list.size();
+        }
+        const std::string range = list.substr(first, last - first);
+        first = last + 1;
+        if(range.empty()) {
+            continue;
+        }
+
+        try {
+            const std::size_t dash = range.find('-');
+            std::size_t end = 0;
+            const int low = std::stoi(range.substr(0, dash), &end);
+            int high = low;
+            if(dash != std::string::npos) {
+                high = std::stoi(range.substr(dash + 1), &end);
+                end += dash + 1;
+            }
+            if(end != range.size() || low < 0 || high < low) {
+                throw std::invalid_argument(range);
+            }
+            for(int cpu = low; cpu <= high; cpu++) {
+                cpus.push_back(cpu);
+            }
+        }
+        catch(const std::logic_error&) {
+            throw std::runtime_error("bad cpu list: " + list);
+        }
+    }
+    return cpus;
+}
+
+std::vector<int> physical_core_cpus()
+{
+    std::vector<int> cpus;
+    std::set<std::pair<int, int>> cores;
+    for(const cpu_info& info : online_cpus()) {
+        if(cores.insert(std::make_pair(info.package, info.core)).second) {
+            cpus.push_back(info.cpu);
+        }
+    }
+    return cpus;
+}
+
+int cpu_node(int cpu)
+{
+    for(const std::string& name : list_directory(SYS_CPU + "cpu" + std::to_string(cpu))) {
+        if(name.compare(0, 4, "node") == 0) {
+            try {
+                return std::stoi(name.substr(4));
+            }
+            catch(const std::exception&) {
+            }
+        }
+    }
+    return 0;
+}
+
+bool pin_current_thread(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set) == 0;
+}
+
+void report_network_affinity(std::ostream& out)
+{
+    for(const std::string& name : list_directory(SYS_NET)) {
+        if(name == "lo") {
+            continue;
+        }
+        const std::string net = SYS_NET + name + "/";
+
+        std::size_t rx_queues = 0;
+        std::string rps;
+        for(const std::string& queue : list_directory(net + "queues")) {
+            if(queue.compare(0, 3, "rx-") == 0) {
+                rx_queues++;
+                std::string mask;
+                if(read_line(net + "queues/" + queue + "/rps_cpus", mask)) {
+                    rps += " " + queue + ":" + mask;
+                }
+            }
+        }
+        out << "#> net " << name << " rx queues: " << rx_queues;
+        if(!rps.empty()) {
+            out << " rps cpus:" << rps;
+        }
+        out << "\n";
+
+        const std::vector<std::string> irqs = list_directory(net + "device/msi_irqs");
+        for(const std::string& irq : irqs) {
+            std::string cpus;
+            if(read_line("/proc/irq/" + irq + "/smp_affinity_list", cpus)) {
+                out << "#> net " << name << " irq " << irq << " cpus: " << cpus << "\n";
+            }
+        }
+        if(irqs.empty()) {
+            out << "#> net " << name << " no MSI interrupts reported\n";
+        }
+    }
+    out.flush();
+}
+
+affinity parse_affinity(const std::string& text)
+{
+    if(text == "none") {
+        return affinity::none;
+    }
+    if(text == "list") {
+        return affinity::list;
+    }
+    if(text == "cores") {
+        return affinity::cores;
+    }
+    throw std::runtime_error("unknown affinity: " + text);
+}
+
+std::vector<int> placement_cpus(affinity pinning, const std::vector<int>& cpu_list)
+{
+    switch(pinning) {
+    case affinity::list:
+        if(!cpu_list.empty()) {
+            return cpu_list;
+        }
+        {
+            std::vector<int> cpus;
+            for(const cpu_info& info : online_cpus()) {
+                cpus.push_back(info.cpu);
+            }
+            return cpus;
+        }
+    case affinity::cores:
+        return physical_core_cpus();
+    case affinity::none:
+        break;
+    }
+    return cpu_list;
+}
+
+std::size_t worker_count(std::size_t threads, const std::vector<int>& cpus)
+{
+    if(threads) {
+        return threads;
+    }
+    if(!cpus.empty()) {
+        return cpus.size();
+    }
+    const std::size_t hardware_concurrency = std::thread::hardware_concurrency();
+    return hardware_concurrency ? hardware_concurrency : 1;
+}
+
+std::vector<int> assign_worker_cpus(std::size_t workers, const std::vector<int>& cpus)
+{
+    std::vector<int> assigned;
+    if(cpus.empty()) {
+        return assigned;
+    }
+    for(std::size_t i = 0; i < workers; i++) {
+        assigned.push_back(cpus[i % cpus.size()]);
+    }
+    return assigned;
+}
+
+void report_worker_cpus(std::ostream& out, const std::vector<int>& worker_cpus)
+{
+    if(worker_cpus.empty()) {
+        return;
+    }
+    for(std::size_t i = 0; i < worker_cpus.size(); i++) {
+        out << "#> worker " << i << " cpu: " << worker_cpus[i] << " node: " << cpu_node(worker_cpus[i]) << "\n";
+    }
+    report_network_affinity(out);
+}
+
+thread_placement::thread_placement(std::vector<int> cpus) :
+    cpus_(std::move(cpus)),
+    next_(0)
+{
+}
+
+void thread_placement::pin()
+{
+    thread_local bool placed = false;
+    if(placed || cpus_.empty()) {
+        return;
+    }
+    placed = true;
+    const int cpu = cpus_[next_++ % cpus_.size()];
+    if(!pin_current_thread(cpu)) {
+        std::cerr << "#> can not pin a worker to cpu " << cpu << std::endl;
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <ostream>
+
+// Where a logical CPU sits, from /sys/devices/system/cpu (Linux). Fields
+// the system does not report are 0.
+struct cpu_info
+{
+    int cpu;
+    int core;       // core_id, unique within a package
+    int package;    // physical_package_id
+    int node;       // NUMA node
+};
+
+// Online CPUs; without sysfs, 0..hardware_concurrency-1 on a single node.
+std::vector<cpu_info> online_cpus();
+
+// "0-3,8,10-11" -> 0 1 2 3 8 10 11; throws std::runtime_error when malformed.
+std::vector<int> parse_cpu_list(const std::string& list);
+
+// The first hardware thread of every physical core.
+std::vector<int> physical_core_cpus();
+
+int cpu_node(int cpu);
+
+// Binds the calling thread to a CPU; false when the system refuses.
+bool pin_current_thread(int cpu);
+
+// Receive queues and NIC interrupts with the CPUs serving them, per network
+// interface, so the workers can be placed next to them.
+void report_network_affinity(std::ostream& out);
+
+// Where worker threads run.
+enum class affinity
+{
+    none,           // wherever the scheduler puts them
+    list,           // pinned to the CPUs of a list, in order
+    cores           // pinned one per physical core
+};
+
+// "none", "list" or "cores"; throws std::runtime_error otherwise.
+affinity parse_affinity(const std::string& text);
+
+// The CPUs the workers of a placement go on, in order: the list, or every
+// online CPU when it is empty, for affinity::list; empty for affinity::none
+// unless a list is given, which implies affinity::list.
+std::vector<int> placement_cpus(affinity pinning, const std::vector<int>& cpu_list);
+
+// `threads`, or else one per placement CPU, or per hardware thread.
+std::size_t worker_count(std::size_t threads, const std::vector<int>& cpus);
+
+// The CPU of each of `workers`, wrapping around the placement CPUs; empty
+// without pinning.
+std::vector<int> assign_worker_cpus(std::size_t workers, const std::vector<int>& cpus);
+
+// The CPU and NUMA node of every worker, then report_network_affinity();
+// nothing without pinning.
+void report_worker_cpus(std::ostream& out, const std::vector<int>& worker_cpus);
+
+// Pins the threads of a pool the caller does not start itself, as Poco's:
+// the first pin() on a thread binds it to the next CPU of the plan, later
+// calls on that thread do nothing. Buffers a thread allocates after that
+// stay on its node.
+class thread_placement
+{
+public:
+    explicit thread_placement(std::vector<int> cpus);
+
+    void pin();
+
+private:
+    const std::vector<int> cpus_;
+    std::atomic<std::size_t> next_;
+};
@@ -0,0 +1,325 @@
+#include "file_cache.h"
+
+#include "url.h"
+#include "http_date.h"
+#include "mime_types.h"
+
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <stdexcept>
+
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+
+namespace {
+
+const uint32_t WATCH_MASK = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                            IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+std::string make_etag(std::time_t mtime, std::size_t size)
+{
+    char buffer[64];
+    const int length = std::snprintf(buffer, sizeof(buffer), "\"%lx-%zx\"",
+                                     static_cast<unsigned long>(mtime), size);
+    return std::string(buffer, length);
+}
+
+}
+
+file_entry::file_entry(int descriptor) :
+    fd(descriptor),
+    size(0),
+    mtime(0),
+    content_type(nullptr),
+    stale(false)
+{
+}
+
+file_entry::~file_entry()
+{
+    ::close(fd);
+}
+
+file_cache::file_cache(const std::string& root, std::size_t max_entries) :
+    max_entries_(max_entries ? max_entries : 1),
+    inotify_(-1),
+    wakeup_(-1),
+    done_(false),
+    changes_(0)
+{
+    char resolved[PATH_MAX];
+    if(!::realpath(root.c_str(), resolved)) {
+        throw std::runtime_error("invalid document root: " + root);
+    }
+    root_ = resolved;
+
+    inotify_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(inotify_ < 0) {
+        throw std::runtime_error("inotify_init1 failed");
+    }
+    wakeup_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(wakeup_ < 0) {
+        ::close(inotify_);
+        throw std::runtime_error("eventfd failed");
+    }
+
+    thread_ = std::thread([this](){
+        run();
+    });
+}
+
+file_cache::~file_cache()
+{
+    done_ = true;
+    const uint64_t one = 1;
+    if(::write(wakeup_, &one, sizeof(one)) < 0) {
+        // the thread still wakes up on its poll timeout
+    }
+    thread_.join();
+
+    ::close(wakeup_);
+    ::close(inotify_);
+}
+
+bool file_cache::resolve(const std::string& url, std::string& path) const
+{
+    const std::size_t end = url.find_first_of("?#");
+    const std::size_t length = (end == std::string::npos) ? url.size() : end;
+    if(length == 0 || url[0] != '/') {
+        return false;
+    }
+
+    path = root_;
+    std::string segment;
+    for(std::size_t i = 1; i <= length; i++) {
+        if(i == length || url[i] == '/') {
+            if(segment == "..") {
+                return false;
+            }
+            if(!segment.empty() && segment != ".") {
+                path += '/';
+                path += segment;
+            }
+            segment.clear();
+            continue;
+        }
+
+        char c = url[i];
+        if(c == '%') {
+            if(i + 2 >= length) {
+                return false;
+            }
+            const int hi = hex_digit(url[i + 1]);
+            const int lo = hex_digit(url[i + 2]);
+            if(hi < 0 || lo < 0) {
+                return false;
+            }
+            c = static_cast<char>(hi * 16 + lo);
+            i += 2;
+        }
+        if(c == '\0' || c == '/') {
+            return false;
+        }
+        segment += c;
+    }
+
+    if(url[length - 1] == '/') {
+        path += "/index.html";
+    }
+    return true;
+}
+
+file_cache::entry_ptr file_cache::open(const std::string& url)
+{
+    std::string path;
+    if(!resolve(url, path)) {
+        return nullptr;
+    }
+    return open_path(path);
+}
+
+file_cache::entry_ptr file_cache::open_path(const std::string& path)
+{
+    std::uint64_t changes = 0;
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        auto it = entries_.find(path);
+        if(it != entries_.end()) {
+            if(!it->second.entry->stale) {
+                lru_.splice(lru_.begin(), lru_, it->second.used);
+                return it->second.entry;
+            }
+            erase(it);
+        }
+        changes = changes_;
+
+        // the watch goes in before stat so a change racing with us is not lost
+        if(!watch(path.substr(0, path.rfind('/')))) {
+            return nullptr;
+        }
+    }
+
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return nullptr;
+    }
+    auto entry = std::make_shared<file_entry>(fd);
+
+    struct stat st;
+    if(::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return nullptr;
+    }
+
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtime;
+    entry->path = path;
+    entry->etag = make_etag(st.st_mtime, st.st_size);
+    entry->last_modified = http_date(st.st_mtime);
+    entry->content_type = mime_type(path);
+
+    // an event handled since the open found nothing to invalidate: the
+    // entry may already be outdated, serve it this once without keeping it
+    std::lock_guard<std::mutex> guard(mutex_);
+    if(changes == changes_) {
+        insert(path, entry);
+    }
+    return entry;
+}
+
+void file_cache::insert(const std::string& path, const entry_ptr& entry)
+{
+    auto it = entries_.find(path);
+    if(it != entries_.end()) {
+        erase(it);
+    }
+    lru_.push_front(path);
+    entries_.emplace(path, cached{ entry, lru_.begin() });
+
+    // evicted entries are not stale, responses holding them go on
+    while(entries_.size() > max_entries_) {
+        erase(entries_.find(lru_.back()));
+    }
+}
+
+file_cache::entry_map::iterator file_cache::erase(entry_map::iterator it)
+{
+    lru_.erase(it->second.used);
+    return entries_.erase(it);
+}
+
+std::size_t file_cache::size() const
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    return entries_.size();
+}
+
+bool file_cache::watch(const std::string& directory)
+{
+    if(directories_.count(directory)) {
+        return true;
+    }
+
+    const int wd = ::inotify_add_watch(inotify_, directory.c_str(), WATCH_MASK);
+    if(wd < 0) {
+        return false;
+    }
+    watches_[wd] = directory;
+    directories_[directory] = wd;
+    return true;
+}
+
+void file_cache::invalidate(const std::string& path)
+{
+    auto it = entries_.find(path);
+    if(it != entries_.end()) {
+        it->second.entry->stale = true;
+        erase(it);
+    }
+
+    // a precompressed sibling changes how the original is served
+    const std::string suffix = ".gz";
+    if(path.size() > suffix.size() && path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0) {
+        invalidate(path.substr(0, path.size() - suffix.size()));
+    }
+}
+
+void file_cache::invalidate_prefix(const std::string& prefix)
+{
+    for(auto it = entries_.begin(); it != entries_.end(); ) {
+        if(it->first.compare(0, prefix.size(), prefix) == 0) {
+            it->second.entry->stale = true;
+            it = erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+void file_cache::run()
+{
+    alignas(struct inotify_event) char buffer[16 * 1024];
+
+    struct pollfd fds[2];
+    fds[0].fd = inotify_;
+    fds[0].events = POLLIN;
+    fds[1].fd = wakeup_;
+    fds[1].events = POLLIN;
+
+    while(!done_) {
+        fds[0].revents = 0;
+        fds[1].revents = 0;
+        if(::poll(fds, 2, 1000) <= 0 || !(fds[0].revents & POLLIN)) {
+            continue;
+        }
+
+        const ssize_t length = ::read(inotify_, buffer, sizeof(buffer));
+        if(length <= 0) {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> guard(mutex_);
+        for(char* ptr = buffer; ptr < buffer + length; ) {
+            const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(ptr);
+            ptr += sizeof(struct inotify_event) + event->len;
+            changes_++;
+
+            if(event->mask & IN_Q_OVERFLOW) {
+                invalidate_prefix(root_);
+                continue;
+            }
+
+            auto it = watches_.find(event->wd);
+            if(it == watches_.end()) {
+                continue;
+            }
+            const std::string directory = it->second;
+
+            if(event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                invalidate_prefix(directory + "/");
+                if(event->mask & IN_IGNORED) {
+                    directories_.erase(directory);
+                    watches_.erase(it);
+                }
+                else {
+                    ::inotify_rm_watch(inotify_, event->wd);
+                }
+                continue;
+            }
+
+            if(event->len) {
+                const std::string path = directory + "/" + event->name;
+                invalidate(path);
+                if(event->mask & IN_ISDIR) {
+                    invalidate_prefix(path + "/");
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <ctime>
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <cstdint>
+#include <unordered_map>
+
+// Opened regular file with the metadata needed to answer a request.
+// The descriptor stays open while anyone holds the entry, so a response
+// in flight is not affected by an invalidation.
+struct file_entry
+{
+    explicit file_entry(int descriptor);
+    ~file_entry();
+
+    file_entry(const file_entry&) = delete;
+    file_entry& operator=(const file_entry&) = delete;
+
+    int fd;
+    std::size_t size;
+    std::time_t mtime;
+
+    std::string path;
+    std::string etag;
+    std::string last_modified;
+    const char* content_type;
+
+    // set by the inotify thread when the file changes on disk
+    mutable std::atomic<bool> stale;
+};
+
+// Cache of open descriptors and stat results for files under a document root.
+// Directories holding cached files are watched with inotify and entries are
+// dropped as soon as the file is modified, replaced or removed. At most
+// `max_entries` descriptors are kept, the least recently used go first, so
+// a large root does not run the process out of descriptors.
+class file_cache
+{
+public:
+    typedef std::shared_ptr<const file_entry> entry_ptr;
+
+    explicit file_cache(const std::string& root, std::size_t max_entries = 1024);
+    ~file_cache();
+
+    file_cache(const file_cache&) = delete;
+    file_cache& operator=(const file_cache&) = delete;
+
+    // Looks up the file for a request target ("/css/site.css?v=1").
+    // Returns nullptr when the target escapes the root or is not a regular file.
+    entry_ptr open(const std::string& url);
+
+    // Same for a path already produced by resolve().
+    entry_ptr open_path(const std::string& path);
+
+    // Maps a request target to an absolute path under the root.
+    bool resolve(const std::string& url, std::string& path) const;
+
+    std::size_t size() const;
+
+private:
+    struct cached
+    {
+        entry_ptr entry;
+        std::list<std::string>::iterator used;     // place in lru_
+    };
+    typedef std::unordered_map<std::string, cached> entry_map;
+
+    void insert(const std::string& path, const entry_ptr& entry);
+    entry_map::iterator erase(entry_map::iterator it);
+    bool watch(const std::string& directory);
+    void invalidate(const std::string& path);
+    void invalidate_prefix(const std::string& prefix);
+    void run();
+
+private:
+    std::string root_;
+    const std::size_t max_entries_;
+
+    int inotify_;
+    int wakeup_;
+    std::atomic<bool> done_;
+
+    mutable std::mutex mutex_;
+    entry_map entries_;
+    std::list<std::string> lru_;                // most recently used first
+    std::uint64_t changes_;                     // inotify events handled
+    std::unordered_map<int, std::string> watches_;
+    std::unordered_map<std::string, int> directories_;
+
+    std::thread thread_;
+};
@@ -0,0 +1,106 @@
+#include "gzip.h"
+
+#include <cctype>
+#include <cstring>
+#include <cstdlib>
+
+#include <zlib.h>
+
+namespace {
+
+// windowBits 15 plus 16 selects the gzip wrapper in deflateInit2
+const int GZIP_WINDOW_BITS = 15 + 16;
+const int MEMORY_LEVEL = 8;
+
+bool iequals(const char* a, std::size_t length, const char* b)
+{
+    if(std::strlen(b) != length) {
+        return false;
+    }
+    for(std::size_t i = 0; i < length; i++) {
+        if(std::tolower(static_cast<unsigned char>(a[i])) != b[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+bool accepts_gzip(const std::string& accept_encoding)
+{
+    const char* ptr = accept_encoding.c_str();
+    const char* end = ptr + accept_encoding.size();
+
+    bool wildcard = false;
+    while(ptr < end) {
+        while(ptr < end && (*ptr == ' ' || *ptr == ',')) {
+            ptr++;
+        }
+        const char* token = ptr;
+        while(ptr < end && *ptr != ',' && *ptr != ';' && *ptr != ' ') {
+            ptr++;
+        }
+        const std::size_t length = ptr - token;
+
+        double quality = 1.0;
+        while(ptr < end && *ptr == ' ') {
+            ptr++;
+        }
+        if(ptr < end && *ptr == ';') {
+            const char* q = std::strstr(ptr, "q=");
+            const char* next = static_cast<const char*>(std::memchr(ptr, ',', end - ptr));
+            if(q && (!next || q < next)) {
+                quality = std::strtod(q + 2, nullptr);
+            }
+            ptr = next ? next : end;
+        }
+
+        if(iequals(token, length, "gzip")) {
+            return quality > 0;
+        }
+        if(length == 1 && *token == '*') {
+            wildcard = quality > 0;
+        }
+    }
+    return wildcard;
+}
+
+bool compressible(const char* content_type)
+{
+    return std::strncmp(content_type, "text/", 5) == 0 ||
+           std::strstr(content_type, "json") != nullptr ||
+           std::strstr(content_type, "javascript") != nullptr ||
+           std::strstr(content_type, "xml") != nullptr;
+}
+
+bool gzip_compress(const char* data, std::size_t size, int level, std::string& out)
+{
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    if(deflateInit2(&stream, level, Z_DEFLATED, GZIP_WINDOW_BITS, MEMORY_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+
+    out.resize(deflateBound(&stream, size));
+
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = static_cast<uInt>(size);
+    stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    stream.avail_out = static_cast<uInt>(out.size());
+
+    const int result = deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+
+    return result == Z_STREAM_END;
+}
+
+std::string gzip_compress(const std::string& data, int level)
+{
+    std::string out;
+    if(!gzip_compress(data.data(), data.size(), level, out)) {
+        out.clear();
+    }
+    return out;
+}
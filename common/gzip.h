@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+
+// Tunables shared by every server that compresses responses.
+struct gzip_options
+{
+    int level = 6;                  // zlib level, 0 disables compression
+    std::size_t min_size = 256;     // smaller bodies are sent as is
+
+    bool enabled() const
+    {
+        return level > 0;
+    }
+
+    bool worth(std::size_t size) const
+    {
+        return level > 0 && size >= min_size;
+    }
+};
+
+// Accept-Encoding negotiation: "gzip" or "*" with a non-zero quality value.
+bool accepts_gzip(const std::string& accept_encoding);
+
+// Whether compressing a body of this type pays off (text, JSON, JS, XML, SVG).
+bool compressible(const char* content_type);
+
+// Compresses into the gzip container format. Returns false on zlib errors.
+bool gzip_compress(const char* data, std::size_t size, int level, std::string& out);
+std::string gzip_compress(const std::string& data, int level);
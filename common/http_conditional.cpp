@@ -0,0 +1,69 @@
+#include "http_conditional.h"
+
+#include "http_date.h"
+
+namespace {
+
+// weak comparison: W/"x" matches "x"
+bool etag_matches(const std::string& list, const std::string& etag)
+{
+    std::size_t pos = 0;
+    while(pos < list.size()) {
+        while(pos < list.size() && (list[pos] == ' ' || list[pos] == ',')) {
+            pos++;
+        }
+        std::size_t end = list.find(',', pos);
+        if(end == std::string::npos) {
+            end = list.size();
+        }
+        std::size_t last = end;
+        while(last > pos && list[last - 1] == ' ') {
+            last--;
+        }
+
+        std::size_t first = pos;
+        if(list.compare(first, 2, "W/") == 0) {
+            first += 2;
+        }
+        if(list.compare(first, last - first, "*") == 0 ||
+           list.compare(first, last - first, etag) == 0) {
+            return true;
+        }
+        pos = end;
+    }
+    return false;
+}
+
+}
+
+bool not_modified(const std::string& if_none_match,
+                  const std::string& if_modified_since,
+                  const std::string& etag,
+                  std::time_t mtime)
+{
+    // If-None-Match takes precedence, If-Modified-Since is ignored with it
+    if(!if_none_match.empty()) {
+        return etag_matches(if_none_match, etag);
+    }
+    if(!if_modified_since.empty()) {
+        const std::time_t since = parse_http_date(if_modified_since);
+        return since != -1 && mtime <= since;
+    }
+    return false;
+}
+
+bool if_range_matches(const std::string& if_range,
+                      const std::string& etag,
+                      const std::string& last_modified)
+{
+    if(if_range.empty()) {
+        return true;
+    }
+    if(if_range[0] == '"') {
+        return if_range == etag;
+    }
+    if(if_range.compare(0, 2, "W/") == 0) {
+        return false;
+    }
+    return if_range == last_modified;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <ctime>
+#include <string>
+
+// RFC 7232 evaluation of If-None-Match / If-Modified-Since for GET and HEAD.
+// Returns true when the copy held by the client is current and a
+// 304 Not Modified can be sent instead of the body.
+bool not_modified(const std::string& if_none_match,
+                  const std::string& if_modified_since,
+                  const std::string& etag,
+                  std::time_t mtime);
+
+// RFC 7233 If-Range: the range applies only while the validator still matches.
+// An entity tag must match strongly, a date must equal Last-Modified exactly.
+bool if_range_matches(const std::string& if_range,
+                      const std::string& etag,
+                      const std::string& last_modified);
@@ -0,0 +1,28 @@
+#include "http_date.h"
+
+std::string http_date(std::time_t time)
+{
+    std::string date;
+    append_http_date(time, date);
+    return date;
+}
+
+void append_http_date(std::time_t time, std::string& out)
+{
+    std::tm tm;
+    gmtime_r(&time, &tm);
+
+    char buffer[32];
+    const std::size_t length = std::strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    out.append(buffer, length);
+}
+
+std::time_t parse_http_date(const std::string& value)
+{
+    std::tm tm = {};
+    const char* end = strptime(value.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if(!end || *end != '\0') {
+        return -1;
+    }
+    return timegm(&tm);
+}
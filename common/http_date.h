@@ -0,0 +1,13 @@
+#pragma once
+
+#include <ctime>
+#include <string>
+
+// RFC 7231 IMF-fixdate, e.g. "Wed, 07 Jun 2017 16:19:01 GMT".
+std::string http_date(std::time_t time);
+
+// The same, appended to `out` without a temporary string.
+void append_http_date(std::time_t time, std::string& out);
+
+// Parses an IMF-fixdate. Returns -1 when the value is not a valid date.
+std::time_t parse_http_date(const std::string& value);
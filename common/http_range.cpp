@@ -0,0 +1,162 @@
+#include "http_range.h"
+
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+
+namespace {
+
+const std::size_t MAX_RANGES = 16;
+
+const std::string& boundary()
+{
+    static const std::string value = [](){
+        std::random_device device;
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%08x%08x", device(), device());
+        return std::string(buffer);
+    }();
+    return value;
+}
+
+bool parse_number(const std::string& str, std::size_t begin, std::size_t end, std::size_t& value)
+{
+    if(begin == end) {
+        return false;
+    }
+    value = 0;
+    for(std::size_t i = begin; i < end; i++) {
+        if(str[i] < '0' || str[i] > '9') {
+            return false;
+        }
+        // saturate: a position past any file size means the same as SIZE_MAX
+        const std::size_t digit = str[i] - '0';
+        if(value > (SIZE_MAX - digit) / 10) {
+            value = SIZE_MAX;
+        }
+        else {
+            value = value * 10 + digit;
+        }
+    }
+    return true;
+}
+
+}
+
+range_result parse_range(const std::string& header, std::size_t size, std::vector<byte_range>& ranges)
+{
+    ranges.clear();
+
+    const std::string unit = "bytes=";
+    if(header.compare(0, unit.size(), unit) != 0) {
+        return range_result::none;
+    }
+
+    std::size_t count = 0;
+    std::size_t pos = unit.size();
+    while(pos <= header.size()) {
+        std::size_t end = header.find(',', pos);
+        if(end == std::string::npos) {
+            end = header.size();
+        }
+
+        std::size_t begin = pos;
+        std::size_t last = end;
+        while(begin < last && header[begin] == ' ') {
+            begin++;
+        }
+        while(last > begin && header[last - 1] == ' ') {
+            last--;
+        }
+        pos = end + 1;
+        if(begin == last) {
+            continue;
+        }
+
+        if(++count > MAX_RANGES) {
+            ranges.clear();
+            return range_result::none;
+        }
+
+        const std::size_t dash = header.find('-', begin);
+        if(dash == std::string::npos || dash >= last) {
+            ranges.clear();
+            return range_result::none;
+        }
+
+        byte_range range;
+        if(dash == begin) {
+            // suffix range: the last N bytes
+            std::size_t suffix = 0;
+            if(!parse_number(header, dash + 1, last, suffix)) {
+                ranges.clear();
+                return range_result::none;
+            }
+            if(suffix == 0 || size == 0) {
+                continue;
+            }
+            range.first = suffix < size ? size - suffix : 0;
+            range.last = size - 1;
+        }
+        else {
+            if(!parse_number(header, begin, dash, range.first)) {
+                ranges.clear();
+                return range_result::none;
+            }
+            if(dash + 1 == last) {
+                range.last = size ? size - 1 : 0;
+            }
+            else if(!parse_number(header, dash + 1, last, range.last) || range.last < range.first) {
+                ranges.clear();
+                return range_result::none;
+            }
+            if(range.first >= size) {
+                continue;
+            }
+            if(range.last >= size) {
+                range.last = size - 1;
+            }
+        }
+        ranges.push_back(range);
+    }
+
+    if(count == 0) {
+        return range_result::none;
+    }
+    return ranges.empty() ? range_result::unsatisfiable : range_result::satisfiable;
+}
+
+std::string content_range(const byte_range& range, std::size_t size)
+{
+    return "bytes " + std::to_string(range.first) + "-" + std::to_string(range.last) + "/" + std::to_string(size);
+}
+
+std::string content_range(std::size_t size)
+{
+    return "bytes */" + std::to_string(size);
+}
+
+multipart_ranges make_multipart_ranges(const std::vector<byte_range>& ranges, std::size_t size,
+                                       const char* content_type)
+{
+    multipart_ranges result;
+    result.content_type = "multipart/byteranges; boundary=" + boundary();
+    result.content_length = 0;
+
+    for(const auto& range : ranges) {
+        std::string header = "\r\n--" + boundary() + "\r\nContent-Type: ";
+        header += content_type;
+        header += "\r\nContent-Range: ";
+        header += content_range(range, size);
+        header += "\r\n\r\n";
+
+        result.content_length += header.size() + range.length();
+        result.part_headers.push_back(std::move(header));
+    }
+
+    result.trailer = "\r\n--" + boundary() + "--\r\n";
+    result.content_length += result.trailer.size();
+
+    return result;
+}
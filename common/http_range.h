@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Inclusive byte range of a representation, as in "Content-Range: bytes first-last/size".
+struct byte_range
+{
+    std::size_t first;
+    std::size_t last;
+
+    std::size_t length() const
+    {
+        return last - first + 1;
+    }
+};
+
+enum class range_result
+{
+    none,           // no usable Range header: send the whole representation
+    satisfiable,    // 206 Partial Content
+    unsatisfiable   // 416 Range Not Satisfiable
+};
+
+// Parses a "Range: bytes=0-99,500-,-200" header for a representation of `size` bytes.
+// Syntactically invalid headers and requests for too many ranges are ignored.
+range_result parse_range(const std::string& header, std::size_t size, std::vector<byte_range>& ranges);
+
+// Value for the Content-Range header: "bytes 0-99/1000", or "bytes */1000" for a 416.
+std::string content_range(const byte_range& range, std::size_t size);
+std::string content_range(std::size_t size);
+
+// Framing of a multipart/byteranges body. The body is
+// part_headers[0], data of range 0, part_headers[1], ..., trailer.
+struct multipart_ranges
+{
+    std::string content_type;
+    std::vector<std::string> part_headers;
+    std::string trailer;
+    std::size_t content_length;
+};
+
+multipart_ranges make_multipart_ranges(const std::vector<byte_range>& ranges, std::size_t size,
+                                       const char* content_type);
@@ -0,0 +1,63 @@
+#include "latency_histogram.h"
+
+#include <cmath>
+#include <algorithm>
+
+latency_histogram::latency_histogram() :
+    counts_(buckets, 0),
+    count_(0),
+    sum_(0),
+    max_(0)
+{
+}
+
+void latency_histogram::add(std::uint64_t value)
+{
+    counts_[index(value)]++;
+    count_++;
+    sum_ += value;
+    max_ = std::max(max_, value);
+}
+
+void latency_histogram::merge(const latency_histogram& other)
+{
+    for (std::size_t i = 0; i < counts_.size(); i++) {
+        counts_[i] += other.counts_[i];
+    }
+    count_ += other.count_;
+    sum_ += other.sum_;
+    max_ = std::max(max_, other.max_);
+}
+
+std::uint64_t latency_histogram::percentile(double fraction) const
+{
+    const std::uint64_t rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(fraction * count_)));
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < counts_.size(); i++) {
+        seen += counts_[i];
+        if (seen >= rank) {
+            return std::min(upper(i), max_);
+        }
+    }
+    return max_;
+}
+
+std::size_t latency_histogram::index(std::uint64_t value)
+{
+    if (value < (1u << sub_bits)) {
+        return static_cast<std::size_t>(value);
+    }
+    const int msb = 63 - __builtin_clzll(value);
+    const std::uint64_t sub = (value >> (msb - sub_bits)) & ((1u << sub_bits) - 1);
+    return static_cast<std::size_t>(((msb - sub_bits + 1) << sub_bits) + sub);
+}
+
+std::uint64_t latency_histogram::upper(std::size_t index)
+{
+    if (index < (1u << sub_bits)) {
+        return index;
+    }
+    const int shift = static_cast<int>(index >> sub_bits) - 1;
+    const std::uint64_t sub = index & ((1u << sub_bits) - 1);
+    return (((1ull << sub_bits) + sub + 1) << shift) - 1;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Log-linear buckets over nanoseconds: 32 per power of two, so a percentile
+// is within about 3% of the true value, in 15 KB whatever the range.
+// Not thread safe; keep one per thread and merge() them to report.
+class latency_histogram
+{
+public:
+    latency_histogram();
+
+    void add(std::uint64_t value);
+    void merge(const latency_histogram& other);
+
+    std::uint64_t count() const
+    {
+        return count_;
+    }
+
+    std::uint64_t max() const
+    {
+        return max_;
+    }
+
+    double mean() const
+    {
+        return count_ ? static_cast<double>(sum_) / count_ : 0;
+    }
+
+    // The upper bound of the bucket holding the given fraction of the
+    // values, e.g. 0.99; 0 while empty.
+    std::uint64_t percentile(double fraction) const;
+
+private:
+    enum { sub_bits = 5, buckets = (65 - sub_bits) << sub_bits };
+
+    static std::size_t index(std::uint64_t value);
+    static std::uint64_t upper(std::size_t index);
+
+    std::vector<std::uint64_t> counts_;
+    std::uint64_t count_;
+    std::uint64_t sum_;
+    std::uint64_t max_;
+};
@@ -0,0 +1,331 @@
+#include "log.h"
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <condition_variable>
+
+#include <ctime>
+
+namespace log_detail {
+
+std::atomic<int> threshold(LOG_LEVEL_INFO);
+
+}
+
+namespace {
+
+using log_detail::log_record;
+using log_detail::arg_type;
+
+// Single producer (the owning thread), single consumer (the writer); the
+// indexes are padded apart so they do not share a cache line. `busy` spans
+// begin() to commit(), so log_stop can tell when no record is in flight.
+struct log_ring
+{
+    enum { capacity = 1024, line = 64 };
+
+    std::atomic<std::uint64_t> head{0};
+    std::atomic<bool> busy{false};
+    char head_pad[line - sizeof(std::uint64_t) - sizeof(std::atomic<bool>)];
+    std::atomic<std::uint64_t> tail{0};
+    char tail_pad[line - sizeof(std::uint64_t)];
+    std::atomic<std::uint64_t> dropped{0};
+    char dropped_pad[line - sizeof(std::uint64_t)];
+    log_record records[capacity];
+};
+
+struct log_state
+{
+    std::atomic<bool> async{false};
+    std::FILE* out = stderr;
+
+    std::mutex mutex;                           // rings, writer start and stop
+    std::vector<std::unique_ptr<log_ring>> rings;
+    std::thread writer;
+    bool stopping = false;
+    std::condition_variable wakeup;
+};
+
+// never destroyed: threads may log while statics are torn down
+log_state& state()
+{
+    static log_state* s = new log_state;
+    return *s;
+}
+
+thread_local log_ring* ring = nullptr;
+thread_local log_record scratch;
+
+log_ring* thread_ring()
+{
+    if (!ring) {
+        std::unique_ptr<log_ring> created(new log_ring);
+        ring = created.get();
+        log_state& s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.rings.push_back(std::move(created));
+    }
+    return ring;
+}
+
+const char LEVELS[] = "TDIWE";
+
+void format_record(const log_record& record, std::string& out)
+{
+    const std::time_t seconds = static_cast<std::time_t>(record.time / 1000000000);
+    std::tm tm;
+    localtime_r(&seconds, &tm);
+
+    char prefix[64];
+    std::size_t length = std::strftime(prefix, sizeof(prefix), "%Y-%m-%d %H:%M:%S", &tm);
+    length += std::snprintf(prefix + length, sizeof(prefix) - length, ".%06u %c ",
+                            static_cast<unsigned>(record.time % 1000000000 / 1000),
+                            LEVELS[record.site->level]);
+    out.append(prefix, length);
+
+    const char* file = std::strrchr(record.site->file, '/');
+    out += file ? file + 1 : record.site->file;
+    out += ':';
+    out += std::to_string(record.site->line);
+    out += ' ';
+
+    std::size_t arg = 0;
+    auto append_arg = [&record, &out](std::size_t i) {
+        const log_detail::arg_value& value = record.values[i];
+        char number[32];
+        switch (record.types[i]) {
+        case arg_type::integer:
+            out += std::to_string(value.integer);
+            break;
+        case arg_type::unsigned_integer:
+            out += std::to_string(value.unsigned_integer);
+            break;
+        case arg_type::floating:
+            std::snprintf(number, sizeof(number), "%g", value.floating);
+            out += number;
+            break;
+        case arg_type::boolean:
+            out += value.unsigned_integer ? "true" : "false";
+            break;
+        case arg_type::character:
+            out += static_cast<char>(value.unsigned_integer);
+            break;
+        case arg_type::text:
+            out.append(record.text + (value.unsigned_integer >> 8), value.unsigned_integer & 0xff);
+            break;
+        }
+    };
+
+    for (const char* p = record.site->format; *p; p++) {
+        if (p[0] == '{' && p[1] == '}') {
+            if (arg < record.count) {
+                append_arg(arg++);
+            }
+            p++;
+            continue;
+        }
+        out += *p;
+    }
+    for (; arg < record.count; arg++) {
+        out += ' ';
+        append_arg(arg);
+    }
+    out += '\n';
+}
+
+void write_line(const log_record& record)
+{
+    thread_local std::string line;
+    line.clear();
+    format_record(record, line);
+    std::fwrite(line.data(), 1, line.size(), state().out);
+}
+
+// Takes what every ring holds, writes it in time order; false if there was
+// nothing. The rings are taken one after another and the sort is stable, so
+// records of the same time keep their order within a thread and the order
+// of the threads.
+bool drain(std::vector<log_record>& batch, std::string& text)
+{
+    log_state& s = state();
+    batch.clear();
+    std::uint64_t dropped = 0;
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        for (const std::unique_ptr<log_ring>& r : s.rings) {
+            const std::uint64_t tail = r->tail.load(std::memory_order_relaxed);
+            const std::uint64_t head = r->head.load(std::memory_order_acquire);
+            for (std::uint64_t i = tail; i != head; i++) {
+                batch.push_back(r->records[i % log_ring::capacity]);
+            }
+            r->tail.store(head, std::memory_order_release);
+            dropped += r->dropped.exchange(0, std::memory_order_relaxed);
+        }
+    }
+    if (batch.empty() && !dropped) {
+        return false;
+    }
+
+    std::stable_sort(batch.begin(), batch.end(), [](const log_record& a, const log_record& b) {
+        return a.time < b.time || (a.time == b.time && a.sequence < b.sequence);
+    });
+    text.clear();
+    for (const log_record& record : batch) {
+        format_record(record, text);
+    }
+    if (dropped) {
+        text += "#> log: " + std::to_string(dropped) + " records dropped\n";
+    }
+    std::fwrite(text.data(), 1, text.size(), s.out);
+    std::fflush(s.out);
+    return true;
+}
+
+// Nothing queued and no producer between begin() and commit(); once async
+// is off a producer that is not busy stays out of its ring.
+bool rings_idle()
+{
+    log_state& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    for (const std::unique_ptr<log_ring>& r : s.rings) {
+        if (r->busy.load(std::memory_order_seq_cst) ||
+            r->head.load(std::memory_order_acquire) != r->tail.load(std::memory_order_relaxed)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void run_writer()
+{
+    log_state& s = state();
+    std::vector<log_record> batch;
+    std::string text;
+    for (;;) {
+        if (drain(batch, text)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(s.mutex);
+        if (s.stopping) {
+            break;
+        }
+        s.wakeup.wait_for(lock, std::chrono::milliseconds(1));
+    }
+    // records committed after the last drain above
+    for (;;) {
+        drain(batch, text);
+        if (rings_idle()) {
+            break;
+        }
+        std::this_thread::yield();
+    }
+}
+
+}
+
+namespace log_detail {
+
+log_record* begin(const log_site& site)
+{
+    log_state& s = state();
+    log_record* record = &scratch;
+    std::uint64_t sequence = 0;
+    if (s.async.load(std::memory_order_acquire)) {
+        log_ring* r = thread_ring();
+        // busy before async is read again: log_stop either waits for this
+        // record or the record goes out synchronously
+        r->busy.store(true, std::memory_order_seq_cst);
+        if (s.async.load(std::memory_order_seq_cst)) {
+            const std::uint64_t head = r->head.load(std::memory_order_relaxed);
+            if (head - r->tail.load(std::memory_order_acquire) == log_ring::capacity) {
+                r->dropped.fetch_add(1, std::memory_order_relaxed);
+                r->busy.store(false, std::memory_order_release);
+                return nullptr;
+            }
+            record = &r->records[head % log_ring::capacity];
+            sequence = head;
+        }
+        else {
+            r->busy.store(false, std::memory_order_release);
+        }
+    }
+
+    record->time = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+    record->sequence = sequence;
+    record->site = &site;
+    record->count = 0;
+    record->text_size = 0;
+    return record;
+}
+
+void commit(log_record* record)
+{
+    if (record == &scratch) {
+        write_line(*record);
+        return;
+    }
+    ring->head.store(ring->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    ring->busy.store(false, std::memory_order_release);
+}
+
+void put_text(log_record& record, const char* data, std::size_t size)
+{
+    size = std::min(size, sizeof(record.text) - record.text_size);
+    std::memcpy(record.text + record.text_size, data, size);
+
+    arg_value v;
+    v.unsigned_integer = (static_cast<std::uint64_t>(record.text_size) << 8) | size;
+    record.text_size = static_cast<std::uint8_t>(record.text_size + size);
+    put(record, arg_type::text, v);
+}
+
+}
+
+void log_start(log_mode mode, int level, std::FILE* out)
+{
+    log_stop();
+
+    log_state& s = state();
+    s.out = out;
+    log_detail::threshold.store(level, std::memory_order_relaxed);
+    if (mode == log_mode::async) {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.stopping = false;
+        s.writer = std::thread(run_writer);
+        s.async.store(true, std::memory_order_release);
+    }
+}
+
+void log_stop()
+{
+    log_state& s = state();
+    std::thread writer;
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (!s.writer.joinable()) {
+            return;
+        }
+        s.async.store(false, std::memory_order_seq_cst);
+        s.stopping = true;
+        writer.swap(s.writer);
+    }
+    s.wakeup.notify_one();
+    writer.join();
+}
+
+int parse_log_level(const std::string& name)
+{
+    const char* names[] = { "trace", "debug", "info", "warning", "error", "off" };
+    for (int level = LOG_LEVEL_TRACE; level <= LOG_LEVEL_OFF; level++) {
+        if (name == names[level]) {
+            return level;
+        }
+    }
+    throw std::runtime_error("unknown log level: " + name);
+}
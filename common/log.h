@@ -0,0 +1,214 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+
+// Logging with the levels below LOG_MIN_LEVEL compiled out:
+//
+//     LOG_DEBUG("{} read: {} bytes", sequence, size);
+//
+// A statement under LOG_MIN_LEVEL is dead code; its arguments are not even
+// evaluated. Above it, a runtime threshold (log_start) is checked first.
+// Each "{}" takes the next argument: integers, floating point, bool, char,
+// C and std strings, std::thread::id. Strings are copied, up to the space
+// left in the record.
+//
+// In log_mode::async a statement only stores a fixed size binary record -
+// time, its place in the ring, the statement's site and the raw arguments -
+// in a lock-free ring owned by the calling thread; a background thread
+// merges the rings by time, formats and writes them. A full ring drops records rather than block, and the
+// drops are reported. In log_mode::sync the line is written right away.
+
+#define LOG_LEVEL_TRACE     0
+#define LOG_LEVEL_DEBUG     1
+#define LOG_LEVEL_INFO      2
+#define LOG_LEVEL_WARNING   3
+#define LOG_LEVEL_ERROR     4
+#define LOG_LEVEL_OFF       5
+
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_AT(LEVEL, FORMAT, ...)                                                  \
+    do {                                                                            \
+        if ((LEVEL) >= LOG_MIN_LEVEL && log_enabled(LEVEL)) {                       \
+            static const log_site log_site_ = { (LEVEL), __FILE__, __LINE__, FORMAT };   \
+            log_write(log_site_, ##__VA_ARGS__);                                    \
+        }                                                                           \
+    } while (0)
+
+#define LOG_TRACE(FORMAT, ...)      LOG_AT(LOG_LEVEL_TRACE, FORMAT, ##__VA_ARGS__)
+#define LOG_DEBUG(FORMAT, ...)      LOG_AT(LOG_LEVEL_DEBUG, FORMAT, ##__VA_ARGS__)
+#define LOG_INFO(FORMAT, ...)       LOG_AT(LOG_LEVEL_INFO, FORMAT, ##__VA_ARGS__)
+#define LOG_WARNING(FORMAT, ...)    LOG_AT(LOG_LEVEL_WARNING, FORMAT, ##__VA_ARGS__)
+#define LOG_ERROR(FORMAT, ...)      LOG_AT(LOG_LEVEL_ERROR, FORMAT, ##__VA_ARGS__)
+
+enum class log_mode
+{
+    sync,
+    async
+};
+
+// One log statement; the record refers to it instead of carrying the format.
+struct log_site
+{
+    int level;
+    const char* file;
+    int line;
+    const char* format;
+};
+
+// Sets the mode, the runtime threshold and the output, starting the
+// background writer in async mode. Before it is called, INFO and up go to
+// stderr synchronously.
+void log_start(log_mode mode, int level, std::FILE* out = stderr);
+
+// Writes what is still queued and stops the background writer.
+void log_stop();
+
+// "trace" ... "error", "off"; throws std::runtime_error otherwise.
+int parse_log_level(const std::string& name);
+
+namespace log_detail {
+
+enum { max_args = 8 };
+
+enum class arg_type : std::uint8_t
+{
+    integer,
+    unsigned_integer,
+    floating,
+    boolean,
+    character,
+    text            // offset and length into log_record::text
+};
+
+union arg_value
+{
+    std::int64_t integer;
+    std::uint64_t unsigned_integer;
+    double floating;
+};
+
+struct log_record
+{
+    std::uint64_t time;         // nanoseconds since the epoch
+    std::uint64_t sequence;     // within the thread's ring
+    const log_site* site;
+    std::uint8_t count;
+    std::uint8_t text_size;
+    arg_type types[max_args];
+    arg_value values[max_args];
+    char text[88];
+};
+
+static_assert(sizeof(log_record) == 192, "log records are three cache lines");
+
+extern std::atomic<int> threshold;
+
+log_record* begin(const log_site& site);
+void commit(log_record* record);
+
+inline void put(log_record& record, arg_type type, arg_value value)
+{
+    if (record.count < max_args) {
+        record.types[record.count] = type;
+        record.values[record.count] = value;
+        record.count++;
+    }
+}
+
+void put_text(log_record& record, const char* data, std::size_t size);
+
+template<class T>
+typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value && !std::is_same<T, char>::value>::type
+pack_one(log_record& record, T value)
+{
+    arg_value v;
+    v.integer = value;
+    put(record, arg_type::integer, v);
+}
+
+template<class T>
+typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value && !std::is_same<T, bool>::value>::type
+pack_one(log_record& record, T value)
+{
+    arg_value v;
+    v.unsigned_integer = value;
+    put(record, arg_type::unsigned_integer, v);
+}
+
+template<class T>
+typename std::enable_if<std::is_floating_point<T>::value>::type
+pack_one(log_record& record, T value)
+{
+    arg_value v;
+    v.floating = value;
+    put(record, arg_type::floating, v);
+}
+
+inline void pack_one(log_record& record, bool value)
+{
+    arg_value v;
+    v.unsigned_integer = value;
+    put(record, arg_type::boolean, v);
+}
+
+inline void pack_one(log_record& record, char value)
+{
+    arg_value v;
+    v.unsigned_integer = static_cast<unsigned char>(value);
+    put(record, arg_type::character, v);
+}
+
+inline void pack_one(log_record& record, const char* value)
+{
+    put_text(record, value, std::char_traits<char>::length(value));
+}
+
+inline void pack_one(log_record& record, const std::string& value)
+{
+    put_text(record, value.data(), value.size());
+}
+
+inline void pack_one(log_record& record, std::thread::id value)
+{
+    arg_value v;
+    v.unsigned_integer = std::hash<std::thread::id>()(value);
+    put(record, arg_type::unsigned_integer, v);
+}
+
+inline void pack(log_record& /*record*/)
+{
+}
+
+template<class T, class... Args>
+void pack(log_record& record, const T& value, const Args&... args)
+{
+    pack_one(record, value);
+    pack(record, args...);
+}
+
+}
+
+inline bool log_enabled(int level)
+{
+    return level >= log_detail::threshold.load(std::memory_order_relaxed);
+}
+
+template<class... Args>
+void log_write(const log_site& site, const Args&... args)
+{
+    log_detail::log_record* record = log_detail::begin(site);
+    if (record) {
+        log_detail::pack(*record, args...);
+        log_detail::commit(record);
+    }
+}
@@ -0,0 +1,213 @@
+#include "memory_cache.h"
+
+#include <sys/mman.h>
+
+namespace {
+
+void render_header(memory_variant& variant, const char* content_type, bool gzip, bool vary)
+{
+    std::string& header = variant.header;
+    header.reserve(256);
+    header += "HTTP/1.1 200 OK\r\nServer: ashttp\r\nContent-Type: ";
+    header += content_type;
+    header += "\r\nContent-Length: ";
+    header += std::to_string(variant.size);
+    header += "\r\nLast-Modified: ";
+    header += variant.last_modified;
+    header += "\r\nETag: ";
+    header += variant.etag;
+    header += "\r\n";
+    if(gzip) {
+        header += "Content-Encoding: gzip\r\n";
+    }
+    else {
+        header += "Accept-Ranges: bytes\r\n";
+    }
+    if(vary) {
+        header += "Vary: Accept-Encoding\r\n";
+    }
+}
+
+bool map_variant(memory_variant& variant, const file_cache::entry_ptr& file,
+                 const char* content_type, bool gzip, bool vary)
+{
+    variant.file = file;
+    variant.size = file->size;
+    variant.etag = file->etag;
+    variant.mtime = file->mtime;
+    variant.last_modified = file->last_modified;
+
+    if(file->size) {
+        void* body = ::mmap(nullptr, file->size, PROT_READ, MAP_SHARED | MAP_POPULATE, file->fd, 0);
+        if(body == MAP_FAILED) {
+            variant.file.reset();
+            return false;
+        }
+        variant.body = static_cast<const char*>(body);
+        variant.mapped = true;
+    }
+
+    render_header(variant, content_type, gzip, vary);
+    return true;
+}
+
+bool compress_variant(memory_variant& variant, const memory_variant& identity, const char* content_type, int level)
+{
+    if(!gzip_compress(identity.body, identity.size, level, variant.compressed) ||
+       variant.compressed.size() >= identity.size) {
+        return false;
+    }
+
+    variant.file = identity.file;
+    variant.body = variant.compressed.data();
+    variant.size = variant.compressed.size();
+    variant.mtime = identity.mtime;
+    variant.last_modified = identity.last_modified;
+
+    // a distinct strong validator for the encoded representation
+    variant.etag = identity.etag;
+    variant.etag.insert(variant.etag.size() - 1, "-gzip");
+
+    render_header(variant, content_type, true, true);
+    return true;
+}
+
+void unmap_variant(memory_variant& variant)
+{
+    if(variant.mapped) {
+        ::munmap(const_cast<char*>(variant.body), variant.size);
+    }
+}
+
+}
+
+memory_variant::memory_variant() :
+    body(nullptr),
+    size(0),
+    mapped(false),
+    mtime(0)
+{
+}
+
+memory_entry::~memory_entry()
+{
+    unmap_variant(identity);
+    unmap_variant(gzip);
+}
+
+memory_cache::memory_cache(file_cache& files, std::size_t budget, std::size_t max_file_size,
+                           const gzip_options& gzip) :
+    files_(files),
+    budget_(budget),
+    max_file_size_(max_file_size),
+    gzip_(gzip),
+    memory_(0)
+{
+}
+
+memory_cache::entry_ptr memory_cache::lookup(const std::string& url)
+{
+    std::string path;
+    if(!files_.resolve(url, path)) {
+        return nullptr;
+    }
+
+    auto file = files_.open_path(path);
+    if(!file || file->size > max_file_size_ || file->size > budget_) {
+        return nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        auto it = entries_.find(path);
+        if(it != entries_.end()) {
+            if(current(*it->second.entry, file)) {
+                lru_.splice(lru_.begin(), lru_, it->second.lru);
+                return it->second.entry;
+            }
+            erase(it);
+        }
+    }
+
+    auto gzip = files_.open_path(path + ".gz");
+    if(gzip && gzip->size > max_file_size_) {
+        gzip.reset();
+    }
+
+    auto entry = load(file, gzip);
+    if(!entry) {
+        return nullptr;
+    }
+    const std::size_t cost = entry->identity.size + entry->identity.header.size() +
+                             entry->gzip.size + entry->gzip.header.size();
+
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto it = entries_.find(path);
+    if(it != entries_.end()) {
+        erase(it);
+    }
+
+    while(!lru_.empty() && memory_ + cost > budget_) {
+        erase(entries_.find(lru_.back()));
+    }
+
+    lru_.push_front(path);
+    slot& s = entries_[path];
+    s.entry = entry;
+    s.cost = cost;
+    s.lru = lru_.begin();
+    memory_ += cost;
+
+    return entry;
+}
+
+std::size_t memory_cache::memory() const
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    return memory_;
+}
+
+std::size_t memory_cache::size() const
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    return entries_.size();
+}
+
+bool memory_cache::current(const memory_entry& entry, const file_cache::entry_ptr& file) const
+{
+    // file_cache hands out a new entry once the file changed on disk or was
+    // evicted; an evicted sibling is no longer watched, so it is reloaded
+    if(entry.identity.file.lock() != file) {
+        return false;
+    }
+    if(!entry.has_gzip()) {
+        return true;
+    }
+    const file_cache::entry_ptr gzip = entry.gzip.file.lock();
+    return gzip && !gzip->stale;
+}
+
+memory_cache::entry_ptr memory_cache::load(const file_cache::entry_ptr& file, const file_cache::entry_ptr& gzip) const
+{
+    auto entry = std::make_shared<memory_entry>();
+
+    const bool encode = !gzip && gzip_.worth(file->size) && compressible(file->content_type);
+    if(!map_variant(entry->identity, file, file->content_type, false, gzip != nullptr || encode)) {
+        return nullptr;
+    }
+    if(gzip && !map_variant(entry->gzip, gzip, file->content_type, true, true)) {
+        return nullptr;
+    }
+    if(encode && !compress_variant(entry->gzip, entry->identity, file->content_type, gzip_.level)) {
+        // incompressible after all: Vary in the identity header is harmless
+        entry->gzip = memory_variant();
+    }
+    return entry;
+}
+
+void memory_cache::erase(std::unordered_map<std::string, slot>::iterator it)
+{
+    memory_ -= it->second.cost;
+    lru_.erase(it->second.lru);
+    entries_.erase(it);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "gzip.h"
+#include "file_cache.h"
+
+// One representation of a cached file: the status line and entity headers
+// rendered once, and the body either mapped into memory or, for a variant
+// compressed on the fly, held in `compressed`.
+struct memory_variant
+{
+    memory_variant();
+
+    std::string header;     // ends with "\r\n" but not the blank line
+    const char* body;
+    std::size_t size;
+    bool mapped;
+
+    std::string etag;
+    std::time_t mtime;
+    std::string last_modified;
+
+    std::string compressed;
+
+    // The file_cache entry it was made from. Not held: the mapping outlives
+    // the descriptor, and file_cache alone decides how many stay open.
+    std::weak_ptr<const file_entry> file;
+};
+
+struct memory_entry
+{
+    memory_entry() = default;
+    ~memory_entry();
+
+    memory_entry(const memory_entry&) = delete;
+    memory_entry& operator=(const memory_entry&) = delete;
+
+    bool has_gzip() const
+    {
+        return !gzip.header.empty();
+    }
+
+    memory_variant identity;
+    memory_variant gzip;    // "<file>.gz" sibling, or compressed once on load
+};
+
+// Size-limited cache of small hot files on top of file_cache.
+// Entries are dropped together with their file_cache entry - changed on
+// disk, or evicted there and opened again - and evicted
+// least recently used first when the memory budget is exceeded.
+// Compressible files without a "<file>.gz" sibling get a gzip variant
+// built once when the entry is loaded.
+class memory_cache
+{
+public:
+    typedef std::shared_ptr<const memory_entry> entry_ptr;
+
+    memory_cache(file_cache& files, std::size_t budget, std::size_t max_file_size,
+                 const gzip_options& gzip = gzip_options());
+
+    memory_cache(const memory_cache&) = delete;
+    memory_cache& operator=(const memory_cache&) = delete;
+
+    // Returns nullptr when the target is missing or too large to be cached;
+    // the caller falls back to sendfile in that case.
+    entry_ptr lookup(const std::string& url);
+
+    std::size_t memory() const;
+    std::size_t size() const;
+
+private:
+    struct slot
+    {
+        entry_ptr entry;
+        std::size_t cost;
+        std::list<std::string>::iterator lru;
+    };
+
+    bool current(const memory_entry& entry, const file_cache::entry_ptr& file) const;
+    entry_ptr load(const file_cache::entry_ptr& file, const file_cache::entry_ptr& gzip) const;
+    void erase(std::unordered_map<std::string, slot>::iterator it);
+
+private:
+    file_cache& files_;
+    const std::size_t budget_;
+    const std::size_t max_file_size_;
+    const gzip_options gzip_;
+
+    mutable std::mutex mutex_;
+    std::size_t memory_;
+    std::list<std::string> lru_;
+    std::unordered_map<std::string, slot> entries_;
+};
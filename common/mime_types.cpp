@@ -0,0 +1,70 @@
+#include "mime_types.h"
+
+#include <cctype>
+#include <cstring>
+
+namespace {
+
+struct mapping
+{
+    const char* extension;
+    const char* mime_type;
+};
+
+const mapping MAPPINGS[] = {
+    { "html",  "text/html" },
+    { "htm",   "text/html" },
+    { "css",   "text/css" },
+    { "js",    "application/javascript" },
+    { "json",  "application/json" },
+    { "txt",   "text/plain" },
+    { "xml",   "text/xml" },
+    { "svg",   "image/svg+xml" },
+    { "png",   "image/png" },
+    { "jpg",   "image/jpeg" },
+    { "jpeg",  "image/jpeg" },
+    { "gif",   "image/gif" },
+    { "ico",   "image/x-icon" },
+    { "webp",  "image/webp" },
+    { "woff",  "font/woff" },
+    { "woff2", "font/woff2" },
+    { "ttf",   "font/ttf" },
+    { "pdf",   "application/pdf" },
+    { "zip",   "application/zip" },
+    { "gz",    "application/gzip" },
+    { "tar",   "application/x-tar" },
+    { "mp4",   "video/mp4" },
+    { "webm",  "video/webm" },
+    { "mp3",   "audio/mpeg" },
+    { "wasm",  "application/wasm" },
+};
+
+const char* DEFAULT_MIME_TYPE = "application/octet-stream";
+
+}
+
+const char* mime_type(const std::string& path)
+{
+    const std::size_t dot = path.rfind('.');
+    const std::size_t slash = path.rfind('/');
+    if(dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return DEFAULT_MIME_TYPE;
+    }
+
+    char extension[8];
+    const std::size_t length = path.size() - dot - 1;
+    if(length == 0 || length >= sizeof(extension)) {
+        return DEFAULT_MIME_TYPE;
+    }
+    for(std::size_t i = 0; i < length; i++) {
+        extension[i] = std::tolower(static_cast<unsigned char>(path[dot + 1 + i]));
+    }
+    extension[length] = '\0';
+
+    for(const auto& m : MAPPINGS) {
+        if(std::strcmp(m.extension, extension) == 0) {
+            return m.mime_type;
+        }
+    }
+    return DEFAULT_MIME_TYPE;
+}
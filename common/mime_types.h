@@ -0,0 +1,7 @@
+#pragma once
+
+#include <string>
+
+// Content-Type for a file path, decided by its extension.
+// Unknown extensions are served as application/octet-stream.
+const char* mime_type(const std::string& path);
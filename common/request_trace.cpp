@@ -0,0 +1,187 @@
+#include "request_trace.h"
+#include "latency_histogram.h"
+
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <cmath>
+#include <algorithm>
+
+namespace {
+
+const char* PHASE_NAMES[trace_phase_count] = {
+    "accept",
+    "head_read",
+    "pool_acquire",
+    "upstream_connect",
+    "upstream_first_byte",
+    "body_transfer",
+    "downstream_write",
+};
+
+struct stored_trace
+{
+    std::uint64_t id;
+    unsigned thread;
+    std::uint64_t start;
+    std::uint64_t begins[trace_phase_count];
+    std::uint64_t ends[trace_phase_count];
+};
+
+struct trace_state
+{
+    std::atomic<std::uint64_t> period{0};
+    std::atomic<unsigned> threads{0};
+    std::uint64_t epoch = 0;
+
+    std::mutex mutex;                   // everything below
+    std::size_t max_traces = 0;
+    std::vector<stored_trace> traces;
+    std::uint64_t dropped = 0;
+    latency_histogram phases[trace_phase_count];
+    latency_histogram requests;
+};
+
+// never destroyed: workers may finish requests while statics are torn down
+trace_state& state()
+{
+    static trace_state* s = new trace_state;
+    return *s;
+}
+
+thread_local std::uint64_t thread_requests = 0;
+
+unsigned thread_number()
+{
+    thread_local const unsigned number = state().threads++;
+    return number;
+}
+
+void write_event(std::ostream& out, bool& first, const char* name, std::uint64_t id, unsigned thread,
+                 std::uint64_t epoch, std::uint64_t begin, std::uint64_t end)
+{
+    out << (first ? "\n" : ",\n");
+    first = false;
+    out << "{\"name\":\"" << name << "\",\"cat\":\"request\",\"ph\":\"X\",\"pid\":1"
+        << ",\"tid\":" << thread
+        << ",\"ts\":" << (begin - epoch) / 1000.0
+        << ",\"dur\":" << (end - begin) / 1000.0
+        << ",\"args\":{\"request\":" << id << "}}";
+}
+
+void write_row(std::ostream& out, const char* name, const latency_histogram& histogram)
+{
+    out << "#> trace " << name
+        << " count: " << histogram.count()
+        << " mean: " << static_cast<std::uint64_t>(histogram.mean()) / 1000.0
+        << " p50: " << histogram.percentile(0.5) / 1000.0
+        << " p90: " << histogram.percentile(0.9) / 1000.0
+        << " p99: " << histogram.percentile(0.99) / 1000.0
+        << " p99.9: " << histogram.percentile(0.999) / 1000.0
+        << " max: " << histogram.max() / 1000.0
+        << "\n";
+}
+
+}
+
+const char* trace_phase_name(trace_phase phase)
+{
+    return PHASE_NAMES[static_cast<std::size_t>(phase)];
+}
+
+void trace_start(double sample_rate, std::size_t max_traces)
+{
+    trace_state& s = state();
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.max_traces = max_traces;
+        s.traces.reserve(std::min<std::size_t>(max_traces, 4096));
+        s.epoch = trace_now();
+    }
+    const double rate = std::min(sample_rate, 1.0);
+    s.period = rate > 0 ? static_cast<std::uint64_t>(std::llround(1 / rate)) : 0;
+}
+
+void trace_write_chrome(std::ostream& out)
+{
+    trace_state& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    bool first = true;
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    for (const stored_trace& trace : s.traces) {
+        std::uint64_t end = trace.start;
+        for (std::size_t i = 0; i < trace_phase_count; i++) {
+            if (trace.ends[i]) {
+                write_event(out, first, PHASE_NAMES[i], trace.id, trace.thread, s.epoch, trace.begins[i], trace.ends[i]);
+                end = std::max(end, trace.ends[i]);
+            }
+        }
+        write_event(out, first, "request", trace.id, trace.thread, s.epoch, trace.start, end);
+    }
+    out << "\n]}\n";
+}
+
+void trace_write_histograms(std::ostream& out)
+{
+    trace_state& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    out << "#> trace phases, microseconds\n";
+    for (std::size_t i = 0; i < trace_phase_count; i++) {
+        write_row(out, PHASE_NAMES[i], s.phases[i]);
+    }
+    write_row(out, "request", s.requests);
+    if (s.dropped) {
+        out << "#> trace " << s.dropped << " traces over the limit left out of the timeline\n";
+    }
+}
+
+void request_trace::begin(std::uint64_t id, std::uint64_t since)
+{
+    const std::uint64_t period = state().period.load(std::memory_order_relaxed);
+    sampled_ = period && ++thread_requests % period == 0;
+    if (sampled_) {
+        id_ = id;
+        start_ = since ? since : trace_now();
+        last_ = start_;
+        std::fill(ends_, ends_ + trace_phase_count, 0);
+    }
+}
+
+void request_trace::mark_sampled(trace_phase phase)
+{
+    const std::size_t i = static_cast<std::size_t>(phase);
+    const std::uint64_t now = trace_now();
+    begins_[i] = last_;
+    ends_[i] = now;
+    last_ = now;
+}
+
+void request_trace::finish_sampled()
+{
+    sampled_ = false;
+
+    stored_trace trace;
+    trace.id = id_;
+    trace.thread = thread_number();
+    trace.start = start_;
+    std::copy(begins_, begins_ + trace_phase_count, trace.begins);
+    std::copy(ends_, ends_ + trace_phase_count, trace.ends);
+
+    trace_state& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    for (std::size_t i = 0; i < trace_phase_count; i++) {
+        if (ends_[i]) {
+            s.phases[i].add(ends_[i] - begins_[i]);
+        }
+    }
+    s.requests.add(last_ - start_);
+    if (s.traces.size() < s.max_traces) {
+        s.traces.push_back(trace);
+    }
+    else {
+        s.dropped++;
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <cstdint>
+#include <ostream>
+
+// Phase timestamps of sampled requests, to see where the tail latency of a
+// proxied request goes:
+//
+//     request_trace trace;
+//     trace.begin(sequence);
+//     ... read the head ...
+//     trace.mark(trace_phase::head_read);
+//     ...
+//     trace.finish();
+//
+// A phase ends at its mark() and begins where the previous one ended, or at
+// begin(); phases that do not happen for a request (no new upstream
+// connection, no body left to read) are simply not marked. An unsampled
+// request costs a branch per call. Sampled ones take steady_clock
+// timestamps and are handed over, under a lock, on finish().
+
+enum class trace_phase : std::uint8_t
+{
+    accept,                 // accepted until the session runs; first request on a connection
+    head_read,              // waiting for and reading the request head
+    pool_acquire,           // taking an upstream client from the pool
+    upstream_connect,       // a new upstream connection
+    upstream_first_byte,    // request sent until the upstream response head arrived
+    body_transfer,          // the rest of the upstream body
+    downstream_write,       // the response written back to the client
+};
+
+enum { trace_phase_count = 7 };
+
+const char* trace_phase_name(trace_phase phase);
+
+// Samples one request in round(1 / sample_rate) per thread; 0 turns tracing
+// off, which is the default. Keeps up to max_traces traces for the Chrome
+// export; histograms take every sampled trace.
+void trace_start(double sample_rate, std::size_t max_traces = 100000);
+
+// Chrome trace-event JSON (chrome://tracing, Perfetto) of the kept traces.
+void trace_write_chrome(std::ostream& out);
+
+// Count and percentiles of every phase and of whole requests.
+void trace_write_histograms(std::ostream& out);
+
+inline std::uint64_t trace_now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class request_trace
+{
+public:
+    request_trace() :
+        sampled_(false)
+    {
+    }
+
+    // Decides whether the request is sampled. `since` is when its first
+    // phase began, for a request that started before the call.
+    void begin(std::uint64_t id, std::uint64_t since = 0);
+
+    bool sampled() const
+    {
+        return sampled_;
+    }
+
+    void mark(trace_phase phase)
+    {
+        if (sampled_) {
+            mark_sampled(phase);
+        }
+    }
+
+    // Hands a sampled trace to the exporters; a trace cut short by an error
+    // is kept with the phases it reached. Does nothing the second time.
+    void finish()
+    {
+        if (sampled_) {
+            finish_sampled();
+        }
+    }
+
+private:
+    void mark_sampled(trace_phase phase);
+    void finish_sampled();
+
+    bool sampled_;
+    std::uint64_t id_;
+    std::uint64_t start_;
+    std::uint64_t last_;
+    std::uint64_t begins_[trace_phase_count];
+    std::uint64_t ends_[trace_phase_count];     // 0 if not reached
+};
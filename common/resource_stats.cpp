@@ -0,0 +1,392 @@
+#include "resource_stats.h"
+
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#ifndef RESOURCE_STATS
+#define RESOURCE_STATS 0
+#endif
+
+#if RESOURCE_STATS
+#include <poll.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#endif
+
+namespace {
+
+enum { max_threads = 256 };
+
+// A thread's counts on a cache line of its own. Zero initialized before any
+// constructor runs, so allocations made during static initialization are
+// counted too.
+struct thread_cell
+{
+    std::atomic<std::int64_t> allocations;
+    std::atomic<std::int64_t> deallocations;
+    std::atomic<std::int64_t> bytes;
+    std::atomic<std::int64_t> reads;
+    std::atomic<std::int64_t> writes;
+    std::atomic<std::int64_t> polls;
+    char pad[64 - 6 * sizeof(std::atomic<std::int64_t>)];
+};
+
+thread_cell cells[max_threads];
+std::atomic<std::size_t> threads_seen(0);
+
+#if RESOURCE_STATS
+
+// -1 until the thread first counts something; more than max_threads threads
+// share cells
+thread_local int thread_slot = -1;
+
+thread_cell& this_thread_cell()
+{
+    if(thread_slot < 0) {
+        thread_slot = static_cast<int>(threads_seen.fetch_add(1, std::memory_order_relaxed) % max_threads);
+    }
+    return cells[thread_slot];
+}
+
+void tally(std::atomic<std::int64_t> thread_cell::*field, std::int64_t n = 1)
+{
+    (this_thread_cell().*field).fetch_add(n, std::memory_order_relaxed);
+}
+
+void* allocate(std::size_t size)
+{
+    tally(&thread_cell::allocations);
+    tally(&thread_cell::bytes, static_cast<std::int64_t>(size));
+    for(;;) {
+        void* p = std::malloc(size ? size : 1);
+        if(p) {
+            return p;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if(!handler) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+void deallocate(void* p)
+{
+    if(p) {
+        tally(&thread_cell::deallocations);
+        std::free(p);
+    }
+}
+
+// the libc function a wrapper stands in for
+template<class Function>
+Function next_symbol(const char* name)
+{
+    return reinterpret_cast<Function>(::dlsym(RTLD_NEXT, name));
+}
+
+#endif
+
+std::int64_t sum(std::atomic<std::int64_t> thread_cell::*field)
+{
+    std::int64_t total = 0;
+    for(const thread_cell& cell : cells) {
+        total += (cell.*field).load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+double seconds(const timeval& time)
+{
+    return time.tv_sec + time.tv_usec / 1e6;
+}
+
+void per_request(std::ostream& out, const char* name, std::int64_t value, std::int64_t requests)
+{
+    out << " " << static_cast<double>(value) / requests << " " << name;
+}
+
+}
+
+#if RESOURCE_STATS
+
+void* operator new(std::size_t size)
+{
+    return allocate(size);
+}
+
+void* operator new[](std::size_t size)
+{
+    return allocate(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    try {
+        return allocate(size);
+    }
+    catch(...) {
+        return nullptr;
+    }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    try {
+        return allocate(size);
+    }
+    catch(...) {
+        return nullptr;
+    }
+}
+
+void operator delete(void* p) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+    deallocate(p);
+}
+
+// Definitions in the executable take precedence over libc's, for the code
+// linked into it and for the shared libraries it loads (Poco) alike. Calls
+// libc makes internally, or a fortified build routes to the *_chk variants,
+// are not seen.
+#define RESOURCE_WRAP(FIELD, RESULT, NAME, PARAMETERS, ARGUMENTS, ...)            \
+    RESULT NAME PARAMETERS __VA_ARGS__                                          \
+    {                                                                           \
+        static const auto next = next_symbol<RESULT (*) PARAMETERS>(#NAME);     \
+        tally(&thread_cell::FIELD);                                             \
+        return next ARGUMENTS;                                                  \
+    }
+
+extern "C" {
+
+RESOURCE_WRAP(reads, ssize_t, read, (int fd, void* data, size_t size), (fd, data, size))
+RESOURCE_WRAP(reads, ssize_t, readv, (int fd, const iovec* iov, int count), (fd, iov, count))
+RESOURCE_WRAP(reads, ssize_t, recv, (int fd, void* data, size_t size, int flags), (fd, data, size, flags))
+RESOURCE_WRAP(reads, ssize_t, recvfrom,
+              (int fd, void* data, size_t size, int flags, sockaddr* from, socklen_t* length),
+              (fd, data, size, flags, from, length))
+RESOURCE_WRAP(reads, ssize_t, recvmsg, (int fd, msghdr* message, int flags), (fd, message, flags))
+
+RESOURCE_WRAP(writes, ssize_t, write, (int fd, const void* data, size_t size), (fd, data, size))
+RESOURCE_WRAP(writes, ssize_t, writev, (int fd, const iovec* iov, int count), (fd, iov, count))
+RESOURCE_WRAP(writes, ssize_t, send, (int fd, const void* data, size_t size, int flags), (fd, data, size, flags))
+RESOURCE_WRAP(writes, ssize_t, sendto,
+              (int fd, const void* data, size_t size, int flags, const sockaddr* to, socklen_t length),
+              (fd, data, size, flags, to, length))
+RESOURCE_WRAP(writes, ssize_t, sendmsg, (int fd, const msghdr* message, int flags), (fd, message, flags))
+RESOURCE_WRAP(writes, ssize_t, sendfile, (int out, int in, off_t* offset, size_t size), (out, in, offset, size), noexcept)
+
+RESOURCE_WRAP(polls, int, epoll_wait, (int fd, epoll_event* events, int max, int timeout), (fd, events, max, timeout))
+RESOURCE_WRAP(polls, int, epoll_pwait,
+              (int fd, epoll_event* events, int max, int timeout, const sigset_t* mask),
+              (fd, events, max, timeout, mask))
+RESOURCE_WRAP(polls, int, poll, (pollfd* fds, nfds_t count, int timeout), (fds, count, timeout))
+RESOURCE_WRAP(polls, int, select,
+              (int count, fd_set* reads, fd_set* writes, fd_set* errors, timeval* timeout),
+              (count, reads, writes, errors, timeout))
+
+}
+
+#undef RESOURCE_WRAP
+
+#endif
+
+resource_usage operator-(const resource_usage& after, const resource_usage& before)
+{
+    resource_usage usage;
+    usage.allocations = after.allocations - before.allocations;
+    usage.deallocations = after.deallocations - before.deallocations;
+    usage.allocated_bytes = after.allocated_bytes - before.allocated_bytes;
+    usage.reads = after.reads - before.reads;
+    usage.writes = after.writes - before.writes;
+    usage.polls = after.polls - before.polls;
+    usage.user_seconds = after.user_seconds - before.user_seconds;
+    usage.system_seconds = after.system_seconds - before.system_seconds;
+    usage.voluntary_switches = after.voluntary_switches - before.voluntary_switches;
+    usage.involuntary_switches = after.involuntary_switches - before.involuntary_switches;
+    usage.minor_faults = after.minor_faults - before.minor_faults;
+    usage.syscr = after.syscr - before.syscr;
+    usage.syscw = after.syscw - before.syscw;
+    usage.thread_allocations = after.thread_allocations;
+    for(std::size_t i = 0; i < usage.thread_allocations.size() && i < before.thread_allocations.size(); i++) {
+        usage.thread_allocations[i] -= before.thread_allocations[i];
+    }
+    return usage;
+}
+
+bool resource_stats_enabled()
+{
+    return RESOURCE_STATS != 0;
+}
+
+resource_usage resource_snapshot()
+{
+    resource_usage usage;
+    usage.allocations = sum(&thread_cell::allocations);
+    usage.deallocations = sum(&thread_cell::deallocations);
+    usage.allocated_bytes = sum(&thread_cell::bytes);
+    usage.reads = sum(&thread_cell::reads);
+    usage.writes = sum(&thread_cell::writes);
+    usage.polls = sum(&thread_cell::polls);
+
+    const std::size_t threads = std::min<std::size_t>(threads_seen.load(std::memory_order_relaxed), max_threads);
+    for(std::size_t i = 0; i < threads; i++) {
+        usage.thread_allocations.push_back(cells[i].allocations.load(std::memory_order_relaxed));
+    }
+
+    rusage self;
+    if(::getrusage(RUSAGE_SELF, &self) == 0) {
+        usage.user_seconds = seconds(self.ru_utime);
+        usage.system_seconds = seconds(self.ru_stime);
+        usage.voluntary_switches = self.ru_nvcsw;
+        usage.involuntary_switches = self.ru_nivcsw;
+        usage.minor_faults = self.ru_minflt;
+    }
+
+    std::ifstream io("/proc/self/io");
+    std::string name;
+    std::int64_t value;
+    while(io >> name >> value) {
+        if(name == "syscr:") {
+            usage.syscr = value;
+        }
+        else if(name == "syscw:") {
+            usage.syscw = value;
+        }
+    }
+    return usage;
+}
+
+std::int64_t resource_thread_allocations()
+{
+#if RESOURCE_STATS
+    return this_thread_cell().allocations.load(std::memory_order_relaxed);
+#else
+    return 0;
+#endif
+}
+
+void resource_report(std::ostream& out, const resource_usage& usage, std::int64_t requests, double elapsed)
+{
+    const std::ios::fmtflags flags = out.flags();
+    const std::streamsize precision = out.precision();
+
+    out << std::fixed << std::setprecision(0) << requests << " requests "
+        << (elapsed > 0 ? requests / elapsed : 0) << " rps";
+    if(requests > 0) {
+        out << std::setprecision(2) << ", per request:";
+        if(resource_stats_enabled()) {
+            per_request(out, "allocations", usage.allocations, requests);
+            per_request(out, "bytes allocated", usage.allocated_bytes, requests);
+            per_request(out, "syscalls", usage.reads + usage.writes + usage.polls, requests);
+            out << " (";
+            per_request(out, "read", usage.reads, requests);
+            per_request(out, "write", usage.writes, requests);
+            per_request(out, "poll", usage.polls, requests);
+            out << " )";
+        }
+        per_request(out, "syscr+syscw", usage.syscr + usage.syscw, requests);
+        per_request(out, "context switches", usage.voluntary_switches + usage.involuntary_switches, requests);
+        out << " " << (usage.user_seconds + usage.system_seconds) * 1e6 / requests << " cpu us";
+    }
+    if(resource_stats_enabled() && usage.thread_allocations.size() > 1) {
+        out << std::setprecision(0) << "; allocations by thread:";
+        for(const std::int64_t allocations : usage.thread_allocations) {
+            out << " " << allocations;
+        }
+    }
+    out << std::endl;
+
+    out.flags(flags);
+    out.precision(precision);
+}
+
+stats_reporter::stats_reporter(std::chrono::seconds interval, std::function<std::int64_t()> requests,
+                               std::ostream& out) :
+    interval_(interval),
+    requests_(std::move(requests)),
+    out_(out),
+    stopping_(false),
+    thread_(&stats_reporter::run, this)
+{
+}
+
+stats_reporter::~stats_reporter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wakeup_.notify_one();
+    thread_.join();
+}
+
+void stats_reporter::run()
+{
+    const auto start = std::chrono::steady_clock::now();
+    const resource_usage first = resource_snapshot();
+    const std::int64_t first_requests = requests_();
+
+    auto last = start;
+    resource_usage previous = first;
+    std::int64_t previous_requests = first_requests;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(!stopping_) {
+        if(wakeup_.wait_until(lock, last + interval_, [this]() { return stopping_; })) {
+            break;
+        }
+        const auto now = std::chrono::steady_clock::now();
+        const resource_usage current = resource_snapshot();
+        const std::int64_t current_requests = requests_();
+
+        out_ << "#> stats: ";
+        resource_report(out_, current - previous, current_requests - previous_requests,
+                        std::chrono::duration<double>(now - last).count());
+
+        last = now;
+        previous = current;
+        previous_requests = current_requests;
+    }
+
+    out_ << "#> stats total: ";
+    resource_report(out_, resource_snapshot() - first, requests_() - first_requests,
+                    std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <ostream>
+#include <functional>
+#include <condition_variable>
+
+// What a server spends per request, beyond the time: heap allocations and
+// system calls. Built with RESOURCE_STATS (cmake -DRESOURCE_STATS=ON) the
+// global operator new and delete are replaced to count allocations and bytes
+// per thread, and the libc read, write and poll calls - read(2), recv(2),
+// sendmsg(2), sendfile(2), epoll_wait(2) and their kin - are wrapped to count
+// them. Without it those read zero and only the figures of getrusage(2) and
+// /proc/self/io, sampled by resource_snapshot(), are there.
+
+struct resource_usage
+{
+    // RESOURCE_STATS only
+    std::int64_t allocations = 0;
+    std::int64_t deallocations = 0;
+    std::int64_t allocated_bytes = 0;
+    std::int64_t reads = 0;                 // read, readv, recv, recvfrom, recvmsg
+    std::int64_t writes = 0;                // write, writev, send, sendto, sendmsg, sendfile
+    std::int64_t polls = 0;                 // epoll_wait, epoll_pwait, poll, select
+
+    // getrusage
+    double user_seconds = 0;
+    double system_seconds = 0;
+    std::int64_t voluntary_switches = 0;
+    std::int64_t involuntary_switches = 0;
+    std::int64_t minor_faults = 0;
+
+    // /proc/self/io: the read(2) and write(2) family calls the kernel counts,
+    // recvmsg(2), sendmsg(2) and sendfile(2) are not among them
+    std::int64_t syscr = 0;
+    std::int64_t syscw = 0;
+
+    // allocations made by each thread, in the order threads first allocated
+    std::vector<std::int64_t> thread_allocations;
+};
+
+resource_usage operator-(const resource_usage& after, const resource_usage& before);
+
+// true when built with RESOURCE_STATS
+bool resource_stats_enabled();
+
+resource_usage resource_snapshot();
+
+// allocations the calling thread has made so far, RESOURCE_STATS only
+std::int64_t resource_thread_allocations();
+
+// One line of per request figures for `requests` served over `elapsed`.
+void resource_report(std::ostream& out, const resource_usage& usage, std::int64_t requests, double elapsed);
+
+// Writes a resource_report line every interval, for the requests counted
+// since the previous one, and one for the whole run when destroyed.
+class stats_reporter
+{
+public:
+    stats_reporter(std::chrono::seconds interval, std::function<std::int64_t()> requests, std::ostream& out);
+    ~stats_reporter();
+
+    stats_reporter(const stats_reporter&) = delete;
+    stats_reporter& operator=(const stats_reporter&) = delete;
+
+private:
+    void run();
+
+    const std::chrono::seconds interval_;
+    const std::function<std::int64_t()> requests_;
+    std::ostream& out_;
+
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    bool stopping_;
+    std::thread thread_;
+};
@@ -0,0 +1,71 @@
+#include "sharded_counter.h"
+
+#include <thread>
+
+namespace {
+
+// a power of two, at least the hardware threads
+std::size_t cells_for_hardware()
+{
+    const std::size_t threads = std::thread::hardware_concurrency();
+    std::size_t cells = 1;
+    while(cells < threads && cells < 256) {
+        cells <<= 1;
+    }
+    return cells;
+}
+
+std::atomic<std::size_t> next_thread_index(0);
+
+}
+
+sharded_counter::sharded_counter() :
+    mask_(cells_for_hardware() - 1),
+    cells_(new cell[mask_ + 1])
+{
+}
+
+std::int64_t sharded_counter::value() const
+{
+    std::int64_t sum = 0;
+    for(std::size_t i = 0; i <= mask_; i++) {
+        sum += cells_[i].value.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+std::size_t sharded_counter::thread_index()
+{
+    thread_local const std::size_t index = next_thread_index++;
+    return index;
+}
+
+counter_publisher::counter_publisher(std::chrono::milliseconds interval,
+                                     std::vector<const sharded_counter*> counters) :
+    interval_(interval),
+    counters_(std::move(counters)),
+    stopping_(false),
+    thread_(&counter_publisher::run, this)
+{
+}
+
+counter_publisher::~counter_publisher()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wakeup_.notify_one();
+    thread_.join();
+}
+
+void counter_publisher::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    do {
+        for(const sharded_counter* counter : counters_) {
+            counter->publish();
+        }
+    }
+    while(!wakeup_.wait_for(lock, interval_, [this]() { return stopping_; }));
+}
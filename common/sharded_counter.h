@@ -0,0 +1,100 @@
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <condition_variable>
+
+// A statistic updated from many threads and read rarely - by a stats loop or
+// a metrics handler. Every thread adds to a cell on its own cache line and
+// value() sums the cells, so updates do not bounce a shared line between
+// cores. Threads get a cell in the order they first use any counter; with
+// more threads than cells some share one, which stays correct since the
+// adds are atomic, just not free of contention.
+//
+// Works as a counter (add) and as a gauge (add and sub).
+class sharded_counter
+{
+public:
+    sharded_counter();
+
+    sharded_counter(const sharded_counter&) = delete;
+    sharded_counter& operator=(const sharded_counter&) = delete;
+
+    void add(std::int64_t n = 1)
+    {
+        cells_[thread_index() & mask_].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void sub(std::int64_t n = 1)
+    {
+        add(-n);
+    }
+
+    // Counts like add() and returns a number no other call returns, for
+    // sequence ids; value() is then the number of ids issued. Do not mix with
+    // add() and sub() on the same counter.
+    std::uint64_t next_id()
+    {
+        const std::size_t index = thread_index() & mask_;
+        const std::int64_t local = cells_[index].value.fetch_add(1, std::memory_order_relaxed);
+        return static_cast<std::uint64_t>(local) * (mask_ + 1) + index;
+    }
+
+    // the sum of the cells; concurrent updates may or may not be included
+    std::int64_t value() const;
+
+    // value() as of the last publish(): a single load, for a figure shown on
+    // every request where one a little behind will do
+    std::int64_t published() const
+    {
+        return published_.value.load(std::memory_order_relaxed);
+    }
+
+    void publish() const
+    {
+        published_.value.store(value(), std::memory_order_relaxed);
+    }
+
+private:
+    // 64 bytes apart, so no two values share a cache line
+    struct cell
+    {
+        std::atomic<std::int64_t> value{0};
+        char pad[64 - sizeof(std::atomic<std::int64_t>)];
+    };
+
+    static std::size_t thread_index();
+
+    std::size_t mask_;
+    std::unique_ptr<cell[]> cells_;
+    mutable cell published_;
+};
+
+// Publishes counters every `interval` from a thread of its own, until
+// destroyed, so request handlers read published() instead of summing.
+class counter_publisher
+{
+public:
+    counter_publisher(std::chrono::milliseconds interval, std::vector<const sharded_counter*> counters);
+    ~counter_publisher();
+
+    counter_publisher(const counter_publisher&) = delete;
+    counter_publisher& operator=(const counter_publisher&) = delete;
+
+private:
+    void run();
+
+    const std::chrono::milliseconds interval_;
+    const std::vector<const sharded_counter*> counters_;
+
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    bool stopping_;
+    std::thread thread_;
+};
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#include <boost/asio.hpp>
+
+// Where a stream socket listens or connects, TCP or a UNIX domain socket,
+// written as
+//
+//   8080                     TCP, on the default host
+//   127.0.0.1:8080           TCP
+//   [::1]:8080               TCP over IPv6, the address in brackets
+//   unix:/run/app.sock       a UNIX socket in the filesystem
+//   unix:@app                an abstract UNIX socket, no file behind it
+//
+// A generic::stream_protocol socket takes either kind, so the same sessions
+// serve both; the TCP socket options are left to the callers that know the
+// endpoint is TCP.
+
+typedef boost::asio::generic::stream_protocol::endpoint stream_endpoint;
+typedef boost::asio::generic::stream_protocol::socket stream_socket;
+typedef boost::asio::basic_socket_acceptor<boost::asio::generic::stream_protocol> stream_acceptor;
+
+inline bool is_unix(const stream_endpoint& endpoint)
+{
+    return endpoint.protocol().family() == AF_UNIX;
+}
+
+// Throws on a text that is none of the above, or a path too long for sun_path.
+// An IPv6 address without brackets is refused rather than split at its last
+// colon.
+inline stream_endpoint parse_stream_endpoint(const std::string& text, const std::string& default_host = "0.0.0.0")
+{
+    const std::string unix_prefix = "unix:";
+    if (text.compare(0, unix_prefix.size(), unix_prefix) == 0) {
+        std::string path = text.substr(unix_prefix.size());
+        if (path.empty() || path == "@") {
+            throw std::runtime_error("empty unix socket path: " + text);
+        }
+        if (path[0] == '@') {
+            path[0] = '\0';
+        }
+        return stream_endpoint(boost::asio::local::stream_protocol::endpoint(path));
+    }
+
+    std::string host = default_host;
+    std::string port = text;
+    if (!text.empty() && text[0] == '[') {
+        const std::size_t close = text.find(']');
+        if (close == std::string::npos || close + 1 >= text.size() || text[close + 1] != ':') {
+            throw std::runtime_error("expected [address]:port in endpoint: " + text);
+        }
+        host = text.substr(1, close - 1);
+        port = text.substr(close + 2);
+    }
+    else {
+        const std::size_t colon = text.rfind(':');
+        if (colon != std::string::npos) {
+            host = text.substr(0, colon);
+            port = text.substr(colon + 1);
+            if (host.find(':') != std::string::npos) {
+                throw std::runtime_error("IPv6 address needs brackets, as [::1]:8080, in endpoint: " + text);
+            }
+        }
+    }
+    std::size_t end = 0;
+    unsigned long number = 0;
+    try {
+        number = std::stoul(port, &end);
+    }
+    catch (const std::exception&) {
+        end = 0;
+    }
+    if (port.empty() || end != port.size() || number > 65535) {
+        throw std::runtime_error("bad port in endpoint: " + text);
+    }
+    boost::system::error_code ec;
+    const boost::asio::ip::address address = boost::asio::ip::address::from_string(host, ec);
+    if (ec) {
+        throw std::runtime_error("bad address in endpoint: " + text);
+    }
+    return stream_endpoint(boost::asio::ip::tcp::endpoint(address, static_cast<unsigned short>(number)));
+}
+
+// The TCP endpoint behind `endpoint`; throws for a UNIX socket.
+inline boost::asio::ip::tcp::endpoint to_tcp(const stream_endpoint& endpoint)
+{
+    if (is_unix(endpoint)) {
+        throw std::runtime_error("not a TCP endpoint");
+    }
+    boost::asio::ip::tcp::endpoint tcp;
+    std::memcpy(tcp.data(), endpoint.data(), endpoint.size());
+    tcp.resize(endpoint.size());
+    return tcp;
+}
+
+inline std::string to_string(const stream_endpoint& endpoint)
+{
+    if (!is_unix(endpoint)) {
+        const boost::asio::ip::tcp::endpoint tcp = to_tcp(endpoint);
+        const std::string address = tcp.address().to_string();
+        return (tcp.address().is_v6() ? "[" + address + "]" : address) + ":" + std::to_string(tcp.port());
+    }
+    const sockaddr_un* address = reinterpret_cast<const sockaddr_un*>(endpoint.data());
+    const std::size_t length = endpoint.size() - offsetof(sockaddr_un, sun_path);
+    if (length > 0 && address->sun_path[0] == '\0') {
+        return "unix:@" + std::string(address->sun_path + 1, length - 1);
+    }
+    return "unix:" + std::string(address->sun_path);
+}
+
+// A listener's socket file left behind by an earlier run fails the bind;
+// removed when it is a socket nobody listens on any more - connecting to it
+// is refused. A live server's socket stays, and the bind reports it in use.
+// Abstract sockets go with their last descriptor.
+inline void remove_stale_socket(const stream_endpoint& endpoint)
+{
+    if (!is_unix(endpoint)) {
+        return;
+    }
+    const sockaddr_un* address = reinterpret_cast<const sockaddr_un*>(endpoint.data());
+    struct stat info;
+    if (address->sun_path[0] == '\0' || ::stat(address->sun_path, &info) != 0 || !S_ISSOCK(info.st_mode)) {
+        return;
+    }
+    const int probe = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe < 0) {
+        return;
+    }
+    const bool refused = ::connect(probe, endpoint.data(), static_cast<socklen_t>(endpoint.size())) != 0 &&
+                         errno == ECONNREFUSED;
+    ::close(probe);
+    if (refused) {
+        ::unlink(address->sun_path);
+    }
+}
@@ -0,0 +1,68 @@
+#include "url.h"
+
+namespace {
+
+// malformed escapes are kept as is rather than rejecting the whole query
+void decode(const std::string& url, std::size_t first, std::size_t last, std::string& out)
+{
+    out.clear();
+    for(std::size_t i = first; i < last; i++) {
+        const char c = url[i];
+        if(c == '+') {
+            out += ' ';
+        }
+        else if(c == '%' && i + 2 < last && hex_digit(url[i + 1]) >= 0 && hex_digit(url[i + 2]) >= 0) {
+            out += static_cast<char>(hex_digit(url[i + 1]) * 16 + hex_digit(url[i + 2]));
+            i += 2;
+        }
+        else {
+            out += c;
+        }
+    }
+}
+
+}
+
+int hex_digit(char c)
+{
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+query_string::query_string(const std::string& url) :
+    url_(url),
+    position_(url.find('?')),
+    end_(url.find('#'))
+{
+    if(end_ == std::string::npos) {
+        end_ = url.size();
+    }
+    position_ = (position_ == std::string::npos || position_ > end_) ? end_ : position_ + 1;
+}
+
+bool query_string::next(std::string& name, std::string& value)
+{
+    while(position_ < end_) {
+        std::size_t last = url_.find('&', position_);
+        if(last == std::string::npos || last > end_) {
+            last = end_;
+        }
+
+        const std::size_t first = position_;
+        position_ = (last == end_) ? end_ : last + 1;
+        if(first == last) {
+            continue;
+        }
+
+        std::size_t equals = url_.find('=', first);
+        if(equals == std::string::npos || equals > last) {
+            equals = last;
+        }
+        decode(url_, first, equals, name);
+        decode(url_, equals == last ? last : equals + 1, last, value);
+        return true;
+    }
+    return false;
+}
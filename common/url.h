@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+
+// Value of a hexadecimal digit, -1 for anything else.
+int hex_digit(char c);
+
+// Walks the "name=value&..." pairs of a request target's query string,
+// percent-decoding both parts ('+' stands for a space). The output strings
+// are overwritten on every call, so a caller reusing them across requests
+// stops allocating once their capacity has grown.
+class query_string
+{
+public:
+    explicit query_string(const std::string& url);
+
+    bool next(std::string& name, std::string& value);
+
+private:
+    const std::string& url_;
+    std::size_t position_;
+    std::size_t end_;
+};
@@ -1,5 +1,6 @@
 #include <mutex>
-#include <thread>
+#include <chrono>
+#include <memory>
 #include <string>
 #include <vector>
 #include <iostream>
@@ -11,16 +12,26 @@
 #include <Poco/Net/HTTPResponse.h>
 #include <Poco/Net/HTTPServerRequest.h>
 #include <Poco/Net/HTTPServerResponse.h>
+#include <Poco/ThreadPool.h>
+#include <Poco/Util/Option.h>
+#include <Poco/Util/OptionSet.h>
 #include <Poco/Util/ServerApplication.h>
 
+#include <cpu_topology.h>
+#include <resource_stats.h>
+#include <sharded_counter.h>
+
 using namespace Poco::Net;
 using namespace Poco::Util;
 
+sharded_counter requests;
+
 class IRequestHandler : public HTTPRequestHandler
 {
 public:
     void handleRequest(HTTPServerRequest &req, HTTPServerResponse &resp) override
     {
+        requests.add();
         resp.setStatus(HTTPResponse::HTTP_OK);
         resp.setContentType("text/plain");
 
@@ -34,35 +45,88 @@ public:
 class IRequestHandlerFactory : public HTTPRequestHandlerFactory
 {
 public:
+    explicit IRequestHandlerFactory(std::vector<int> cpus) : placement_(std::move(cpus)) {}
+
+    // runs on the pool thread that serves the connection
     HTTPRequestHandler* createRequestHandler(const HTTPServerRequest &) override
     {
+        placement_.pin();
         return new IRequestHandler;
     }
+
+private:
+    thread_placement placement_;
 };
 
 class IServerApplication : public ServerApplication
 {
 protected:
+    void defineOptions(OptionSet& options) override
+    {
+        ServerApplication::defineOptions(options);
+
+        options.addOption(
+            Option("stats", "", "print requests and resources used per request every N seconds")
+                .required(false)
+                .repeatable(false)
+                .argument("seconds")
+                .binding("http.stats"));
+
+        options.addOption(
+            Option("threads", "", "worker threads, 0 for one per hardware thread")
+                .required(false)
+                .repeatable(false)
+                .argument("count")
+                .binding("http.threads"));
+
+        options.addOption(
+            Option("affinity", "", "worker placement: none, list (pinned to --cpu-list) or cores (one per physical core)")
+                .required(false)
+                .repeatable(false)
+                .argument("placement")
+                .binding("http.affinity"));
+
+        options.addOption(
+            Option("cpu-list", "", "CPUs for --affinity list, e.g. 0-3,8; every online CPU if empty")
+                .required(false)
+                .repeatable(false)
+                .argument("cpus")
+                .binding("http.cpuList"));
+    }
+
     int main(const std::vector<std::string>& args)
     {
-        unsigned int hardware_concurrency = std::thread::hardware_concurrency();
+        const std::vector<int> cpus = placement_cpus(parse_affinity(config().getString("http.affinity", "none")),
+                                                     parse_cpu_list(config().getString("http.cpuList", "")));
+        const int workers = static_cast<int>(worker_count(config().getUInt("http.threads", 0), cpus));
+        Poco::ThreadPool pool(workers, workers);
 
         Poco::Net::HTTPServerParams::Ptr parameters = new Poco::Net::HTTPServerParams();
         parameters->setTimeout(1000);
         parameters->setMaxQueued(1000);
-        parameters->setMaxThreads(hardware_concurrency);
+        parameters->setMaxThreads(workers);
 
         const Poco::UInt16 port = 9999;
         const Poco::Net::ServerSocket socket(port);
-        HTTPServer s(new IRequestHandlerFactory, socket, parameters);
+        HTTPServer s(new IRequestHandlerFactory(cpus), pool, socket, parameters);
 
         s.start();
         std::cout << "server started: 127.0.0.1:" << port << std::endl;
+        report_worker_cpus(std::cerr, assign_worker_cpus(workers, cpus));
+
+        std::unique_ptr<stats_reporter> stats;
+        const int interval = config().getInt("http.stats", 0);
+        if(interval > 0) {
+            stats.reset(new stats_reporter(std::chrono::seconds(interval), []() {
+                return requests.value();
+            }, std::clog));
+        }
 
         waitForTerminationRequest();  // wait for CTRL-C or kill
 
         std::cout << "shutting down..." << std::endl;
         s.stop();
+        stats.reset();
 
         return Application::EXIT_OK;
     }
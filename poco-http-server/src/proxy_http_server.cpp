@@ -1,4 +1,5 @@
-#include <thread>
+#include <chrono>
+#include <memory>
 #include <string>
 #include <vector>
 #include <iterator>
@@ -6,6 +7,7 @@
 
 #include <Poco/URI.h>
 #include <Poco/StreamCopier.h>
+#include <Poco/ThreadPool.h>
 #include <Poco/Net/ServerSocket.h>
 #include <Poco/Net/HTTPServer.h>
 #include <Poco/Net/HTTPRequestHandler.h>
@@ -14,8 +16,14 @@
 #include <Poco/Net/HTTPServerRequest.h>
 #include <Poco/Net/HTTPServerResponse.h>
 #include <Poco/Net/HTTPClientSession.h>
+#include <Poco/Util/Option.h>
+#include <Poco/Util/OptionSet.h>
 #include <Poco/Util/ServerApplication.h>
 
+#include <cpu_topology.h>
+#include <resource_stats.h>
+#include <sharded_counter.h>
+
 using Poco::URI;
 using Poco::StreamCopier;
 using namespace Poco::Net;
@@ -25,25 +33,32 @@ namespace {
     const std::size_t TIMEOUT_MICROSECONDS = 150 * 1000;
     const std::size_t MAX_QUEUE = 1000;
 
-    const std::string SERVER_HOST = "localhost";
-    const std::string SERVER_PATH = "/";
-    const std::string SERVER_ADDR = "127.0.0.1";
-    const std::size_t SERVER_PORT = 80;
+    sharded_counter requests;
 }
 
+// where the proxied requests go; --upstream and friends
+struct Upstream
+{
+    std::string host = "localhost";
+    std::string path = "/";
+    std::string address = "127.0.0.1";
+    Poco::UInt16 port = 80;
+};
+
 class IRequestHandler : public HTTPRequestHandler
 {
 public:
-    IRequestHandler(const HTTPServer* server) : server_(server) {}
+    IRequestHandler(const HTTPServer* server, const Upstream& upstream) : server_(server), upstream_(upstream) {}
 
     void handleRequest(HTTPServerRequest& req, HTTPServerResponse& resp) override
     {
-        HTTPRequest request(HTTPRequest::HTTP_GET, SERVER_PATH, HTTPMessage::HTTP_1_1);
+        requests.add();
+        HTTPRequest request(HTTPRequest::HTTP_GET, upstream_.path, HTTPMessage::HTTP_1_1);
         request.set("User-Agent", "poco/1.7.5");
         request.add("Accept","*/*");
-        request.setHost(SERVER_HOST, SERVER_PORT);
+        request.setHost(upstream_.host, upstream_.port);
 
-        HTTPClientSession session(SERVER_ADDR, SERVER_PORT);
+        HTTPClientSession session(upstream_.address, upstream_.port);
         session.setTimeout(TIMEOUT_MICROSECONDS);
         session.sendRequest(request);
 
@@ -73,52 +88,140 @@ public:
 
 private:
     const HTTPServer* server_;
+    const Upstream& upstream_;
 };
 
 class IRequestHandlerFactory : public HTTPRequestHandlerFactory
 {
 public:
+    IRequestHandlerFactory(const Upstream& upstream, std::vector<int> cpus) :
+        upstream_(upstream),
+        placement_(std::move(cpus))
+    {
+    }
+
+    // runs on the pool thread that serves the connection
     HTTPRequestHandler* createRequestHandler(const HTTPServerRequest &) override
     {
-        return new IRequestHandler(server_);
+        placement_.pin();
+        return new IRequestHandler(server_, upstream_);
     }
 
     void setServer(HTTPServer* server) { server_ = server; }
 
 private:
     HTTPServer* server_;
+    const Upstream& upstream_;
+    thread_placement placement_;
 };
 
 class IServerApplication : public ServerApplication
 {
 protected:
-    int main(const std::vector<std::string>& args)
+    void defineOptions(OptionSet& options) override
     {
-        unsigned int hardware_concurrency = std::thread::hardware_concurrency();
+        ServerApplication::defineOptions(options);
+
+        options.addOption(
+            Option("upstream", "", "upstream address and port")
+                .required(false)
+                .repeatable(false)
+                .argument("address:port")
+                .binding("proxy.upstream"));
+
+        options.addOption(
+            Option("upstream-host", "", "Host header of the upstream requests")
+                .required(false)
+                .repeatable(false)
+                .argument("host")
+                .binding("proxy.upstreamHost"));
+
+        options.addOption(
+            Option("upstream-path", "", "path of the upstream requests")
+                .required(false)
+                .repeatable(false)
+                .argument("path")
+                .binding("proxy.upstreamPath"));
+
+        options.addOption(
+            Option("stats", "", "print requests and resources used per request every N seconds")
+                .required(false)
+                .repeatable(false)
+                .argument("seconds")
+                .binding("proxy.stats"));
+
+        options.addOption(
+            Option("threads", "", "worker threads, 0 for one per hardware thread")
+                .required(false)
+                .repeatable(false)
+                .argument("count")
+                .binding("proxy.threads"));
+
+        options.addOption(
+            Option("affinity", "", "worker placement: none, list (pinned to --cpu-list) or cores (one per physical core)")
+                .required(false)
+                .repeatable(false)
+                .argument("placement")
+                .binding("proxy.affinity"));
+
+        options.addOption(
+            Option("cpu-list", "", "CPUs for --affinity list, e.g. 0-3,8; every online CPU if empty")
+                .required(false)
+                .repeatable(false)
+                .argument("cpus")
+                .binding("proxy.cpuList"));
+    }
 
-        if (args.size() == 1) {
-            hardware_concurrency = std::stoi(args[0]);
+    int main(const std::vector<std::string>& args)
+    {
+        Upstream upstream;
+        const std::string address = config().getString("proxy.upstream", upstream.address + ":" + std::to_string(upstream.port));
+        const std::size_t colon = address.rfind(':');
+        upstream.address = address.substr(0, colon);
+        upstream.port = colon == std::string::npos ? 80 : static_cast<Poco::UInt16>(std::stoi(address.substr(colon + 1)));
+        upstream.host = config().getString("proxy.upstreamHost", upstream.host);
+        upstream.path = config().getString("proxy.upstreamPath", upstream.path);
+
+        // the thread count used to be the only argument
+        unsigned int threads = config().getUInt("proxy.threads", 0);
+        if (!threads && args.size() == 1) {
+            threads = std::stoi(args[0]);
         }
 
+        const std::vector<int> cpus = placement_cpus(parse_affinity(config().getString("proxy.affinity", "none")),
+                                                     parse_cpu_list(config().getString("proxy.cpuList", "")));
+        const int workers = static_cast<int>(worker_count(threads, cpus));
+        Poco::ThreadPool pool(workers, workers);
+
         Poco::Net::HTTPServerParams::Ptr parameters = new Poco::Net::HTTPServerParams();
         parameters->setTimeout(TIMEOUT_MICROSECONDS);
         parameters->setMaxQueued(MAX_QUEUE);
-        parameters->setMaxThreads(hardware_concurrency);
+        parameters->setMaxThreads(workers);
         parameters->setKeepAlive(true);
 
         const Poco::UInt16 port = 11111;
         const Poco::Net::ServerSocket socket(port);
-        auto factory = new IRequestHandlerFactory();
-        HTTPServer s(factory, socket, parameters);
+        auto factory = new IRequestHandlerFactory(upstream, cpus);
+        HTTPServer s(factory, pool, socket, parameters);
         factory->setServer(&s);
 
         s.start();
         std::cout << "server started: 127.0.0.1:" << port << std::endl;
+        report_worker_cpus(std::cerr, assign_worker_cpus(workers, cpus));
+
+        std::unique_ptr<stats_reporter> stats;
+        const int interval = config().getInt("proxy.stats", 0);
+        if (interval > 0) {
+            stats.reset(new stats_reporter(std::chrono::seconds(interval), []() {
+                return requests.value();
+            }, std::clog));
+        }
 
         waitForTerminationRequest();  // wait for CTRL-C or kill
 
         std::cout << "shutting down..." << std::endl;
         s.stop();
+        stats.reset();
 
         return Application::EXIT_OK;
     }
@@ -1,6 +1,10 @@
-#include <thread>
+#include <chrono>
+#include <memory>
+#include <vector>
 #include <iostream>
 
+#include <Poco/URI.h>
+
 #include <Poco/Net/ServerSocket.h>
 #include <Poco/Net/HTTPServer.h>
 #include <Poco/Net/HTTPRequestHandler.h>
@@ -8,16 +12,34 @@
 #include <Poco/Net/HTTPResponse.h>
 #include <Poco/Net/HTTPServerRequest.h>
 #include <Poco/Net/HTTPServerResponse.h>
+#include <Poco/ThreadPool.h>
+#include <Poco/Util/Option.h>
+#include <Poco/Util/OptionSet.h>
 #include <Poco/Util/ServerApplication.h>
 
 #include <rapidjson/writer.h>
 #include <rapidjson/ostreamwrapper.h>
 
+#include <gzip.h>
+#include <cpu_topology.h>
+#include <resource_stats.h>
+#include <sharded_counter.h>
+
 using namespace rapidjson;
 
+sharded_counter requests;
+
+// how far behind the request count in the document may be
+const std::chrono::milliseconds REQUESTS_INTERVAL(100);
+
 class IRequestHandler : public Poco::Net::HTTPRequestHandler
 {
 public:
+    explicit IRequestHandler(const gzip_options& gzip) :
+        gzip_(gzip)
+    {
+    }
+
     void handleRequest(Poco::Net::HTTPServerRequest& req, Poco::Net::HTTPServerResponse& resp) override
     {
         resp.set("Server", "pohttp");
@@ -45,31 +67,126 @@ public:
             writer.Uint(i);                 // all values are elements of the array.
         }
         writer.EndArray();
+
+        // same shape as asio-rapidjson-http-server, to compare the two
+        writer.Key("query");
+        writer.StartObject();
+        for(const auto& parameter : Poco::URI(req.getURI()).getQueryParameters()) {
+            writer.Key(parameter.first.data(), static_cast<SizeType>(parameter.first.size()));
+            writer.String(parameter.second.data(), static_cast<SizeType>(parameter.second.size()));
+        }
+        writer.EndObject();
+        writer.Key("server");
+        writer.StartObject();
+        writer.Key("requests");
+        requests.add();
+        writer.Int64(requests.published());
+        writer.EndObject();
+
         writer.EndObject();
 
         // {"hello":"world","t":true,"f":false,"n":null,"i":123,"pi":3.1416,"a":[0,1,2,3]}
 
         resp.setContentType("application/json");
+
+        if(gzip_.worth(buffer.GetLength())) {
+            resp.set("Vary", "Accept-Encoding");
+
+            std::string compressed;
+            if(accepts_gzip(req.get("Accept-Encoding", "")) &&
+               gzip_compress(buffer.GetString(), buffer.GetLength(), gzip_.level, compressed)) {
+                resp.set("Content-Encoding", "gzip");
+                resp.setContentLength(compressed.size());
+
+                std::ostream& out = resp.send();
+                out.write(compressed.data(), compressed.size());
+                out.flush();
+                return;
+            }
+        }
+
         resp.setContentLength(buffer.GetLength());
 
         std::ostream& out = resp.send();
         out << buffer.GetString();
         out.flush();
     }
+
+private:
+    const gzip_options& gzip_;
 };
 
 class IRequestHandlerFactory : public Poco::Net::HTTPRequestHandlerFactory
 {
 public:
+    IRequestHandlerFactory(const gzip_options& gzip, std::vector<int> cpus) :
+        gzip_(gzip),
+        placement_(std::move(cpus))
+    {
+    }
+
+    // runs on the pool thread that serves the connection
     Poco::Net::HTTPRequestHandler* createRequestHandler(const Poco::Net::HTTPServerRequest&) override
     {
-        return new IRequestHandler;
+        placement_.pin();
+        return new IRequestHandler(gzip_);
     }
+
+private:
+    const gzip_options& gzip_;
+    thread_placement placement_;
 };
 
 class IServerApplication : public Poco::Util::ServerApplication
 {
 protected:
+    void defineOptions(Poco::Util::OptionSet& options) override
+    {
+        Poco::Util::ServerApplication::defineOptions(options);
+
+        options.addOption(
+            Poco::Util::Option("gzip-level", "", "gzip compression level, 0 disables")
+                .required(false)
+                .repeatable(false)
+                .argument("level")
+                .binding("http.gzip.level"));
+
+        options.addOption(
+            Poco::Util::Option("gzip-min-size", "", "smallest body worth compressing, bytes")
+                .required(false)
+                .repeatable(false)
+                .argument("bytes")
+                .binding("http.gzip.minSize"));
+
+        options.addOption(
+            Poco::Util::Option("stats", "", "print requests and resources used per request every N seconds")
+                .required(false)
+                .repeatable(false)
+                .argument("seconds")
+                .binding("http.stats"));
+
+        options.addOption(
+            Poco::Util::Option("threads", "", "worker threads, 0 for one per hardware thread")
+                .required(false)
+                .repeatable(false)
+                .argument("count")
+                .binding("http.threads"));
+
+        options.addOption(
+            Poco::Util::Option("affinity", "", "worker placement: none, list (pinned to --cpu-list) or cores (one per physical core)")
+                .required(false)
+                .repeatable(false)
+                .argument("placement")
+                .binding("http.affinity"));
+
+        options.addOption(
+            Poco::Util::Option("cpu-list", "", "CPUs for --affinity list, e.g. 0-3,8; every online CPU if empty")
+                .required(false)
+                .repeatable(false)
+                .argument("cpus")
+                .binding("http.cpuList"));
+    }
+
     int main(const std::vector<std::string>& args)
     {
         if (args.empty()) {
@@ -77,24 +194,43 @@ protected:
             return Application::EXIT_OK;
         }
 
-        unsigned int hardware_concurrency = std::thread::hardware_concurrency();
+        const std::vector<int> cpus = placement_cpus(parse_affinity(config().getString("http.affinity", "none")),
+                                                     parse_cpu_list(config().getString("http.cpuList", "")));
+        const int workers = static_cast<int>(worker_count(config().getUInt("http.threads", 0), cpus));
+        Poco::ThreadPool pool(workers, workers);
 
         Poco::Net::HTTPServerParams::Ptr parameters = new Poco::Net::HTTPServerParams();
         parameters->setTimeout(1000);
         parameters->setMaxQueued(1000);
-        parameters->setMaxThreads(hardware_concurrency);
+        parameters->setMaxThreads(workers);
+
+        gzip_options gzip;
+        gzip.level = config().getInt("http.gzip.level", gzip.level);
+        gzip.min_size = config().getInt("http.gzip.minSize", static_cast<int>(gzip.min_size));
 
         const Poco::UInt16 port = std::stoi(args[0]);
         const Poco::Net::ServerSocket socket(port);
-        Poco::Net::HTTPServer s(new IRequestHandlerFactory, socket, parameters);
+        Poco::Net::HTTPServer s(new IRequestHandlerFactory(gzip, cpus), pool, socket, parameters);
+
+        counter_publisher publisher(REQUESTS_INTERVAL, { &requests });
 
         s.start();
         std::cout << "Server started: 127.0.0.1:" << port << std::endl;
+        report_worker_cpus(std::cerr, assign_worker_cpus(workers, cpus));
+
+        std::unique_ptr<stats_reporter> stats;
+        const int interval = config().getInt("http.stats", 0);
+        if(interval > 0) {
+            stats.reset(new stats_reporter(std::chrono::seconds(interval), []() {
+                return requests.value();
+            }, std::clog));
+        }
 
         waitForTerminationRequest();  // wait for CTRL-C or kill
 
         std::cout << "Shutting down..." << std::endl;
         s.stop();
+        stats.reset();
 
         return Application::EXIT_OK;
     }
@@ -1,20 +1,38 @@
-#include <thread>
 #include <string>
 #include <chrono>
+#include <memory>
+#include <vector>
 #include <iostream>
 
+#include <errno.h>
+#include <sys/sendfile.h>
+
 #include <Poco/Net/HTTPServer.h>
 #include <Poco/Net/HTTPRequestHandler.h>
 #include <Poco/Net/HTTPRequestHandlerFactory.h>
 #include <Poco/Net/HTTPResponse.h>
 #include <Poco/Net/HTTPServerRequest.h>
+#include <Poco/Net/HTTPServerRequestImpl.h>
 #include <Poco/Net/HTTPServerResponse.h>
 #include <Poco/Net/ServerSocket.h>
+#include <Poco/Net/StreamSocket.h>
+#include <Poco/ThreadPool.h>
+#include <Poco/Util/Option.h>
+#include <Poco/Util/OptionSet.h>
 #include <Poco/Util/ServerApplication.h>
 
 #include <rapidjson/writer.h>
 #include <rapidjson/ostreamwrapper.h>
 
+#include <gzip.h>
+#include <cpu_topology.h>
+#include <file_cache.h>
+#include <memory_cache.h>
+#include <http_range.h>
+#include <http_conditional.h>
+#include <resource_stats.h>
+#include <sharded_counter.h>
+
 using namespace Poco::Net;
 using namespace Poco::Util;
 
@@ -22,6 +40,8 @@ using namespace rapidjson;
 
 namespace {
 
+sharded_counter requests;
+
 const std::string PAGE = R"(
 <!DOCTYPE html>
 <html>
@@ -48,24 +68,37 @@ working.</p>
 </html>
 )";
 
+// State shared by all handlers, prepared once in main().
+struct Content
+{
+    std::string pageGzip;                   // PAGE compressed, empty when not worth it
+    std::unique_ptr<file_cache> files;      // set with --root
+    std::unique_ptr<memory_cache> memory;   // gzip variants of small files
+};
+
 class RequestHandler : public HTTPRequestHandler
 {
 public:
-    RequestHandler(HTTPServer const& server) :
-        server_(server)
+    RequestHandler(HTTPServer const& server, Content const& content) :
+        server_(server),
+        content_(content)
     {
     }
 
     void handleRequest(HTTPServerRequest &req, HTTPServerResponse &resp) override
     {
+        requests.add();
         auto const& uri = req.getURI();
 
-        if("/" == uri) {
-            handleRequestStatic(req, resp);
-        }
-        else if("/status" == uri) {
+        if("/status" == uri) {
             handleRequestStatus(req, resp);
         }
+        else if(content_.files) {
+            handleRequestFile(req, resp);
+        }
+        else if("/" == uri) {
+            handleRequestStatic(req, resp);
+        }
         else {
             resp.setStatus(HTTPResponse::HTTP_NOT_FOUND);
             std::ostream& out = resp.send();
@@ -78,6 +111,21 @@ private:
     {
         resp.setStatus(HTTPResponse::HTTP_OK);
         resp.setContentType("text/html");
+
+        std::string const& pageGzip = content_.pageGzip;
+        if(!pageGzip.empty()) {
+            resp.set("Vary", "Accept-Encoding");
+            if(accepts_gzip(req.get("Accept-Encoding", ""))) {
+                resp.set("Content-Encoding", "gzip");
+                resp.setContentLength(pageGzip.size());
+
+                std::ostream& out = resp.send();
+                out.write(pageGzip.data(), pageGzip.size());
+                out.flush();
+                return;
+            }
+        }
+
         resp.setContentLength(PAGE.size());
 
         std::ostream& out = resp.send();
@@ -111,16 +159,149 @@ private:
         out.flush();
     }
 
+    void handleRequestFile(HTTPServerRequest &req, HTTPServerResponse &resp)
+    {
+        auto const& method = req.getMethod();
+        if(method != HTTPRequest::HTTP_GET && method != HTTPRequest::HTTP_HEAD) {
+            resp.setStatus(HTTPResponse::HTTP_METHOD_NOT_ALLOWED);
+            resp.setContentLength(0);
+            resp.send().flush();
+            return;
+        }
+
+        auto file = content_.files->open(req.getURI());
+        if(!file) {
+            resp.setStatus(HTTPResponse::HTTP_NOT_FOUND);
+            resp.setContentLength(0);
+            resp.send().flush();
+            return;
+        }
+
+        const std::string range = req.get("Range", "");
+        if(range.empty() && content_.memory && compressible(file->content_type) &&
+           accepts_gzip(req.get("Accept-Encoding", ""))) {
+            auto entry = content_.memory->lookup(req.getURI());
+            if(entry && entry->has_gzip()) {
+                handleRequestGzip(req, resp, entry->gzip, file->content_type);
+                return;
+            }
+        }
+
+        std::vector<byte_range> ranges;
+        range_result result = range_result::none;
+        if(!range.empty() && if_range_matches(req.get("If-Range", ""), file->etag, file->last_modified)) {
+            result = parse_range(range, file->size, ranges);
+        }
+
+        if(result == range_result::unsatisfiable) {
+            resp.setStatus(HTTPResponse::HTTP_REQUESTED_RANGE_NOT_SATISFIABLE);
+            resp.set("Content-Range", content_range(file->size));
+            resp.setContentLength(0);
+            resp.send().flush();
+            return;
+        }
+
+        multipart_ranges multipart;
+        if(result == range_result::none) {
+            ranges.assign(1, byte_range{ 0, file->size - 1 });
+            resp.setStatus(HTTPResponse::HTTP_OK);
+            resp.setContentType(file->content_type);
+            resp.setContentLength64(file->size);
+        }
+        else if(ranges.size() == 1) {
+            resp.setStatus(HTTPResponse::HTTP_PARTIAL_CONTENT);
+            resp.setContentType(file->content_type);
+            resp.set("Content-Range", content_range(ranges[0], file->size));
+            resp.setContentLength64(ranges[0].length());
+        }
+        else {
+            multipart = make_multipart_ranges(ranges, file->size, file->content_type);
+            resp.setStatus(HTTPResponse::HTTP_PARTIAL_CONTENT);
+            resp.setContentType(multipart.content_type);
+            resp.setContentLength64(multipart.content_length);
+        }
+        resp.set("Accept-Ranges", "bytes");
+        resp.set("Last-Modified", file->last_modified);
+        resp.set("ETag", file->etag);
+
+        // headers go through the response stream, the body bypasses it
+        std::ostream& out = resp.send();
+        out.flush();
+
+        if(method == HTTPRequest::HTTP_HEAD || file->size == 0) {
+            return;
+        }
+
+        StreamSocket& socket = static_cast<HTTPServerRequestImpl&>(req).socket();
+        for(std::size_t i = 0; i < ranges.size(); i++) {
+            if(!multipart.part_headers.empty()) {
+                const std::string& header = multipart.part_headers[i];
+                socket.sendBytes(header.data(), static_cast<int>(header.size()));
+            }
+            if(!sendFile(socket, *file, ranges[i])) {
+                // peer is gone or the file was truncated: drop the connection
+                socket.shutdown();
+                return;
+            }
+        }
+        if(!multipart.trailer.empty()) {
+            socket.sendBytes(multipart.trailer.data(), static_cast<int>(multipart.trailer.size()));
+        }
+    }
+
+    // gzip variant kept by memory_cache, compressed once per file version
+    void handleRequestGzip(HTTPServerRequest &req, HTTPServerResponse &resp, memory_variant const& variant, const char* content_type)
+    {
+        resp.setStatus(HTTPResponse::HTTP_OK);
+        resp.setContentType(content_type);
+        resp.setContentLength64(variant.size);
+        resp.set("Content-Encoding", "gzip");
+        resp.set("Vary", "Accept-Encoding");
+        resp.set("Last-Modified", variant.last_modified);
+        resp.set("ETag", variant.etag);
+
+        std::ostream& out = resp.send();
+        if(req.getMethod() != HTTPRequest::HTTP_HEAD) {
+            out.write(variant.body, variant.size);
+        }
+        out.flush();
+    }
+
+    static bool sendFile(StreamSocket& socket, const file_entry& file, const byte_range& range)
+    {
+        const int fd = socket.impl()->sockfd();
+
+        off_t offset = range.first;
+        const off_t end = range.last + 1;
+        while(offset < end) {
+            const ssize_t n = ::sendfile(fd, file.fd, &offset, end - offset);
+            if(n > 0 || (n < 0 && errno == EINTR)) {
+                continue;
+            }
+            return false;
+        }
+        return true;
+    }
+
 private:
     HTTPServer const& server_;
+    Content const& content_;
 };
 
 class RequestHandlerFactory : public HTTPRequestHandlerFactory
 {
 public:
+    RequestHandlerFactory(Content const& content, std::vector<int> cpus) :
+        content_(content),
+        placement_(std::move(cpus))
+    {
+    }
+
+    // runs on the pool thread that serves the connection
     HTTPRequestHandler* createRequestHandler(const HTTPServerRequest &) override
     {
-        return new RequestHandler(*server_);
+        placement_.pin();
+        return new RequestHandler(*server_, content_);
     }
 
     void setServer(HTTPServer const* server)
@@ -130,36 +311,132 @@ public:
 
 private:
     HTTPServer const* server_ = nullptr;
+    Content const& content_;
+    thread_placement placement_;
 };
 
 class IServerApplication : public ServerApplication
 {
 protected:
+    void defineOptions(OptionSet& options) override
+    {
+        ServerApplication::defineOptions(options);
+
+        options.addOption(
+            Option("root", "r", "serve files from the document root with sendfile")
+                .required(false)
+                .repeatable(false)
+                .argument("path")
+                .binding("http.root"));
+
+        options.addOption(
+            Option("open-files", "", "descriptors the file cache keeps open")
+                .required(false)
+                .repeatable(false)
+                .argument("count")
+                .binding("http.openFiles"));
+
+        options.addOption(
+            Option("gzip-level", "", "gzip compression level, 0 disables")
+                .required(false)
+                .repeatable(false)
+                .argument("level")
+                .binding("http.gzip.level"));
+
+        options.addOption(
+            Option("gzip-min-size", "", "smallest body worth compressing, bytes")
+                .required(false)
+                .repeatable(false)
+                .argument("bytes")
+                .binding("http.gzip.minSize"));
+
+        options.addOption(
+            Option("stats", "", "print requests and resources used per request every N seconds")
+                .required(false)
+                .repeatable(false)
+                .argument("seconds")
+                .binding("http.stats"));
+
+        options.addOption(
+            Option("threads", "", "worker threads, 0 for one per hardware thread")
+                .required(false)
+                .repeatable(false)
+                .argument("count")
+                .binding("http.threads"));
+
+        options.addOption(
+            Option("affinity", "", "worker placement: none, list (pinned to --cpu-list) or cores (one per physical core)")
+                .required(false)
+                .repeatable(false)
+                .argument("placement")
+                .binding("http.affinity"));
+
+        options.addOption(
+            Option("cpu-list", "", "CPUs for --affinity list, e.g. 0-3,8; every online CPU if empty")
+                .required(false)
+                .repeatable(false)
+                .argument("cpus")
+                .binding("http.cpuList"));
+    }
+
     int main(const std::vector<std::string>& args)
     {
-        unsigned int hardware_concurrency = std::thread::hardware_concurrency();
+        gzip_options gzip;
+        gzip.level = config().getInt("http.gzip.level", gzip.level);
+        gzip.min_size = config().getInt("http.gzip.minSize", static_cast<int>(gzip.min_size));
+
+        Content content;
+        if(gzip.worth(PAGE.size())) {
+            content.pageGzip = gzip_compress(PAGE, gzip.level);
+        }
+
+        const std::string root = config().getString("http.root", "");
+        if(!root.empty()) {
+            content.files.reset(new file_cache(root, config().getUInt("http.openFiles", 1024)));
+            if(gzip.enabled()) {
+                content.memory.reset(new memory_cache(*content.files, 64 * 1024 * 1024, 256 * 1024, gzip));
+            }
+        }
+
+        const std::vector<int> cpus = placement_cpus(parse_affinity(config().getString("http.affinity", "none")),
+                                                     parse_cpu_list(config().getString("http.cpuList", "")));
+        const int workers = static_cast<int>(worker_count(config().getUInt("http.threads", 0), cpus));
+        Poco::ThreadPool pool(workers, workers);
 
         HTTPServerParams::Ptr parameters = new HTTPServerParams();
         parameters->setTimeout(10000);
         parameters->setMaxQueued(10000);
-        parameters->setMaxThreads(hardware_concurrency);
+        parameters->setMaxThreads(workers);
 
         const Poco::UInt16 port = 11111;
         ServerSocket socket(port);
         socket.setReuseAddress(true);
         socket.setReusePort(true);
 
-        auto factory = new RequestHandlerFactory();
-        HTTPServer s(factory, socket, parameters);
+        auto factory = new RequestHandlerFactory(content, cpus);
+        HTTPServer s(factory, pool, socket, parameters);
         factory->setServer(&s);
 
         s.start();
         std::cout << "server started: 127.0.0.1:" << port << std::endl;
+        if(content.files) {
+            std::cout << "document root: " << root << std::endl;
+        }
+        report_worker_cpus(std::cerr, assign_worker_cpus(workers, cpus));
+
+        std::unique_ptr<stats_reporter> stats;
+        const int interval = config().getInt("http.stats", 0);
+        if(interval > 0) {
+            stats.reset(new stats_reporter(std::chrono::seconds(interval), []() {
+                return requests.value();
+            }, std::clog));
+        }
 
         waitForTerminationRequest();  // wait for CTRL-C or kill
 
         std::cout << "shutting down... " << std::endl;
         s.stop();
+        stats.reset();
 
         return Application::EXIT_OK;
     }